@@ -652,6 +652,8 @@ void C_ClientRagdoll::Release( void )
 static unsigned long	g_iModelBoneCounter = 0;
 CUtlVector<C_BaseAnimating *> g_PreviousBoneSetups;
 static unsigned long	g_iPreviousBoneCounter = (unsigned)-1;
+static bool g_bInThreadedBoneSetup;
+static bool g_bDoThreadedBoneSetup;
 
 class C_BaseAnimatingGameSystem : public CAutoGameSystem
 {
@@ -756,6 +758,8 @@ C_BaseAnimating::~C_BaseAnimating()
 	if ( i != -1 )
 		g_PreviousBoneSetups.FastRemove( i );
 
+	Assert( !g_bInThreadedBoneSetup );
+
 	TermRopes();
 
 	Assert( !m_pRagdoll );
@@ -2759,10 +2763,37 @@ CMouthInfo *C_BaseAnimating::GetMouth( void )
 ConVar cl_warn_thread_contested_bone_setup("cl_warn_thread_contested_bone_setup", "0" );
 #endif
 
-// Marked this developmentonly because it currently crashes, and users are enabling it and complaining because of
-// course.  Once this actually works it should just be FCVAR_INTERNAL_USE.
-ConVar cl_threaded_bone_setup("cl_threaded_bone_setup", "0", FCVAR_DEVELOPMENTONLY | FCVAR_INTERNAL_USE,
+ConVar cl_threaded_bone_setup("cl_threaded_bone_setup", "1", FCVAR_ARCHIVE,
                               "Enable parallel processing of C_BaseAnimating::SetupBones()" );
+ConVar cl_threaded_bone_setup_verify("cl_threaded_bone_setup_verify", "0", FCVAR_CHEAT,
+                              "Redo threaded bone setups serially and report entities whose bones differ" );
+
+// Followers are set up in passes by how many move parents they have, so a
+// player's bones are finished before its wearables and weapons merge from them.
+#define MAX_THREADED_BONE_SETUP_DEPTH	4
+
+static CUtlVector<C_BaseAnimating *> g_ThreadedBoneSetupPasses[MAX_THREADED_BONE_SETUP_DEPTH];
+
+// Entities whose threaded setup hit a contested lock somewhere along the way
+// (their own, or a parent's through the bone merge cache).  Redone serially.
+static CUtlVector<C_BaseAnimating *> g_ThreadedBoneSetupFailed;
+static CThreadFastMutex g_ThreadedBoneSetupFailedLock;
+
+// The entity the current job thread was handed
+static CTHREADLOCALPTR( C_BaseAnimating ) g_pThreadedBoneSetupJob;
+
+static void ThreadedBoneSetupContested()
+{
+	C_BaseAnimating *pJob = g_pThreadedBoneSetupJob;
+	if ( !pJob )
+		return;
+
+	AUTO_LOCK( g_ThreadedBoneSetupFailedLock );
+	if ( g_ThreadedBoneSetupFailed.Find( pJob ) == -1 )
+	{
+		g_ThreadedBoneSetupFailed.AddToTail( pJob );
+	}
+}
 
 //-----------------------------------------------------------------------------
 // Purpose: Do the default sequence blending rules as done in HL1
@@ -2770,8 +2801,12 @@ ConVar cl_threaded_bone_setup("cl_threaded_bone_setup", "0", FCVAR_DEVELOPMENTON
 
 static void SetupBonesOnBaseAnimating( C_BaseAnimating *&pBaseAnimating )
 {
-	if ( !pBaseAnimating->GetMoveParent() )
-		pBaseAnimating->SetupBones( NULL, -1, -1, gpGlobals->curtime );
+	g_pThreadedBoneSetupJob = pBaseAnimating;
+	if ( !pBaseAnimating->SetupBones( NULL, -1, -1, gpGlobals->curtime ) )
+	{
+		ThreadedBoneSetupContested();
+	}
+	g_pThreadedBoneSetupJob = NULL;
 }
 
 static void PreThreadedBoneSetup()
@@ -2784,8 +2819,6 @@ static void PostThreadedBoneSetup()
 	mdlcache->EndLock();
 }
 
-static bool g_bInThreadedBoneSetup;
-static bool g_bDoThreadedBoneSetup;
 
 void C_BaseAnimating::InitBoneSetupThreadPool()
 {
@@ -2803,17 +2836,124 @@ void C_BaseAnimating::ThreadedBoneSetup()
 		int nCount = g_PreviousBoneSetups.Count();
 		if ( nCount > 1 )
 		{
+			VPROF_BUDGET( "C_BaseAnimating::ThreadedBoneSetup", VPROF_BUDGETGROUP_CLIENT_ANIMATION );
+
+			// Sort by depth in the move hierarchy.  Entities with the same depth
+			// never merge bones from each other, so each pass can run in parallel.
+			for ( int i = 0; i < nCount; i++ )
+			{
+				C_BaseAnimating *pAnimating = g_PreviousBoneSetups[i];
+
+				int nDepth = 0;
+				for ( C_BaseEntity *pParent = pAnimating->GetMoveParent(); pParent && nDepth < MAX_THREADED_BONE_SETUP_DEPTH - 1; pParent = pParent->GetMoveParent() )
+				{
+					nDepth++;
+				}
+				g_ThreadedBoneSetupPasses[nDepth].AddToTail( pAnimating );
+			}
+
 			g_bInThreadedBoneSetup = true;
 
-			ParallelProcess( "C_BaseAnimating::ThreadedBoneSetup", g_PreviousBoneSetups.Base(), nCount, &SetupBonesOnBaseAnimating, &PreThreadedBoneSetup, &PostThreadedBoneSetup );
+			for ( int nDepth = 0; nDepth < MAX_THREADED_BONE_SETUP_DEPTH; nDepth++ )
+			{
+				CUtlVector<C_BaseAnimating *> &pass = g_ThreadedBoneSetupPasses[nDepth];
+				if ( pass.Count() )
+				{
+					ParallelProcess( "C_BaseAnimating::ThreadedBoneSetup", pass.Base(), pass.Count(), &SetupBonesOnBaseAnimating, &PreThreadedBoneSetup, &PostThreadedBoneSetup );
+				}
+			}
 
 			g_bInThreadedBoneSetup = false;
+
+			// Anything that lost a lock race gets done again the normal way
+			FOR_EACH_VEC( g_ThreadedBoneSetupFailed, i )
+			{
+				C_BaseAnimating *pAnimating = g_ThreadedBoneSetupFailed[i];
+				pAnimating->m_BoneAccessor.SetReadableBones( 0 );
+				pAnimating->m_BoneAccessor.SetWritableBones( 0 );
+				pAnimating->SetupBones( NULL, -1, -1, gpGlobals->curtime );
+			}
+			VPROF_INCREMENT_COUNTER( "threaded bone setups redone serially", g_ThreadedBoneSetupFailed.Count() );
+			g_ThreadedBoneSetupFailed.RemoveAll();
+
+			if ( cl_threaded_bone_setup_verify.GetBool() )
+			{
+				VerifyThreadedBoneSetup();
+			}
+
+			for ( int nDepth = 0; nDepth < MAX_THREADED_BONE_SETUP_DEPTH; nDepth++ )
+			{
+				g_ThreadedBoneSetupPasses[nDepth].RemoveAll();
+			}
 		}
 	}
 	g_iPreviousBoneCounter++;
 	g_PreviousBoneSetups.RemoveAll();
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Redo every threaded setup serially, in the same order, and compare.
+//			Jiggle bones integrate each time they're set up, so models with
+//			them can show small differences that aren't threading bugs.
+//-----------------------------------------------------------------------------
+void C_BaseAnimating::VerifyThreadedBoneSetup()
+{
+	CUtlVector<matrix3x4_t> threadedBones;
+	int nChecked = 0;
+	int nMismatched = 0;
+
+	for ( int nDepth = 0; nDepth < MAX_THREADED_BONE_SETUP_DEPTH; nDepth++ )
+	{
+		FOR_EACH_VEC( g_ThreadedBoneSetupPasses[nDepth], i )
+		{
+			C_BaseAnimating *pAnimating = g_ThreadedBoneSetupPasses[nDepth][i];
+			CBoneAccessor &accessor = pAnimating->m_BoneAccessor;
+
+			int nReadableBones = accessor.GetReadableBones();
+			int nBones = pAnimating->m_CachedBoneData.Count();
+			if ( !nReadableBones || !nBones )
+				continue;
+
+			threadedBones.CopyArray( pAnimating->m_CachedBoneData.Base(), nBones );
+
+			accessor.SetReadableBones( 0 );
+			accessor.SetWritableBones( 0 );
+			pAnimating->SetupBones( NULL, -1, nReadableBones, gpGlobals->curtime );
+			nChecked++;
+
+			CStudioHdr *hdr = pAnimating->GetModelPtr();
+			if ( !hdr || hdr->numbones() != nBones )
+				continue;
+
+			float flMaxError = 0.0f;
+			for ( int iBone = 0; iBone < nBones; iBone++ )
+			{
+				if ( !( hdr->boneFlags( iBone ) & nReadableBones ) )
+					continue;
+
+				const float *pThreaded = threadedBones[iBone].Base();
+				const float *pSerial = pAnimating->m_CachedBoneData[iBone].Base();
+				for ( int j = 0; j < 12; j++ )
+				{
+					flMaxError = MAX( flMaxError, fabs( pThreaded[j] - pSerial[j] ) );
+				}
+			}
+
+			if ( flMaxError > 0.0f )
+			{
+				nMismatched++;
+				Msg( "Threaded bone setup mismatch: %d:%s (%s) depth %d, max error %f\n",
+					pAnimating->entindex(), pAnimating->GetClassname(), modelinfo->GetModelName( pAnimating->GetModel() ), nDepth, flMaxError );
+			}
+		}
+	}
+
+	if ( nMismatched )
+	{
+		Msg( "Threaded bone setup: %d of %d entities differ from the serial path\n", nMismatched, nChecked );
+	}
+}
+
 bool C_BaseAnimating::SetupBones( matrix3x4_t *pBoneToWorldOut, int nMaxBones, int boneMask, float currentTime )
 {
 	VPROF_BUDGET( "C_BaseAnimating::SetupBones", VPROF_BUDGETGROUP_CLIENT_ANIMATION );
@@ -2863,14 +3003,6 @@ bool C_BaseAnimating::SetupBones( matrix3x4_t *pBoneToWorldOut, int nMaxBones, i
 		boneMask |= BONE_USED_BY_ANYTHING;
 	}
 
-	if ( g_bInThreadedBoneSetup )
-	{
-		if ( !m_BoneSetupLock.TryLock() )
-		{
-			return false;
-		}
-	}
-
 	// If we're setting up LOD N, we have set up all lower LODs also
 	// because lower LODs always use subsets of the bones of higher LODs.
 	int nLOD = 0;
@@ -2885,6 +3017,23 @@ bool C_BaseAnimating::SetupBones( matrix3x4_t *pBoneToWorldOut, int nMaxBones, i
 		boneMask |= nMask;
 	}
 
+	if ( g_bInThreadedBoneSetup )
+	{
+		// Followers asking for a parent that an earlier pass already finished.
+		// Nothing writes to it any more this pass, so don't fight over the lock.
+		if ( !pBoneToWorldOut && m_iMostRecentModelBoneCounter == g_iModelBoneCounter &&
+			 ( m_BoneAccessor.GetReadableBones() & boneMask ) == boneMask )
+		{
+			return true;
+		}
+
+		if ( !m_BoneSetupLock.TryLock() )
+		{
+			ThreadedBoneSetupContested();
+			return false;
+		}
+	}
+
 #ifdef DEBUG_BONE_SETUP_THREADING
 	if ( cl_warn_thread_contested_bone_setup.GetBool() )
 	{
@@ -2931,7 +3080,7 @@ bool C_BaseAnimating::SetupBones( matrix3x4_t *pBoneToWorldOut, int nMaxBones, i
 	}
 
 	int nBoneCount = m_CachedBoneData.Count();
-	if ( g_bDoThreadedBoneSetup && !g_bInThreadedBoneSetup && ( nBoneCount >= 16 ) && !GetMoveParent() && m_iMostRecentBoneSetupRequest != g_iPreviousBoneCounter )
+	if ( g_bDoThreadedBoneSetup && !g_bInThreadedBoneSetup && ( nBoneCount >= 16 || IsEffectActive( EF_BONEMERGE ) ) && m_iMostRecentBoneSetupRequest != g_iPreviousBoneCounter )
 	{
 		m_iMostRecentBoneSetupRequest = g_iPreviousBoneCounter;
 		Assert( g_PreviousBoneSetups.Find( this ) == -1 );
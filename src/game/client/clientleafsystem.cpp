@@ -115,7 +115,6 @@ public:
 	virtual void ComputeTranslucentRenderLeaf( int count, const LeafIndex_t *pLeafList, const LeafFogVolume_t *pLeafFogVolumeList, int frameNumber, int viewID );
 	virtual void CollateViewModelRenderables( CUtlVector< IClientRenderable * >& opaque, CUtlVector< IClientRenderable * >& translucent );
 	virtual void BuildRenderablesList( const SetupRenderInfo_t &info );
-			void CollateRenderablesInLeaf( int leaf, int worldListLeafIndex, const SetupRenderInfo_t &info );
 	virtual void DrawStaticProps( bool enable );
 	virtual void DrawSmallEntities( bool enable );
 	virtual void EnableAlternateSorting( ClientRenderHandle_t handle, bool bEnable );
@@ -236,6 +235,12 @@ private:
 
 	void ProcessDirtyRenderable(ClientRenderHandle_t& handle);
 
+	// The passes of BuildRenderablesList
+	struct CullRange_t;
+	void GatherRenderablesInLeaf( int leaf, const SetupRenderInfo_t &info );
+	void CullRenderCandidates( CullRange_t &range );
+	void CollateRenderablesInLeaf( int leaf, int worldListLeafIndex, const SetupRenderInfo_t &info );
+
 	void CalcRenderableWorldSpaceAABB_Bloated(RenderableInfo_t& info, Vector& absMin, Vector& absMax);
 
 	// Methods associated with the various bi-directional sets
@@ -352,6 +357,36 @@ private:
 	int m_nDebugIndex;
 
 	CThreadFastMutex m_DirtyRenderablesMutex;
+
+	// A renderable gathered from a visible leaf by BuildRenderablesList
+	struct RenderCandidate_t
+	{
+		RenderableInfo_t		*m_pInfo;
+		ClientRenderHandle_t	m_Handle;
+		unsigned char			m_nAlpha;
+		bool					m_bVisible;
+	};
+
+	// A run of whole leaves' candidates, culled as one job
+	struct CullRange_t
+	{
+		int m_nFirst;
+		int m_nCount;
+	};
+
+	enum
+	{
+		CULL_RANGE_SIZE = 64,
+	};
+
+	// Renderables gathered for the view being built.  Visible leaf i owns
+	// m_BuildCandidates[ m_BuildLeafOffsets[i] ] up to m_BuildLeafOffsets[i+1].
+	// Kept between views so they don't reallocate.
+	CUtlVector< RenderCandidate_t >	m_BuildCandidates;
+	CUtlVector< int >				m_BuildLeafOffsets;
+	CUtlVector< CullRange_t >		m_BuildCullRanges;
+	const SetupRenderInfo_t			*m_pBuildInfo;
+	bool							m_bBuildPortalTestEnts;
 };
 
 
@@ -472,6 +507,8 @@ CClientLeafSystem::CClientLeafSystem() : m_DrawStaticProps(true), m_DrawSmallObj
 	m_ShadowsInLeaf.Init( FirstShadowInLeaf, FirstLeafInShadow ); 
 	m_ShadowsOnRenderable.Init( FirstShadowOnRenderable, FirstRenderableInShadow );
 	m_bDisableLeafReinsertion = false;
+	m_pBuildInfo = NULL;
+	m_bBuildPortalTestEnts = false;
 }
 
 CClientLeafSystem::~CClientLeafSystem()
@@ -1862,15 +1899,13 @@ static RenderGroup_t DetectBucketedRenderGroup( RenderGroup_t group, float fDime
 	return bucketedGroup;
 }
 
-void CClientLeafSystem::CollateRenderablesInLeaf( int leaf, int worldListLeafIndex,	const SetupRenderInfo_t &info )
+//-----------------------------------------------------------------------------
+// Gathers the renderables in a visible leaf that might be drawn in this view.
+// This is the part that depends on leaf order (each opaque renderable goes
+// to the first visible leaf it's in), so it stays on the calling thread.
+//-----------------------------------------------------------------------------
+void CClientLeafSystem::GatherRenderablesInLeaf( int leaf, const SetupRenderInfo_t &info )
 {
-	bool portalTestEnts = r_PortalTestEnts.GetBool() && !r_portalsopenall.GetBool();
-	
-	// Place a fake entity for static/opaque ents in this leaf
-	AddRenderableToRenderList( *info.m_pRenderList, NULL, worldListLeafIndex, RENDER_GROUP_OPAQUE_STATIC, INVALID_CLIENT_RENDER_HANDLE );
-	AddRenderableToRenderList( *info.m_pRenderList, NULL, worldListLeafIndex, RENDER_GROUP_OPAQUE_ENTITY, INVALID_CLIENT_RENDER_HANDLE );
-
-	// Collate everything.
 	unsigned int idx = m_RenderablesInLeaf.FirstElement(leaf);
 	for ( ;idx != m_RenderablesInLeaf.InvalidIndex(); idx = m_RenderablesInLeaf.NextElement(idx) )
 	{
@@ -1912,23 +1947,43 @@ void CClientLeafSystem::CollateRenderablesInLeaf( int leaf, int worldListLeafInd
 				continue;
 		}
 
-		unsigned char nAlpha = 255;
+		RenderCandidate_t &candidate = m_BuildCandidates[ m_BuildCandidates.AddToTail() ];
+		candidate.m_pInfo = &renderable;
+		candidate.m_Handle = handle;
+		candidate.m_nAlpha = 255;
+		candidate.m_bVisible = false;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Culls a range of gathered renderables.  Only reads shared state, so ranges
+// can be culled on different threads.
+//-----------------------------------------------------------------------------
+void CClientLeafSystem::CullRenderCandidates( CullRange_t &range )
+{
+	const SetupRenderInfo_t &info = *m_pBuildInfo;
+
+	RenderCandidate_t *pCandidate = m_BuildCandidates.Base() + range.m_nFirst;
+	for ( int i = 0; i < range.m_nCount; ++i, ++pCandidate )
+	{
+		const RenderableInfo_t &renderable = *pCandidate->m_pInfo;
+
 		if ( info.m_bDrawTranslucentObjects ) 
 		{
 			// Prevent culling if the renderable is invisible
 			// NOTE: OPAQUE objects can have alpha == 0. 
 			// They are made to be opaque because they don't have to be sorted.
-			nAlpha = renderable.m_pRenderable->GetFxBlend();
-			if ( nAlpha == 0 )
+			pCandidate->m_nAlpha = renderable.m_pRenderable->GetFxBlend();
+			if ( pCandidate->m_nAlpha == 0 )
 				continue;
 		}
 
-		Vector absMins = renderable.m_vecAbsMins;
-		Vector absMaxs = renderable.m_vecAbsMaxs;
+		const Vector &absMins = renderable.m_vecAbsMins;
+		const Vector &absMaxs = renderable.m_vecAbsMaxs;
 		// If the renderable is inside an area, cull it using the frustum for that area.
-		if ( portalTestEnts && renderable.m_Area != -1 )
+		if ( m_bBuildPortalTestEnts && renderable.m_Area != -1 )
 		{
-			VPROF( "r_PortalTestEnts" );
 			if ( !engine->DoesBoxTouchAreaFrustum( absMins, absMaxs, renderable.m_Area ) )
 				continue;
 		}
@@ -1967,6 +2022,34 @@ void CClientLeafSystem::CollateRenderablesInLeaf( int leaf, int worldListLeafInd
 		}
 #endif
 
+		pCandidate->m_bVisible = true;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Adds a leaf's visible renderables and detail objects to the render list
+//-----------------------------------------------------------------------------
+void CClientLeafSystem::CollateRenderablesInLeaf( int leaf, int worldListLeafIndex, const SetupRenderInfo_t &info )
+{
+	// Place a fake entity for static/opaque ents in this leaf
+	AddRenderableToRenderList( *info.m_pRenderList, NULL, worldListLeafIndex, RENDER_GROUP_OPAQUE_STATIC, INVALID_CLIENT_RENDER_HANDLE );
+	AddRenderableToRenderList( *info.m_pRenderList, NULL, worldListLeafIndex, RENDER_GROUP_OPAQUE_ENTITY, INVALID_CLIENT_RENDER_HANDLE );
+
+	// Collate everything.
+	int nLast = m_BuildLeafOffsets[ worldListLeafIndex + 1 ];
+	for ( int i = m_BuildLeafOffsets[ worldListLeafIndex ]; i < nLast; ++i )
+	{
+		const RenderCandidate_t &candidate = m_BuildCandidates[i];
+		if ( !candidate.m_bVisible )
+			continue;
+
+		const RenderableInfo_t &renderable = *candidate.m_pInfo;
+		ClientRenderHandle_t handle = candidate.m_Handle;
+		unsigned char nAlpha = candidate.m_nAlpha;
+		const Vector &absMins = renderable.m_vecAbsMins;
+		const Vector &absMaxs = renderable.m_vecAbsMaxs;
+
 		if( renderable.m_RenderGroup != RENDER_GROUP_TRANSLUCENT_ENTITY )
 		{
 			RenderGroup_t group = (RenderGroup_t)renderable.m_RenderGroup;
@@ -2031,7 +2114,7 @@ void CClientLeafSystem::CollateRenderablesInLeaf( int leaf, int worldListLeafInd
 	// These don't have render handles!
 	if ( info.m_bDrawDetailObjects && ShouldDrawDetailObjectsInLeaf( leaf, info.m_nDetailBuildFrame ) )
 	{
-		idx = m_Leaf[leaf].m_FirstDetailProp;
+		unsigned int idx = m_Leaf[leaf].m_FirstDetailProp;
 		int count = m_Leaf[leaf].m_DetailPropCount;
 		while( --count >= 0 )
 		{
@@ -2157,6 +2240,21 @@ void CClientLeafSystem::ComputeBounds(RenderableInfo_t*& pInfo)
 	CalcRenderableWorldSpaceAABB_Bloated(info, info.m_vecPendingBloatedAbsMins, info.m_vecPendingBloatedAbsMaxs);
 }
 
+//-----------------------------------------------------------------------------
+// Builds the render list for a view in three passes:
+//
+//	1. Gather: walk the visible leaves in order and copy the renderables that
+//	   belong to each leaf into one contiguous array, with a start offset
+//	   per leaf.
+//	2. Cull: test the gathered renderables against the view, split into
+//	   ranges of whole leaves.  With cl_threaded_client_leaf_system the
+//	   ranges are culled in parallel.
+//	3. Collate: walk the leaves in order again, adding the survivors and
+//	   sorting each leaf's translucent renderables.
+//
+// The render list comes out in exactly the same order as when everything
+// was done one leaf at a time.
+//-----------------------------------------------------------------------------
 void CClientLeafSystem::BuildRenderablesList( const SetupRenderInfo_t &info )
 {
 	VPROF_BUDGET( "BuildRenderablesList", "BuildRenderablesList" );
@@ -2166,6 +2264,62 @@ void CClientLeafSystem::BuildRenderablesList( const SetupRenderInfo_t &info )
 	CClientRenderablesList::CEntry *pTranslucentEntries = info.m_pRenderList->m_RenderGroups[RENDER_GROUP_TRANSLUCENT_ENTITY];
 	int &nTranslucentEntries = info.m_pRenderList->m_RenderGroupCounts[RENDER_GROUP_TRANSLUCENT_ENTITY];
 
+	m_BuildCandidates.RemoveAll();
+	m_BuildLeafOffsets.SetCount( leafCount + 1 );
+	m_BuildCullRanges.RemoveAll();
+
+	{
+		VPROF( "BuildRenderablesList - gather" );
+
+		int nRangeStart = 0;
+		for( int i = 0; i < leafCount; i++ )
+		{
+			m_BuildLeafOffsets[i] = m_BuildCandidates.Count();
+			GatherRenderablesInLeaf( info.m_pWorldListInfo->m_pLeafList[i], info );
+
+			// Close a cull range once it has enough renderables in it
+			if ( m_BuildCandidates.Count() - nRangeStart >= CULL_RANGE_SIZE )
+			{
+				CullRange_t &range = m_BuildCullRanges[ m_BuildCullRanges.AddToTail() ];
+				range.m_nFirst = nRangeStart;
+				range.m_nCount = m_BuildCandidates.Count() - nRangeStart;
+				nRangeStart = m_BuildCandidates.Count();
+			}
+		}
+		m_BuildLeafOffsets[leafCount] = m_BuildCandidates.Count();
+
+		if ( m_BuildCandidates.Count() > nRangeStart )
+		{
+			CullRange_t &range = m_BuildCullRanges[ m_BuildCullRanges.AddToTail() ];
+			range.m_nFirst = nRangeStart;
+			range.m_nCount = m_BuildCandidates.Count() - nRangeStart;
+		}
+	}
+
+	{
+		VPROF( "BuildRenderablesList - cull" );
+
+		m_pBuildInfo = &info;
+		m_bBuildPortalTestEnts = r_PortalTestEnts.GetBool() && !r_portalsopenall.GetBool();
+
+		bool bThreaded = ( m_BuildCullRanges.Count() > 1 && cl_threaded_client_leaf_system.GetBool() && g_pThreadPool->NumIdleThreads() );
+		if ( bThreaded )
+		{
+			ParallelProcess( "CClientLeafSystem::CullRenderCandidates", m_BuildCullRanges.Base(), m_BuildCullRanges.Count(), this, &CClientLeafSystem::CullRenderCandidates );
+		}
+		else
+		{
+			for ( int i = 0; i < m_BuildCullRanges.Count(); i++ )
+			{
+				CullRenderCandidates( m_BuildCullRanges[i] );
+			}
+		}
+
+		m_pBuildInfo = NULL;
+	}
+
+	VPROF( "BuildRenderablesList - collate" );
+
 	for( int i = 0; i < leafCount; i++ )
 	{
 		int nTranslucent = nTranslucentEntries;
@@ -81,6 +81,7 @@
 #include "toolframework_client.h"
 #include "bonetoworldarray.h"
 #include "cmodel.h"
+#include "checksum_crc.h"
 
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -683,6 +684,10 @@ void CTextureAllocator::GetTextureRect(TextureHandle_t handle, int& x, int& y, i
 
 static ConVar r_shadows( "r_shadows", "1" ); // hook into engine's cvars..
 static ConVar r_shadowmaxrendered("r_shadowmaxrendered", "32");
+static ConVar r_shadow_reuse( "r_shadow_reuse", "1", 0, "Don't re-render a dirty render-to-texture shadow if its models and bones still land on the same texels." );
+static ConVar r_shadow_reuse_tolerance( "r_shadow_reuse_tolerance", "0.5", 0, "How far, in shadow texels, a bone can move before its render-to-texture shadow is re-rendered." );
+static ConVar r_shadow_update_budget( "r_shadow_update_budget", "0", 0, "Most render-to-texture shadows to re-render per frame, largest on screen first. Shadows over budget keep their old texture for a few frames. 0 means no limit." );
+static ConVar r_shadow_cache_stats( "r_shadow_cache_stats", "0", 0, "Show how many render-to-texture shadows were updated, reused and deferred this frame." );
 static ConVar r_shadows_gamecontrol( "r_shadows_gamecontrol", "-1", FCVAR_CHEAT );	 // hook into engine's cvars..
 
 //-----------------------------------------------------------------------------
@@ -817,6 +822,8 @@ private:
 		CTextureReference		m_ShadowDepthTexture;
 		int						m_nRenderFrame;
 		EHANDLE					m_hTargetEntity;
+		unsigned int			m_nSilhouetteHash;		// What the texture holds; 0 if unknown
+		int						m_nTextureUpdateFrame;	// Last frame the texture was known to be up to date
 	};
 
 private:
@@ -894,6 +901,14 @@ private:
 	// Draws all children shadows into our own
 	bool DrawShadowHierarchy( IClientRenderable *pRenderable, const ClientShadow_t &shadow, bool bChild = false );
 
+	// Hashes what a render-to-texture shadow would look like if it were drawn now
+	unsigned int ComputeShadowSilhouetteHash( IClientRenderable *pRenderable, const ClientShadow_t &shadow );
+	void HashShadowHierarchy( CRC32_t &crc, IClientRenderable *pRenderable, const VMatrix &matWorldToTexel );
+
+	// Per-frame render-to-texture shadow counters
+	void ResetShadowTextureStats();
+	void ReportShadowTextureStats();
+
 	// Setup stage for threading
 	bool BuildSetupListForRenderToTextureShadow( unsigned short clientShadowHandle, float flArea );
 	bool BuildSetupShadowHierarchy( IClientRenderable *pRenderable, const ClientShadow_t &shadow, bool bChild = false );
@@ -963,6 +978,12 @@ private:
 	CUtlRBTree< ClientShadowHandle_t, unsigned short >	m_DirtyShadows;
 	CUtlVector< ClientShadowHandle_t > m_TransparentShadows;
 
+	// Render-to-texture shadows updated, reused and deferred in m_nStatsFrame
+	int m_nStatsFrame;
+	int m_nShadowsUpdated;
+	int m_nShadowsReused;
+	int m_nShadowsDeferred;
+
 	// These members maintain current state of depth texturing (size and global active state)
 	// If either changes in a frame, PreRender() will catch it and do the appropriate allocation, deallocation or reallocation
 	bool m_bDepthTextureActive;
@@ -1172,6 +1193,10 @@ CClientShadowMgr::CClientShadowMgr() :
 {
 	m_nDepthTextureResolution = r_flashlightdepthres.GetInt();
 	m_bThreaded = false;
+	m_nStatsFrame = -1;
+	m_nShadowsUpdated = 0;
+	m_nShadowsReused = 0;
+	m_nShadowsDeferred = 0;
 }
 
 
@@ -1571,6 +1596,7 @@ void CClientShadowMgr::RestoreRenderState()
 	for ( h = m_Shadows.Head(); h != m_Shadows.InvalidIndex(); h = m_Shadows.Next(h) )
 	{
 		m_Shadows[h].m_Flags |= SHADOW_FLAGS_TEXTURE_DIRTY;
+		m_Shadows[h].m_nSilhouetteHash = 0;
 	}
 
 	SetShadowColor( m_AmbientLightColor.r, m_AmbientLightColor.g, m_AmbientLightColor.b );
@@ -1612,6 +1638,7 @@ void CClientShadowMgr::SetupRenderToTextureShadow( ClientShadowHandle_t h )
 	}
 
 	shadow.m_ShadowTexture = m_ShadowAllocator.AllocateTexture( textureSize, textureSize );
+	shadow.m_nSilhouetteHash = 0;
 }
 
 
@@ -1818,6 +1845,8 @@ ClientShadowHandle_t CClientShadowMgr::CreateProjectedTexture( ClientEntityHandl
 	shadow.m_ClientLeafShadowHandle = ClientLeafSystem()->AddShadow( h, flags );
 	shadow.m_Flags = flags;
 	shadow.m_nRenderFrame = -1;
+	shadow.m_nSilhouetteHash = 0;
+	shadow.m_nTextureUpdateFrame = -1;
 	shadow.m_LastOrigin.Init( FLT_MAX, FLT_MAX, FLT_MAX );
 	shadow.m_LastAngles.Init( FLT_MAX, FLT_MAX, FLT_MAX );
 	Assert( ( ( shadow.m_Flags & SHADOW_FLAGS_FLASHLIGHT ) == 0 ) != 
@@ -3703,6 +3732,111 @@ bool CClientShadowMgr::DrawShadowHierarchy( IClientRenderable *pRenderable, cons
 	return bDrewTexture;
 }
 
+//-----------------------------------------------------------------------------
+// Hashes what a render-to-texture shadow would look like if it were drawn now:
+// the models in its hierarchy and where their bones land in the texture,
+// snapped to r_shadow_reuse_tolerance texels.  The light direction and the
+// caster's orientation are part of the world to texture transform, so a
+// change to either moves the snapped points too.
+//-----------------------------------------------------------------------------
+#define SHADOW_HASH_BONE_AXIS_LENGTH 12.0f
+#define SHADOW_MAX_DEFERRED_FRAMES 4
+
+static void HashShadowPoint( CRC32_t &crc, const VMatrix &matWorldToTexel, const Vector &vecWorld )
+{
+	Vector vecTexel;
+	Vector3DMultiplyPosition( matWorldToTexel, vecWorld, vecTexel );
+
+	// Ortho projection, so depth doesn't change the silhouette
+	int pSnapped[2] = { (int)floor( vecTexel.x + 0.5f ), (int)floor( vecTexel.y + 0.5f ) };
+	CRC32_ProcessBuffer( &crc, pSnapped, sizeof( pSnapped ) );
+}
+
+static void HashShadowTransform( CRC32_t &crc, const VMatrix &matWorldToTexel, const matrix3x4_t &mat, float flAxisLength )
+{
+	// The origin and the tips of two axes pin down the whole transform
+	Vector vecOrigin, vecAxis;
+	MatrixGetColumn( mat, 3, vecOrigin );
+	HashShadowPoint( crc, matWorldToTexel, vecOrigin );
+
+	MatrixGetColumn( mat, 0, vecAxis );
+	HashShadowPoint( crc, matWorldToTexel, vecOrigin + vecAxis * flAxisLength );
+
+	MatrixGetColumn( mat, 1, vecAxis );
+	HashShadowPoint( crc, matWorldToTexel, vecOrigin + vecAxis * flAxisLength );
+}
+
+unsigned int CClientShadowMgr::ComputeShadowSilhouetteHash( IClientRenderable *pRenderable, const ClientShadow_t &shadow )
+{
+	int x, y, w, h;
+	m_ShadowAllocator.GetTextureRect( shadow.m_ShadowTexture, x, y, w, h );
+
+	float flTolerance = MAX( r_shadow_reuse_tolerance.GetFloat(), 0.01f );
+	VMatrix matTexelScale, matWorldToTexel;
+	MatrixBuildScale( matTexelScale, w / flTolerance, h / flTolerance, 1.0f );
+	MatrixMultiply( matTexelScale, shadowmgr->GetInfo( shadow.m_ShadowHandle ).m_WorldToShadow, matWorldToTexel );
+
+	CRC32_t crc;
+	CRC32_Init( &crc );
+	CRC32_ProcessBuffer( &crc, &w, sizeof( w ) );
+	CRC32_ProcessBuffer( &crc, &h, sizeof( h ) );
+	HashShadowHierarchy( crc, pRenderable, matWorldToTexel );
+	CRC32_Final( &crc );
+
+	// 0 means the texture contents are unknown
+	return crc ? crc : 1;
+}
+
+void CClientShadowMgr::HashShadowHierarchy( CRC32_t &crc, IClientRenderable *pRenderable, const VMatrix &matWorldToTexel )
+{
+	if ( !pRenderable )
+		return;
+
+	// Walk the same renderables DrawShadowHierarchy draws
+	ShadowType_t shadowType = GetActualShadowCastType( pRenderable );
+	if ( shadowType == SHADOWS_SIMPLE )
+		return;
+
+	if ( shadowType != SHADOWS_NONE )
+	{
+		const model_t *pModel = pRenderable->GetModel();
+		int pKey[2] = { pRenderable->GetBody(), pRenderable->GetSkin() };
+		CRC32_ProcessBuffer( &crc, &pModel, sizeof( pModel ) );
+		CRC32_ProcessBuffer( &crc, pKey, sizeof( pKey ) );
+
+		studiohdr_t *pStudioHdr = ( pModel && modelinfo->GetModelType( pModel ) == mod_studio ) ? modelinfo->GetStudiomodel( pModel ) : NULL;
+
+		matrix3x4_t pBoneToWorld[MAXSTUDIOBONES];
+		if ( pStudioHdr && pStudioHdr->numbones > 1 &&
+			 pRenderable->SetupBones( pBoneToWorld, MAXSTUDIOBONES, BONE_USED_BY_VERTEX_AT_LOD(0), gpGlobals->curtime ) )
+		{
+			for ( int i = 0; i < pStudioHdr->numbones; ++i )
+			{
+				if ( pStudioHdr->pBone( i )->flags & BONE_USED_BY_VERTEX_AT_LOD(0) )
+				{
+					HashShadowTransform( crc, matWorldToTexel, pBoneToWorld[i], SHADOW_HASH_BONE_AXIS_LENGTH );
+				}
+			}
+		}
+		else
+		{
+			// Rigid model; scale the axes to its size so a small turn still shows up
+			Vector mins, maxs;
+			pRenderable->GetRenderBounds( mins, maxs );
+			float flRadius = MAX( mins.Length(), maxs.Length() );
+
+			matrix3x4_t matRenderable;
+			AngleMatrix( pRenderable->GetRenderAngles(), pRenderable->GetRenderOrigin(), matRenderable );
+			HashShadowTransform( crc, matWorldToTexel, matRenderable, MAX( flRadius, 1.0f ) );
+		}
+	}
+
+	for ( IClientRenderable *pChild = pRenderable->FirstShadowChild(); pChild; pChild = pChild->NextShadowPeer() )
+	{
+		HashShadowHierarchy( crc, pChild, matWorldToTexel );
+	}
+}
+
 //-----------------------------------------------------------------------------
 // This gets called with every shadow that potentially will need to re-render
 //-----------------------------------------------------------------------------
@@ -3753,10 +3887,53 @@ bool CClientShadowMgr::DrawRenderToTextureShadow( unsigned short clientShadowHan
 		return false;
 	}
 
-	if ( bNeedsRedraw || bDirtyTexture )
+	IClientRenderable *pRenderable = NULL;
+	unsigned int nSilhouetteHash = 0;
+	bool bRedraw = bNeedsRedraw || bDirtyTexture;
+
+	// Dirty doesn't mean the texture would come out any different.  If the
+	// texture still holds what we drew last time, check whether that's
+	// still right before drawing it again.
+	if ( bRedraw && !bNeedsRedraw && shadow.m_nSilhouetteHash != 0 )
+	{
+		pRenderable = ClientEntityList().GetClientRenderableFromHandle( shadow.m_Entity );
+
+		if ( r_shadow_reuse.GetBool() )
+		{
+			nSilhouetteHash = ComputeShadowSilhouetteHash( pRenderable, shadow );
+			if ( nSilhouetteHash == shadow.m_nSilhouetteHash )
+			{
+				bRedraw = false;
+				++m_nShadowsReused;
+				VPROF_INCREMENT_COUNTER( "RTT shadows reused", 1 );
+				shadow.m_nTextureUpdateFrame = gpGlobals->framecount;
+
+				if ( (shadow.m_Flags & SHADOW_FLAGS_ANIMATING_SOURCE) == 0 )
+				{
+					shadow.m_Flags &= ~SHADOW_FLAGS_TEXTURE_DIRTY;
+				}
+			}
+		}
+
+		// Over budget, a slightly stale texture beats a blobby one.  Shadows
+		// come in largest-first order, so the small ones wait.
+		int nBudget = r_shadow_update_budget.GetInt();
+		if ( bRedraw && nBudget > 0 && m_nShadowsUpdated >= nBudget &&
+			 gpGlobals->framecount - shadow.m_nTextureUpdateFrame < SHADOW_MAX_DEFERRED_FRAMES )
+		{
+			bRedraw = false;
+			++m_nShadowsDeferred;
+			VPROF_INCREMENT_COUNTER( "RTT shadows deferred", 1 );
+		}
+	}
+
+	if ( bRedraw )
 	{
 		// shadow to be redrawn; for now, we'll always do it.
-		IClientRenderable *pRenderable = ClientEntityList().GetClientRenderableFromHandle( shadow.m_Entity );
+		if ( !pRenderable )
+		{
+			pRenderable = ClientEntityList().GetClientRenderableFromHandle( shadow.m_Entity );
+		}
 
 		CMatRenderContextPtr pRenderContext( materials );
 		
@@ -3774,6 +3951,20 @@ bool CClientShadowMgr::DrawRenderToTextureShadow( unsigned short clientShadowHan
 		if ( DrawShadowHierarchy( pRenderable, shadow ) )
 		{
 			bDrewTexture = true;
+			++m_nShadowsUpdated;
+			VPROF_INCREMENT_COUNTER( "RTT shadows updated", 1 );
+			shadow.m_nTextureUpdateFrame = gpGlobals->framecount;
+
+			// Remember what we drew.  The bones are already set up, so this is cheap.
+			if ( r_shadow_reuse.GetBool() || r_shadow_update_budget.GetInt() > 0 )
+			{
+				shadow.m_nSilhouetteHash = nSilhouetteHash ? nSilhouetteHash : ComputeShadowSilhouetteHash( pRenderable, shadow );
+			}
+			else
+			{
+				shadow.m_nSilhouetteHash = 0;
+			}
+
 			if ( IsX360() )
 			{
 				// resolve render target to system memory texture
@@ -3787,6 +3978,7 @@ bool CClientShadowMgr::DrawRenderToTextureShadow( unsigned short clientShadowHan
 			// NOTE: Think the flags reset + texcoord set should only happen in DrawShadowHierarchy
 			// but it's 2 days before 360 ship.. not going to change this now.
 			DevMsg( "Didn't draw shadow hierarchy.. bad shadow texcoords probably going to happen..grab Brian!\n" );
+			shadow.m_nSilhouetteHash = 0;
 		}
 
 		// Only clear the dirty flag if the caster isn't animating
@@ -4007,11 +4199,16 @@ void CClientShadowMgr::ComputeShadowTextures( const CViewSetup &viewShadow, int
 
 	m_bThreaded = false;//( r_threaded_client_shadow_manager.GetBool() && g_pThreadPool->NumIdleThreads() );
 
+	ResetShadowTextureStats();
+
 	MDLCACHE_CRITICAL_SECTION();
 	// First grab all shadow textures we may want to render
 	int nCount = s_VisibleShadowList.FindShadows( &viewShadow, leafCount, pLeafList );
 	if ( nCount == 0 )
+	{
+		ReportShadowTextureStats();
 		return;
+	}
 
 	// FIXME: Add heuristics based on distance, etc. to futz with
 	// the shadow allocator + to select blobby shadows
@@ -4106,6 +4303,32 @@ void CClientShadowMgr::ComputeShadowTextures( const CViewSetup &viewShadow, int
 
 	// Restore the clear color
 	pRenderContext->ClearColor3ub( 0, 0, 0 );
+
+	ReportShadowTextureStats();
+}
+
+
+//-----------------------------------------------------------------------------
+// Render-to-texture shadow counters.  There can be several shadow views in a
+// frame, so the counters (and the update budget) cover the whole frame.
+//-----------------------------------------------------------------------------
+void CClientShadowMgr::ResetShadowTextureStats()
+{
+	if ( m_nStatsFrame == gpGlobals->framecount )
+		return;
+
+	m_nStatsFrame = gpGlobals->framecount;
+	m_nShadowsUpdated = 0;
+	m_nShadowsReused = 0;
+	m_nShadowsDeferred = 0;
+}
+
+void CClientShadowMgr::ReportShadowTextureStats()
+{
+	if ( r_shadow_cache_stats.GetBool() )
+	{
+		engine->Con_NPrintf( 0, "RTT shadows: %d updated, %d reused, %d deferred", m_nShadowsUpdated, m_nShadowsReused, m_nShadowsDeferred );
+	}
 }
 
 //-------------------------------------------------------------------------------------------------------
@@ -13,6 +13,7 @@
 #include "view.h"
 #include "clientmode.h"
 #include "iviewrender.h"
+#include "viewrender.h"
 #include "bsptreedata.h"
 #include "tier0/vprof.h"
 #include "engine/ivmodelinfo.h"
@@ -51,6 +52,7 @@ struct model_t;
 
 ConVar cl_detaildist( "cl_detaildist", "1200", 0, "Distance at which detail props are no longer visible" );
 ConVar cl_detailfade( "cl_detailfade", "400", 0, "Distance across which detail props fade in" );
+ConVar cl_detail_sort_cache_dist( "cl_detail_sort_cache_dist", "16", 0, "Reuse each leaf's back-to-front detail sprite order until the view moves this far (0 = sort every frame)" );
 #if defined( USE_DETAIL_SHAPES ) 
 ConVar cl_detail_max_sway( "cl_detail_max_sway", "0", FCVAR_ARCHIVE, "Amplitude of the detail prop sway" );
 ConVar cl_detail_avoid_radius( "cl_detail_avoid_radius", "0", FCVAR_ARCHIVE, "radius around detail sprite to avoid players" );
@@ -339,10 +341,23 @@ class CFastDetailLeafSpriteList : public CClientLeafSubSystemData
 	int m_nNumPendingSprites;
 	int m_nStartSpriteIndex;
 
+	// back-to-front order of every sprite in the leaf, as seen from m_vecSortOrigin.
+	// Each view keeps its own, so reflections and monitors don't resort the main view.
+	struct SortCache_t
+	{
+		CUtlVector<int> m_SortedOrder;
+		Vector m_vecSortOrigin;
+	};
+	SortCache_t m_SortCache[VIEW_ID_COUNT];
+
 	CFastDetailLeafSpriteList( void )
 	{
 		m_nNumPendingSprites = 0;
 		m_nStartSpriteIndex = 0;
+		for ( int i = 0; i < VIEW_ID_COUNT; ++i )
+		{
+			m_SortCache[i].m_vecSortOrigin.Init();
+		}
 	}
 
 };
@@ -461,7 +476,7 @@ private:
 	void FreeSortBuffers( void );
 
 	// Sorts sprites in back-to-front order
-	static bool SortLessFunc( const SortInfo_t &left, const SortInfo_t &right );
+	static void RadixSortBackToFront( SortInfo_t *pSortInfo, SortInfo_t *pScratch, int nCount );
 	int SortSpritesBackToFront( int nLeaf, const Vector &viewOrigin, const Vector &viewForward, SortInfo_t *pSortInfo );
 
 	// For fast detail object insertion
@@ -485,7 +500,10 @@ private:
 	int m_nSortedFastLeaf;
 	SortInfo_t *m_pSortInfo;
 	SortInfo_t *m_pFastSortInfo;
+	SortInfo_t *m_pSortScratch;
 	FastSpriteQuadBuildoutBufferX4_t *m_pBuildoutBuffer;
+	float *m_pFastSpriteDistance;							// per sprite, indexed like the buildout buffer
+	uint8 *m_pFastCullMask;									// per group of 4, bit set = don't draw
 
 	float m_flDefaultFadeStart;
 	float m_flDefaultFadeEnd;
@@ -1402,7 +1420,10 @@ CDetailObjectSystem::CDetailObjectSystem() : m_DetailSpriteDict( 0, 32 ), m_Deta
 	m_pFastSpriteData = NULL;
 	m_pSortInfo = NULL;
 	m_pFastSortInfo = NULL;
+	m_pSortScratch = NULL;
 	m_pBuildoutBuffer = NULL;
+	m_pFastSpriteDistance = NULL;
+	m_pFastCullMask = NULL;
 }
 
 void CDetailObjectSystem::FreeSortBuffers( void )
@@ -1417,11 +1438,26 @@ void CDetailObjectSystem::FreeSortBuffers( void )
 		MemAlloc_FreeAligned(  m_pFastSortInfo );
 		m_pFastSortInfo = NULL;
 	}
+	if ( m_pSortScratch )
+	{
+		MemAlloc_FreeAligned(  m_pSortScratch );
+		m_pSortScratch = NULL;
+	}
 	if ( m_pBuildoutBuffer )
 	{
 		MemAlloc_FreeAligned(  m_pBuildoutBuffer );
 		m_pBuildoutBuffer = NULL;
 	}
+	if ( m_pFastSpriteDistance )
+	{
+		MemAlloc_FreeAligned(  m_pFastSpriteDistance );
+		m_pFastSpriteDistance = NULL;
+	}
+	if ( m_pFastCullMask )
+	{
+		MemAlloc_FreeAligned(  m_pFastCullMask );
+		m_pFastCullMask = NULL;
+	}
 }
 
 CDetailObjectSystem::~CDetailObjectSystem()
@@ -1748,6 +1784,17 @@ void CDetailObjectSystem::UnserializeModels( CUtlBuffer& buf )
 			MemAlloc_AllocAligned( 
 				( 1 + nMaxFastInLeaf / 4 ) * sizeof( FastSpriteQuadBuildoutBufferX4_t ),
 				sizeof( fltx4 ) ) );
+
+		m_pFastSpriteDistance = reinterpret_cast<float *> (
+			MemAlloc_AllocAligned( ( 4 + nMaxFastInLeaf ) * sizeof( float ), sizeof( fltx4 ) ) );
+		m_pFastCullMask = reinterpret_cast<uint8 *> (
+			MemAlloc_AllocAligned( 1 + nMaxFastInLeaf / 4, sizeof( fltx4 ) ) );
+	}
+	int nMaxInLeaf = MAX( nMaxOldInLeaf, nMaxFastInLeaf );
+	if ( nMaxInLeaf )
+	{
+		m_pSortScratch = reinterpret_cast<SortInfo_t *> (
+			MemAlloc_AllocAligned( (3 + nMaxInLeaf ) * sizeof( SortInfo_t ), sizeof( fltx4 ) ) );
 	}
 
 	if ( nNumFastSpritesToAllocate )
@@ -2030,12 +2077,57 @@ int CDetailObjectSystem::CountSpriteQuadsInLeafList( int nLeafCount, LeafIndex_t
 #define TREATASINT(x) ( *(  ( (int32 const *)( &(x) ) ) ) )
 
 //-----------------------------------------------------------------------------
-// Sorts sprites in back-to-front order
+// Sorts sprites in back-to-front order. This is an LSD radix sort on the
+// distance bits, a byte at a time: squared distances are never negative, so
+// their bits order like ints, and inverting them puts the farthest first.
+// Passes where every sprite lands in the same bucket are skipped, which is
+// usually the case for the top byte within a leaf.
 //-----------------------------------------------------------------------------
-inline bool CDetailObjectSystem::SortLessFunc( const CDetailObjectSystem::SortInfo_t &left, const CDetailObjectSystem::SortInfo_t &right )
+#define SPRITE_SORT_KEY( info ) ( ~( uint32 )TREATASINT( ( info ).m_flDistance ) )
+
+void CDetailObjectSystem::RadixSortBackToFront( SortInfo_t *pSortInfo, SortInfo_t *pScratch, int nCount )
 {
-	return TREATASINT( left.m_flDistance ) > TREATASINT( right.m_flDistance );
-//	return left.m_flDistance > right.m_flDistance;
+	if ( nCount < 2 )
+		return;
+
+	int nBuckets[4][256];
+	V_memset( nBuckets, 0, sizeof( nBuckets ) );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		uint32 nKey = SPRITE_SORT_KEY( pSortInfo[i] );
+		nBuckets[0][nKey & 0xff]++;
+		nBuckets[1][( nKey >> 8 ) & 0xff]++;
+		nBuckets[2][( nKey >> 16 ) & 0xff]++;
+		nBuckets[3][nKey >> 24]++;
+	}
+
+	SortInfo_t *pSrc = pSortInfo;
+	SortInfo_t *pDst = pScratch;
+	for ( int nPass = 0; nPass < 4; ++nPass )
+	{
+		int nShift = nPass * 8;
+		int *pBucket = nBuckets[nPass];
+		if ( pBucket[( SPRITE_SORT_KEY( pSrc[0] ) >> nShift ) & 0xff] == nCount )
+			continue;
+
+		int nOffset = 0;
+		for ( int b = 0; b < 256; ++b )
+		{
+			int nInBucket = pBucket[b];
+			pBucket[b] = nOffset;
+			nOffset += nInBucket;
+		}
+		for ( int i = 0; i < nCount; ++i )
+		{
+			pDst[pBucket[( SPRITE_SORT_KEY( pSrc[i] ) >> nShift ) & 0xff]++] = pSrc[i];
+		}
+		V_swap( pSrc, pDst );
+	}
+
+	if ( pSrc != pSortInfo )
+	{
+		V_memcpy( pSortInfo, pSrc, nCount * sizeof( SortInfo_t ) );
+	}
 }
 
 
@@ -2109,7 +2201,7 @@ int CDetailObjectSystem::SortSpritesBackToFront( int nLeaf, const Vector &viewOr
 	if ( nCount )
 	{
 		VPROF( "CDetailObjectSystem::SortSpritesBackToFront -- Sort" );
-		HeapSort( pSortInfo, nCount, SortLessFunc );
+		RadixSortBackToFront( pSortInfo, m_pSortScratch, nCount );
 	}
 
 	return nCount;
@@ -2134,13 +2226,13 @@ int CDetailObjectSystem::BuildOutSortedSprites( CFastDetailLeafSpriteList *pData
 												Vector const &viewRight,
 												Vector const &viewUp )
 {
-	// part 1 - do all vertex math, fading, etc into a buffer, using as much simd as we can
+	// part 1 - do all vertex math, fading, etc into a buffer, using as much simd as we can.
+	// The buffer is indexed like the leaf's sprites so a cached order can point into it.
 	int nSIMDSprites = pData->m_nNumSIMDSprites;
 	FastSpriteX4_t const *pSprites = pData->m_pSprites;
-	SortInfo_t *pOut = m_pFastSortInfo;
 	FastSpriteQuadBuildoutBufferX4_t *pQuadBufferOut = m_pBuildoutBuffer;
-	int curidx = 0;
-	int nLastBfMask = 0;
+	fltx4 *pDistanceOut = reinterpret_cast<fltx4 *>( m_pFastSpriteDistance );
+	uint8 *pCullMaskOut = m_pFastCullMask;
 
 	FourVectors vecViewPos;
 	vecViewPos.DuplicateVector( viewOrigin );
@@ -2161,8 +2253,10 @@ int CDetailObjectSystem::BuildOutSortedSprites( CFastDetailLeafSpriteList *pData
 		ofs -= vecViewPos;
 		fltx4 ofsDotFwd = ofs * vecFwd;
 		fltx4 distanceSquared = ofs * ofs;
-		nLastBfMask = TestSignSIMD( OrSIMD( ofsDotFwd, CmpGtSIMD( distanceSquared, maxsqdist ) ) );		//  cull
-		if ( nLastBfMask != 0xf )
+		int nBfMask = TestSignSIMD( OrSIMD( ofsDotFwd, CmpGtSIMD( distanceSquared, maxsqdist ) ) );		//  cull
+		*pDistanceOut = distanceSquared;
+		*pCullMaskOut = nBfMask;
+		if ( nBfMask != 0xf )
 		{
 			FourVectors dx1;
 			dx1.x = fnegate( ofs.y );
@@ -2217,43 +2311,90 @@ int CDetailObjectSystem::BuildOutSortedSprites( CFastDetailLeafSpriteList *pData
 			fetch4 = *( ( fltx4 *) ( &pSprites->m_RGBColor[0][0] ) );
 			*( (fltx4 *) ( & ( pQuadBufferOut->m_RGBColor[0][0] ) ) ) = fetch4;
 #endif
-
-			//!! bug!! store distance
-			// !! speed!! simd?
-			pOut[0].m_nIndex = curidx;
-			pOut[0].m_flDistance = SubFloat( distanceSquared, 0 );
-			pOut[1].m_nIndex = curidx+1;
-			pOut[1].m_flDistance = SubFloat( distanceSquared, 1 );
-			pOut[2].m_nIndex = curidx+2;
-			pOut[2].m_flDistance = SubFloat( distanceSquared, 2 );
-			pOut[3].m_nIndex = curidx+3;
-			pOut[3].m_flDistance = SubFloat( distanceSquared, 3 );
-			curidx += 4;
-			pOut += 4;
-			pQuadBufferOut++;
 		}
 		pSprites++;
+		pQuadBufferOut++;
+		pDistanceOut++;
+		pCullMaskOut++;
 	} while( --nSIMDSprites );
 
-	// adjust count for tail
-	int nCount = pOut - m_pFastSortInfo;
-	if ( nLastBfMask != 0xf )						// if last not skipped
-		nCount -= ( 0 - pData->m_nNumSprites ) & 3;
+	// the tail of the last group is padding
+	int nNumSprites = pData->m_nNumSprites;
+	if ( nNumSprites & 3 )
+	{
+		pCullMaskOut[-1] |= 0xf & ~( ( 1 << ( nNumSprites & 3 ) ) - 1 );
+	}
 
-	// part 2 - sort
-	if ( nCount )
+	// part 2 - sort, or reuse the order from a recent frame if the view hasn't moved far
+	SortInfo_t *pOut = m_pFastSortInfo;
+	float flCacheDist = cl_detail_sort_cache_dist.GetFloat();
+	int nViewID = CurrentViewID();
+	if ( flCacheDist <= 0 || nViewID < 0 || nViewID >= VIEW_ID_COUNT )
+	{
+		if ( flCacheDist <= 0 )
+		{
+			for ( int i = 0; i < VIEW_ID_COUNT; ++i )
+			{
+				pData->m_SortCache[i].m_SortedOrder.Purge();
+			}
+		}
+		for ( int i = 0; i < nNumSprites; ++i )
+		{
+			if ( m_pFastCullMask[i >> 2] & ( 1 << ( i & 3 ) ) )
+				continue;
+			pOut->m_nIndex = i;
+			pOut->m_flDistance = m_pFastSpriteDistance[i];
+			pOut++;
+		}
+
+		int nCount = pOut - m_pFastSortInfo;
+		if ( nCount )
+		{
+			VPROF( "CDetailObjectSystem::SortSpritesBackToFront -- Sort" );
+			RadixSortBackToFront( m_pFastSortInfo, m_pSortScratch, nCount );
+		}
+		return nCount;
+	}
+
+	CFastDetailLeafSpriteList::SortCache_t &cache = pData->m_SortCache[nViewID];
+	if ( cache.m_SortedOrder.Count() != nNumSprites ||
+		 viewOrigin.DistToSqr( cache.m_vecSortOrigin ) > flCacheDist * flCacheDist )
 	{
+		// sort everything, including what's culled now, so turning around doesn't need a resort
 		VPROF( "CDetailObjectSystem::SortSpritesBackToFront -- Sort" );
-		HeapSort( m_pFastSortInfo, nCount, SortLessFunc );
+		for ( int i = 0; i < nNumSprites; ++i )
+		{
+			m_pFastSortInfo[i].m_nIndex = i;
+			m_pFastSortInfo[i].m_flDistance = m_pFastSpriteDistance[i];
+		}
+		RadixSortBackToFront( m_pFastSortInfo, m_pSortScratch, nNumSprites );
+
+		cache.m_SortedOrder.SetCount( nNumSprites );
+		for ( int i = 0; i < nNumSprites; ++i )
+		{
+			cache.m_SortedOrder[i] = m_pFastSortInfo[i].m_nIndex;
+		}
+		cache.m_vecSortOrigin = viewOrigin;
 	}
-	return nCount;
+
+	int const *pOrder = cache.m_SortedOrder.Base();
+	for ( int i = 0; i < nNumSprites; ++i )
+	{
+		int nIndex = pOrder[i];
+		if ( m_pFastCullMask[nIndex >> 2] & ( 1 << ( nIndex & 3 ) ) )
+			continue;
+		pOut->m_nIndex = nIndex;
+		pOut->m_flDistance = m_pFastSpriteDistance[nIndex];
+		pOut++;
+	}
+	return pOut - m_pFastSortInfo;
 }
 
 
 void CDetailObjectSystem::RenderFastSprites( const Vector &viewOrigin, const Vector &viewForward, const Vector &viewRight, const Vector &viewUp, int nLeafCount, LeafIndex_t const * pLeafList )
 {
 	// Here, we must draw all detail objects back-to-front
-	// FIXME: Cache off a sorted list so we don't have to re-sort every frame
+	// (each leaf keeps its sorted order while the view stays within cl_detail_sort_cache_dist)
 
 	// Count the total # of detail quads we possibly could render
 	int nMaxInLeaf;
@@ -12,6 +12,8 @@
 #include "materialsystem/itexture.h"
 #include "view_shared.h"
 #include "viewpostprocess.h"
+#include "materialsystem/MaterialSystemUtil.h"
+#include "tier0/vprof.h"
 
 #define FULL_FRAME_TEXTURE "_rt_FullFrameFB"
 
@@ -19,11 +21,17 @@
 
 ConVar glow_outline_effect_enable( "glow_outline_effect_enable", "1", FCVAR_ARCHIVE, "Enable entity outline glow effects." );
 ConVar glow_outline_effect_width( "glow_outline_width", "10.0f", FCVAR_CHEAT, "Width of glow outline effect in screen space." );
+ConVar glow_outline_effect_downsample( "glow_outline_effect_downsample", "1", FCVAR_ARCHIVE, "1 draws a sharp glow outline at full resolution. 2 or 4 draws a soft glow blurred at half or quarter resolution, which is cheaper on slow GPUs." );
+ConVar glow_outline_effect_stats( "glow_outline_effect_stats", "0", 0, "Show how many glow stencil passes and model draws were made this frame." );
 
 extern bool g_bDumpRenderTargets; // in viewpostprocess.cpp
 
 CGlowObjectManager g_GlowObjectManager;
 
+// Adds the blurred glow to the screen.  Made here since it samples whichever
+// target the blur ended up in.
+static CMaterialReference s_GlowBlurredAddToScreen;
+
 struct ShaderStencilState_t
 {
 	bool m_bEnable;
@@ -68,8 +76,19 @@ void CGlowObjectManager::RenderGlowEffects( const CViewSetup *pSetup, int nSplit
 			int nX, nY, nWidth, nHeight;
 			pRenderContext->GetViewport( nX, nY, nWidth, nHeight );
 
+			if ( m_nStatsFrame != gpGlobals->framecount )
+			{
+				m_nStatsFrame = gpGlobals->framecount;
+				m_nStencilPasses = 0;
+				m_nGlowModelDraws = 0;
+			}
+
+			BuildGlowDrawList( nSplitScreenSlot );
+
 			PIXEvent _pixEvent( pRenderContext, "EntityGlowEffects" );
 			ApplyEntityGlowEffects( pSetup, nSplitScreenSlot, pRenderContext, glow_outline_effect_width.GetFloat(), nX, nY, nWidth, nHeight );
+
+			ReportGlowStats();
 		}
 	}
 }
@@ -124,17 +143,20 @@ void CGlowObjectManager::RenderGlowModels( const CViewSetup *pSetup, int nSplitS
 	//==================//
 	// Draw the objects //
 	//==================//
-	for ( int i = 0; i < m_GlowObjectDefinitions.Count(); ++ i )
+	for ( int i = 0; i < m_GlowColorGroups.Count(); ++ i )
 	{
-		if ( m_GlowObjectDefinitions[i].IsUnused() || !m_GlowObjectDefinitions[i].ShouldDraw( nSplitScreenSlot ) )
-			continue;
+		const GlowColorGroup_t &group = m_GlowColorGroups[i];
 
-		render->SetBlend( m_GlowObjectDefinitions[i].m_flGlowAlpha );
-		Vector vGlowColor = m_GlowObjectDefinitions[i].m_vGlowColor * m_GlowObjectDefinitions[i].m_flGlowAlpha;
+		render->SetBlend( group.m_flGlowAlpha );
+		Vector vGlowColor = group.m_vGlowColor * group.m_flGlowAlpha;
 		render->SetColorModulation( &vGlowColor[0] ); // This only sets rgb, not alpha
 
-		m_GlowObjectDefinitions[i].DrawModel();
-	}	
+		for ( int j = group.m_nFirst; j < group.m_nFirst + group.m_nCount; ++ j )
+		{
+			m_GlowObjectDefinitions[ m_GlowDrawList[j] ].DrawModel();
+			m_nGlowModelDraws++;
+		}
+	}
 
 	if ( g_bDumpRenderTargets )
 	{
@@ -169,82 +191,40 @@ void CGlowObjectManager::ApplyEntityGlowEffects( const CViewSetup *pSetup, int n
 	render->SetBlend( 0.0f );
 	pRenderContext->OverrideDepthEnable( true, false );
 
-	int iNumGlowObjects = 0;
+	// Objects with the same occlusion flags share a stencil state, so each
+	// kind is drawn in one pass.  Nothing here writes 0 to the stencil, and
+	// the final pass only tests for 0, so the order of the draws doesn't matter.
+	DrawGlowStencilPass( pRenderContext, true, true );
+	DrawGlowStencilPass( pRenderContext, true, false );
+	DrawGlowStencilPass( pRenderContext, false, true );
 
-	for ( int i = 0; i < m_GlowObjectDefinitions.Count(); ++ i )
+	// Need to do a 2nd pass to warm stencil for objects which are rendered only when occluded
 	{
-		if ( m_GlowObjectDefinitions[i].IsUnused() || !m_GlowObjectDefinitions[i].ShouldDraw( nSplitScreenSlot ) )
-			continue;
+		ShaderStencilState_t stencilState;
+		stencilState.m_bEnable = true;
+		stencilState.m_nReferenceValue = 2;
+		stencilState.m_CompareFunc = STENCILCOMPARISONFUNCTION_ALWAYS;
+		stencilState.m_PassOp = STENCILOPERATION_REPLACE;
+		stencilState.m_FailOp = STENCILOPERATION_KEEP;
+		stencilState.m_ZFailOp = STENCILOPERATION_KEEP;
 
-		if ( m_GlowObjectDefinitions[i].m_bRenderWhenOccluded || m_GlowObjectDefinitions[i].m_bRenderWhenUnoccluded )
+		bool bStateSet = false;
+		for ( int i = 0; i < m_GlowDrawList.Count(); ++ i )
 		{
-			if ( m_GlowObjectDefinitions[i].m_bRenderWhenOccluded && m_GlowObjectDefinitions[i].m_bRenderWhenUnoccluded )
-			{
-				ShaderStencilState_t stencilState;
-				stencilState.m_bEnable = true;
-				stencilState.m_nReferenceValue = 1;
-				stencilState.m_CompareFunc = STENCILCOMPARISONFUNCTION_ALWAYS;
-				stencilState.m_PassOp = STENCILOPERATION_REPLACE;
-				stencilState.m_FailOp = STENCILOPERATION_KEEP;
-				stencilState.m_ZFailOp = STENCILOPERATION_REPLACE;
-
-				stencilState.SetStencilState( pRenderContext );
+			GlowObjectDefinition_t &glowObject = m_GlowObjectDefinitions[ m_GlowDrawList[i] ];
+			if ( !glowObject.m_bRenderWhenOccluded || glowObject.m_bRenderWhenUnoccluded )
+				continue;
 
-				m_GlowObjectDefinitions[i].DrawModel();
-			}
-			else if ( m_GlowObjectDefinitions[i].m_bRenderWhenOccluded )
-			{
-				ShaderStencilState_t stencilState;
-				stencilState.m_bEnable = true;
-				stencilState.m_nReferenceValue = 1;
-				stencilState.m_CompareFunc = STENCILCOMPARISONFUNCTION_ALWAYS;
-				stencilState.m_PassOp = STENCILOPERATION_KEEP;
-				stencilState.m_FailOp = STENCILOPERATION_KEEP;
-				stencilState.m_ZFailOp = STENCILOPERATION_REPLACE;
-
-				stencilState.SetStencilState( pRenderContext );
-
-				m_GlowObjectDefinitions[i].DrawModel();
-			}
-			else if ( m_GlowObjectDefinitions[i].m_bRenderWhenUnoccluded )
+			if ( !bStateSet )
 			{
-				ShaderStencilState_t stencilState;
-				stencilState.m_bEnable = true;
-				stencilState.m_nReferenceValue = 2;
-				stencilState.m_nTestMask = 0x1;
-				stencilState.m_nWriteMask = 0x3;
-				stencilState.m_CompareFunc = STENCILCOMPARISONFUNCTION_EQUAL;
-				stencilState.m_PassOp = STENCILOPERATION_INCRSAT;
-				stencilState.m_FailOp = STENCILOPERATION_KEEP;
-				stencilState.m_ZFailOp = STENCILOPERATION_REPLACE;
-
 				stencilState.SetStencilState( pRenderContext );
-
-				m_GlowObjectDefinitions[i].DrawModel();
+				bStateSet = true;
+				m_nStencilPasses++;
+				VPROF_INCREMENT_COUNTER( "Glow stencil passes", 1 );
 			}
-		}
-
-		iNumGlowObjects++;
-	}
-
-	// Need to do a 2nd pass to warm stencil for objects which are rendered only when occluded
-	for ( int i = 0; i < m_GlowObjectDefinitions.Count(); ++ i )
-	{
-		if ( m_GlowObjectDefinitions[i].IsUnused() || !m_GlowObjectDefinitions[i].ShouldDraw( nSplitScreenSlot ) )
-			continue;
 
-		if ( m_GlowObjectDefinitions[i].m_bRenderWhenOccluded && !m_GlowObjectDefinitions[i].m_bRenderWhenUnoccluded )
-		{
-			ShaderStencilState_t stencilState;
-			stencilState.m_bEnable = true;
-			stencilState.m_nReferenceValue = 2;
-			stencilState.m_CompareFunc = STENCILCOMPARISONFUNCTION_ALWAYS;
-			stencilState.m_PassOp = STENCILOPERATION_REPLACE;
-			stencilState.m_FailOp = STENCILOPERATION_KEEP;
-			stencilState.m_ZFailOp = STENCILOPERATION_KEEP;
-			stencilState.SetStencilState( pRenderContext );
-
-			m_GlowObjectDefinitions[i].DrawModel();
+			glowObject.DrawModel();
+			m_nGlowModelDraws++;
 		}
 	}
 
@@ -256,7 +236,7 @@ void CGlowObjectManager::ApplyEntityGlowEffects( const CViewSetup *pSetup, int n
 	// If there aren't any objects to glow, don't do all this other stuff
 	// this fixes a bug where if there are glow objects in the list, but none of them are glowing,
 	// the whole screen blooms.
-	if ( iNumGlowObjects <= 0 )
+	if ( m_GlowDrawList.Count() <= 0 )
 		return;
 
 	//=============================================
@@ -273,6 +253,14 @@ void CGlowObjectManager::ApplyEntityGlowEffects( const CViewSetup *pSetup, int n
 	int nViewportX, nViewportY, nViewportWidth, nViewportHeight;
 	pRenderContext->GetViewport( nViewportX, nViewportY, nViewportWidth, nViewportHeight );
 
+	int nDownsample = glow_outline_effect_downsample.GetInt();
+	if ( nDownsample == 2 || nDownsample == 4 )
+	{
+		PIXEvent pixEvent( pRenderContext, "BlurGlow" );
+		ApplyBlurredGlow( pSetup, pRenderContext, flBloomScale, nDownsample );
+		return;
+	}
+
 	// Get material and texture pointers
 	ITexture *pRtQuarterSize1 = materials->FindTexture( "_rt_SmallFB1", TEXTURE_GROUP_RENDER_TARGET );
 
@@ -305,11 +293,295 @@ void CGlowObjectManager::ApplyEntityGlowEffects( const CViewSetup *pSetup, int n
 			0.0f, -0.5f, nSrcWidth / 4 - 1, nSrcHeight / 4 - 1,
 			pRtQuarterSize1->GetActualWidth(),
 			pRtQuarterSize1->GetActualHeight() );
+		m_nStencilPasses++;
+		VPROF_INCREMENT_COUNTER( "Glow stencil passes", 1 );
 
 		stencilStateDisable.SetStencilState( pRenderContext );
 	}
 }
 
+void CGlowObjectManager::BuildGlowDrawList( int nSplitScreenSlot )
+{
+	m_GlowColorGroups.RemoveAll();
+	m_GlowUnsortedList.RemoveAll();
+
+	// Find the group for each object.  There are only ever a handful of
+	// colors (team colors, the flag, MvM robots), so a linear search is fine.
+	for ( int i = 0; i < m_GlowObjectDefinitions.Count(); ++ i )
+	{
+		const GlowObjectDefinition_t &glowObject = m_GlowObjectDefinitions[i];
+		if ( glowObject.IsUnused() || !glowObject.ShouldDraw( nSplitScreenSlot ) )
+			continue;
+
+		int nGroup;
+		for ( nGroup = 0; nGroup < m_GlowColorGroups.Count(); ++ nGroup )
+		{
+			const GlowColorGroup_t &group = m_GlowColorGroups[nGroup];
+			if ( group.m_vGlowColor == glowObject.m_vGlowColor && group.m_flGlowAlpha == glowObject.m_flGlowAlpha )
+				break;
+		}
+
+		if ( nGroup == m_GlowColorGroups.Count() )
+		{
+			GlowColorGroup_t &group = m_GlowColorGroups[ m_GlowColorGroups.AddToTail() ];
+			group.m_vGlowColor = glowObject.m_vGlowColor;
+			group.m_flGlowAlpha = glowObject.m_flGlowAlpha;
+			group.m_nCount = 0;
+		}
+
+		m_GlowColorGroups[nGroup].m_nCount++;
+
+		GlowDrawEntry_t &entry = m_GlowUnsortedList[ m_GlowUnsortedList.AddToTail() ];
+		entry.m_nObject = i;
+		entry.m_nGroup = nGroup;
+	}
+
+	// Lay the groups out one after another, keeping the objects in each
+	// group in registration order
+	int nFirst = 0;
+	for ( int i = 0; i < m_GlowColorGroups.Count(); ++ i )
+	{
+		m_GlowColorGroups[i].m_nFirst = nFirst;
+		nFirst += m_GlowColorGroups[i].m_nCount;
+		m_GlowColorGroups[i].m_nCount = 0;
+	}
+
+	m_GlowDrawList.SetCount( m_GlowUnsortedList.Count() );
+	for ( int i = 0; i < m_GlowUnsortedList.Count(); ++ i )
+	{
+		GlowColorGroup_t &group = m_GlowColorGroups[ m_GlowUnsortedList[i].m_nGroup ];
+		m_GlowDrawList[ group.m_nFirst + group.m_nCount++ ] = m_GlowUnsortedList[i].m_nObject;
+	}
+}
+
+void CGlowObjectManager::DrawGlowStencilPass( CMatRenderContextPtr &pRenderContext, bool bRenderWhenOccluded, bool bRenderWhenUnoccluded )
+{
+	ShaderStencilState_t stencilState;
+	stencilState.m_bEnable = true;
+	stencilState.m_FailOp = STENCILOPERATION_KEEP;
+	stencilState.m_ZFailOp = STENCILOPERATION_REPLACE;
+
+	if ( bRenderWhenOccluded && bRenderWhenUnoccluded )
+	{
+		stencilState.m_nReferenceValue = 1;
+		stencilState.m_CompareFunc = STENCILCOMPARISONFUNCTION_ALWAYS;
+		stencilState.m_PassOp = STENCILOPERATION_REPLACE;
+	}
+	else if ( bRenderWhenOccluded )
+	{
+		stencilState.m_nReferenceValue = 1;
+		stencilState.m_CompareFunc = STENCILCOMPARISONFUNCTION_ALWAYS;
+		stencilState.m_PassOp = STENCILOPERATION_KEEP;
+	}
+	else
+	{
+		stencilState.m_nReferenceValue = 2;
+		stencilState.m_nTestMask = 0x1;
+		stencilState.m_nWriteMask = 0x3;
+		stencilState.m_CompareFunc = STENCILCOMPARISONFUNCTION_EQUAL;
+		stencilState.m_PassOp = STENCILOPERATION_INCRSAT;
+	}
+
+	bool bStateSet = false;
+	for ( int i = 0; i < m_GlowDrawList.Count(); ++ i )
+	{
+		GlowObjectDefinition_t &glowObject = m_GlowObjectDefinitions[ m_GlowDrawList[i] ];
+		if ( glowObject.m_bRenderWhenOccluded != bRenderWhenOccluded || glowObject.m_bRenderWhenUnoccluded != bRenderWhenUnoccluded )
+			continue;
+
+		if ( !bStateSet )
+		{
+			stencilState.SetStencilState( pRenderContext );
+			bStateSet = true;
+			m_nStencilPasses++;
+			VPROF_INCREMENT_COUNTER( "Glow stencil passes", 1 );
+		}
+
+		glowObject.DrawModel();
+		m_nGlowModelDraws++;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// The blur samples a few texels past the edge of the area it uses, so clear a
+// border around it unless it already covers the whole target
+//-----------------------------------------------------------------------------
+static void ClearGlowBlurTarget( CMatRenderContextPtr &pRenderContext, ITexture *pRt, int nWidth, int nHeight )
+{
+	if ( pRt->GetActualWidth() == nWidth && pRt->GetActualHeight() == nHeight )
+		return;
+
+	SetRenderTargetAndViewPort( pRt, MIN( nWidth + 8, pRt->GetActualWidth() ), MIN( nHeight + 8, pRt->GetActualHeight() ) );
+	pRenderContext->ClearColor3ub( 0, 0, 0 );
+	pRenderContext->ClearBuffers( true, false, false );
+}
+
+//-----------------------------------------------------------------------------
+// Downsamples the glow colors in _rt_FullFrameFB, blurs them and adds them to
+// the screen outside the stenciled objects.  Quarter resolution works in
+// _rt_SmallFB0/1.  Half resolution works in the top left corner of
+// _rt_FullFrameFB1 and _rt_FullFrameFB, since the glow colors in
+// _rt_FullFrameFB aren't needed once they're downsampled.
+//-----------------------------------------------------------------------------
+void CGlowObjectManager::ApplyBlurredGlow( const CViewSetup *pSetup, CMatRenderContextPtr &pRenderContext, float flBloomScale, int nDownsample )
+{
+	ITexture *pRtFullFrame = materials->FindTexture( FULL_FRAME_TEXTURE, TEXTURE_GROUP_RENDER_TARGET );
+	ITexture *pRtBlur0 = NULL;
+	ITexture *pRtBlur1 = NULL;
+	if ( nDownsample == 2 )
+	{
+		pRtBlur0 = materials->FindTexture( "_rt_FullFrameFB1", TEXTURE_GROUP_RENDER_TARGET, false );
+		pRtBlur1 = pRtFullFrame;
+		if ( !pRtBlur0 || pRtBlur0->IsError() )
+		{
+			nDownsample = 4;
+		}
+	}
+	if ( nDownsample == 4 )
+	{
+		pRtBlur0 = materials->FindTexture( "_rt_SmallFB0", TEXTURE_GROUP_RENDER_TARGET );
+		pRtBlur1 = materials->FindTexture( "_rt_SmallFB1", TEXTURE_GROUP_RENDER_TARGET );
+	}
+
+	IMaterial *pMatDownsample = materials->FindMaterial( "dev/glow_downsample", TEXTURE_GROUP_OTHER, true );
+	IMaterial *pMatBlurX = materials->FindMaterial( "dev/glow_blur_x", TEXTURE_GROUP_OTHER, true );
+	IMaterial *pMatBlurY = materials->FindMaterial( "dev/glow_blur_y", TEXTURE_GROUP_OTHER, true );
+
+	if ( !s_GlowBlurredAddToScreen.IsValid() )
+	{
+		KeyValues *pVMTKeyValues = new KeyValues( "screenspace_general" );
+		pVMTKeyValues->SetString( "$PIXSHADER", "haloadd_ps20" );
+		pVMTKeyValues->SetString( "$basetexture", "_rt_SmallFB0" );
+		pVMTKeyValues->SetInt( "$ignorez", 1 );
+		pVMTKeyValues->SetInt( "$linearread_basetexture", 1 );
+		pVMTKeyValues->SetInt( "$linearwrite", 1 );
+		pVMTKeyValues->SetInt( "$alpha_blend_color_overlay", 1 );
+		pVMTKeyValues->SetFloat( "$C0_X", 1.0f );
+		s_GlowBlurredAddToScreen.Init( "__glow_blurred_add_to_screen", TEXTURE_GROUP_OTHER, pVMTKeyValues );
+	}
+
+	bool bFound;
+	int nSrcWidth = pSetup->width;
+	int nSrcHeight = pSetup->height;
+	int nDstWidth = nSrcWidth / nDownsample;
+	int nDstHeight = nSrcHeight / nDownsample;
+
+	pRenderContext->PushRenderTargetAndViewport();
+
+	ClearGlowBlurTarget( pRenderContext, pRtBlur0, nDstWidth, nDstHeight );
+
+	//============================================
+	// Downsample _rt_FullFrameFB to blur target 0
+	//============================================
+	SetRenderTargetAndViewPort( pRtBlur0, nDstWidth, nDstHeight );
+
+	IMaterialVar *pVar = pMatDownsample->FindVar( "$bloomexp", &bFound, false );
+	if ( bFound )
+	{
+		pVar->SetFloatValue( 2.5f );
+	}
+	pVar = pMatDownsample->FindVar( "$bloomsaturation", &bFound, false );
+	if ( bFound )
+	{
+		pVar->SetFloatValue( 1.0f );
+	}
+	pVar = pMatDownsample->FindVar( "$basetexture", &bFound, false );
+	if ( bFound )
+	{
+		pVar->SetTextureValue( pRtFullFrame );
+	}
+
+	// The shader reads texels on both sides of each sample, hence the -4's
+	pRenderContext->DrawScreenSpaceRectangle( pMatDownsample, 0, 0, nDstWidth, nDstHeight,
+		0, 0, nSrcWidth - 4, nSrcHeight - 4,
+		pRtFullFrame->GetActualWidth(), pRtFullFrame->GetActualHeight() );
+
+	// Only now, since target 1 can be _rt_FullFrameFB itself
+	ClearGlowBlurTarget( pRenderContext, pRtBlur1, nDstWidth, nDstHeight );
+
+	//==================================
+	// Gaussian blur x target 0 to 1
+	//==================================
+	SetRenderTargetAndViewPort( pRtBlur1, nDstWidth, nDstHeight );
+
+	pVar = pMatBlurX->FindVar( "$bloomamount", &bFound, false );
+	if ( bFound )
+	{
+		pVar->SetFloatValue( flBloomScale );
+	}
+	pVar = pMatBlurX->FindVar( "$basetexture", &bFound, false );
+	if ( bFound )
+	{
+		pVar->SetTextureValue( pRtBlur0 );
+	}
+	pRenderContext->DrawScreenSpaceRectangle( pMatBlurX, 0, 0, nDstWidth, nDstHeight,
+		0, 0, nDstWidth - 1, nDstHeight - 1,
+		pRtBlur0->GetActualWidth(), pRtBlur0->GetActualHeight() );
+
+	//==================================
+	// Gaussian blur y target 1 to 0
+	//==================================
+	SetRenderTargetAndViewPort( pRtBlur0, nDstWidth, nDstHeight );
+
+	pVar = pMatBlurY->FindVar( "$bloomamount", &bFound, false );
+	if ( bFound )
+	{
+		pVar->SetFloatValue( flBloomScale );
+	}
+	pVar = pMatBlurY->FindVar( "$basetexture", &bFound, false );
+	if ( bFound )
+	{
+		pVar->SetTextureValue( pRtBlur1 );
+	}
+	pRenderContext->DrawScreenSpaceRectangle( pMatBlurY, 0, 0, nDstWidth, nDstHeight,
+		0, 0, nDstWidth - 1, nDstHeight - 1,
+		pRtBlur1->GetActualWidth(), pRtBlur1->GetActualHeight() );
+
+	pRenderContext->PopRenderTargetAndViewport();
+
+	//==========================================================
+	// Scale the blur up onto the screen outside the objects
+	//==========================================================
+	pVar = s_GlowBlurredAddToScreen->FindVar( "$basetexture", &bFound, false );
+	if ( bFound )
+	{
+		pVar->SetTextureValue( pRtBlur0 );
+	}
+
+	int nViewportX, nViewportY, nViewportWidth, nViewportHeight;
+	pRenderContext->GetViewport( nViewportX, nViewportY, nViewportWidth, nViewportHeight );
+
+	ShaderStencilState_t stencilState;
+	stencilState.m_bEnable = true;
+	stencilState.m_nWriteMask = 0x0; // We're not changing stencil
+	stencilState.m_nTestMask = 0xFF;
+	stencilState.m_nReferenceValue = 0x0;
+	stencilState.m_CompareFunc = STENCILCOMPARISONFUNCTION_EQUAL;
+	stencilState.m_PassOp = STENCILOPERATION_KEEP;
+	stencilState.m_FailOp = STENCILOPERATION_KEEP;
+	stencilState.m_ZFailOp = STENCILOPERATION_KEEP;
+	stencilState.SetStencilState( pRenderContext );
+
+	pRenderContext->DrawScreenSpaceRectangle( s_GlowBlurredAddToScreen, 0, 0, nViewportWidth, nViewportHeight,
+		0.0f, -0.5f, nDstWidth - 1, nDstHeight - 1,
+		pRtBlur0->GetActualWidth(), pRtBlur0->GetActualHeight() );
+	m_nStencilPasses++;
+	VPROF_INCREMENT_COUNTER( "Glow stencil passes", 1 );
+
+	ShaderStencilState_t stencilStateDisable;
+	stencilStateDisable.m_bEnable = false;
+	stencilStateDisable.SetStencilState( pRenderContext );
+}
+
+void CGlowObjectManager::ReportGlowStats()
+{
+	if ( glow_outline_effect_stats.GetBool() )
+	{
+		engine->Con_NPrintf( 1, "Glow: %d objects in %d color groups, %d stencil passes, %d model draws this frame",
+			m_GlowDrawList.Count(), m_GlowColorGroups.Count(), m_nStencilPasses, m_nGlowModelDraws );
+	}
+}
+
 void CGlowObjectManager::GlowObjectDefinition_t::DrawModel()
 {
 	if ( m_hEntity.Get() )
@@ -26,7 +26,10 @@ class CGlowObjectManager
 {
 public:
 	CGlowObjectManager() :
-	m_nFirstFreeSlot( GlowObjectDefinition_t::END_OF_FREE_LIST )
+	m_nFirstFreeSlot( GlowObjectDefinition_t::END_OF_FREE_LIST ),
+	m_nStatsFrame( -1 ),
+	m_nStencilPasses( 0 ),
+	m_nGlowModelDraws( 0 )
 	{
 	}
 
@@ -120,6 +123,17 @@ private:
 	void RenderGlowModels( const CViewSetup *pSetup, int nSplitScreenSlot, CMatRenderContextPtr &pRenderContext );
 	void ApplyEntityGlowEffects( const CViewSetup *pSetup, int nSplitScreenSlot, CMatRenderContextPtr &pRenderContext, float flBloomScale, int x, int y, int w, int h );
 
+	// Collects the glow objects to draw this view, grouped by color
+	void BuildGlowDrawList( int nSplitScreenSlot );
+
+	// Draws every glow object whose occlusion flags match with one stencil state
+	void DrawGlowStencilPass( CMatRenderContextPtr &pRenderContext, bool bRenderWhenOccluded, bool bRenderWhenUnoccluded );
+
+	// Blurs _rt_FullFrameFB at 1/nDownsample resolution and adds it to the screen
+	void ApplyBlurredGlow( const CViewSetup *pSetup, CMatRenderContextPtr &pRenderContext, float flBloomScale, int nDownsample );
+
+	void ReportGlowStats();
+
 	struct GlowObjectDefinition_t
 	{
 		bool ShouldDraw( int nSlot ) const
@@ -152,6 +166,32 @@ private:
 
 	CUtlVector< GlowObjectDefinition_t > m_GlowObjectDefinitions;
 	int m_nFirstFreeSlot;
+
+	// Glow objects sharing a color and alpha, drawn with one color modulation
+	struct GlowColorGroup_t
+	{
+		Vector m_vGlowColor;
+		float m_flGlowAlpha;
+		int m_nFirst;
+		int m_nCount;
+	};
+
+	// Indices into m_GlowObjectDefinitions for the current view, in color group order
+	CUtlVector< int > m_GlowDrawList;
+	CUtlVector< GlowColorGroup_t > m_GlowColorGroups;
+
+	// Scratch for BuildGlowDrawList: each object and its group, in registration order
+	struct GlowDrawEntry_t
+	{
+		int m_nObject;
+		int m_nGroup;
+	};
+	CUtlVector< GlowDrawEntry_t > m_GlowUnsortedList;
+
+	// Stencil passes and model draws this frame
+	int m_nStatsFrame;
+	int m_nStencilPasses;
+	int m_nGlowModelDraws;
 };
 
 extern CGlowObjectManager g_GlowObjectManager;
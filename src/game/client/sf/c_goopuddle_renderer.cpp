@@ -0,0 +1,281 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Batches goo puddle cells into one dynamic mesh per goo material.
+//
+//=============================================================================//
+
+#include "cbase.h"
+#include "c_goopuddle_renderer.h"
+#include "view.h"
+#include "materialsystem/imesh.h"
+#include "materialsystem/imaterial.h"
+#include "mathlib/ssemath.h"
+#include "tier0/vprof.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+ConVar sf_goopuddle_batch( "sf_goopuddle_batch", "1", FCVAR_CLIENTDLL, "Draw goo puddles from all goo entities in one batch per material instead of one draw per puddle." );
+
+static CGooPuddleRenderer s_GooPuddleRenderer;
+
+CGooPuddleRenderer *GooPuddleRenderer()
+{
+	return &s_GooPuddleRenderer;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CGooPuddleRenderer::Batch_t::RemoveAll()
+{
+	m_pProxyData = NULL;
+
+	m_flPosX.RemoveAll();
+	m_flPosY.RemoveAll();
+	m_flPosZ.RemoveAll();
+	m_flNormalX.RemoveAll();
+	m_flNormalY.RemoveAll();
+	m_flNormalZ.RemoveAll();
+	m_flHalfSize.RemoveAll();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+CGooPuddleRenderer::CGooPuddleRenderer()
+{
+	m_nActiveBatches = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Batches are kept (and their memory with them) for the next view
+//-----------------------------------------------------------------------------
+void CGooPuddleRenderer::ResetRenderCache()
+{
+	for ( int i = 0; i < m_nActiveBatches; i++ )
+	{
+		m_Batches[i]->RemoveAll();
+	}
+	m_nActiveBatches = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CGooPuddleRenderer::AddToRenderCache( IMaterial *pMaterial, void *pProxyData, int nProxyKey, const Vector &vecPos, const Vector &vecNormal, float flSize )
+{
+	if ( !pMaterial )
+		return;
+
+	// There are only ever a couple of goo materials and teams, so a linear
+	// search is fine
+	Batch_t *pBatch = NULL;
+	for ( int i = 0; i < m_nActiveBatches; i++ )
+	{
+		if ( m_Batches[i]->m_pMaterial == pMaterial && m_Batches[i]->m_nProxyKey == nProxyKey )
+		{
+			pBatch = m_Batches[i];
+			break;
+		}
+	}
+
+	if ( !pBatch )
+	{
+		if ( m_nActiveBatches == m_Batches.Count() )
+		{
+			m_Batches.AddToTail( new Batch_t );
+		}
+		pBatch = m_Batches[ m_nActiveBatches++ ];
+		pBatch->m_pMaterial = pMaterial;
+		pBatch->m_pProxyData = pProxyData;
+		pBatch->m_nProxyKey = nProxyKey;
+	}
+
+	pBatch->m_flPosX.AddToTail( vecPos.x );
+	pBatch->m_flPosY.AddToTail( vecPos.y );
+	pBatch->m_flPosZ.AddToTail( vecPos.z );
+	pBatch->m_flNormalX.AddToTail( vecNormal.x );
+	pBatch->m_flNormalY.AddToTail( vecNormal.y );
+	pBatch->m_flNormalZ.AddToTail( vecNormal.z );
+	pBatch->m_flHalfSize.AddToTail( flSize * 0.5f );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CGooPuddleRenderer::DrawRenderCache( bool bShadowDepth )
+{
+	if ( !m_nActiveBatches )
+		return;
+
+	if ( !bShadowDepth )
+	{
+		VPROF_BUDGET( "CGooPuddleRenderer::DrawRenderCache", VPROF_BUDGETGROUP_PARTICLE_RENDERING );
+
+		const Vector &vecViewOrigin = CurrentViewOrigin();
+		for ( int i = 0; i < m_nActiveBatches; i++ )
+		{
+			const Batch_t &batch = *m_Batches[i];
+			if ( !batch.Count() )
+				continue;
+
+			ComputeAxes( batch, vecViewOrigin );
+			DrawBatch( batch );
+		}
+	}
+
+	ResetRenderCache();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Works out the quad axes for every cell in the batch.
+//
+//			Each cell faces along its normal, flipped towards the viewer, with
+//			right = ( 0, 1, 0 ) x fwd and up = fwd x right.  Written out with
+//			the constant folded in:
+//
+//				right = (  fz, 0, -fx )
+//				up    = ( -fx * fy, fx * fx + fz * fz, -fy * fz )
+//
+//			Both are scaled by the cell's half size.
+//-----------------------------------------------------------------------------
+void CGooPuddleRenderer::ComputeAxes( const Batch_t &batch, const Vector &vecViewOrigin )
+{
+	const int nCells = batch.Count();
+	m_flRightX.SetCount( nCells );
+	m_flRightZ.SetCount( nCells );
+	m_flUpX.SetCount( nCells );
+	m_flUpY.SetCount( nCells );
+	m_flUpZ.SetCount( nCells );
+
+	const float *pPX = batch.m_flPosX.Base();
+	const float *pPY = batch.m_flPosY.Base();
+	const float *pPZ = batch.m_flPosZ.Base();
+	const float *pNX = batch.m_flNormalX.Base();
+	const float *pNY = batch.m_flNormalY.Base();
+	const float *pNZ = batch.m_flNormalZ.Base();
+	const float *pHalf = batch.m_flHalfSize.Base();
+
+	float *pRX = m_flRightX.Base();
+	float *pRZ = m_flRightZ.Base();
+	float *pUX = m_flUpX.Base();
+	float *pUY = m_flUpY.Base();
+	float *pUZ = m_flUpZ.Base();
+
+	const fltx4 viewX = ReplicateX4( vecViewOrigin.x );
+	const fltx4 viewY = ReplicateX4( vecViewOrigin.y );
+	const fltx4 viewZ = ReplicateX4( vecViewOrigin.z );
+
+	int i = 0;
+	for ( ; i + 4 <= nCells; i += 4 )
+	{
+		fltx4 fx = LoadUnalignedSIMD( pNX + i );
+		fltx4 fy = LoadUnalignedSIMD( pNY + i );
+		fltx4 fz = LoadUnalignedSIMD( pNZ + i );
+
+		// Only the sign matters, so neither vector needs normalizing
+		fltx4 dx = SubSIMD( viewX, LoadUnalignedSIMD( pPX + i ) );
+		fltx4 dy = SubSIMD( viewY, LoadUnalignedSIMD( pPY + i ) );
+		fltx4 dz = SubSIMD( viewZ, LoadUnalignedSIMD( pPZ + i ) );
+		fltx4 dot = MaddSIMD( fz, dz, MaddSIMD( fy, dy, MulSIMD( fx, dx ) ) );
+
+		fltx4 behind = CmpLtSIMD( dot, Four_Zeros );
+		fx = MaskedAssign( behind, NegSIMD( fx ), fx );
+		fy = MaskedAssign( behind, NegSIMD( fy ), fy );
+		fz = MaskedAssign( behind, NegSIMD( fz ), fz );
+
+		fltx4 half = LoadUnalignedSIMD( pHalf + i );
+		fltx4 fxHalf = MulSIMD( fx, half );
+		fltx4 fzHalf = MulSIMD( fz, half );
+
+		StoreUnalignedSIMD( pRX + i, fzHalf );
+		StoreUnalignedSIMD( pRZ + i, NegSIMD( fxHalf ) );
+		StoreUnalignedSIMD( pUX + i, NegSIMD( MulSIMD( fxHalf, fy ) ) );
+		StoreUnalignedSIMD( pUY + i, MulSIMD( MaddSIMD( fz, fz, MulSIMD( fx, fx ) ), half ) );
+		StoreUnalignedSIMD( pUZ + i, NegSIMD( MulSIMD( fzHalf, fy ) ) );
+	}
+	for ( ; i < nCells; ++i )
+	{
+		float fx = pNX[i];
+		float fy = pNY[i];
+		float fz = pNZ[i];
+
+		float dot = fx * ( vecViewOrigin.x - pPX[i] ) + fy * ( vecViewOrigin.y - pPY[i] ) + fz * ( vecViewOrigin.z - pPZ[i] );
+		if ( dot < 0.0f )
+		{
+			fx = -fx;
+			fy = -fy;
+			fz = -fz;
+		}
+
+		float half = pHalf[i];
+		pRX[i] = fz * half;
+		pRZ[i] = -fx * half;
+		pUX[i] = -fx * fy * half;
+		pUY[i] = ( fx * fx + fz * fz ) * half;
+		pUZ[i] = -fy * fz * half;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Emits the batch as quads, splitting it only when it won't fit in
+//			one dynamic mesh
+//-----------------------------------------------------------------------------
+void CGooPuddleRenderer::DrawBatch( const Batch_t &batch )
+{
+	CMatRenderContextPtr pRenderContext( materials );
+	pRenderContext->Bind( batch.m_pMaterial, batch.m_pProxyData );
+
+	int nMaxQuads = MIN( pRenderContext->GetMaxVerticesToRender( batch.m_pMaterial ) / 4, pRenderContext->GetMaxIndicesToRender() / 6 );
+	if ( nMaxQuads <= 0 )
+		return;
+
+	const float *pPX = batch.m_flPosX.Base();
+	const float *pPY = batch.m_flPosY.Base();
+	const float *pPZ = batch.m_flPosZ.Base();
+	const float *pRX = m_flRightX.Base();
+	const float *pRZ = m_flRightZ.Base();
+	const float *pUX = m_flUpX.Base();
+	const float *pUY = m_flUpY.Base();
+	const float *pUZ = m_flUpZ.Base();
+
+	const unsigned char pColor[4] = { 255, 255, 255, 255 };
+
+	CMeshBuilder meshBuilder;
+	const int nCells = batch.Count();
+	for ( int nFirst = 0; nFirst < nCells; nFirst += nMaxQuads )
+	{
+		int nQuads = MIN( nCells - nFirst, nMaxQuads );
+
+		IMesh *pMesh = pRenderContext->GetDynamicMesh();
+		meshBuilder.Begin( pMesh, MATERIAL_QUADS, nQuads );
+
+		for ( int i = nFirst; i < nFirst + nQuads; i++ )
+		{
+			// Same corner order and texture coordinates as the old per puddle quads
+			meshBuilder.Position3f( pPX[i] - pUX[i] - pRX[i], pPY[i] - pUY[i], pPZ[i] - pUZ[i] - pRZ[i] );
+			meshBuilder.Color4ubv( pColor );
+			meshBuilder.TexCoord2f( 0, 0, 1 );
+			meshBuilder.AdvanceVertex();
+
+			meshBuilder.Position3f( pPX[i] + pUX[i] - pRX[i], pPY[i] + pUY[i], pPZ[i] + pUZ[i] - pRZ[i] );
+			meshBuilder.Color4ubv( pColor );
+			meshBuilder.TexCoord2f( 0, 0, 0 );
+			meshBuilder.AdvanceVertex();
+
+			meshBuilder.Position3f( pPX[i] + pUX[i] + pRX[i], pPY[i] + pUY[i], pPZ[i] + pUZ[i] + pRZ[i] );
+			meshBuilder.Color4ubv( pColor );
+			meshBuilder.TexCoord2f( 0, 1, 0 );
+			meshBuilder.AdvanceVertex();
+
+			meshBuilder.Position3f( pPX[i] - pUX[i] + pRX[i], pPY[i] - pUY[i], pPZ[i] - pUZ[i] + pRZ[i] );
+			meshBuilder.Color4ubv( pColor );
+			meshBuilder.TexCoord2f( 0, 1, 1 );
+			meshBuilder.AdvanceVertex();
+		}
+
+		meshBuilder.End();
+		pMesh->Draw();
+	}
+}
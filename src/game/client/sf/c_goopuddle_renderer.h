@@ -0,0 +1,84 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Batches goo puddle cells from every C_TFPropGooPuddle into one
+//			dynamic mesh per goo material.
+//
+//			Puddles used to bind their material and draw one quad per live
+//			cell, so a few Tox Gun users meant hundreds of tiny draw calls.
+//			Now C_TFPropGooPuddle::DrawModel only adds its cells here, and the
+//			view renderer flushes the whole batch after the opaque renderables,
+//			the same way it handles ropes and particles.  Translucent puddles
+//			flush their own cells straight away so they keep their place in
+//			the sorted translucent list.
+//
+//=============================================================================//
+#ifndef C_GOOPUDDLE_RENDERER_H
+#define C_GOOPUDDLE_RENDERER_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "utlvector.h"
+
+class IMaterial;
+
+//-----------------------------------------------------------------------------
+// Purpose: Collects the visible puddle cells for the current view
+//-----------------------------------------------------------------------------
+class CGooPuddleRenderer
+{
+public:
+	CGooPuddleRenderer();
+
+	// Drops everything queued for the previous view
+	void ResetRenderCache();
+
+	// Queues one cell.  Cells are batched by material and nProxyKey, which
+	// must be equal for any two proxy datas the material's proxies treat the
+	// same (the team, for TeamColor).  pProxyData is passed to the proxies
+	// when the batch is bound, taken from the first cell added to the batch.
+	void AddToRenderCache( IMaterial *pMaterial, void *pProxyData, int nProxyKey, const Vector &vecPos, const Vector &vecNormal, float flSize );
+
+	// Draws and drops every queued cell, one draw per material unless a
+	// batch is bigger than the dynamic mesh allows.  Puddles lie flat on
+	// the ground, so they're left out of shadow depth views.
+	void DrawRenderCache( bool bShadowDepth );
+
+private:
+	// One batch of cells sharing a material, stored as columns so the
+	// orientation pass can work on four cells at a time
+	struct Batch_t
+	{
+		IMaterial			*m_pMaterial;
+		void				*m_pProxyData;
+		int					m_nProxyKey;
+
+		CUtlVector< float >	m_flPosX;
+		CUtlVector< float >	m_flPosY;
+		CUtlVector< float >	m_flPosZ;
+		CUtlVector< float >	m_flNormalX;
+		CUtlVector< float >	m_flNormalY;
+		CUtlVector< float >	m_flNormalZ;
+		CUtlVector< float >	m_flHalfSize;
+
+		int Count() const { return m_flHalfSize.Count(); }
+		void RemoveAll();
+	};
+
+	void ComputeAxes( const Batch_t &batch, const Vector &vecViewOrigin );
+	void DrawBatch( const Batch_t &batch );
+
+	CUtlVector< Batch_t * > m_Batches;
+	int m_nActiveBatches;
+
+	// Scaled right and up axes for every cell of the batch being drawn
+	CUtlVector< float > m_flRightX;
+	CUtlVector< float > m_flRightZ;
+	CUtlVector< float > m_flUpX;
+	CUtlVector< float > m_flUpY;
+	CUtlVector< float > m_flUpZ;
+};
+
+CGooPuddleRenderer *GooPuddleRenderer();
+
+#endif // C_GOOPUDDLE_RENDERER_H
@@ -8,13 +8,120 @@
 #include "tf_gamerules.h"
 #include "c_tf_player.h"
 #include "functionproxy.h"
+#include "GameEventListener.h"
+#include "igamesystem.h"
+#include "tier0/vprof.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
 class IMaterialVar;
 
-ConVar sf_menu_rgb_color("sf_menu_rgb_color", "76 122 75", FCVAR_CLIENTDLL, "Sets the rgb colour for the menu RGB system");
+#define VPROF_BUDGETGROUP_TEAMCOLOR_PROXY	_T("Team Color Proxy")
+
+static void MenuRGBColorChangeCallback(IConVar *var, const char *pOldValue, float flOldValue);
+
+ConVar sf_menu_rgb_color("sf_menu_rgb_color", "76 122 75", FCVAR_CLIENTDLL, "Sets the rgb colour for the menu RGB system", MenuRGBColorChangeCallback);
+
+//-----------------------------------------------------------------------------
+// Purpose: The colour every team resolves to, already scaled for the proxy
+//			result.  Rebuilt only when sf_menu_rgb_color or the game rules
+//			colours change, so a bind is a table lookup.
+//-----------------------------------------------------------------------------
+class CTeamColorPalette : public CAutoGameSystem, public CGameEventListener
+{
+public:
+	CTeamColorPalette() : CAutoGameSystem("CTeamColorPalette")
+	{
+		m_bDirty = true;
+		m_pRules = NULL;
+	}
+
+	virtual bool Init()
+	{
+		ListenForGameEvent("colors_updated");
+		return true;
+	}
+
+	virtual void LevelInitPostEntity()
+	{
+		m_bDirty = true;
+	}
+
+	virtual void FireGameEvent(IGameEvent *event)
+	{
+		m_bDirty = true;
+	}
+
+	void MarkDirty() { m_bDirty = true; }
+
+	const Vector &GetColor(int iTeamNum)
+	{
+		// The rules entity is recreated on every map, so check it hasn't changed under us
+		if (m_bDirty || m_pRules != TFGameRules())
+		{
+			Rebuild();
+		}
+
+		if (iTeamNum < 0 || iTeamNum >= TF_TEAM_COUNT)
+			return m_vecMenuColor;
+
+		return m_vecColors[iTeamNum];
+	}
+
+private:
+	void Rebuild()
+	{
+		m_bDirty = false;
+		m_pRules = TFGameRules();
+
+		int r, g, b;
+		r = g = b = 0;
+		if (sscanf(sf_menu_rgb_color.GetString(), "%i %i %i", &r, &g, &b) == 3)
+			m_vecMenuColor.Init(r / 255.0f, g / 255.0f, b / 255.0f);
+		else
+			m_vecMenuColor.Init(0.0f, 0.0f, 0.0f);
+
+		for (int i = 0; i < TF_TEAM_COUNT; i++)
+		{
+			m_vecColors[i] = m_vecMenuColor;
+		}
+
+		// Without rules there's no team colour to show
+		m_vecColors[TF_TEAM_RED].Init(0.0f, 0.0f, 0.0f);
+		m_vecColors[TF_TEAM_BLUE].Init(0.0f, 0.0f, 0.0f);
+		if (m_pRules)
+		{
+			m_vecColors[TF_TEAM_RED] = m_pRules->GetRedTeamColor() / 255.0f;
+			m_vecColors[TF_TEAM_BLUE] = m_pRules->GetBlueTeamColor() / 255.0f;
+		}
+	}
+
+	bool m_bDirty;
+	C_TFGameRules *m_pRules;
+	Vector m_vecMenuColor;
+	Vector m_vecColors[TF_TEAM_COUNT];
+};
+
+static CTeamColorPalette s_TeamColorPalette;
+
+static void MenuRGBColorChangeCallback(IConVar *var, const char *pOldValue, float flOldValue)
+{
+	s_TeamColorPalette.MarkDirty();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Display team per networked entity, worked out once per frame.
+//			Most entities bind several team coloured materials every frame.
+//-----------------------------------------------------------------------------
+struct TeamColorDisplayTeam_t
+{
+	C_BaseEntity *m_pEntity;
+	int m_nFrame;
+	int m_iTeamNum;
+};
+
+static TeamColorDisplayTeam_t s_DisplayTeamCache[MAX_EDICTS];
 
 //Okay, so basically vgui elements are not passed to proxy OnBind functions
 //so I'm forced to use a boolean to indicate that we are rendering a UI element
@@ -79,6 +186,21 @@ int CEntityTeamColorProxy::GetDisplayTeamNum(void* pC_BaseEntity)
 
 	C_BaseEntity* pEnt = BindArgToEntity(pC_BaseEntity);
 
+	// Client-only entities have no index and skip the cache
+	TeamColorDisplayTeam_t *pCached = NULL;
+	if (pEnt)
+	{
+		int iEntIndex = pEnt->entindex();
+		if (iEntIndex >= 0 && iEntIndex < MAX_EDICTS)
+		{
+			pCached = &s_DisplayTeamCache[iEntIndex];
+			if (pCached->m_pEntity == pEnt && pCached->m_nFrame == gpGlobals->framecount)
+				return pCached->m_iTeamNum;
+
+			VPROF_INCREMENT_COUNTER("TeamColor display team misses", 1);
+		}
+	}
+
 	if (pEnt)
 	{
 		C_TFPlayer* pPlayer = ToTFPlayer(pEnt);
@@ -92,6 +214,12 @@ int CEntityTeamColorProxy::GetDisplayTeamNum(void* pC_BaseEntity)
 			if (!pOwner)
 			{
 				Warning("Team color proxy error: No weapon owner for weapon %s\n", pWeapon->GetName());
+				if (pCached)
+				{
+					pCached->m_pEntity = pEnt;
+					pCached->m_nFrame = gpGlobals->framecount;
+					pCached->m_iTeamNum = iTeamNum;
+				}
 				return iTeamNum;
 			}
 			pPlayer = pOwner;
@@ -123,11 +251,21 @@ int CEntityTeamColorProxy::GetDisplayTeamNum(void* pC_BaseEntity)
 		
 	}
 
+	if (pCached)
+	{
+		pCached->m_pEntity = pEnt;
+		pCached->m_nFrame = gpGlobals->framecount;
+		pCached->m_iTeamNum = iTeamNum;
+	}
+
 	return iTeamNum;
 }
 
 void CEntityTeamColorProxy::OnBind(void* pC_BaseEntity)
 {
+	VPROF_BUDGET("CEntityTeamColorProxy::OnBind", VPROF_BUDGETGROUP_TEAMCOLOR_PROXY);
+	VPROF_INCREMENT_COUNTER("TeamColor proxy binds", 1);
+
 	int iTeamNum = GetDisplayTeamNum(pC_BaseEntity);
 
 	if (iTeamNum == -1)
@@ -136,39 +274,8 @@ void CEntityTeamColorProxy::OnBind(void* pC_BaseEntity)
 		return;
 	}
 
-	Vector color;
-
-	switch (iTeamNum)
-	{
-	case TF_TEAM_RED:
-			if (!TFGameRules()) break;
-		color = TFGameRules()->GetRedTeamColor();
-		break;
-
-	case TF_TEAM_BLUE:
-			if (!TFGameRules()) break;
-		color = TFGameRules()->GetBlueTeamColor();
-		break;
-
-	case TEAM_UNASSIGNED:
-		default:
-		int r, g, b;
-		r = g = b = 0;
-
-		int scanned;
-		scanned = sscanf(sf_menu_rgb_color.GetString(), "%i %i %i", &r, &g, &b);
-
-		if (scanned != 3)
-		{
-				color = Vector(0, 0, 0);
-			break;
-		}
-
-			color = Vector(r, g, b);
-		break;
-	}
-
-	m_pResult->SetVecValue(color.x / 255.0f, color.y / 255.0f, color.z / 255.0f);
+	const Vector &color = s_TeamColorPalette.GetColor(iTeamNum);
+	m_pResult->SetVecValue(color.x, color.y, color.z);
 
 	if (ToolsEnabled())
 	{
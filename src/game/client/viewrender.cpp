@@ -56,6 +56,9 @@
 #ifdef TF_CLIENT_DLL
 #include "tf/c_tf_player.h"
 #endif
+#ifdef SF_DLL
+#include "sf/c_goopuddle_renderer.h"
+#endif
 
 #ifdef PORTAL
 //#include "C_Portal_Player.h"
@@ -4073,6 +4076,9 @@ void CRendering3dView::DrawOpaqueRenderables( ERenderDepthMode DepthMode )
 	//
 	RopeManager()->ResetRenderCache();
 	g_pParticleSystemMgr->ResetRenderCache();
+#ifdef SF_DLL
+	GooPuddleRenderer()->ResetRenderCache();
+#endif
 
 	//bool const bDrawopaquestaticpropslast = r_drawopaquestaticpropslast.GetBool();
 
@@ -4128,6 +4134,9 @@ void CRendering3dView::DrawOpaqueRenderables( ERenderDepthMode DepthMode )
 			//
 			RopeManager()->DrawRenderCache( bShadowDepth );
 			g_pParticleSystemMgr->DrawRenderCache( bShadowDepth );
+#ifdef SF_DLL
+			GooPuddleRenderer()->DrawRenderCache( bShadowDepth );
+#endif
 
 			return;
 		}
@@ -4269,6 +4278,9 @@ void CRendering3dView::DrawOpaqueRenderables( ERenderDepthMode DepthMode )
 	//
 	RopeManager()->DrawRenderCache( DepthMode );
 	g_pParticleSystemMgr->DrawRenderCache( DepthMode );
+#ifdef SF_DLL
+	GooPuddleRenderer()->DrawRenderCache( DepthMode != DEPTH_MODE_NORMAL );
+#endif
 }
 
 
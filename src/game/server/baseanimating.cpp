@@ -328,6 +328,7 @@ CBaseAnimating::CBaseAnimating()
 	m_nNewSequenceParity = 0;
 	m_nResetEventsParity = 0;
 	m_boneCacheHandle = 0;
+	m_hitboxBoneCacheHandle = 0;
 	m_pStudioHdr = NULL;
 	m_fadeMinDist = 0;
 	m_fadeMaxDist = 0;
@@ -338,6 +339,7 @@ CBaseAnimating::CBaseAnimating()
 CBaseAnimating::~CBaseAnimating()
 {
 	Studio_DestroyBoneCache( m_boneCacheHandle );
+	Studio_DestroyBoneCache( m_hitboxBoneCacheHandle );
 	delete m_pIk;
 	UnlockStudioHdr();
 	delete m_pStudioHdr;
@@ -2678,6 +2680,12 @@ void CBaseAnimating::SetModel( const char *szModelName )
 		m_boneCacheHandle = 0;
 	}
 
+	if ( m_hitboxBoneCacheHandle )
+	{
+		Studio_DestroyBoneCache( m_hitboxBoneCacheHandle );
+		m_hitboxBoneCacheHandle = 0;
+	}
+
 	UTIL_SetModel( this, szModelName );
 
 	InitBoneControllers( );
@@ -2803,6 +2811,302 @@ CBoneCache *CBaseAnimating::GetBoneCache( void )
 void CBaseAnimating::InvalidateBoneCache( void )
 {
 	Studio_InvalidateBoneCache( m_boneCacheHandle );
+	Studio_InvalidateBoneCache( m_hitboxBoneCacheHandle );
+}
+
+
+//-----------------------------------------------------------------------------
+// Hitbox-only bone setup.
+//
+// Hit tests (bullets, melee swings, anything else that ends up in
+// TestHitboxes) only read the bones that hitboxes are attached to.  The full
+// bone cache also sets up attachment and bone merge bones, which on TF
+// players is a large part of the skeleton.  When the full cache is out of
+// date, hit tests set up just the hitbox bones and their parents for the
+// current hitbox set and keep them in a second, hitbox-only cache.
+//-----------------------------------------------------------------------------
+ConVar sv_hitbox_bone_setup( "sv_hitbox_bone_setup", "1", FCVAR_NONE, "Hit tests set up only the bones that place the current hitbox set when the full bone cache is out of date." );
+
+struct HitboxBoneChain_t
+{
+	CUtlVector< short > m_Bones;	// Hitbox bones and their parents, parents first
+	int m_nFullBones;				// Bones a full GetBoneCache() setup builds
+	bool m_bUsable;					// False if a bone in the chain isn't flagged BONE_USED_BY_HITBOX
+};
+
+class CHitboxBoneChainCache : public CAutoGameSystem
+{
+public:
+	CHitboxBoneChainCache() : CAutoGameSystem( "CHitboxBoneChainCache" ), m_Models( DefLessFunc( const studiohdr_t * ) )
+	{
+		ResetStats();
+	}
+
+	virtual void LevelShutdownPostEntity()
+	{
+		AUTO_LOCK( m_Mutex );
+		m_Models.PurgeAndDeleteElements();
+	}
+
+	// NULL if hit tests on this model need the full bone setup
+	const HitboxBoneChain_t *GetChain( const CStudioHdr *pStudioHdr, int nHitboxSet, int nFullBoneMask );
+
+	void RecordSetup( const HitboxBoneChain_t *pChain )
+	{
+		AUTO_LOCK( m_Mutex );
+		m_nSetups++;
+		m_nBonesBuilt += pChain->m_Bones.Count();
+		m_nBonesSaved += pChain->m_nFullBones - pChain->m_Bones.Count();
+	}
+
+	void ResetStats()
+	{
+		AUTO_LOCK( m_Mutex );
+		m_nSetups = 0;
+		m_nBonesBuilt = 0;
+		m_nBonesSaved = 0;
+	}
+
+	void Report();
+
+private:
+	struct ModelChains_t
+	{
+		CUtlString m_Name;
+		int m_nChecksum;
+		int m_nBoneCount;
+		CUtlVector< HitboxBoneChain_t > m_Sets;
+	};
+
+	CUtlMap< const studiohdr_t *, ModelChains_t * > m_Models;
+	CThreadFastMutex m_Mutex;
+
+	int64 m_nSetups;
+	int64 m_nBonesBuilt;
+	int64 m_nBonesSaved;
+};
+
+static CHitboxBoneChainCache g_HitboxBoneChainCache;
+
+//-----------------------------------------------------------------------------
+// Purpose: Works the chains out the first time a model is hit tested
+//-----------------------------------------------------------------------------
+const HitboxBoneChain_t *CHitboxBoneChainCache::GetChain( const CStudioHdr *pStudioHdr, int nHitboxSet, int nFullBoneMask )
+{
+	const studiohdr_t *pRenderHdr = pStudioHdr->GetRenderHdr();
+	if ( !pRenderHdr || nHitboxSet < 0 || nHitboxSet >= pStudioHdr->numhitboxsets() )
+		return NULL;
+
+	AUTO_LOCK( m_Mutex );
+
+	ModelChains_t *pModel = NULL;
+	unsigned short nIndex = m_Models.Find( pRenderHdr );
+	if ( nIndex != m_Models.InvalidIndex() )
+	{
+		pModel = m_Models[nIndex];
+
+		// Same address, different model
+		if ( pModel->m_nChecksum != pRenderHdr->checksum || pModel->m_nBoneCount != pStudioHdr->numbones() )
+		{
+			delete pModel;
+			m_Models.RemoveAt( nIndex );
+			pModel = NULL;
+		}
+	}
+
+	if ( !pModel )
+	{
+		pModel = new ModelChains_t;
+		pModel->m_Name = pStudioHdr->pszName();
+		pModel->m_nChecksum = pRenderHdr->checksum;
+		pModel->m_nBoneCount = pStudioHdr->numbones();
+
+		int nFullBones = 0;
+		for ( int i = 0; i < pStudioHdr->numbones(); i++ )
+		{
+			if ( pStudioHdr->boneFlags( i ) & nFullBoneMask )
+			{
+				nFullBones++;
+			}
+		}
+
+		pModel->m_Sets.SetCount( pStudioHdr->numhitboxsets() );
+		for ( int nSet = 0; nSet < pModel->m_Sets.Count(); nSet++ )
+		{
+			HitboxBoneChain_t &chain = pModel->m_Sets[nSet];
+			chain.m_nFullBones = nFullBones;
+			chain.m_bUsable = true;
+
+			CBitVec< MAXSTUDIOBONES > used;
+			used.ClearAll();
+
+			mstudiohitboxset_t *pSet = pStudioHdr->pHitboxSet( nSet );
+			for ( int nBox = 0; nBox < pSet->numhitboxes; nBox++ )
+			{
+				for ( int iBone = pSet->pHitbox( nBox )->bone; iBone != -1 && !used.IsBitSet( iBone ); iBone = pStudioHdr->boneParent( iBone ) )
+				{
+					used.Set( iBone );
+				}
+			}
+
+			// Bones are stored parents first, so ascending order is a valid build order
+			for ( int i = 0; i < pStudioHdr->numbones(); i++ )
+			{
+				if ( !used.IsBitSet( i ) )
+					continue;
+
+				chain.m_Bones.AddToTail( i );
+
+				// The pose is evaluated with the hitbox mask only
+				if ( !( pStudioHdr->boneFlags( i ) & BONE_USED_BY_HITBOX ) )
+				{
+					chain.m_bUsable = false;
+				}
+			}
+		}
+
+		m_Models.Insert( pRenderHdr, pModel );
+	}
+
+	const HitboxBoneChain_t &chain = pModel->m_Sets[nHitboxSet];
+	return chain.m_bUsable ? &chain : NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CHitboxBoneChainCache::Report()
+{
+	AUTO_LOCK( m_Mutex );
+
+	Msg( "%lld hitbox-only bone setups, %lld bones built, %lld bones skipped", m_nSetups, m_nBonesBuilt, m_nBonesSaved );
+	if ( m_nSetups )
+	{
+		Msg( " (%.1f per setup)", (double)m_nBonesSaved / (double)m_nSetups );
+	}
+	Msg( "\n" );
+
+	FOR_EACH_MAP_FAST( m_Models, i )
+	{
+		const ModelChains_t *pModel = m_Models[i];
+		for ( int nSet = 0; nSet < pModel->m_Sets.Count(); nSet++ )
+		{
+			const HitboxBoneChain_t &chain = pModel->m_Sets[nSet];
+			Msg( "  %s set %d: %d of %d bones%s\n", pModel->m_Name.Get(), nSet, chain.m_Bones.Count(), chain.m_nFullBones, chain.m_bUsable ? "" : " (uses full setup)" );
+		}
+	}
+}
+
+CON_COMMAND( sv_hitbox_bone_setup_report, "Show how many bones hitbox-only bone setup skipped, and the bone chain for each hit tested model. Pass 'reset' to clear the counts." )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	g_HitboxBoneChainCache.Report();
+
+	if ( args.ArgC() > 1 && !V_stricmp( args[1], "reset" ) )
+	{
+		g_HitboxBoneChainCache.ResetStats();
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Bone cache for hit tests.  Uses the full cache when it's up to
+//			date, otherwise sets up only the current hitbox set's bones.
+//			Entities that override SetupBones opt out through
+//			CanUseHitboxBoneCache() and always get the full cache.
+//-----------------------------------------------------------------------------
+CBoneCache *CBaseAnimating::GetHitboxBoneCache( void )
+{
+	if ( !sv_hitbox_bone_setup.GetBool() || !CanUseHitboxBoneCache() )
+		return GetBoneCache();
+
+	CStudioHdr *pStudioHdr = GetModelPtr( );
+	Assert(pStudioHdr);
+
+	// Either cache will do if it's valid.  Take the newer one.
+	CBoneCache *pFullCache = Studio_GetBoneCache( m_boneCacheHandle );
+	if ( pFullCache && ( !pFullCache->IsValid( gpGlobals->curtime ) || !( pFullCache->m_boneMask & BONE_USED_BY_HITBOX ) || pFullCache->m_timeValid > gpGlobals->curtime ) )
+	{
+		pFullCache = NULL;
+	}
+
+	CBoneCache *pcache = Studio_GetBoneCache( m_hitboxBoneCacheHandle );
+	if ( pcache && pcache->IsValid( gpGlobals->curtime ) && pcache->m_timeValid <= gpGlobals->curtime )
+	{
+		if ( pFullCache && pFullCache->m_timeValid >= pcache->m_timeValid )
+			return pFullCache;
+		return pcache;
+	}
+
+	if ( pFullCache )
+		return pFullCache;
+
+	// IK, bone merging and skipped animation all go through SetupBones
+	int boneMask = BONE_USED_BY_HITBOX | BONE_USED_BY_ATTACHMENT;
+#if defined( TF_DLL )
+	boneMask |= BONE_USED_BY_BONE_MERGE;
+#endif
+	const HitboxBoneChain_t *pChain = g_HitboxBoneChainCache.GetChain( pStudioHdr, m_nHitboxSet, boneMask );
+	if ( !pChain || m_pIk || CanSkipAnimation() || dynamic_cast< CBaseAnimating* >( GetMoveParent() ) )
+		return GetBoneCache();
+
+	matrix3x4_t bonetoworld[MAXSTUDIOBONES];
+	SetupHitboxBones( pStudioHdr, pChain->m_Bones.Base(), pChain->m_Bones.Count(), bonetoworld );
+
+	g_HitboxBoneChainCache.RecordSetup( pChain );
+	VPROF_INCREMENT_COUNTER( "Hitbox-only bone setups", 1 );
+	VPROF_INCREMENT_COUNTER( "Hitbox-only bones skipped", pChain->m_nFullBones - pChain->m_Bones.Count() );
+
+	// The cache copies every BONE_USED_BY_HITBOX bone.  The ones outside the
+	// chain belong to other hitbox sets and are never read; changing the set
+	// invalidates this cache.
+	if ( pcache )
+	{
+		pcache->UpdateBones( bonetoworld, pStudioHdr->numbones(), gpGlobals->curtime );
+	}
+	else
+	{
+		bonecacheparams_t params;
+		params.pStudioHdr = pStudioHdr;
+		params.pBoneToWorld = bonetoworld;
+		params.curtime = gpGlobals->curtime;
+		params.boneMask = BONE_USED_BY_HITBOX;
+
+		m_hitboxBoneCacheHandle = Studio_CreateBoneCache( params );
+		pcache = Studio_GetBoneCache( m_hitboxBoneCacheHandle );
+	}
+	Assert(pcache);
+	return pcache;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: SetupBones for a chain of hitbox bones, without IK or bone merging
+//-----------------------------------------------------------------------------
+void CBaseAnimating::SetupHitboxBones( CStudioHdr *pStudioHdr, const short *pBones, int nBoneCount, matrix3x4_t *pBoneToWorld )
+{
+	AUTO_LOCK( m_BoneSetupMutex );
+
+	VPROF_BUDGET( "CBaseAnimating::SetupHitboxBones", VPROF_BUDGETGROUP_SERVER_ANIM );
+
+	MDLCACHE_CRITICAL_SECTION();
+
+	Assert( !IsEFlagSet( EFL_SETTING_UP_BONES ) );
+
+	AddEFlags( EFL_SETTING_UP_BONES );
+
+	Vector pos[MAXSTUDIOBONES];
+	Quaternion q[MAXSTUDIOBONES];
+
+	// adjust hit boxes based on IK driven offset
+	Vector adjOrigin = GetAbsOrigin() + Vector( 0, 0, m_flEstIkOffset );
+
+	GetSkeleton( pStudioHdr, pos, q, BONE_USED_BY_HITBOX );
+
+	Studio_BuildMatricesForBoneList( pStudioHdr, GetAbsAngles(), adjOrigin, pos, q, pBones, nBoneCount, GetModelScale(), pBoneToWorld );
+
+	RemoveEFlags( EFL_SETTING_UP_BONES );
 }
 
 bool CBaseAnimating::TestCollision( const Ray_t &ray, unsigned int fContentsMask, trace_t& tr )
@@ -2846,7 +3150,7 @@ bool CBaseAnimating::TestHitboxes( const Ray_t &ray, unsigned int fContentsMask,
 	if ( !set || !set->numhitboxes )
 		return false;
 
-	CBoneCache *pcache = GetBoneCache( );
+	CBoneCache *pcache = GetHitboxBoneCache( );
 
 	matrix3x4_t *hitboxbones[MAXSTUDIOBONES];
 	pcache->ReadCachedBonePointers( hitboxbones, pStudioHdr->numbones() );
@@ -3099,6 +3403,12 @@ void CBaseAnimating::SetHitboxSet( int setnum )
 	}
 #endif
 
+	if ( m_nHitboxSet != setnum )
+	{
+		// The hitbox-only bones were set up for the old set
+		Studio_InvalidateBoneCache( m_hitboxBoneCacheHandle );
+	}
+
 	m_nHitboxSet = setnum;
 }
 
@@ -3109,7 +3419,7 @@ void CBaseAnimating::SetHitboxSet( int setnum )
 void CBaseAnimating::SetHitboxSetByName( const char *setname )
 {
 	AssertMsg( GetModelPtr(), "GetModelPtr NULL. %s", STRING(GetEntityName()) ? STRING(GetEntityName()) : "" );
-	m_nHitboxSet = FindHitboxSetByName( GetModelPtr(), setname );
+	SetHitboxSet( FindHitboxSetByName( GetModelPtr(), setname ) );
 }
 
 //-----------------------------------------------------------------------------
@@ -3257,7 +3567,7 @@ bool CBaseAnimating::ComputeHitboxSurroundingBox( Vector *pVecWorldMins, Vector
 	if ( !set || !set->numhitboxes )
 		return false;
 
-	CBoneCache *pCache = GetBoneCache();
+	CBoneCache *pCache = GetHitboxBoneCache();
 
 	// Compute a box in world space that surrounds this entity
 	pVecWorldMins->Init( FLT_MAX, FLT_MAX, FLT_MAX );
@@ -3297,7 +3607,7 @@ bool CBaseAnimating::ComputeEntitySpaceHitboxSurroundingBox( Vector *pVecWorldMi
 	if ( !set || !set->numhitboxes )
 		return false;
 
-	CBoneCache *pCache = GetBoneCache();
+	CBoneCache *pCache = GetHitboxBoneCache();
 	matrix3x4_t *hitboxbones[MAXSTUDIOBONES];
 	pCache->ReadCachedBonePointers( hitboxbones, pStudioHdr->numbones() );
 
@@ -138,6 +138,8 @@ public:
 
 	virtual void GetBoneTransform( int iBone, matrix3x4_t &pBoneToWorld );
 	virtual void SetupBones( matrix3x4_t *pBoneToWorld, int boneMask );
+	// Entities whose SetupBones doesn't come from the animation must return false
+	virtual bool CanUseHitboxBoneCache( void ) { return true; }
 	virtual void CalculateIKLocks( float currentTime );
 	virtual void Teleport( const Vector *newPosition, const QAngle *newAngles, const Vector *newVelocity );
 
@@ -278,6 +280,7 @@ public:
 	virtual bool TestCollision( const Ray_t &ray, unsigned int fContentsMask, trace_t& tr );
 	virtual bool TestHitboxes( const Ray_t &ray, unsigned int fContentsMask, trace_t& tr );
 	class CBoneCache *GetBoneCache( void );
+	class CBoneCache *GetHitboxBoneCache( void );	// only holds the bones that place the current hitbox set
 	void InvalidateBoneCache();
 	void InvalidateBoneCacheIfOlderThan( float deltaTime );
 	virtual int DrawDebugTextOverlays( void );
@@ -367,6 +370,7 @@ private:
 	void InputSetPlaybackRate( inputdata_t &inputdata );
 
 	bool CanSkipAnimation( void );
+	void SetupHitboxBones( CStudioHdr *pStudioHdr, const short *pBones, int nBoneCount, matrix3x4_t *pBoneToWorld );
 
 public:
 	void ScriptSetModel( const char *pszModel );
@@ -434,6 +438,7 @@ private:
 	string_t m_iszLightingOrigin;			// for reading from the file only
 
 	memhandle_t		m_boneCacheHandle;
+	memhandle_t		m_hitboxBoneCacheHandle;
 	unsigned short	m_fBoneCacheFlags;		// Used for bone cache state on model
 
 protected:
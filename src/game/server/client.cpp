@@ -28,6 +28,7 @@
 #include "engine/IEngineSound.h"
 #include <ctype.h>
 #include "tier1/strtools.h"
+#include "tier1/keyvaluesjson.h"
 #include "te_effect_dispatch.h"
 #include "globals.h"
 #include "nav_mesh.h"
@@ -467,6 +468,14 @@ CON_COMMAND_F( cast_hull, "Tests hull collision detection", FCVAR_CHEAT )
 	}
 }
 
+#ifdef _DEBUG
+CON_COMMAND( kv_json_parser_test, "Checks that the indexed and scalar JSON parsers agree on a test corpus. Differences are reported as asserts." )
+{
+	TestKeyValuesJSONParser();
+	Msg( "kv_json_parser_test: done\n" );
+}
+#endif
+
 //-----------------------------------------------------------------------------
 // Purpose: Used to find targets for ent_* commands
 //			Without a name, returns the entity under the player's crosshair.
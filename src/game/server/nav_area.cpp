@@ -35,6 +35,10 @@
 #include "team.h"
 #include "nav_entities.h"
 
+#if defined( _M_IX86 ) || defined( _M_X64 ) || defined( __i386__ ) || defined( __x86_64__ )
+#include <emmintrin.h>
+#endif
+
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
@@ -50,6 +54,10 @@ CNavArea *CNavArea::m_openListTail = NULL;
 bool CNavArea::m_isReset = false;
 uint32 CNavArea::s_nCurrVisTestCounter = 0;
 
+CUtlVector< uint32 > CNavArea::s_visSetWords;
+CUtlVector< CNavArea * > CNavArea::s_visSetAreas;
+bool CNavArea::s_isVisSetValid = false;
+
 ConVar nav_coplanar_slope_limit( "nav_coplanar_slope_limit", "0.99", FCVAR_CHEAT );
 ConVar nav_coplanar_slope_limit_displacement( "nav_coplanar_slope_limit_displacement", "0.7", FCVAR_CHEAT );
 ConVar nav_split_place_on_ground( "nav_split_place_on_ground", "0", FCVAR_CHEAT, "If true, nav areas will be placed flush with the ground when split." );
@@ -248,6 +256,14 @@ CNavArea::CNavArea( void )
 	m_funcNavCostVector.RemoveAll();
 
 	m_nVisTestCounter = (uint32)-1;
+
+	m_visSetIndex = 0;
+	m_visSetFirstWord = 0;
+	m_visSetWordCount = 0;
+	m_visSetOffset = 0;
+
+	// the new area isn't in any visibility set
+	InvalidateVisibilitySets();
 }
 
 //--------------------------------------------------------------------------------------------------------------
@@ -534,6 +550,8 @@ CNavArea::~CNavArea()
 	// spot encounters aren't owned by anything else, so free them up here
 	m_spotEncounters.PurgeAndDeleteElements();
 
+	InvalidateVisibilitySets();
+
 	// if we are resetting the system, don't bother cleaning up - all areas are being destroyed
 	if (m_isReset)
 		return;
@@ -5515,6 +5533,9 @@ const CNavArea::CAreaBindInfoArray &CNavArea::ComputeVisibilityDelta( const CNav
 void CNavArea::ResetPotentiallyVisibleAreas()
 {
 	m_potentiallyVisibleAreas.RemoveAll();
+
+	// rebuilt by CNavMesh::EndVisibilityComputations()
+	InvalidateVisibilitySets();
 }
 
 
@@ -5722,6 +5743,11 @@ bool CNavArea::IsPotentiallyVisible( const CNavArea *viewedArea ) const
 		return true;
 	}
 
+	if ( s_isVisSetValid )
+	{
+		return IsInVisSet( viewedArea, VIS_SET_POTENTIAL );
+	}
+
 	// normal visibility check
 	for ( int i=0; i<m_potentiallyVisibleAreas.Count(); ++i )
 	{
@@ -5767,6 +5793,11 @@ bool CNavArea::IsCompletelyVisible( const CNavArea *viewedArea ) const
 		return true;
 	}
 
+	if ( s_isVisSetValid )
+	{
+		return IsInVisSet( viewedArea, VIS_SET_COMPLETE );
+	}
+
 	// normal visibility check
 	for ( int i=0; i<m_potentiallyVisibleAreas.Count(); ++i )
 	{
@@ -5795,6 +5826,329 @@ bool CNavArea::IsCompletelyVisible( const CNavArea *viewedArea ) const
 }
 
 
+//--------------------------------------------------------------------------------------------------------
+// Interleave the low 16 bits of x and y
+static uint32 NavMortonKey( uint32 x, uint32 y )
+{
+	x &= 0xFFFF;
+	x = ( x | ( x << 8 ) ) & 0x00FF00FF;
+	x = ( x | ( x << 4 ) ) & 0x0F0F0F0F;
+	x = ( x | ( x << 2 ) ) & 0x33333333;
+	x = ( x | ( x << 1 ) ) & 0x55555555;
+
+	y &= 0xFFFF;
+	y = ( y | ( y << 8 ) ) & 0x00FF00FF;
+	y = ( y | ( y << 4 ) ) & 0x0F0F0F0F;
+	y = ( y | ( y << 2 ) ) & 0x33333333;
+	y = ( y | ( y << 1 ) ) & 0x55555555;
+
+	return x | ( y << 1 );
+}
+
+struct NavVisSetOrder_t
+{
+	uint32 key;
+	CNavArea *area;
+
+	static int Compare( const NavVisSetOrder_t *lhs, const NavVisSetOrder_t *rhs )
+	{
+		if ( lhs->key != rhs->key )
+			return ( lhs->key < rhs->key ) ? -1 : 1;
+
+		return ( lhs->area->GetID() < rhs->area->GetID() ) ? -1 : ( lhs->area->GetID() > rhs->area->GetID() );
+	}
+};
+
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * Build the compressed visibility set of every area from the bound visibility lists.
+ * Must be called after PostLoad() or visibility computation, once all IDs are pointers.
+ */
+void CNavArea::BuildVisibilitySets( void )
+{
+	VPROF_BUDGET( "CNavArea::BuildVisibilitySets", "NextBot" );
+
+	s_isVisSetValid = false;
+	s_visSetWords.RemoveAll();
+	s_visSetAreas.RemoveAll();
+
+	const int areaCount = TheNavAreas.Count();
+	if ( !areaCount )
+		return;
+
+	// Number areas along a Z-order curve so an area's visible neighbors get nearby indices
+	Extent extent;
+	extent.lo = extent.hi = TheNavAreas[0]->GetCenter();
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		extent.Encompass( TheNavAreas[ it ]->GetCenter() );
+	}
+
+	float scaleX = 65535.0f / MAX( 1.0f, extent.hi.x - extent.lo.x );
+	float scaleY = 65535.0f / MAX( 1.0f, extent.hi.y - extent.lo.y );
+
+	CUtlVector< NavVisSetOrder_t > order;
+	order.SetCount( areaCount );
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		const Vector &center = TheNavAreas[ it ]->GetCenter();
+		order[ it ].key = NavMortonKey( (uint32)( ( center.x - extent.lo.x ) * scaleX ), (uint32)( ( center.y - extent.lo.y ) * scaleY ) );
+		order[ it ].area = TheNavAreas[ it ];
+	}
+	order.Sort( &NavVisSetOrder_t::Compare );
+
+	s_visSetAreas.SetCount( areaCount );
+	FOR_EACH_VEC( order, oit )
+	{
+		order[ oit ].area->m_visSetIndex = oit;
+		s_visSetAreas[ oit ] = order[ oit ].area;
+	}
+
+	// scratch bitsets over the whole index space, cleared back to zero after each area
+	const int totalWords = ( areaCount + BITS_PER_INT - 1 ) >> LOG2_BITS_PER_INT;
+	CUtlVector< uint32 > potential, complete;
+	potential.SetCount( totalWords );
+	complete.SetCount( totalWords );
+	V_memset( potential.Base(), 0, totalWords * sizeof( uint32 ) );
+	V_memset( complete.Base(), 0, totalWords * sizeof( uint32 ) );
+
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		CNavArea *area = TheNavAreas[ it ];
+
+		int loWord = totalWords;
+		int hiWord = -1;
+
+		// inherited list first, so our own entries (including NOT_VISIBLE deltas) override it
+		for ( int pass = 0; pass < 2; ++pass )
+		{
+			const CAreaBindInfoArray *list = &area->m_potentiallyVisibleAreas;
+			if ( pass == 0 )
+			{
+				if ( !area->m_inheritVisibilityFrom.area )
+					continue;
+
+				list = &area->m_inheritVisibilityFrom.area->m_potentiallyVisibleAreas;
+			}
+
+			for ( int i=0; i<list->Count(); ++i )
+			{
+				const CNavArea *visArea = (*list)[i].area;
+				if ( !visArea )
+					continue;
+
+				unsigned int index = visArea->m_visSetIndex;
+				int word = index >> LOG2_BITS_PER_INT;
+				uint32 bit = 1u << ( index & ( BITS_PER_INT - 1 ) );
+				unsigned char attributes = (*list)[i].attributes;
+
+				if ( attributes == NOT_VISIBLE )
+				{
+					potential[ word ] &= ~bit;
+				}
+				else
+				{
+					potential[ word ] |= bit;
+				}
+
+				if ( attributes & COMPLETELY_VISIBLE )
+				{
+					complete[ word ] |= bit;
+				}
+				else
+				{
+					complete[ word ] &= ~bit;
+				}
+
+				loWord = MIN( loWord, word );
+				hiWord = MAX( hiWord, word );
+			}
+		}
+
+		// trim words that ended up empty
+		while ( loWord <= hiWord && !potential[ loWord ] && !complete[ loWord ] )
+		{
+			++loWord;
+		}
+		while ( hiWord >= loWord && !potential[ hiWord ] && !complete[ hiWord ] )
+		{
+			--hiWord;
+		}
+
+		area->m_visSetOffset = s_visSetWords.Count();
+
+		if ( hiWord < loWord )
+		{
+			area->m_visSetFirstWord = 0;
+			area->m_visSetWordCount = 0;
+			continue;
+		}
+
+		int wordCount = hiWord - loWord + 1;
+		area->m_visSetFirstWord = loWord;
+		area->m_visSetWordCount = wordCount;
+
+		int offset = s_visSetWords.AddMultipleToTail( 2 * wordCount );
+		V_memcpy( &s_visSetWords[ offset ], &potential[ loWord ], wordCount * sizeof( uint32 ) );
+		V_memcpy( &s_visSetWords[ offset + wordCount ], &complete[ loWord ], wordCount * sizeof( uint32 ) );
+
+		V_memset( &potential[ loWord ], 0, wordCount * sizeof( uint32 ) );
+		V_memset( &complete[ loWord ], 0, wordCount * sizeof( uint32 ) );
+	}
+
+	s_isVisSetValid = true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+void CNavArea::PurgeVisibilitySets( void )
+{
+	s_isVisSetValid = false;
+	s_visSetWords.Purge();
+	s_visSetAreas.Purge();
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * Return the index of the first non-zero word at or after 'start', or 'count' if there is none.
+ * Skips runs of empty words four at a time.
+ */
+int CNavArea::NextNonZeroVisSetWord( const uint32 *words, int start, int count )
+{
+	int w = start;
+
+#if defined( _M_IX86 ) || defined( _M_X64 ) || defined( __i386__ ) || defined( __x86_64__ )
+	const __m128i zero = _mm_setzero_si128();
+	for ( ; w + 4 <= count; w += 4 )
+	{
+		__m128i block = _mm_loadu_si128( (const __m128i *)( words + w ) );
+		if ( _mm_movemask_epi8( _mm_cmpeq_epi32( block, zero ) ) != 0xFFFF )
+			break;
+	}
+#endif
+
+	for ( ; w < count; ++w )
+	{
+		if ( words[w] )
+			return w;
+	}
+
+	return count;
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+class CCountVisibleAreas
+{
+public:
+	CCountVisibleAreas( void ) { m_count = 0; }
+
+	bool operator() ( CNavArea *area )
+	{
+		++m_count;
+		return true;
+	}
+
+	int m_count;
+};
+
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * Compare memory use and query speed of the visibility sets against the visibility lists
+ */
+void CNavArea::ReportVisibilitySets( void )
+{
+	if ( !s_isVisSetValid )
+	{
+		Msg( "Visibility sets are not built (no mesh loaded, or the mesh was edited since the last analyze)\n" );
+		return;
+	}
+
+	const int areaCount = TheNavAreas.Count();
+
+	size_t listBytes = 0;
+	int inheritingCount = 0;
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		listBytes += TheNavAreas[ it ]->m_potentiallyVisibleAreas.Count() * sizeof( AreaBindInfo );
+		if ( TheNavAreas[ it ]->m_inheritVisibilityFrom.area )
+		{
+			++inheritingCount;
+		}
+	}
+
+	size_t setBytes = s_visSetWords.Count() * sizeof( uint32 ) + s_visSetAreas.Count() * sizeof( CNavArea * );
+
+	Msg( "%d areas, %d inherit visibility\n", areaCount, inheritingCount );
+	Msg( "Visibility lists: %.2f KB\n", listBytes / 1024.0f );
+	Msg( "Visibility sets:  %.2f KB (%.1f%% of lists, %.1f words per area)\n", setBytes / 1024.0f,
+		 listBytes ? 100.0f * setBytes / listBytes : 0.0f, (float)s_visSetWords.Count() / ( 2.0f * areaCount ) );
+
+	// time the same random queries and full iterations with and without the sets
+	const int queryCount = 100000;
+	CUniformRandomStream random;
+	random.SetSeed( 1 );
+
+	CUtlVector< CNavArea * > queries;
+	queries.SetCount( 2 * queryCount );
+	for ( int i=0; i<queries.Count(); ++i )
+	{
+		queries[i] = TheNavAreas[ random.RandomInt( 0, areaCount-1 ) ];
+	}
+
+	double queryTime[2], iterateTime[2];
+	int visibleCount[2], iteratedCount[2];
+
+	for ( int useSets = 0; useSets < 2; ++useSets )
+	{
+		s_isVisSetValid = ( useSets != 0 );
+
+		double start = Plat_FloatTime();
+		visibleCount[ useSets ] = 0;
+		for ( int i=0; i<queryCount; ++i )
+		{
+			if ( queries[ 2*i ]->IsPotentiallyVisible( queries[ 2*i+1 ] ) )
+			{
+				++visibleCount[ useSets ];
+			}
+		}
+		queryTime[ useSets ] = Plat_FloatTime() - start;
+
+		start = Plat_FloatTime();
+		CCountVisibleAreas counter;
+		FOR_EACH_VEC( TheNavAreas, it )
+		{
+			TheNavAreas[ it ]->ForAllPotentiallyVisibleAreas( counter );
+		}
+		iterateTime[ useSets ] = Plat_FloatTime() - start;
+		iteratedCount[ useSets ] = counter.m_count;
+	}
+
+	s_isVisSetValid = true;
+
+	Msg( "IsPotentiallyVisible x %d: lists %.2f ms, sets %.2f ms (%d / %d visible)\n", queryCount,
+		 1000.0 * queryTime[0], 1000.0 * queryTime[1], visibleCount[0], visibleCount[1] );
+	Msg( "ForAllPotentiallyVisibleAreas over every area: lists %.2f ms, sets %.2f ms (%d / %d areas)\n",
+		 1000.0 * iterateTime[0], 1000.0 * iterateTime[1], iteratedCount[0], iteratedCount[1] );
+
+	if ( visibleCount[0] != visibleCount[1] || iteratedCount[0] != iteratedCount[1] )
+	{
+		Warning( "Visibility sets disagree with the visibility lists!\n" );
+	}
+}
+
+CON_COMMAND_F( nav_vis_set_report, "Reports memory use and query speed of the compressed nav area visibility sets against the visibility lists", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	CNavArea::ReportVisibilitySets();
+}
+
+
 //--------------------------------------------------------------------------------------------------------
 /**
  * Return true if any portion of this area is visible to anyone on the given team
@@ -14,6 +14,7 @@
 
 #include "nav_ladder.h"
 #include "tier1/memstack.h"
+#include "bitvec.h"
 
 // BOTPORT: Clean up relationship between team index and danger storage in nav areas
 enum { MAX_NAV_TEAMS = 2 };
@@ -24,6 +25,11 @@ class CFuncElevator;
 class CFuncNavPrerequisite;
 class CFuncNavCost;
 
+struct NavFlatArea_t;
+struct NavFlatHidingSpot_t;
+struct NavFlatMeshBuilder_t;
+struct NavFlatMeshView_t;
+
 class CNavVectorNoEditAllocator
 {
 public:
@@ -132,6 +138,8 @@ public:
 
 	void Save( CUtlBuffer &fileBuffer, unsigned int version ) const;
 	void Load( CUtlBuffer &fileBuffer, unsigned int version );
+	void SaveFlat( NavFlatHidingSpot_t *record ) const;			// store into the flat tables of a version 17+ nav file
+	void LoadFlat( const NavFlatHidingSpot_t &record );
 	NavErrorType PostLoad( void );
 
 	const Vector &GetPosition( void ) const		{ return m_pos; }	// get the position of the hiding spot
@@ -276,6 +284,9 @@ public:
 	virtual NavErrorType Load( CUtlBuffer &fileBuffer, unsigned int version, unsigned int subVersion );		// (EXTEND)
 	virtual NavErrorType PostLoad( void );								// (EXTEND) invoked after all areas have been loaded - for pointer binding, etc
 
+	void SaveFlat( NavFlatMeshBuilder_t *builder ) const;									// append this area's data to the flat tables of a version 17+ nav file
+	NavErrorType LoadFlat( const NavFlatMeshView_t &view, const NavFlatArea_t &record );	// read this area's data from the flat tables, before Load() reads any derived class data
+
 	virtual void SaveToSelectedSet( KeyValues *areaKey ) const;		// (EXTEND) saves attributes for the area to a KeyValues
 	virtual void RestoreFromSelectedSet( KeyValues *areaKey );		// (EXTEND) restores attributes from a KeyValues
 
@@ -533,6 +544,9 @@ public:
 	template < typename Functor >
 	bool ForAllPotentiallyVisibleAreas( Functor &func )
 	{
+		if ( s_isVisSetValid )
+			return ForAllAreasInVisSet( func, VIS_SET_POTENTIAL );
+
 		int i;
 
 		++s_nCurrVisTestCounter;
@@ -590,6 +604,9 @@ public:
 	template < typename Functor >
 	bool ForAllCompletelyVisibleAreas( Functor &func )
 	{
+		if ( s_isVisSetValid )
+			return ForAllAreasInVisSet( func, VIS_SET_COMPLETE );
+
 		int i;
 
 		++s_nCurrVisTestCounter;
@@ -639,6 +656,67 @@ public:
 		return true;
 	}
 
+	//- compressed visibility sets ---------------------------------------------------------------------
+	// After load or analysis, each area's visibility list (with its inherited list
+	// folded in) is stored as a bitset over area indices, trimmed to the span of
+	// words that have bits set.  Area indices follow a spatial order so the spans
+	// stay short.  Membership is a single bit test.  Any edit to the mesh
+	// invalidates the sets and the lists above are used until they are rebuilt.
+	static void BuildVisibilitySets( void );
+	static void InvalidateVisibilitySets( void )	{ s_isVisSetValid = false; }
+	static void PurgeVisibilitySets( void );
+	static bool HasVisibilitySets( void )			{ return s_isVisSetValid; }
+	static void ReportVisibilitySets( void );
+
+private:
+	enum VisSetType
+	{
+		VIS_SET_POTENTIAL = 0,
+		VIS_SET_COMPLETE = 1,
+	};
+
+	bool IsInVisSet( const CNavArea *area, VisSetType which ) const
+	{
+		unsigned int word = ( area->m_visSetIndex >> LOG2_BITS_PER_INT ) - m_visSetFirstWord;
+		if ( word >= m_visSetWordCount )
+			return false;
+
+		return ( s_visSetWords[ m_visSetOffset + which * m_visSetWordCount + word ] & ( 1u << ( area->m_visSetIndex & ( BITS_PER_INT - 1 ) ) ) ) != 0;
+	}
+
+	template < typename Functor >
+	bool ForAllAreasInVisSet( Functor &func, VisSetType which )
+	{
+		const uint32 *words = s_visSetWords.Base() + m_visSetOffset + which * m_visSetWordCount;
+		const int wordCount = m_visSetWordCount;
+		const int firstIndex = m_visSetFirstWord << LOG2_BITS_PER_INT;
+
+		for ( int w = NextNonZeroVisSetWord( words, 0, wordCount ); w < wordCount; w = NextNonZeroVisSetWord( words, w + 1, wordCount ) )
+		{
+			uint32 bits = words[w];
+			while ( bits )
+			{
+				int index = FirstBitInWord( bits, firstIndex + ( w << LOG2_BITS_PER_INT ) );
+				bits &= bits - 1;
+
+				if ( func( s_visSetAreas[ index ] ) == false )
+					return false;
+			}
+		}
+
+		return true;
+	}
+
+	static int NextNonZeroVisSetWord( const uint32 *words, int start, int count );	// returns count if there are none
+
+	unsigned int m_visSetIndex;									// this area's bit in other areas' visibility sets
+	unsigned int m_visSetFirstWord;								// first word of the index space our sets cover
+	unsigned int m_visSetWordCount;
+	unsigned int m_visSetOffset;								// our potential words, then our complete words, in s_visSetWords
+
+	static CUtlVector< uint32 > s_visSetWords;
+	static CUtlVector< CNavArea * > s_visSetAreas;				// index -> area
+	static bool s_isVisSetValid;
 
 private:
 	friend class CNavMesh;
@@ -44,7 +44,140 @@
 /// IMPORTANT: If this version changes, the swap function in makegamedata 
 /// must be updated to match. If not, this will break the Xbox 360.
 // TODO: Was changed from 15, update when latest 360 code is integrated (MSB 5/5/09)
-const int NavCurrentVersion = 16;
+const int NavCurrentVersion = 17;
+
+/// First version that stores areas as flat, pointer-free tables
+const int NavFlatVersion = 17;
+
+//--------------------------------------------------------------------------------------------------------------
+//
+// Flat area tables (version 17+)
+//
+// Instead of each area serializing itself field by field, the base area data is written as one
+// fixed-size record per area followed by one pool per variable-length list.  Records refer to the
+// pools by index range, never by pointer, so the whole block is used in place from the file buffer
+// and each area only needs a single pass to copy its ranges and bind IDs.
+//
+//	unsigned int			areaCount
+//	unsigned int			connectCount, hidingSpotCount, encounterCount, encounterSpotCount, ladderCount, visibleAreaCount
+//	unsigned int			derived area data size in bytes
+//	(pad to 4 bytes)
+//	NavFlatArea_t			[areaCount]
+//	unsigned int			connect area IDs [connectCount]
+//	NavFlatHidingSpot_t		[hidingSpotCount]
+//	NavFlatEncounter_t		[encounterCount]
+//	NavFlatEncounterSpot_t	[encounterSpotCount]
+//	unsigned int			ladder IDs [ladderCount]
+//	NavFlatVisibleArea_t	[visibleAreaCount]
+//	derived area data, written by CNavArea::Save() overrides for each area in order
+//
+// All values are little endian.
+//
+struct NavFlatRange_t
+{
+	unsigned int first;
+	unsigned int count;
+};
+
+struct NavFlatArea_t
+{
+	unsigned int id;
+	int attributeFlags;
+	float nwCorner[3];
+	float seCorner[3];
+	float neZ;
+	float swZ;
+	float earliestOccupyTime[ MAX_NAV_TEAMS ];
+	float lightIntensity[ NUM_CORNERS ];
+	unsigned int inheritVisibilityFrom;
+	unsigned short place;						// PlaceDirectory index
+	unsigned short pad;
+
+	NavFlatRange_t connect[ NUM_DIRECTIONS ];
+	NavFlatRange_t hidingSpots;
+	NavFlatRange_t spotEncounters;
+	NavFlatRange_t ladder[ CNavLadder::NUM_LADDER_DIRECTIONS ];
+	NavFlatRange_t potentiallyVisibleAreas;
+};
+
+struct NavFlatHidingSpot_t
+{
+	unsigned int id;
+	float pos[3];
+	unsigned char flags;
+	unsigned char pad[3];
+};
+
+struct NavFlatEncounter_t
+{
+	unsigned int fromID;
+	unsigned int toID;
+	unsigned char fromDir;
+	unsigned char toDir;
+	unsigned short pad;
+	NavFlatRange_t spots;
+};
+
+struct NavFlatEncounterSpot_t
+{
+	unsigned int id;
+	unsigned char t;							// 0..255 maps to 0..1
+	unsigned char pad[3];
+};
+
+struct NavFlatVisibleArea_t
+{
+	unsigned int id;
+	unsigned char attributes;
+	unsigned char pad[3];
+};
+
+/// Tables being built up by CNavMesh::Save()
+struct NavFlatMeshBuilder_t
+{
+	CUtlVector< NavFlatArea_t > areas;
+	CUtlVector< unsigned int > connects;
+	CUtlVector< NavFlatHidingSpot_t > hidingSpots;
+	CUtlVector< NavFlatEncounter_t > encounters;
+	CUtlVector< NavFlatEncounterSpot_t > encounterSpots;
+	CUtlVector< unsigned int > ladders;
+	CUtlVector< NavFlatVisibleArea_t > visibleAreas;
+};
+
+/// Tables pointing straight into the loaded file buffer
+struct NavFlatMeshView_t
+{
+	const NavFlatArea_t *areas;
+	const unsigned int *connects;
+	const NavFlatHidingSpot_t *hidingSpots;
+	const NavFlatEncounter_t *encounters;
+	const NavFlatEncounterSpot_t *encounterSpots;
+	const unsigned int *ladders;
+	const NavFlatVisibleArea_t *visibleAreas;
+
+	unsigned int areaCount;
+	unsigned int connectCount;
+	unsigned int hidingSpotCount;
+	unsigned int encounterCount;
+	unsigned int encounterSpotCount;
+	unsigned int ladderCount;
+	unsigned int visibleAreaCount;
+};
+
+template < typename T >
+static NavFlatRange_t AppendFlatRange( CUtlVector< T > &pool, int count )
+{
+	NavFlatRange_t range;
+	range.first = pool.Count();
+	range.count = count;
+	pool.AddMultipleToTail( count );
+	return range;
+}
+
+static bool IsValidFlatRange( const NavFlatRange_t &range, unsigned int poolCount )
+{
+	return range.first <= poolCount && range.count <= poolCount - range.first;
+}
 
 //--------------------------------------------------------------------------------------------------------------
 //
@@ -218,6 +351,12 @@ char *GetBspFilename( const char *navFilename )
  */
 void CNavArea::Save( CUtlBuffer &fileBuffer, unsigned int version ) const
 {
+	if ( version >= NavFlatVersion )
+	{
+		// base data goes into the flat tables, see SaveFlat()
+		return;
+	}
+
 	// save ID
 	fileBuffer.PutUnsignedInt( m_id );
 
@@ -397,6 +536,12 @@ void CNavArea::Save( CUtlBuffer &fileBuffer, unsigned int version ) const
  */
 NavErrorType CNavArea::Load( CUtlBuffer &fileBuffer, unsigned int version, unsigned int subVersion )
 {
+	if ( version >= NavFlatVersion )
+	{
+		// base data was already read from the flat tables by LoadFlat()
+		return NAV_OK;
+	}
+
 	// load ID
 	m_id = fileBuffer.GetUnsignedInt();
 
@@ -680,6 +825,280 @@ NavErrorType CNavArea::Load( CUtlBuffer &fileBuffer, unsigned int version, unsig
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+void HidingSpot::SaveFlat( NavFlatHidingSpot_t *record ) const
+{
+	V_memset( record, 0, sizeof( *record ) );
+	record->id = m_id;
+	record->pos[0] = m_pos.x;
+	record->pos[1] = m_pos.y;
+	record->pos[2] = m_pos.z;
+	record->flags = m_flags;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void HidingSpot::LoadFlat( const NavFlatHidingSpot_t &record )
+{
+	m_id = record.id;
+	m_pos.Init( record.pos[0], record.pos[1], record.pos[2] );
+	m_flags = record.flags;
+
+	// update next ID to avoid ID collisions by later spots
+	if (m_id >= m_nextID)
+		m_nextID = m_id+1;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Append this area to the flat tables of a version 17+ nav file
+ */
+void CNavArea::SaveFlat( NavFlatMeshBuilder_t *builder ) const
+{
+	NavFlatArea_t record;
+	V_memset( &record, 0, sizeof( record ) );
+
+	record.id = m_id;
+	record.attributeFlags = m_attributeFlags;
+	V_memcpy( record.nwCorner, m_nwCorner.Base(), sizeof( record.nwCorner ) );
+	V_memcpy( record.seCorner, m_seCorner.Base(), sizeof( record.seCorner ) );
+	record.neZ = m_neZ;
+	record.swZ = m_swZ;
+
+	int i;
+	for( i=0; i<MAX_NAV_TEAMS; ++i )
+	{
+		record.earliestOccupyTime[i] = m_earliestOccupyTime[i];
+	}
+
+	for ( i=0; i<NUM_CORNERS; ++i )
+	{
+		record.lightIntensity[i] = m_lightIntensity[i];
+	}
+
+	record.place = placeDirectory.GetIndex( GetPlace() );
+	record.inheritVisibilityFrom = ( m_inheritVisibilityFrom.area ) ? m_inheritVisibilityFrom.area->GetID() : 0;
+
+	for( int d=0; d<NUM_DIRECTIONS; d++ )
+	{
+		record.connect[d] = AppendFlatRange( builder->connects, m_connect[d].Count() );
+		FOR_EACH_VEC( m_connect[d], it )
+		{
+			builder->connects[ record.connect[d].first + it ] = m_connect[d][ it ].area->m_id;
+		}
+	}
+
+	record.hidingSpots = AppendFlatRange( builder->hidingSpots, m_hidingSpots.Count() );
+	FOR_EACH_VEC( m_hidingSpots, hit )
+	{
+		m_hidingSpots[ hit ]->SaveFlat( &builder->hidingSpots[ record.hidingSpots.first + hit ] );
+	}
+
+	record.spotEncounters = AppendFlatRange( builder->encounters, m_spotEncounters.Count() );
+	FOR_EACH_VEC( m_spotEncounters, eit )
+	{
+		const SpotEncounter *e = m_spotEncounters[ eit ];
+
+		NavFlatEncounter_t &encounter = builder->encounters[ record.spotEncounters.first + eit ];
+		V_memset( &encounter, 0, sizeof( encounter ) );
+		encounter.fromID = ( e->from.area ) ? e->from.area->m_id : 0;
+		encounter.fromDir = (unsigned char)e->fromDir;
+		encounter.toID = ( e->to.area ) ? e->to.area->m_id : 0;
+		encounter.toDir = (unsigned char)e->toDir;
+		encounter.spots = AppendFlatRange( builder->encounterSpots, e->spots.Count() );
+
+		FOR_EACH_VEC( e->spots, sit )
+		{
+			const SpotOrder &order = e->spots[ sit ];
+
+			NavFlatEncounterSpot_t &spot = builder->encounterSpots[ encounter.spots.first + sit ];
+			V_memset( &spot, 0, sizeof( spot ) );
+
+			// order.spot may be NULL if we've loaded a nav mesh that has been edited but not re-analyzed
+			spot.id = ( order.spot ) ? order.spot->GetID() : 0;
+			spot.t = (unsigned char)( 255 * order.t );
+		}
+	}
+
+	for ( i=0; i<CNavLadder::NUM_LADDER_DIRECTIONS; ++i )
+	{
+		record.ladder[i] = AppendFlatRange( builder->ladders, m_ladder[i].Count() );
+		FOR_EACH_VEC( m_ladder[i], it )
+		{
+			builder->ladders[ record.ladder[i].first + it ] = m_ladder[i][ it ].ladder->GetID();
+		}
+	}
+
+	record.potentiallyVisibleAreas = AppendFlatRange( builder->visibleAreas, m_potentiallyVisibleAreas.Count() );
+	for ( int vit=0; vit<m_potentiallyVisibleAreas.Count(); ++vit )
+	{
+		NavFlatVisibleArea_t &info = builder->visibleAreas[ record.potentiallyVisibleAreas.first + vit ];
+		V_memset( &info, 0, sizeof( info ) );
+
+		CNavArea *area = m_potentiallyVisibleAreas[ vit ].area;
+		info.id = area ? area->GetID() : 0;
+		info.attributes = m_potentiallyVisibleAreas[ vit ].attributes;
+	}
+
+	builder->areas.AddToTail( record );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Read this area from the flat tables of a version 17+ nav file.
+ * Every list is sized exactly once, IDs are bound to pointers in PostLoad() as usual.
+ */
+NavErrorType CNavArea::LoadFlat( const NavFlatMeshView_t &view, const NavFlatArea_t &record )
+{
+	for( int d=0; d<NUM_DIRECTIONS; d++ )
+	{
+		if ( !IsValidFlatRange( record.connect[d], view.connectCount ) )
+			return NAV_CORRUPT_DATA;
+	}
+	for ( int i=0; i<CNavLadder::NUM_LADDER_DIRECTIONS; ++i )
+	{
+		if ( !IsValidFlatRange( record.ladder[i], view.ladderCount ) )
+			return NAV_CORRUPT_DATA;
+	}
+	if ( !IsValidFlatRange( record.hidingSpots, view.hidingSpotCount ) ||
+		 !IsValidFlatRange( record.spotEncounters, view.encounterCount ) ||
+		 !IsValidFlatRange( record.potentiallyVisibleAreas, view.visibleAreaCount ) )
+	{
+		return NAV_CORRUPT_DATA;
+	}
+
+	m_id = record.id;
+
+	// update nextID to avoid collisions
+	if (m_id >= m_nextID)
+		m_nextID = m_id+1;
+
+	m_attributeFlags = record.attributeFlags;
+
+	m_nwCorner.Init( record.nwCorner[0], record.nwCorner[1], record.nwCorner[2] );
+	m_seCorner.Init( record.seCorner[0], record.seCorner[1], record.seCorner[2] );
+
+	m_center.x = (m_nwCorner.x + m_seCorner.x)/2.0f;
+	m_center.y = (m_nwCorner.y + m_seCorner.y)/2.0f;
+	m_center.z = (m_nwCorner.z + m_seCorner.z)/2.0f;
+
+	if ( ( m_seCorner.x - m_nwCorner.x ) > 0.0f && ( m_seCorner.y - m_nwCorner.y ) > 0.0f )
+	{
+		m_invDxCorners = 1.0f / ( m_seCorner.x - m_nwCorner.x );
+		m_invDyCorners = 1.0f / ( m_seCorner.y - m_nwCorner.y );
+	}
+	else
+	{
+		m_invDxCorners = m_invDyCorners = 0;
+
+		DevWarning( "Degenerate Navigation Area #%d at setpos %g %g %g\n", 
+			m_id, m_center.x, m_center.y, m_center.z );
+	}
+
+	m_neZ = record.neZ;
+	m_swZ = record.swZ;
+
+	CheckWaterLevel();
+
+	for( int d=0; d<NUM_DIRECTIONS; d++ )
+	{
+		const unsigned int *ids = view.connects + record.connect[d].first;
+
+		m_connect[d].EnsureCapacity( record.connect[d].count );
+		for( unsigned int i=0; i<record.connect[d].count; ++i )
+		{
+			// don't allow self-referential connections
+			if ( ids[i] != m_id )
+			{
+				NavConnect connect;
+				connect.id = ids[i];
+				m_connect[d].AddToTail( connect );
+			}
+		}
+	}
+
+	m_hidingSpots.EnsureCapacity( record.hidingSpots.count );
+	for( unsigned int h=0; h<record.hidingSpots.count; ++h )
+	{
+		// create new hiding spot and put on master list
+		HidingSpot *spot = TheNavMesh->CreateHidingSpot();
+		spot->LoadFlat( view.hidingSpots[ record.hidingSpots.first + h ] );
+		m_hidingSpots.AddToTail( spot );
+	}
+
+	m_spotEncounters.EnsureCapacity( record.spotEncounters.count );
+	for( unsigned int e=0; e<record.spotEncounters.count; ++e )
+	{
+		const NavFlatEncounter_t &flat = view.encounters[ record.spotEncounters.first + e ];
+		if ( !IsValidFlatRange( flat.spots, view.encounterSpotCount ) )
+			return NAV_CORRUPT_DATA;
+
+		SpotEncounter *encounter = new SpotEncounter;
+		encounter->from.id = flat.fromID;
+		encounter->fromDir = static_cast<NavDirType>( flat.fromDir );
+		encounter->to.id = flat.toID;
+		encounter->toDir = static_cast<NavDirType>( flat.toDir );
+
+		encounter->spots.EnsureCapacity( flat.spots.count );
+		for( unsigned int s=0; s<flat.spots.count; ++s )
+		{
+			const NavFlatEncounterSpot_t &spot = view.encounterSpots[ flat.spots.first + s ];
+
+			SpotOrder order;
+			order.id = spot.id;
+			order.t = (float)spot.t/255.0f;
+			encounter->spots.AddToTail( order );
+		}
+
+		m_spotEncounters.AddToTail( encounter );
+	}
+
+	// convert entry to actual Place
+	SetPlace( placeDirectory.IndexToPlace( record.place ) );
+
+	// ladder IDs were made unique when the mesh was saved
+	for ( int dir=0; dir<CNavLadder::NUM_LADDER_DIRECTIONS; ++dir )
+	{
+		const unsigned int *ids = view.ladders + record.ladder[dir].first;
+
+		m_ladder[dir].EnsureCapacity( record.ladder[dir].count );
+		for( unsigned int i=0; i<record.ladder[dir].count; ++i )
+		{
+			NavLadderConnect connect;
+			connect.id = ids[i];
+			m_ladder[dir].AddToTail( connect );
+		}
+	}
+
+	for( int i=0; i<MAX_NAV_TEAMS; ++i )
+	{
+		m_earliestOccupyTime[i] = record.earliestOccupyTime[i];
+	}
+
+	for ( int i=0; i<NUM_CORNERS; ++i )
+	{
+		m_lightIntensity[i] = record.lightIntensity[i];
+	}
+
+	m_potentiallyVisibleAreas.EnsureCapacity( record.potentiallyVisibleAreas.count );
+	for( unsigned int j=0; j<record.potentiallyVisibleAreas.count; ++j )
+	{
+		const NavFlatVisibleArea_t &flat = view.visibleAreas[ record.potentiallyVisibleAreas.first + j ];
+
+		AreaBindInfo info;
+		info.id = flat.id;
+		info.attributes = flat.attributes;
+		m_potentiallyVisibleAreas.AddToTail( info );
+	}
+
+	m_inheritVisibilityFrom.id = record.inheritVisibilityFrom;
+
+	return NAV_OK;
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Convert loaded IDs to pointers
@@ -1123,6 +1542,7 @@ bool CNavMesh::Save( void ) const
 	// 14 - Added a bool for if the nav needs analysis
 	// 15 - removed approach areas
 	// 16 - Added visibility data to the base mesh
+	// 17 - Areas stored as flat, pointer-free tables
 	fileBuffer.PutUnsignedInt( NavCurrentVersion );
 
 	// The sub-version number is maintained and owned by classes derived from CNavMesh and CNavArea
@@ -1160,17 +1580,43 @@ bool CNavMesh::Save( void ) const
 	// Store navigation areas
 	//
 	{
-		// store number of areas
-		unsigned int count = TheNavAreas.Count();
-		fileBuffer.PutUnsignedInt( count );
+		NavFlatMeshBuilder_t builder;
+		builder.areas.EnsureCapacity( TheNavAreas.Count() );
+
+		// derived classes append their own area data after the tables
+		CUtlBuffer derivedBuffer( 4096, 0 );
 
-		// store each area
 		FOR_EACH_VEC( TheNavAreas, it )
 		{
 			CNavArea *area = TheNavAreas[ it ];
 
-			area->Save( fileBuffer, NavCurrentVersion );
+			area->SaveFlat( &builder );
+			area->Save( derivedBuffer, NavCurrentVersion );
 		}
+
+		fileBuffer.PutUnsignedInt( builder.areas.Count() );
+		fileBuffer.PutUnsignedInt( builder.connects.Count() );
+		fileBuffer.PutUnsignedInt( builder.hidingSpots.Count() );
+		fileBuffer.PutUnsignedInt( builder.encounters.Count() );
+		fileBuffer.PutUnsignedInt( builder.encounterSpots.Count() );
+		fileBuffer.PutUnsignedInt( builder.ladders.Count() );
+		fileBuffer.PutUnsignedInt( builder.visibleAreas.Count() );
+		fileBuffer.PutUnsignedInt( derivedBuffer.TellPut() );
+
+		// align the tables so they can be used in place when loaded
+		while ( fileBuffer.TellPut() & 3 )
+		{
+			fileBuffer.PutUnsignedChar( 0 );
+		}
+
+		fileBuffer.Put( builder.areas.Base(), builder.areas.Count() * sizeof( NavFlatArea_t ) );
+		fileBuffer.Put( builder.connects.Base(), builder.connects.Count() * sizeof( unsigned int ) );
+		fileBuffer.Put( builder.hidingSpots.Base(), builder.hidingSpots.Count() * sizeof( NavFlatHidingSpot_t ) );
+		fileBuffer.Put( builder.encounters.Base(), builder.encounters.Count() * sizeof( NavFlatEncounter_t ) );
+		fileBuffer.Put( builder.encounterSpots.Base(), builder.encounterSpots.Count() * sizeof( NavFlatEncounterSpot_t ) );
+		fileBuffer.Put( builder.ladders.Base(), builder.ladders.Count() * sizeof( unsigned int ) );
+		fileBuffer.Put( builder.visibleAreas.Base(), builder.visibleAreas.Count() * sizeof( NavFlatVisibleArea_t ) );
+		fileBuffer.Put( derivedBuffer.Base(), derivedBuffer.TellPut() );
 	}
 
 	//
@@ -1321,6 +1767,85 @@ void CommandNavCheckFileConsistency( void )
 static ConCommand nav_check_file_consistency( "nav_check_file_consistency", CommandNavCheckFileConsistency, "Scans the maps directory and reports any missing/out-of-date navigation files.", FCVAR_GAMEDLL | FCVAR_CHEAT );
 
 
+//--------------------------------------------------------------------------------------------------------------
+static size_t GetUsedHeapBytes( void )
+{
+#if !defined( NO_MALLOC_OVERRIDE )
+	size_t usedMemory = 0, freeMemory = 0;
+	g_pMemAlloc->GlobalMemoryStatus( &usedMemory, &freeMemory );
+	return usedMemory;
+#else
+	return 0;
+#endif
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Reload the nav mesh a number of times and report how long it took and how much heap it holds
+ */
+void CommandNavLoadBenchmark( const CCommand &args )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int iterations = ( args.ArgC() > 1 ) ? MAX( 1, atoi( args[1] ) ) : 1;
+
+	CUtlBuffer fileBuffer( 4096, 1024*1024, CUtlBuffer::READ_ONLY );
+	unsigned int version = 0;
+	if ( TheNavMesh->GetNavDataFromFile( fileBuffer ) == NAV_OK && fileBuffer.TellMaxPut() >= 8 )
+	{
+		fileBuffer.GetUnsignedInt();
+		version = fileBuffer.GetUnsignedInt();
+	}
+
+	double totalTime = 0.0;
+	double bestTime = 1.0e10;
+	size_t meshBytes = 0;
+	bool hasMemoryStatus = false;
+
+	for( int i=0; i<iterations; ++i )
+	{
+		// measure from an empty mesh so the delta is only what the load allocates
+		TheNavMesh->Reset();
+		CNavVectorNoEditAllocator::Reset();
+
+		size_t usedBefore = GetUsedHeapBytes();
+
+		double start = Plat_FloatTime();
+		NavErrorType result = TheNavMesh->Load();
+		double elapsed = Plat_FloatTime() - start;
+
+		if ( result != NAV_OK )
+		{
+			Msg( "ERROR: Navigation Mesh load failed.\n" );
+			return;
+		}
+
+		size_t usedAfter = GetUsedHeapBytes();
+
+		hasMemoryStatus = ( usedAfter != 0 );
+		meshBytes = ( usedAfter > usedBefore ) ? usedAfter - usedBefore : 0;
+
+		totalTime += elapsed;
+		bestTime = MIN( bestTime, elapsed );
+	}
+
+	Msg( "Nav file version %u (%s), %d bytes\n", version, ( version >= NavFlatVersion ) ? "flat" : "per-area", fileBuffer.TellMaxPut() );
+	Msg( "%d areas, %d hiding spots, %d ladders\n", TheNavAreas.Count(), TheHidingSpots.Count(), TheNavMesh->GetLadders().Count() );
+	Msg( "Load time: %.2f ms average, %.2f ms best over %d load(s)\n", 1000.0 * totalTime / iterations, 1000.0 * bestTime, iterations );
+	if ( hasMemoryStatus )
+	{
+		Msg( "Resident mesh memory: %.2f MB\n", meshBytes / ( 1024.0 * 1024.0 ) );
+	}
+	else
+	{
+		Msg( "Resident mesh memory: not reported by this allocator\n" );
+	}
+}
+static ConCommand nav_load_benchmark( "nav_load_benchmark", CommandNavLoadBenchmark, "Reloads the Navigation Mesh [count] times and reports load time and resident memory.", FCVAR_GAMEDLL | FCVAR_CHEAT );
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Reads the used place names from the nav file (can be used to selectively precache before the nav is loaded)
@@ -1429,6 +1954,87 @@ NavErrorType CNavMesh::GetNavDataFromFile( CUtlBuffer &outBuffer, bool *pNavData
 	return NAV_OK;
 }
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Create and load all areas from the flat tables of a version 17+ nav file.
+ * The tables are used in place from the file buffer.
+ */
+NavErrorType CNavMesh::LoadFlatAreas( CUtlBuffer &fileBuffer, unsigned int count, unsigned int version, unsigned int subVersion )
+{
+	NavFlatMeshView_t view;
+	view.areaCount = count;
+	view.connectCount = fileBuffer.GetUnsignedInt();
+	view.hidingSpotCount = fileBuffer.GetUnsignedInt();
+	view.encounterCount = fileBuffer.GetUnsignedInt();
+	view.encounterSpotCount = fileBuffer.GetUnsignedInt();
+	view.ladderCount = fileBuffer.GetUnsignedInt();
+	view.visibleAreaCount = fileBuffer.GetUnsignedInt();
+	unsigned int derivedSize = fileBuffer.GetUnsignedInt();
+
+	if ( !fileBuffer.IsValid() )
+	{
+		return NAV_INVALID_FILE;
+	}
+
+	// tables are aligned to 4 bytes from the start of the file
+	int tableStart = ( fileBuffer.TellGet() + 3 ) & ~3;
+
+	uint64 tableSize = (uint64)view.areaCount * sizeof( NavFlatArea_t ) +
+					   (uint64)view.connectCount * sizeof( unsigned int ) +
+					   (uint64)view.hidingSpotCount * sizeof( NavFlatHidingSpot_t ) +
+					   (uint64)view.encounterCount * sizeof( NavFlatEncounter_t ) +
+					   (uint64)view.encounterSpotCount * sizeof( NavFlatEncounterSpot_t ) +
+					   (uint64)view.ladderCount * sizeof( unsigned int ) +
+					   (uint64)view.visibleAreaCount * sizeof( NavFlatVisibleArea_t );
+
+	if ( (uint64)tableStart + tableSize + derivedSize > (uint64)fileBuffer.TellMaxPut() )
+	{
+		Msg( "Navigation file is truncated.\n" );
+		return NAV_CORRUPT_DATA;
+	}
+
+	const byte *pCursor = (const byte *)fileBuffer.Base() + tableStart;
+	view.areas = (const NavFlatArea_t *)pCursor;				pCursor += view.areaCount * sizeof( NavFlatArea_t );
+	view.connects = (const unsigned int *)pCursor;				pCursor += view.connectCount * sizeof( unsigned int );
+	view.hidingSpots = (const NavFlatHidingSpot_t *)pCursor;	pCursor += view.hidingSpotCount * sizeof( NavFlatHidingSpot_t );
+	view.encounters = (const NavFlatEncounter_t *)pCursor;		pCursor += view.encounterCount * sizeof( NavFlatEncounter_t );
+	view.encounterSpots = (const NavFlatEncounterSpot_t *)pCursor;	pCursor += view.encounterSpotCount * sizeof( NavFlatEncounterSpot_t );
+	view.ladders = (const unsigned int *)pCursor;				pCursor += view.ladderCount * sizeof( unsigned int );
+	view.visibleAreas = (const NavFlatVisibleArea_t *)pCursor;	pCursor += view.visibleAreaCount * sizeof( NavFlatVisibleArea_t );
+
+	TheHidingSpots.EnsureCapacity( TheHidingSpots.Count() + view.hidingSpotCount );
+
+	for( unsigned int i=0; i<count; ++i )
+	{
+		CNavArea *area = TheNavMesh->CreateArea();
+		TheNavAreas.AddToTail( area );
+
+		NavErrorType result = area->LoadFlat( view, view.areas[i] );
+		if ( result != NAV_OK )
+		{
+			Msg( "Navigation area #%u has invalid table ranges.\n", view.areas[i].id );
+			return result;
+		}
+	}
+
+	// derived class area data follows the tables
+	int derivedStart = pCursor - (const byte *)fileBuffer.Base();
+	fileBuffer.SeekGet( CUtlBuffer::SEEK_HEAD, derivedStart );
+
+	for( unsigned int i=0; i<count; ++i )
+	{
+		TheNavAreas[i]->Load( fileBuffer, version, subVersion );
+	}
+
+	if ( fileBuffer.TellGet() != derivedStart + (int)derivedSize )
+	{
+		Warning( "Navigation file derived area data size mismatch (read %d of %u bytes).\n", fileBuffer.TellGet() - derivedStart, derivedSize );
+		fileBuffer.SeekGet( CUtlBuffer::SEEK_HEAD, derivedStart + derivedSize );
+	}
+
+	return fileBuffer.IsValid() ? NAV_OK : NAV_INVALID_FILE;
+}
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Load AI navigation data from a file
@@ -1541,12 +2147,31 @@ NavErrorType CNavMesh::Load( void )
 
 	// load the areas and compute total extent
 	TheNavMesh->PreLoadAreas( count );
+	TheNavAreas.EnsureCapacity( count );
 	Extent areaExtent;
+
+	if ( version >= NavFlatVersion )
+	{
+		NavErrorType flatResult = LoadFlatAreas( fileBuffer, count, version, subVersion );
+		if ( flatResult != NAV_OK )
+		{
+			return flatResult;
+		}
+	}
+
 	for( i=0; i<count; ++i )
 	{
-		CNavArea *area = TheNavMesh->CreateArea();
-		area->Load( fileBuffer, version, subVersion );
-		TheNavAreas.AddToTail( area );
+		CNavArea *area;
+		if ( version >= NavFlatVersion )
+		{
+			area = TheNavAreas[ i ];
+		}
+		else
+		{
+			area = TheNavMesh->CreateArea();
+			area->Load( fileBuffer, version, subVersion );
+			TheNavAreas.AddToTail( area );
+		}
 
 		area->GetExtent( &areaExtent );
 
@@ -1712,6 +2337,9 @@ NavErrorType CNavMesh::PostLoad( unsigned int version )
 
 	ValidateNavAreaConnections();
 
+	// all visibility IDs are pointers now
+	CNavArea::BuildVisibilitySets();
+
 	// TERROR: loading into a map directly creates entities before the mesh is loaded.  Tell the preexisting
 	// entities now that the mesh is loaded so they can update areas.
 	for ( int i=0; i<m_avoidanceObstacles.Count(); ++i )
@@ -185,6 +185,7 @@ void CNavMesh::DestroyNavigationMesh( bool incremental )
 		}
 
 		TheNavAreas.RemoveAll();
+		CNavArea::PurgeVisibilitySets();
 
 		CNavArea::m_isReset = false;
 
@@ -3543,4 +3544,6 @@ void CNavMesh::EndVisibilityComputations( void )
 	}
 
 	Msg( "NavMesh Visibility List Lengths:  min = %d, avg = %d, max = %d\n", minVisLength, avgVisLength, maxVisLength );
+
+	CNavArea::BuildVisibilitySets();
 }
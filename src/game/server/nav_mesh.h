@@ -1077,6 +1077,7 @@ public:
 
 protected:
 	NavErrorType GetNavDataFromFile( CUtlBuffer &outBuffer, bool *pNavDataFromBSP = NULL );
+	NavErrorType LoadFlatAreas( CUtlBuffer &fileBuffer, unsigned int count, unsigned int version, unsigned int subVersion );	// version 17+ area tables
 
 	virtual void PostCustomAnalysis( void ) { }					// invoked when custom analysis step is complete
 	bool FindActiveNavArea( void );								// Finds the area or ladder the local player is currently pointing at.  Returns true if a surface was hit by the traceline.
@@ -1089,6 +1090,7 @@ private:
 	friend class CNavArea;
 	friend class CNavNode;
 	friend class CNavUIBasePanel;
+	friend void CommandNavLoadBenchmark( const CCommand &args );
 
 	mutable CUtlVector<NavAreaVector> m_grid;
 	float m_gridCellSize;										// the width/height of a grid cell for spatially partitioning nav areas for fast access
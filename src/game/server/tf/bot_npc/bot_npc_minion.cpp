@@ -22,6 +22,7 @@
 #include "nav_mesh/tf_path_follower.h"
 #include "tf_obj_sentrygun.h"
 #include "bot/map_entities/tf_spawner.h"
+#include "tf_hot_game_events.h"
 
 #define MINION_LIGHT_ON 0
 #define MINION_LIGHT_OFF 1
@@ -197,39 +198,24 @@ int CBotNPCMinion::OnTakeDamage_Alive( const CTakeDamageInfo &rawInfo )
 	BecomeAlert();
 
 	// fire event for client combat text, beep, etc.
-	IGameEvent *event = gameeventmanager->CreateEvent( "npc_hurt" );
-	if ( event )
-	{
-		event->SetInt( "entindex", entindex() );
-		event->SetInt( "health", MAX( 0, GetHealth() ) );
-		event->SetInt( "damageamount", info.GetDamage() );
-		event->SetBool( "crit", ( info.GetDamageType() & DMG_CRITICAL ) ? true : false );
+	TFHotGameEvent_t hurtEvent( TF_HOT_EVENT_NPC_HURT );
+	hurtEvent.m_nVictim = entindex();
+	hurtEvent.m_nAmount = (int)info.GetDamage();
+	hurtEvent.SetHealth( MAX( 0, GetHealth() ) );
+	hurtEvent.SetFlag( TF_HOT_FIELD_CRIT, ( info.GetDamageType() & DMG_CRITICAL ) != 0 );
 
-		CTFPlayer *attackerPlayer = ToTFPlayer( info.GetAttacker() );
-		if ( attackerPlayer )
-		{
-			event->SetInt( "attacker_player", attackerPlayer->GetUserID() );
+	// attacker 0 is hurt by world
+	CTFPlayer *attackerPlayer = ToTFPlayer( info.GetAttacker() );
+	hurtEvent.SetAttacker( attackerPlayer ? attackerPlayer->GetUserID() : 0 );
+	hurtEvent.SetWeaponID( ( attackerPlayer && attackerPlayer->GetActiveTFWeapon() ) ? attackerPlayer->GetActiveTFWeapon()->GetWeaponID() : 0 );
 
-			if ( attackerPlayer->GetActiveTFWeapon() )
-			{
-				event->SetInt( "weaponid", attackerPlayer->GetActiveTFWeapon()->GetWeaponID() );
-			}
-			else
-			{
-				event->SetInt( "weaponid", 0 );
-			}
-		}
-		else
-		{
-			// hurt by world
-			event->SetInt( "attacker_player", 0 );
-			event->SetInt( "weaponid", 0 );
-		}
+	int result = BaseClass::OnTakeDamage_Alive( info );
 
-		gameeventmanager->FireEvent( event );
-	}
+	// health above is from before the hit, so check for the kill once it's applied
+	hurtEvent.SetLethal( GetHealth() <= 0 );
+	TFHotGameEvents().Fire( hurtEvent );
 
-	return BaseClass::OnTakeDamage_Alive( info );
+	return result;
 }
 
 
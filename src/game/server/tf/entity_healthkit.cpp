@@ -13,6 +13,7 @@
 #include "entity_healthkit.h"
 #include "tf_weapon_lunchbox.h"
 #include "tf_gamestats.h"
+#include "tf_hot_game_events.h"
 
 
 //=============================================================================
@@ -98,18 +99,15 @@ bool CHealthKit::MyTouch( CBasePlayer *pPlayer )
 
 			if ( nHealthGiven > 0 )
 			{
-				IGameEvent *event = gameeventmanager->CreateEvent( "player_healed" );
-				if ( event )
-				{
-					CTFPlayer *pOwner = ToTFPlayer( GetOwnerEntity() );
-					int nHealerID = pOwner ? pOwner->GetUserID() : 0;
-
-					event->SetInt( "priority", 1 );	// HLTV event priority
-					event->SetInt( "patient", pPlayer->GetUserID() );
-					event->SetInt( "healer", nHealerID );
-					event->SetInt( "amount", nHealthGiven );
-					gameeventmanager->FireEvent( event );
-				}
+				CTFPlayer *pOwner = ToTFPlayer( GetOwnerEntity() );
+				int nHealerID = pOwner ? pOwner->GetUserID() : 0;
+
+				TFHotGameEvent_t healEvent( TF_HOT_EVENT_PLAYER_HEALED );
+				healEvent.SetPriority( 1 );	// HLTV event priority
+				healEvent.m_nVictim = pPlayer->GetUserID();
+				healEvent.SetAttacker( nHealerID );
+				healEvent.m_nAmount = nHealthGiven;
+				TFHotGameEvents().Fire( healEvent );
 			}
 
 			if ( pTFPlayer->m_Shared.InCond( TF_COND_DISGUISED ) && pTFPlayer->m_Shared.GetCarryingRuneType() != RUNE_PLAGUE )
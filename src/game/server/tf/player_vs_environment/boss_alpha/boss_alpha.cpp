@@ -28,6 +28,7 @@
 
 #include "player_vs_environment/boss_alpha/boss_alpha.h"
 #include "player_vs_environment/boss_alpha/behavior/boss_alpha_behavior.h"
+#include "tf_hot_game_events.h"
 
 
 //#define USE_BOSS_SENTRY
@@ -698,40 +699,23 @@ int CBossAlpha::OnTakeDamage_Alive( const CTakeDamageInfo &rawInfo )
 
 
 	// fire event for client combat text, beep, etc.
-	IGameEvent *event = gameeventmanager->CreateEvent( "npc_hurt" );
-	if ( event )
-	{
-		event->SetInt( "entindex", entindex() );
-		event->SetInt( "health", MAX( 0, GetHealth() ) );
-		event->SetInt( "damageamount", info.GetDamage() );
-		event->SetBool( "crit", ( info.GetDamageType() & DMG_CRITICAL ) ? true : false );
-
-		CTFPlayer *attackerPlayer = ToTFPlayer( info.GetAttacker() );
-		if ( attackerPlayer )
-		{
-			event->SetInt( "attacker_player", attackerPlayer->GetUserID() );
-
-			if ( attackerPlayer->GetActiveTFWeapon() )
-			{
-				event->SetInt( "weaponid", attackerPlayer->GetActiveTFWeapon()->GetWeaponID() );
-			}
-			else
-			{
-				event->SetInt( "weaponid", 0 );
-			}
-		}
-		else
-		{
-			// hurt by world
-			event->SetInt( "attacker_player", 0 );
-			event->SetInt( "weaponid", 0 );
-		}
+	TFHotGameEvent_t hurtEvent( TF_HOT_EVENT_NPC_HURT );
+	hurtEvent.m_nVictim = entindex();
+	hurtEvent.m_nAmount = (int)info.GetDamage();
+	hurtEvent.SetHealth( MAX( 0, GetHealth() ) );
+	hurtEvent.SetFlag( TF_HOT_FIELD_CRIT, ( info.GetDamageType() & DMG_CRITICAL ) != 0 );
 
-		gameeventmanager->FireEvent( event );
-	}
+	// attacker 0 is hurt by world
+	CTFPlayer *attackerPlayer = ToTFPlayer( info.GetAttacker() );
+	hurtEvent.SetAttacker( attackerPlayer ? attackerPlayer->GetUserID() : 0 );
+	hurtEvent.SetWeaponID( ( attackerPlayer && attackerPlayer->GetActiveTFWeapon() ) ? attackerPlayer->GetActiveTFWeapon()->GetWeaponID() : 0 );
 
 	int result = BaseClass::OnTakeDamage_Alive( info );
 
+	// health above is from before the hit, so check for the kill once it's applied
+	hurtEvent.SetLethal( GetHealth() <= 0 );
+	TFHotGameEvents().Fire( hurtEvent );
+
 	// emit injury outputs
 	float healthPercentage = (float)GetHealth() / (float)GetMaxHealth();
 
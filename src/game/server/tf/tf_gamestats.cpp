@@ -40,6 +40,7 @@ extern ConVar tf_mm_trusted;
 static ConVar tf_stats_nogameplaycheck( "tf_stats_nogameplaycheck", "0", FCVAR_NONE , "Disable normal check for valid gameplay, send stats regardless." );
 //static ConVar tf_stats_track( "tf_stats_track", "1", FCVAR_NONE, "Turn on//off tf stats tracking." );
 //static ConVar tf_stats_verbose( "tf_stats_verbose", "0", FCVAR_NONE, "Turn on//off verbose logging of stats." );
+static ConVar tf_stats_columns_export( "tf_stats_columns_export", "0", FCVAR_NONE, "Write per-tick shot, damage and healing events to a columnar sf_gamestats_<map>_<time>.scol file for offline analysis. Takes effect on the next map load." );
 
 CTFGameStats CTF_GameStats;
 
@@ -67,6 +68,7 @@ const char *g_aClassNames[] =
 CTFGameStats::CTFGameStats()
 {
 	gamestats = this;
+	m_hEventColumnsExport = FILESYSTEM_INVALID_HANDLE;
 	Clear();
 
 	SetDefLessFunc( m_MapsPlaytime );
@@ -243,6 +245,7 @@ void StripNewlineFromString( char *string )
 void CTFGameStats::Event_LevelInit( void )
 {
 	ClearCurrentGameData();
+	OpenEventColumnsExport();
 
 	// Get the host ip and port.
 	int nIPAddr = 0;
@@ -343,6 +346,130 @@ void CTFGameStats::LevelShutdownPreClearSteamAPIContext()
 	GetSteamWorksSGameStatsUploader().EndSession();
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Aggregates this tick's buffered events.
+//-----------------------------------------------------------------------------
+void CTFGameStats::FrameUpdatePostEntityThink()
+{
+	FlushEventColumns();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds the buffered shot, damage and healing events to the reported
+//			per-weapon stats and the current round summaries, optionally
+//			writes them to the export file, and empties the buffers.
+//-----------------------------------------------------------------------------
+void CTFGameStats::FlushEventColumns()
+{
+	if ( m_eventColumns.IsEmpty() )
+		return;
+
+	VPROF_BUDGET( "CTFGameStats::FlushEventColumns", VPROF_BUDGETGROUP_GAME );
+
+	m_eventColumns.WriteChunks( m_hEventColumnsExport, gpGlobals->tickcount, gpGlobals->curtime );
+
+	TF_Gamestats_LevelStats_t *pGame = m_reportedStats.m_pCurrentGame;
+
+	// Shots
+	const CTFGameStatsEventColumns::Shots_t &shots = m_eventColumns.m_shots;
+	for ( int i = 0; i < shots.Count(); i++ )
+	{
+		if ( pGame )
+		{
+			TF_Gamestats_WeaponStats_t &weaponStats = pGame->m_aWeaponStats[ shots.m_iWeapon[i] ];
+			weaponStats.iShotsFired++;
+			weaponStats.iCritShotsFired += shots.m_bCrit[i];
+		}
+
+		if ( shots.m_bCrit[i] )
+		{
+			TF_Gamestats_RoundStats_t* round = GetRoundStatsForTeam( shots.m_iTeam[i] );
+			if ( round )
+			{
+				round->m_Summary.iCrits++;
+			}
+		}
+	}
+
+	// Damage
+	const CTFGameStatsEventColumns::Damage_t &damage = m_eventColumns.m_damage;
+	m_eventColumns.ComputeDamageDistances( m_vecDamageDistances );
+	for ( int i = 0; i < damage.Count(); i++ )
+	{
+		TF_Gamestats_RoundStats_t* round = GetRoundStatsForTeam( damage.m_iAttackerTeam[i] );
+		if ( round )
+		{
+			round->m_Summary.iDamageDone += damage.m_iDamageTaken[i];
+		}
+
+		if ( pGame && ( damage.m_nFlags[i] & TF_STATS_DAMAGE_WEAPON_STATS ) )
+		{
+			TF_Gamestats_WeaponStats_t &weaponStats = pGame->m_aWeaponStats[ damage.m_iWeapon[i] ];
+			weaponStats.iHits++;
+			weaponStats.iTotalDamage += damage.m_iDamageTaken[i];
+			if ( damage.m_nFlags[i] & TF_STATS_DAMAGE_KNOWN_ORIGIN )
+			{
+				weaponStats.iHitsWithKnownDistance++;
+				weaponStats.iTotalDistance += (int)m_vecDamageDistances[i];
+			}
+		}
+	}
+
+	// Healing
+	const CTFGameStatsEventColumns::Healing_t &healing = m_eventColumns.m_healing;
+	for ( int i = 0; i < healing.Count(); i++ )
+	{
+		TF_Gamestats_RoundStats_t* round = GetRoundStatsForTeam( healing.m_iTeam[i] );
+		if ( round )
+		{
+			round->m_Summary.iHealingDone += healing.m_flAmount[i];
+		}
+	}
+
+	m_eventColumns.Reset();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Starts a new export file for this level if tf_stats_columns_export is set
+//-----------------------------------------------------------------------------
+void CTFGameStats::OpenEventColumnsExport()
+{
+	CloseEventColumnsExport();
+
+	if ( !tf_stats_columns_export.GetBool() )
+		return;
+
+	char szFilename[MAX_PATH];
+	V_sprintf_safe( szFilename, "sf_gamestats_%s_%u.scol", STRING( gpGlobals->mapname ), CRTime::RTime32TimeCur() );
+	m_hEventColumnsExport = g_pFullFileSystem->Open( szFilename, "wb", "MOD" );
+	if ( m_hEventColumnsExport == FILESYSTEM_INVALID_HANDLE )
+	{
+		Warning( "CTFGameStats: unable to open %s for writing\n", szFilename );
+		return;
+	}
+
+	TFGameStatsColumnsFileHeader_t header;
+	V_memset( &header, 0, sizeof( header ) );
+	header.m_nMagic = TF_GAMESTATS_COLUMNS_MAGIC;
+	header.m_nVersion = TF_GAMESTATS_COLUMNS_VERSION;
+	V_strcpy_safe( header.m_szMapName, STRING( gpGlobals->mapname ) );
+	g_pFullFileSystem->Write( &header, sizeof( header ), m_hEventColumnsExport );
+
+	Msg( "Writing game stats columns to %s\n", szFilename );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+void CTFGameStats::CloseEventColumnsExport()
+{
+	if ( m_hEventColumnsExport != FILESYSTEM_INVALID_HANDLE )
+	{
+		g_pFullFileSystem->Close( m_hEventColumnsExport );
+		m_hEventColumnsExport = FILESYSTEM_INVALID_HANDLE;
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
@@ -377,6 +504,8 @@ void CTFGameStats::Event_LevelShutdown( float flElapsed )
 
 	SW_GameStats_WriteMap();
 
+	CloseEventColumnsExport();
+
 	if ( m_bServerShutdown )
 	{
 		StopListeningForAllEvents();
@@ -429,6 +558,9 @@ void CTFGameStats::ResetKillHistory( CTFPlayer *pPlayer )
 //-----------------------------------------------------------------------------
 void CTFGameStats::ResetRoundStats()
 {
+	// Anything buffered this tick belongs to the round we're resetting
+	FlushEventColumns();
+
 	for ( int i = 0; i < ARRAYSIZE( m_aPlayerStats ); i++ )
 	{		
 		m_aPlayerStats[i].statsCurrentRound.Reset();
@@ -729,11 +861,8 @@ void CTFGameStats::Event_PlayerHealedOther( CTFPlayer *pPlayer, float amount )
 	}
 	IncrementStat( pPlayer, TFSTAT_HEALING, (int) amount );
 
-	TF_Gamestats_RoundStats_t* round = GetRoundStatsForTeam( pPlayer->GetTeamNumber() );
-	if ( round )
-	{
-		round->m_Summary.iHealingDone += amount;
-	}
+	// Round summary is updated in bulk at the end of the tick
+	m_eventColumns.AddHealing( pPlayer->entindex(), pPlayer->GetTeamNumber(), amount );
 }
 
 //-----------------------------------------------------------------------------
@@ -999,21 +1128,13 @@ void CTFGameStats::Event_PlayerFiredWeapon( CTFPlayer *pPlayer, bool bCritical )
 		CTFWeaponBase *pTFWeapon = pPlayer->GetActiveTFWeapon();
 		if ( pTFWeapon )
 		{
-			// record shots fired in reported per-weapon stats
-			int iWeaponID = pTFWeapon->GetWeaponID();
-
+			// record shots fired in reported per-weapon stats.  The per-weapon
+			// and round totals are updated in bulk at the end of the tick.
 			if ( m_reportedStats.m_pCurrentGame != NULL )
 			{
-				TF_Gamestats_WeaponStats_t *pWeaponStats = &m_reportedStats.m_pCurrentGame->m_aWeaponStats[iWeaponID];
-				pWeaponStats->iShotsFired++;
+				m_eventColumns.AddShot( pPlayer->entindex(), pPlayer->GetTeamNumber(), pTFWeapon->GetWeaponID(), bCritical );
 				if ( bCritical )
 				{
-					pWeaponStats->iCritShotsFired++;
-					TF_Gamestats_RoundStats_t* round = GetRoundStatsForTeam( pPlayer->GetTeamNumber() );
-					if ( round )
-					{
-						round->m_Summary.iCrits++;
-					}
 					IncrementStat( pPlayer, TFSTAT_CRITS, 1 );
 				}
 			}
@@ -1090,12 +1211,6 @@ void CTFGameStats::Event_PlayerDamage( CBasePlayer *pBasePlayer, const CTakeDama
 			}
 		}
 
-		TF_Gamestats_RoundStats_t* round = GetRoundStatsForTeam( pAttacker->GetTeamNumber() );
-		if ( round )
-		{
-			round->m_Summary.iDamageDone += iDamageTaken;
-		}
-
 		//Report MvM damage to bots
 		if ( TFGameRules()->IsMannVsMachineMode() )
 		{
@@ -1122,14 +1237,13 @@ void CTFGameStats::Event_PlayerDamage( CBasePlayer *pBasePlayer, const CTakeDama
 		IncrementStat( pTarget, TFSTAT_DAMAGETAKEN, iDamageTaken );
 	}
 
-	TF_Gamestats_LevelStats_t::PlayerDamageLump_t damage;
+	int iAttackClass = TF_CLASS_UNDEFINED;
+	int iWeapon = TF_WEAPON_NONE;
+	int nFlags = 0;
 	Vector killerOrg(0, 0, 0);
 
-	// set the location where the target was hit
+	// the location where the target was hit
 	const Vector &org = pTarget ? pTarget->GetAbsOrigin() : vec3_origin;
-	damage.nTargetPosition[ 0 ] = static_cast<int>( org.x );
-	damage.nTargetPosition[ 1 ] = static_cast<int>( org.y );
-	damage.nTargetPosition[ 2 ] = static_cast<int>( org.z );
 
 	// set the class of the attacker
 	CBaseEntity *pInflictor = info.GetInflictor();
@@ -1143,13 +1257,14 @@ void CTFGameStats::Event_PlayerDamage( CBasePlayer *pBasePlayer, const CTakeDama
 	if ( pSentry != NULL )
 	{
 		killerOrg = pSentry->GetAbsOrigin();
-		damage.iAttackClass = TF_CLASS_ENGINEER;
-		damage.iWeapon = ( info.GetDamageType() & DMG_BLAST ) ? TF_WEAPON_SENTRY_ROCKET : TF_WEAPON_SENTRY_BULLET;
+		iAttackClass = TF_CLASS_ENGINEER;
+		iWeapon = ( info.GetDamageType() & DMG_BLAST ) ? TF_WEAPON_SENTRY_ROCKET : TF_WEAPON_SENTRY_BULLET;
+		nFlags |= TF_STATS_DAMAGE_SENTRY;
 	} 
 	else if ( dynamic_cast<CObjectDispenser *>( pInflictor ) )
 	{
-		damage.iAttackClass = TF_CLASS_ENGINEER;
-		damage.iWeapon = TF_WEAPON_DISPENSER;
+		iAttackClass = TF_CLASS_ENGINEER;
+		iWeapon = TF_WEAPON_DISPENSER;
 	}
 	else
 	{
@@ -1157,83 +1272,63 @@ void CTFGameStats::Event_PlayerDamage( CBasePlayer *pBasePlayer, const CTakeDama
 		if ( pTFAttacker )
 		{
 			CTFPlayerClass *pAttackerClass = pTFAttacker->GetPlayerClass();
-			damage.iAttackClass = ( !pAttackerClass ) ? TF_CLASS_UNDEFINED : pAttackerClass->GetClassIndex();
+			iAttackClass = ( !pAttackerClass ) ? TF_CLASS_UNDEFINED : pAttackerClass->GetClassIndex();
 			killerOrg = pTFAttacker->GetAbsOrigin();
 		}
 		else
 		{
-			damage.iAttackClass = TF_CLASS_UNDEFINED;
+			iAttackClass = TF_CLASS_UNDEFINED;
 			killerOrg = org;
 		}
 
 		// find the weapon the killer used
-		damage.iWeapon = GetWeaponFromDamage( info );
+		iWeapon = GetWeaponFromDamage( info );
 	}
 
-	// If normal gameplay state, track weapon stats. 
-	if ( ( TFGameRules()->State_Get() == GR_STATE_RND_RUNNING ) && ( damage.iWeapon != TF_WEAPON_NONE  ) )
+	Assert( iAttackClass != TF_CLASS_UNDEFINED );
+
+	// Try and figure out where the damage is coming from
+	Vector vecDamageOrigin = info.GetReportedPosition();
+	// If we didn't get an origin to use, try using the attacker's origin
+	if ( vecDamageOrigin == vec3_origin )
 	{
-		// record hits & damage in reported per-weapon stats
-		if ( m_reportedStats.m_pCurrentGame != NULL )
-		{
-			TF_Gamestats_WeaponStats_t *pWeaponStats = &m_reportedStats.m_pCurrentGame->m_aWeaponStats[damage.iWeapon];
-			pWeaponStats->iHits++;
-			pWeaponStats->iTotalDamage += iDamageTaken;
-
-			// Try and figure out where the damage is coming from
-			Vector vecDamageOrigin = info.GetReportedPosition();
-			// If we didn't get an origin to use, try using the attacker's origin
-			if ( vecDamageOrigin == vec3_origin )
-			{
-				if ( pSentry )
-				{
-					vecDamageOrigin = pSentry->GetAbsOrigin();
-				}
-				else
-				{
-					vecDamageOrigin = killerOrg;
-				}					
-			}
-			if ( vecDamageOrigin != vec3_origin )
-			{
-				pWeaponStats->iHitsWithKnownDistance++;
-				int iDistance = (int) vecDamageOrigin.DistTo( pBasePlayer->GetAbsOrigin() );
-				//				Msg( "Damage distance: %d\n", iDistance );
-				pWeaponStats->iTotalDistance += iDistance;
-			}
-		}
+		vecDamageOrigin = killerOrg;
+	}
+	if ( vecDamageOrigin != vec3_origin )
+	{
+		nFlags |= TF_STATS_DAMAGE_KNOWN_ORIGIN;
 	}
 
-	Assert( damage.iAttackClass != TF_CLASS_UNDEFINED );
-
-	// record the time the damage occurred
-	damage.fTime = gpGlobals->curtime;
-
-	// store the attacker's position
-	damage.nAttackerPosition[ 0 ] = static_cast<int>( killerOrg.x );
-	damage.nAttackerPosition[ 1 ] = static_cast<int>( killerOrg.y );
-	damage.nAttackerPosition[ 2 ] = static_cast<int>( killerOrg.z );
+	// If normal gameplay state, track weapon stats. 
+	if ( ( TFGameRules()->State_Get() == GR_STATE_RND_RUNNING ) && ( iWeapon != TF_WEAPON_NONE ) && ( m_reportedStats.m_pCurrentGame != NULL ) )
+	{
+		nFlags |= TF_STATS_DAMAGE_WEAPON_STATS;
+	}
 
 	// set the class of the target
-	CTFPlayer *pTFPlayer = ToTFPlayer( pTarget );
-	CTFPlayerClass *pTargetClass = ( pTFPlayer ) ? pTFPlayer->GetPlayerClass() : NULL;
-	damage.iTargetClass = ( !pTargetClass ) ? TF_CLASS_UNDEFINED : pTargetClass->GetClassIndex();
+	CTFPlayerClass *pTargetClass = ( pTarget ) ? pTarget->GetPlayerClass() : NULL;
+	int iTargetClass = ( !pTargetClass ) ? TF_CLASS_UNDEFINED : pTargetClass->GetClassIndex();
 
-	Assert( damage.iTargetClass != TF_CLASS_UNDEFINED );
+	Assert( iTargetClass != TF_CLASS_UNDEFINED );
 
-	// record the damage done
-	damage.iDamage = info.GetDamage();
-
-	// record if it was a crit
-	damage.iCrit = ( ( info.GetDamageType() & DMG_CRITICAL ) != 0 );
+	if ( info.GetDamageType() & DMG_CRITICAL )
+	{
+		nFlags |= TF_STATS_DAMAGE_CRIT;
+	}
+	if ( pBasePlayer->GetHealth() <= 0 )
+	{
+		nFlags |= TF_STATS_DAMAGE_KILL;
+	}
 
-	// record if it was a kill
-	damage.iKill = ( pTarget->GetHealth() <= 0 );
+	// Per-weapon hits, damage and distance, and the round damage summary, are
+	// aggregated at the end of the tick
+	m_eventColumns.AddDamage( pAttacker ? pAttacker->entindex() : 0, pBasePlayer->entindex(),
+							  pAttacker ? pAttacker->GetTeamNumber() : TEAM_INVALID,
+							  iAttackClass, iTargetClass, iWeapon, (int)info.GetDamage(), iDamageTaken, nFlags,
+							  pBasePlayer->GetAbsOrigin(), vecDamageOrigin );
 
-	// add it to the list of damages
 	if ( m_reportedStats.m_pCurrentGame != NULL )
 	{
-		//m_reportedStats.m_pCurrentGame->m_aPlayerDamage.AddToTail( damage );
 		m_reportedStats.m_pCurrentGame->m_bIsRealServer = true;
 	}	
 }
@@ -1720,6 +1815,8 @@ void CTFGameStats::StoreGameEndReason( const char* reason )
 //-----------------------------------------------------------------------------
 void CTFGameStats::AccumulateGameData()
 {
+	FlushEventColumns();
+
 	// find or add a bucket for this level
 	TF_Gamestats_LevelStats_t *map = m_reportedStats.FindOrAddMapStats( STRING( gpGlobals->mapname ) );
 	// get current game data
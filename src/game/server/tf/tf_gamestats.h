@@ -13,6 +13,7 @@
 #include "tf_obj.h"
 #include "tf_gamestats_shared.h"
 #include "GameEventListener.h"
+#include "tf_gamestats_columns.h"
 
 class CTFPlayer;
 
@@ -20,7 +21,7 @@ class CTFPlayer;
 //
 // TF Game Stats Class
 //
-class CTFGameStats : public CBaseGameStats, public CGameEventListener, public CAutoGameSystem
+class CTFGameStats : public CBaseGameStats, public CGameEventListener, public CAutoGameSystemPerFrame
 {
 public:
 
@@ -38,6 +39,7 @@ public:
 	virtual bool Init();
 	virtual void LevelInitPreEntity();
 	virtual void LevelShutdownPreClearSteamAPIContext();
+	virtual void FrameUpdatePostEntityThink();
 
 	// Events.
 	virtual void Event_LevelInit( void );
@@ -134,6 +136,11 @@ protected:
 	void						AccumulateAndResetPerLifeStats( CTFPlayer *pPlayer );
 	void						TrackKillStats( CBasePlayer *pAttacker, CBasePlayer *pVictim );
 
+	// Aggregates the buffered per-tick events into the reported stats
+	void						FlushEventColumns();
+	void						OpenEventColumnsExport();
+	void						CloseEventColumnsExport();
+
 public:
 	TFReportedStats_t			m_reportedStats;		// Stats which are uploaded from TF server to Steam
 	PlayerStats_t				m_aPlayerStats[MAX_PLAYERS_ARRAY_SAFE];	// List of stats for each player for current life - reset after each death or class change
@@ -162,6 +169,10 @@ public:
 	PasstimeStats_t				m_passtimeStats;
 
 private:
+	CTFGameStatsEventColumns	m_eventColumns;
+	CUtlVector< float >			m_vecDamageDistances;
+	FileHandle_t				m_hEventColumnsExport;
+
 	CUtlMap< CUtlConstString, int > m_MapsPlaytime;
 	char						m_szNextMap[32];
 };
@@ -0,0 +1,198 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Per-tick columnar buffers for high frequency game stats events.
+//
+//=============================================================================//
+
+#include "cbase.h"
+#include "tf_gamestats_columns.h"
+#include "mathlib/ssemath.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CTFGameStatsEventColumns::AddShot( int iPlayer, int iTeam, int iWeapon, bool bCrit )
+{
+	m_shots.m_iPlayer.AddToTail( (uint8)iPlayer );
+	m_shots.m_iTeam.AddToTail( (uint8)iTeam );
+	m_shots.m_iWeapon.AddToTail( (uint16)iWeapon );
+	m_shots.m_bCrit.AddToTail( bCrit ? 1 : 0 );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CTFGameStatsEventColumns::AddDamage( int iAttacker, int iTarget, int iAttackerTeam, int iAttackerClass, int iTargetClass,
+										  int iWeapon, int iDamage, int iDamageTaken, int nFlags,
+										  const Vector &vecTarget, const Vector &vecSource )
+{
+	m_damage.m_iAttacker.AddToTail( (uint8)iAttacker );
+	m_damage.m_iTarget.AddToTail( (uint8)iTarget );
+	m_damage.m_iAttackerTeam.AddToTail( (uint8)iAttackerTeam );
+	m_damage.m_iAttackerClass.AddToTail( (uint8)iAttackerClass );
+	m_damage.m_iTargetClass.AddToTail( (uint8)iTargetClass );
+	m_damage.m_iWeapon.AddToTail( (uint16)iWeapon );
+	m_damage.m_iDamage.AddToTail( (uint16)clamp( iDamage, 0, 0xffff ) );
+	m_damage.m_iDamageTaken.AddToTail( (uint16)clamp( iDamageTaken, 0, 0xffff ) );
+	m_damage.m_nFlags.AddToTail( (uint8)nFlags );
+	m_damage.m_flTargetX.AddToTail( vecTarget.x );
+	m_damage.m_flTargetY.AddToTail( vecTarget.y );
+	m_damage.m_flTargetZ.AddToTail( vecTarget.z );
+	m_damage.m_flSourceX.AddToTail( vecSource.x );
+	m_damage.m_flSourceY.AddToTail( vecSource.y );
+	m_damage.m_flSourceZ.AddToTail( vecSource.z );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CTFGameStatsEventColumns::AddHealing( int iHealer, int iTeam, float flAmount )
+{
+	m_healing.m_iHealer.AddToTail( (uint8)iHealer );
+	m_healing.m_iTeam.AddToTail( (uint8)iTeam );
+	m_healing.m_flAmount.AddToTail( flAmount );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CTFGameStatsEventColumns::ComputeDamageDistances( CUtlVector< float > &vecDistances ) const
+{
+	const int nRows = m_damage.Count();
+	vecDistances.SetCount( nRows );
+	if ( !nRows )
+		return;
+
+	const float *pTX = m_damage.m_flTargetX.Base();
+	const float *pTY = m_damage.m_flTargetY.Base();
+	const float *pTZ = m_damage.m_flTargetZ.Base();
+	const float *pSX = m_damage.m_flSourceX.Base();
+	const float *pSY = m_damage.m_flSourceY.Base();
+	const float *pSZ = m_damage.m_flSourceZ.Base();
+	float *pOut = vecDistances.Base();
+
+	// The columns are already SoA, so this is a straight four-wide loop
+	int i = 0;
+	for ( ; i + 4 <= nRows; i += 4 )
+	{
+		fltx4 dx = SubSIMD( LoadUnalignedSIMD( pTX + i ), LoadUnalignedSIMD( pSX + i ) );
+		fltx4 dy = SubSIMD( LoadUnalignedSIMD( pTY + i ), LoadUnalignedSIMD( pSY + i ) );
+		fltx4 dz = SubSIMD( LoadUnalignedSIMD( pTZ + i ), LoadUnalignedSIMD( pSZ + i ) );
+		fltx4 lenSqr = MaddSIMD( dz, dz, MaddSIMD( dy, dy, MulSIMD( dx, dx ) ) );
+		StoreUnalignedSIMD( pOut + i, SqrtSIMD( lenSqr ) );
+	}
+	for ( ; i < nRows; ++i )
+	{
+		float dx = pTX[i] - pSX[i];
+		float dy = pTY[i] - pSY[i];
+		float dz = pTZ[i] - pSZ[i];
+		pOut[i] = FastSqrt( dx * dx + dy * dy + dz * dz );
+	}
+
+	for ( i = 0; i < nRows; ++i )
+	{
+		if ( !( m_damage.m_nFlags[i] & TF_STATS_DAMAGE_KNOWN_ORIGIN ) )
+		{
+			pOut[i] = 0.0f;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+template < class T >
+static void WriteColumn( FileHandle_t hFile, const CUtlVector< T > &vecColumn )
+{
+	if ( vecColumn.Count() )
+	{
+		g_pFullFileSystem->Write( vecColumn.Base(), vecColumn.Count() * sizeof( T ), hFile );
+	}
+}
+
+static void WriteChunkHeader( FileHandle_t hFile, ETFGameStatsColumnTable eTable, int nTick, float flTime, int nRows )
+{
+	TFGameStatsColumnsChunkHeader_t header;
+	header.m_nTable = eTable;
+	header.m_nTick = nTick;
+	header.m_flTime = flTime;
+	header.m_nRows = nRows;
+	g_pFullFileSystem->Write( &header, sizeof( header ), hFile );
+}
+
+void CTFGameStatsEventColumns::WriteChunks( FileHandle_t hFile, int nTick, float flTime ) const
+{
+	if ( hFile == FILESYSTEM_INVALID_HANDLE )
+		return;
+
+	if ( m_shots.Count() )
+	{
+		WriteChunkHeader( hFile, TF_STATS_TABLE_SHOTS, nTick, flTime, m_shots.Count() );
+		WriteColumn( hFile, m_shots.m_iPlayer );
+		WriteColumn( hFile, m_shots.m_iTeam );
+		WriteColumn( hFile, m_shots.m_iWeapon );
+		WriteColumn( hFile, m_shots.m_bCrit );
+	}
+
+	if ( m_damage.Count() )
+	{
+		WriteChunkHeader( hFile, TF_STATS_TABLE_DAMAGE, nTick, flTime, m_damage.Count() );
+		WriteColumn( hFile, m_damage.m_iAttacker );
+		WriteColumn( hFile, m_damage.m_iTarget );
+		WriteColumn( hFile, m_damage.m_iAttackerTeam );
+		WriteColumn( hFile, m_damage.m_iAttackerClass );
+		WriteColumn( hFile, m_damage.m_iTargetClass );
+		WriteColumn( hFile, m_damage.m_iWeapon );
+		WriteColumn( hFile, m_damage.m_iDamage );
+		WriteColumn( hFile, m_damage.m_iDamageTaken );
+		WriteColumn( hFile, m_damage.m_nFlags );
+		WriteColumn( hFile, m_damage.m_flTargetX );
+		WriteColumn( hFile, m_damage.m_flTargetY );
+		WriteColumn( hFile, m_damage.m_flTargetZ );
+		WriteColumn( hFile, m_damage.m_flSourceX );
+		WriteColumn( hFile, m_damage.m_flSourceY );
+		WriteColumn( hFile, m_damage.m_flSourceZ );
+	}
+
+	if ( m_healing.Count() )
+	{
+		WriteChunkHeader( hFile, TF_STATS_TABLE_HEALING, nTick, flTime, m_healing.Count() );
+		WriteColumn( hFile, m_healing.m_iHealer );
+		WriteColumn( hFile, m_healing.m_iTeam );
+		WriteColumn( hFile, m_healing.m_flAmount );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CTFGameStatsEventColumns::Reset()
+{
+	m_shots.m_iPlayer.RemoveAll();
+	m_shots.m_iTeam.RemoveAll();
+	m_shots.m_iWeapon.RemoveAll();
+	m_shots.m_bCrit.RemoveAll();
+
+	m_damage.m_iAttacker.RemoveAll();
+	m_damage.m_iTarget.RemoveAll();
+	m_damage.m_iAttackerTeam.RemoveAll();
+	m_damage.m_iAttackerClass.RemoveAll();
+	m_damage.m_iTargetClass.RemoveAll();
+	m_damage.m_iWeapon.RemoveAll();
+	m_damage.m_iDamage.RemoveAll();
+	m_damage.m_iDamageTaken.RemoveAll();
+	m_damage.m_nFlags.RemoveAll();
+	m_damage.m_flTargetX.RemoveAll();
+	m_damage.m_flTargetY.RemoveAll();
+	m_damage.m_flTargetZ.RemoveAll();
+	m_damage.m_flSourceX.RemoveAll();
+	m_damage.m_flSourceY.RemoveAll();
+	m_damage.m_flSourceZ.RemoveAll();
+
+	m_healing.m_iHealer.RemoveAll();
+	m_healing.m_iTeam.RemoveAll();
+	m_healing.m_flAmount.RemoveAll();
+}
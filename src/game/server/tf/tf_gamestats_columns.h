@@ -0,0 +1,140 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Per-tick columnar buffers for high frequency game stats events.
+//
+//			Weapon fire, damage and healing events happen many times per tick
+//			in a big fight.  Rather than updating the reported stats structs
+//			on every call, CTFGameStats appends a row to one of these buffers
+//			(one array per field) and aggregates the whole tick at once.
+//
+//			The same columns can be written to a local file for offline
+//			weapon balance analysis, see tf_stats_columns_export.
+//
+//=============================================================================//
+#ifndef TF_GAMESTATS_COLUMNS_H
+#define TF_GAMESTATS_COLUMNS_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "utlvector.h"
+#include "filesystem.h"
+
+//-----------------------------------------------------------------------------
+// Export file format (all values little endian):
+//
+//	TFGameStatsColumnsFileHeader_t
+//	{ TFGameStatsColumnsChunkHeader_t, column 0[nRows], column 1[nRows], ... } *
+//
+// Columns are written in the order they are declared in the tables below.
+//-----------------------------------------------------------------------------
+#define TF_GAMESTATS_COLUMNS_MAGIC		( ( 'L' << 24 ) | ( 'O' << 16 ) | ( 'C' << 8 ) | 'S' )
+#define TF_GAMESTATS_COLUMNS_VERSION	1
+
+enum ETFGameStatsColumnTable
+{
+	TF_STATS_TABLE_SHOTS = 0,
+	TF_STATS_TABLE_DAMAGE,
+	TF_STATS_TABLE_HEALING,
+
+	TF_STATS_TABLE_COUNT
+};
+
+struct TFGameStatsColumnsFileHeader_t
+{
+	uint32	m_nMagic;
+	uint32	m_nVersion;
+	char	m_szMapName[64];
+};
+
+struct TFGameStatsColumnsChunkHeader_t
+{
+	uint32	m_nTable;		// ETFGameStatsColumnTable
+	int32	m_nTick;
+	float	m_flTime;
+	uint32	m_nRows;
+};
+
+// Flags for the damage table
+enum
+{
+	TF_STATS_DAMAGE_CRIT			= ( 1 << 0 ),
+	TF_STATS_DAMAGE_KILL			= ( 1 << 1 ),
+	TF_STATS_DAMAGE_SENTRY			= ( 1 << 2 ),
+	TF_STATS_DAMAGE_KNOWN_ORIGIN	= ( 1 << 3 ),	// m_flSource* columns are valid
+	TF_STATS_DAMAGE_WEAPON_STATS	= ( 1 << 4 ),	// counts towards reported per-weapon stats
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Append-only column buffers for one tick's worth of events
+//-----------------------------------------------------------------------------
+class CTFGameStatsEventColumns
+{
+public:
+	// Shots: one row per Event_PlayerFiredWeapon while the round is running
+	struct Shots_t
+	{
+		CUtlVector< uint8 >		m_iPlayer;
+		CUtlVector< uint8 >		m_iTeam;
+		CUtlVector< uint16 >	m_iWeapon;
+		CUtlVector< uint8 >		m_bCrit;
+
+		int Count() const { return m_iWeapon.Count(); }
+	};
+
+	// Damage: one row per Event_PlayerDamage that wasn't rejected
+	struct Damage_t
+	{
+		CUtlVector< uint8 >		m_iAttacker;
+		CUtlVector< uint8 >		m_iTarget;
+		CUtlVector< uint8 >		m_iAttackerTeam;
+		CUtlVector< uint8 >		m_iAttackerClass;
+		CUtlVector< uint8 >		m_iTargetClass;
+		CUtlVector< uint16 >	m_iWeapon;
+		CUtlVector< uint16 >	m_iDamage;		// Damage from the CTakeDamageInfo
+		CUtlVector< uint16 >	m_iDamageTaken;	// Damage actually applied
+		CUtlVector< uint8 >		m_nFlags;
+		CUtlVector< float >		m_flTargetX;
+		CUtlVector< float >		m_flTargetY;
+		CUtlVector< float >		m_flTargetZ;
+		CUtlVector< float >		m_flSourceX;
+		CUtlVector< float >		m_flSourceY;
+		CUtlVector< float >		m_flSourceZ;
+
+		int Count() const { return m_iWeapon.Count(); }
+	};
+
+	// Healing: one row per Event_PlayerHealedOther
+	struct Healing_t
+	{
+		CUtlVector< uint8 >		m_iHealer;
+		CUtlVector< uint8 >		m_iTeam;
+		CUtlVector< float >		m_flAmount;
+
+		int Count() const { return m_iTeam.Count(); }
+	};
+
+	void AddShot( int iPlayer, int iTeam, int iWeapon, bool bCrit );
+	void AddDamage( int iAttacker, int iTarget, int iAttackerTeam, int iAttackerClass, int iTargetClass,
+					int iWeapon, int iDamage, int iDamageTaken, int nFlags,
+					const Vector &vecTarget, const Vector &vecSource );
+	void AddHealing( int iHealer, int iTeam, float flAmount );
+
+	bool IsEmpty() const { return !m_shots.Count() && !m_damage.Count() && !m_healing.Count(); }
+
+	// Distance from source to target for every damage row, computed four at a time.
+	// Rows without TF_STATS_DAMAGE_KNOWN_ORIGIN get 0.
+	void ComputeDamageDistances( CUtlVector< float > &vecDistances ) const;
+
+	// Writes every non-empty table as a chunk to an export file
+	void WriteChunks( FileHandle_t hFile, int nTick, float flTime ) const;
+
+	// Drops the rows but keeps the memory for the next tick
+	void Reset();
+
+	Shots_t		m_shots;
+	Damage_t	m_damage;
+	Healing_t	m_healing;
+};
+
+#endif // TF_GAMESTATS_COLUMNS_H
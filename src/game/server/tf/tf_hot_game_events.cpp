@@ -0,0 +1,209 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Typed, coalesced path for the game events we fire on every hit.
+//
+//=============================================================================//
+
+#include "cbase.h"
+#include "tf_hot_game_events.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+ConVar tf_hot_events_coalesce( "tf_hot_events_coalesce", "1", FCVAR_NONE, "Merge repeated player_hurt, npc_hurt and player_healed events between the same attacker and victim within a tick." );
+
+//-----------------------------------------------------------------------------
+// Event descriptors.  Keys that differ per event; the rest share their names.
+//-----------------------------------------------------------------------------
+struct TFHotGameEventDesc_t
+{
+	const char *m_pszName;
+	const char *m_pszVictimKey;
+	const char *m_pszAttackerKey;
+	const char *m_pszAmountKey;
+	bool		m_bLethalFlushes;	// Fire the killing blow immediately, so listeners see it before the death event
+};
+
+static const TFHotGameEventDesc_t s_HotGameEventDescs[] =
+{
+	{ "player_hurt",	"userid",	"attacker",			"damageamount",	true },		// TF_HOT_EVENT_PLAYER_HURT
+	{ "npc_hurt",		"entindex",	"attacker_player",	"damageamount",	true },		// TF_HOT_EVENT_NPC_HURT
+	{ "player_healed",	"patient",	"healer",			"amount",		false },	// TF_HOT_EVENT_PLAYER_HEALED
+};
+COMPILE_TIME_ASSERT( ARRAYSIZE( s_HotGameEventDescs ) == TF_HOT_EVENT_COUNT );
+
+static CTFHotGameEventDispatcher g_TFHotGameEventDispatcher;
+CTFHotGameEventDispatcher &TFHotGameEvents() { return g_TFHotGameEventDispatcher; }
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+CTFHotGameEventDispatcher::CTFHotGameEventDispatcher()
+{
+	V_memset( m_nSubmitted, 0, sizeof( m_nSubmitted ) );
+	V_memset( m_nDispatched, 0, sizeof( m_nDispatched ) );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CTFHotGameEventDispatcher::LevelShutdownPreEntity()
+{
+	Flush();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CTFHotGameEventDispatcher::FrameUpdatePostEntityThink()
+{
+	Flush();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Queue an event, merging it into a pending one with the same key
+//-----------------------------------------------------------------------------
+void CTFHotGameEventDispatcher::Fire( const TFHotGameEvent_t &event )
+{
+	Assert( event.m_eType > TF_HOT_EVENT_INVALID && event.m_eType < TF_HOT_EVENT_COUNT );
+	m_nSubmitted[ event.m_eType ]++;
+
+	if ( !tf_hot_events_coalesce.GetBool() )
+	{
+		Dispatch( event );
+		return;
+	}
+
+	const TFHotGameEventDesc_t &desc = s_HotGameEventDescs[ event.m_eType ];
+	bool bLethal = desc.m_bLethalFlushes && ( event.m_bLethal || ( ( event.m_nFieldsSet & TF_HOT_FIELD_HEALTH ) && event.m_nHealth <= 0 ) );
+
+	TFHotGameEventKey_t key;
+	event.GetKey( key );
+
+	UtlHashHandle_t hPending = m_PendingByKey.Find( key );
+	if ( !bLethal )
+	{
+		if ( hPending != m_PendingByKey.InvalidHandle() )
+		{
+			TFHotGameEvent_t &pending = m_vecPending[ m_PendingByKey.Element( hPending ) ];
+			pending.m_nAmount += event.m_nAmount;
+			pending.m_nHealth = event.m_nHealth;
+		}
+		else
+		{
+			m_PendingByKey.Insert( key, m_vecPending.AddToTail( event ) );
+		}
+		return;
+	}
+
+	// The killing blow goes out last, after everything queued before it and
+	// before the death event.  Hits it merges with are folded into it.
+	TFHotGameEvent_t lethalEvent = event;
+	if ( hPending != m_PendingByKey.InvalidHandle() )
+	{
+		TFHotGameEvent_t &pending = m_vecPending[ m_PendingByKey.Element( hPending ) ];
+		lethalEvent.m_nAmount += pending.m_nAmount;
+		pending.m_eType = TF_HOT_EVENT_INVALID;
+		m_PendingByKey.RemoveByHandle( hPending );
+	}
+
+	Flush();
+	Dispatch( lethalEvent );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CTFHotGameEventDispatcher::Flush()
+{
+	if ( !m_vecPending.Count() )
+		return;
+
+	VPROF_BUDGET( "CTFHotGameEventDispatcher::Flush", VPROF_BUDGETGROUP_GAME );
+
+	// Dispatching can cause listeners to fire more hot events.  Those
+	// go into the pending list and are picked up by this loop, so each
+	// entry is closed for merging before it's dispatched.
+	for ( int i = 0; i < m_vecPending.Count(); i++ )
+	{
+		if ( m_vecPending[i].m_eType == TF_HOT_EVENT_INVALID )
+			continue;
+
+		TFHotGameEvent_t event = m_vecPending[i];
+		m_vecPending[i].m_eType = TF_HOT_EVENT_INVALID;
+
+		TFHotGameEventKey_t key;
+		event.GetKey( key );
+		m_PendingByKey.Remove( key );
+
+		Dispatch( event );
+	}
+
+	// Keeps the memory for the next tick
+	m_vecPending.RemoveAll();
+	m_PendingByKey.RemoveAll();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Build and fire the real game event
+//-----------------------------------------------------------------------------
+void CTFHotGameEventDispatcher::Dispatch( const TFHotGameEvent_t &event )
+{
+	const TFHotGameEventDesc_t &desc = s_HotGameEventDescs[ event.m_eType ];
+
+	// Returns NULL if nobody is listening
+	IGameEvent *pEvent = gameeventmanager->CreateEvent( desc.m_pszName );
+	if ( !pEvent )
+		return;
+
+	m_nDispatched[ event.m_eType ]++;
+
+	const int nFields = event.m_nFieldsSet;
+
+	pEvent->SetInt( desc.m_pszVictimKey, event.m_nVictim );
+	pEvent->SetInt( desc.m_pszAmountKey, event.m_nAmount );
+	if ( nFields & TF_HOT_FIELD_ATTACKER )
+		pEvent->SetInt( desc.m_pszAttackerKey, event.m_nAttacker );
+	if ( nFields & TF_HOT_FIELD_HEALTH )
+		pEvent->SetInt( "health", event.m_nHealth );
+	if ( nFields & TF_HOT_FIELD_PRIORITY )
+		pEvent->SetInt( "priority", event.m_nPriority );
+	if ( nFields & TF_HOT_FIELD_WEAPONID )
+		pEvent->SetInt( "weaponid", event.m_nWeaponID );
+	if ( nFields & TF_HOT_FIELD_CUSTOM )
+		pEvent->SetInt( "custom", event.m_nCustom );
+	if ( nFields & TF_HOT_FIELD_BONUSEFFECT )
+		pEvent->SetInt( "bonuseffect", event.m_nBonusEffect );
+	if ( nFields & TF_HOT_FIELD_BOSS )
+		pEvent->SetInt( "boss", event.m_nBoss );
+	if ( nFields & TF_HOT_FIELD_CRIT )
+		pEvent->SetBool( "crit", ( event.m_nFlags & TF_HOT_FIELD_CRIT ) != 0 );
+	if ( nFields & TF_HOT_FIELD_MINICRIT )
+		pEvent->SetBool( "minicrit", ( event.m_nFlags & TF_HOT_FIELD_MINICRIT ) != 0 );
+	if ( nFields & TF_HOT_FIELD_ALLSEECRIT )
+		pEvent->SetBool( "allseecrit", ( event.m_nFlags & TF_HOT_FIELD_ALLSEECRIT ) != 0 );
+	if ( nFields & TF_HOT_FIELD_SHOWDISGUISEDCRIT )
+		pEvent->SetBool( "showdisguisedcrit", ( event.m_nFlags & TF_HOT_FIELD_SHOWDISGUISEDCRIT ) != 0 );
+
+	gameeventmanager->FireEvent( pEvent );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CTFHotGameEventDispatcher::ReportStats()
+{
+	Msg( "%-16s %12s %12s\n", "event", "submitted", "fired" );
+	for ( int i = 0; i < TF_HOT_EVENT_COUNT; i++ )
+	{
+		Msg( "%-16s %12d %12d\n", s_HotGameEventDescs[i].m_pszName, m_nSubmitted[i], m_nDispatched[i] );
+	}
+}
+
+CON_COMMAND( tf_hot_events_report, "Show how many hot game events were submitted and how many were actually fired after merging." )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	TFHotGameEvents().ReportStats();
+}
@@ -0,0 +1,173 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Typed, coalesced path for the game events we fire on every hit.
+//
+//			"player_hurt", "npc_hurt" and "player_healed" can fire many times
+//			per tick for the same attacker and victim (flamethrowers, miniguns,
+//			medigun ticks).  Code that fires them fills in a fixed-layout
+//			TFHotGameEvent_t and hands it to TFHotGameEvents().  Events with
+//			matching keys are merged within the tick (amounts summed, health
+//			taken from the latest), and one real IGameEvent per merged entry
+//			is fired at the end of the tick, so CGameEventListener and
+//			IGameEventListener2 listeners see the normal events.
+//
+//			The IGameEvents themselves can't be reused: FireEvent() takes
+//			ownership and frees them.  What's saved is the events that
+//			merging never creates.
+//
+//=============================================================================//
+#ifndef TF_HOT_GAME_EVENTS_H
+#define TF_HOT_GAME_EVENTS_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "igamesystem.h"
+#include "utlvector.h"
+#include "utlhashtable.h"
+#include "generichash.h"
+
+enum ETFHotGameEvent
+{
+	TF_HOT_EVENT_INVALID = -1,
+
+	TF_HOT_EVENT_PLAYER_HURT = 0,	// "player_hurt"
+	TF_HOT_EVENT_NPC_HURT,			// "npc_hurt"
+	TF_HOT_EVENT_PLAYER_HEALED,		// "player_healed"
+
+	TF_HOT_EVENT_COUNT
+};
+
+// Which optional fields were set.  Fields that weren't set are left out of
+// the fired event, so GetInt( key, default ) keeps returning the default.
+enum
+{
+	TF_HOT_FIELD_ATTACKER			= ( 1 << 0 ),
+	TF_HOT_FIELD_HEALTH				= ( 1 << 1 ),
+	TF_HOT_FIELD_PRIORITY			= ( 1 << 2 ),
+	TF_HOT_FIELD_WEAPONID			= ( 1 << 3 ),
+	TF_HOT_FIELD_CUSTOM				= ( 1 << 4 ),
+	TF_HOT_FIELD_BONUSEFFECT		= ( 1 << 5 ),
+	TF_HOT_FIELD_BOSS				= ( 1 << 6 ),
+	TF_HOT_FIELD_CRIT				= ( 1 << 7 ),
+	TF_HOT_FIELD_MINICRIT			= ( 1 << 8 ),
+	TF_HOT_FIELD_ALLSEECRIT			= ( 1 << 9 ),
+	TF_HOT_FIELD_SHOWDISGUISEDCRIT	= ( 1 << 10 ),
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: The fields that have to match for two events to be merged
+//-----------------------------------------------------------------------------
+struct TFHotGameEventKey_t
+{
+	int		m_nType;
+	int		m_nVictim;
+	int		m_nAttacker;
+	int		m_nFieldsSet;
+	int		m_nFlags;
+	int		m_nWeaponID;
+	int		m_nCustom;
+	int		m_nBonusEffect;
+	int		m_nBoss;
+	int		m_nPriority;
+};
+
+struct TFHotGameEventKeyHashFunctor
+{
+	unsigned int operator()( const TFHotGameEventKey_t &key ) const { return HashBlock( &key, sizeof( key ) ); }
+};
+
+struct TFHotGameEventKeyEqualFunctor
+{
+	bool operator()( const TFHotGameEventKey_t &a, const TFHotGameEventKey_t &b ) const { return V_memcmp( &a, &b, sizeof( a ) ) == 0; }
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Fixed-layout payload for a hot game event
+//-----------------------------------------------------------------------------
+struct TFHotGameEvent_t
+{
+	explicit TFHotGameEvent_t( ETFHotGameEvent eType )
+	{
+		V_memset( this, 0, sizeof( *this ) );
+		m_eType = eType;
+	}
+
+	void SetAttacker( int nAttacker )		{ m_nAttacker = nAttacker; m_nFieldsSet |= TF_HOT_FIELD_ATTACKER; }
+	void SetHealth( int nHealth )			{ m_nHealth = nHealth; m_nFieldsSet |= TF_HOT_FIELD_HEALTH; }
+	void SetPriority( int nPriority )		{ m_nPriority = nPriority; m_nFieldsSet |= TF_HOT_FIELD_PRIORITY; }
+	void SetWeaponID( int nWeaponID )		{ m_nWeaponID = nWeaponID; m_nFieldsSet |= TF_HOT_FIELD_WEAPONID; }
+	void SetCustom( int nCustom )			{ m_nCustom = nCustom; m_nFieldsSet |= TF_HOT_FIELD_CUSTOM; }
+	void SetBonusEffect( int nEffect )		{ m_nBonusEffect = nEffect; m_nFieldsSet |= TF_HOT_FIELD_BONUSEFFECT; }
+	void SetBoss( int nBoss )				{ m_nBoss = nBoss; m_nFieldsSet |= TF_HOT_FIELD_BOSS; }
+	void SetFlag( int nField, bool bValue )	{ m_nFieldsSet |= nField; if ( bValue ) m_nFlags |= nField; else m_nFlags &= ~nField; }
+
+	// For victims that report their health from before the hit.  Otherwise
+	// a health of 0 or less marks the killing blow.
+	void SetLethal( bool bLethal )			{ m_bLethal = bLethal; }
+
+	// Events with equal keys can be merged into one
+	void GetKey( TFHotGameEventKey_t &key ) const
+	{
+		key.m_nType = m_eType;
+		key.m_nVictim = m_nVictim;
+		key.m_nAttacker = m_nAttacker;
+		key.m_nFieldsSet = m_nFieldsSet;
+		key.m_nFlags = m_nFlags;
+		key.m_nWeaponID = m_nWeaponID;
+		key.m_nCustom = m_nCustom;
+		key.m_nBonusEffect = m_nBonusEffect;
+		key.m_nBoss = m_nBoss;
+		key.m_nPriority = m_nPriority;
+	}
+
+	ETFHotGameEvent m_eType;
+	int		m_nVictim;			// player_hurt "userid", npc_hurt "entindex", player_healed "patient"
+	int		m_nAttacker;		// player_hurt "attacker", npc_hurt "attacker_player", player_healed "healer"
+	int		m_nAmount;			// "damageamount" or "amount".  Summed when events are merged.
+	int		m_nHealth;			// Latest value wins when events are merged
+	int		m_nPriority;
+	int		m_nWeaponID;
+	int		m_nCustom;
+	int		m_nBonusEffect;
+	int		m_nBoss;
+	int		m_nFieldsSet;
+	int		m_nFlags;			// Values for the boolean TF_HOT_FIELD_ bits
+	bool	m_bLethal;			// Not sent; makes the event fire straight away
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Collects hot events during the tick and fires them at the end
+//-----------------------------------------------------------------------------
+class CTFHotGameEventDispatcher : public CAutoGameSystemPerFrame
+{
+public:
+	CTFHotGameEventDispatcher();
+
+	virtual char const *Name() { return "CTFHotGameEventDispatcher"; }
+
+	virtual void LevelShutdownPreEntity();
+	virtual void FrameUpdatePostEntityThink();
+
+	void Fire( const TFHotGameEvent_t &event );
+
+	// Fires everything queued so far
+	void Flush();
+
+	void ReportStats();
+
+private:
+	void Dispatch( const TFHotGameEvent_t &event );
+
+	CUtlVector< TFHotGameEvent_t > m_vecPending;
+
+	// Index into m_vecPending of the entry that's still open for merging
+	CUtlHashtable< TFHotGameEventKey_t, int, TFHotGameEventKeyHashFunctor, TFHotGameEventKeyEqualFunctor > m_PendingByKey;
+
+	int m_nSubmitted[ TF_HOT_EVENT_COUNT ];
+	int m_nDispatched[ TF_HOT_EVENT_COUNT ];
+};
+
+CTFHotGameEventDispatcher &TFHotGameEvents();
+
+#endif // TF_HOT_GAME_EVENTS_H
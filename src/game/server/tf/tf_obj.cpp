@@ -46,6 +46,7 @@
 #include "tf_weapon_builder.h"
 
 #include "player_vs_environment/tf_population_manager.h"
+#include "tf_hot_game_events.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -2051,37 +2052,18 @@ int CBaseObject::OnTakeDamage( const CTakeDamageInfo &info )
 
 	ReportDamage( szInflictor, GetClassname(), flDamage, GetHealth(), GetMaxHealth() );
 
-	IGameEvent *event = gameeventmanager->CreateEvent( "npc_hurt" );
-	if ( event )
-	{
-		event->SetInt( "entindex", entindex() );
-		event->SetInt( "health", Max( 0, (int)GetHealth() ) );
-		event->SetInt( "damageamount", flDamage );
-		event->SetBool( "crit", ( info.GetDamageType() & DMG_CRITICAL ) ? true : false );
+	TFHotGameEvent_t hurtEvent( TF_HOT_EVENT_NPC_HURT );
+	hurtEvent.m_nVictim = entindex();
+	hurtEvent.m_nAmount = (int)flDamage;
+	hurtEvent.SetHealth( Max( 0, (int)GetHealth() ) );
+	hurtEvent.SetFlag( TF_HOT_FIELD_CRIT, ( info.GetDamageType() & DMG_CRITICAL ) != 0 );
 
-		CTFPlayer *pTFAttacker = ToTFPlayer( info.GetAttacker() );
-		if ( pTFAttacker )
-		{
-			event->SetInt( "attacker_player", pTFAttacker->GetUserID() );
+	// attacker 0 is hurt by world
+	CTFPlayer *pTFAttacker = ToTFPlayer( info.GetAttacker() );
+	hurtEvent.SetAttacker( pTFAttacker ? pTFAttacker->GetUserID() : 0 );
+	hurtEvent.SetWeaponID( ( pTFAttacker && pTFAttacker->GetActiveTFWeapon() ) ? pTFAttacker->GetActiveTFWeapon()->GetWeaponID() : 0 );
 
-			if ( pTFAttacker->GetActiveTFWeapon() )
-			{
-				event->SetInt( "weaponid", pTFAttacker->GetActiveTFWeapon()->GetWeaponID() );
-			}
-			else
-			{
-				event->SetInt( "weaponid", 0 );
-			}
-		}
-		else
-		{
-			// hurt by world
-			event->SetInt( "attacker_player", 0 );
-			event->SetInt( "weaponid", 0 );
-		}
-
-		gameeventmanager->FireEvent( event );
-	}
+	TFHotGameEvents().Fire( hurtEvent );
 
 	return flDamage;
 }
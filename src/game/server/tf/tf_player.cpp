@@ -137,6 +137,7 @@
 #include "haptics/haptic_utils.h"
 
 #include "gc_clientsystem.h"
+#include "tf_hot_game_events.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -1901,15 +1902,12 @@ void CTFPlayer::RegenThink( void )
 			int nHealedAmount = TakeHealth( nHealAmount, DMG_GENERIC | DMG_IGNORE_DEBUFFS );
 			if ( nHealedAmount > 0 )
 			{
-				IGameEvent *event = gameeventmanager->CreateEvent( "player_healed" );
-				if ( event )
-				{
-					event->SetInt( "priority", 1 );	// HLTV event priority
-					event->SetInt( "patient", GetUserID() );
-					event->SetInt( "healer", GetUserID() );
-					event->SetInt( "amount", nHealedAmount );
-					gameeventmanager->FireEvent( event );
-				}
+				TFHotGameEvent_t healEvent( TF_HOT_EVENT_PLAYER_HEALED );
+				healEvent.SetPriority( 1 );	// HLTV event priority
+				healEvent.m_nVictim = GetUserID();
+				healEvent.SetAttacker( GetUserID() );
+				healEvent.m_nAmount = nHealedAmount;
+				TFHotGameEvents().Fire( healEvent );
 			}
 		}
 	}
@@ -2037,15 +2035,12 @@ void CTFPlayer::RuneRegenThink( void )
 			int nHealedAmount = TakeHealth( nHealAmount, DMG_GENERIC );
 			if ( nHealedAmount > 0 )
 			{
-				IGameEvent *event = gameeventmanager->CreateEvent( "player_healed" );
-				if ( event )
-				{
-					event->SetInt("priority", 1);	// HLTV event priority
-					event->SetInt("patient", GetUserID());
-					event->SetInt( "healer", GetUserID() );
-					event->SetInt( "amount", nHealedAmount );
-					gameeventmanager->FireEvent( event );
-				}
+				TFHotGameEvent_t healEvent( TF_HOT_EVENT_PLAYER_HEALED );
+				healEvent.SetPriority( 1 );	// HLTV event priority
+				healEvent.m_nVictim = GetUserID();
+				healEvent.SetAttacker( GetUserID() );
+				healEvent.m_nAmount = nHealedAmount;
+				TFHotGameEvents().Fire( healEvent );
 			}
 		}
 	}
@@ -10863,45 +10858,45 @@ int CTFPlayer::OnTakeDamage_Alive( const CTakeDamageInfo &info )
 		}
 	}
 
-	// Fire a global game event - "player_hurt"
-	IGameEvent * event = gameeventmanager->CreateEvent( "player_hurt" );
-	if ( event )
+	// Fire a global game event - "player_hurt".  Repeated hits from the same
+	// attacker in this tick are merged, see tf_hot_game_events.h
 	{
-		event->SetInt( "userid", GetUserID() );
-		event->SetInt( "health", MAX( 0, m_iHealth ) );
+		TFHotGameEvent_t hurtEvent( TF_HOT_EVENT_PLAYER_HURT );
+		hurtEvent.m_nVictim = GetUserID();
+		hurtEvent.SetHealth( MAX( 0, m_iHealth ) );
 
 		// HLTV event priority, not transmitted
-		event->SetInt( "priority", 5 );	
+		hurtEvent.SetPriority( 5 );
 
 		int iDamageAmount = ( iPrevHealth - m_iHealth );
-		event->SetInt( "damageamount", outParams.bSendPreFeignDamage ? iPreFeignDamage : iDamageAmount );
+		hurtEvent.m_nAmount = outParams.bSendPreFeignDamage ? iPreFeignDamage : iDamageAmount;
 
 		// Hurt by another player.
 		if ( pAttacker->IsPlayer() )
 		{
 			CBasePlayer *pPlayer = ToBasePlayer( pAttacker );
-			event->SetInt( "attacker", pPlayer->GetUserID() );
-			
-			event->SetInt( "custom", info.GetDamageCustom() );
-			event->SetBool( "showdisguisedcrit", m_bShowDisguisedCrit );
-			event->SetBool( "crit", (info.GetDamageType() & DMG_CRITICAL) != 0 );
-			event->SetBool( "minicrit", m_bMiniCrit );
-			event->SetBool( "allseecrit", m_bAllSeeCrit );
+			hurtEvent.SetAttacker( pPlayer->GetUserID() );
+
+			hurtEvent.SetCustom( info.GetDamageCustom() );
+			hurtEvent.SetFlag( TF_HOT_FIELD_SHOWDISGUISEDCRIT, m_bShowDisguisedCrit );
+			hurtEvent.SetFlag( TF_HOT_FIELD_CRIT, (info.GetDamageType() & DMG_CRITICAL) != 0 );
+			hurtEvent.SetFlag( TF_HOT_FIELD_MINICRIT, m_bMiniCrit );
+			hurtEvent.SetFlag( TF_HOT_FIELD_ALLSEECRIT, m_bAllSeeCrit );
 			Assert( (int)m_eBonusAttackEffect < 256 );
-			event->SetInt( "bonuseffect", (int)m_eBonusAttackEffect );
+			hurtEvent.SetBonusEffect( (int)m_eBonusAttackEffect );
 
 			if ( pTFAttacker && pTFAttacker->GetActiveTFWeapon() )
 			{
-				event->SetInt( "weaponid", pTFAttacker->GetActiveTFWeapon()->GetWeaponID() );
+				hurtEvent.SetWeaponID( pTFAttacker->GetActiveTFWeapon()->GetWeaponID() );
 			}
 		}
 		// Hurt by world.
 		else
 		{
-			event->SetInt( "attacker", 0 );
+			hurtEvent.SetAttacker( 0 );
 		}
 
-        gameeventmanager->FireEvent( event );
+		TFHotGameEvents().Fire( hurtEvent );
 	}
 	
 	if ( pTFAttacker && pTFAttacker != this )
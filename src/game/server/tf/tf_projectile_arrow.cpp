@@ -29,6 +29,7 @@
 #include "tf_weapon_medigun.h"
 #include "soundenvelope.h"
 #include "tf_obj_sentrygun.h"
+#include "tf_hot_game_events.h"
 
 
 //=============================================================================
@@ -1238,20 +1239,18 @@ void CTFProjectile_HealingBolt::ImpactTeamPlayer( CTFPlayer *pOther )
 
 	CTF_GameStats.Event_PlayerHealedOther( pOwner, flHealth );
 
-	IGameEvent * event = gameeventmanager->CreateEvent( "player_healed" );
-	if ( event )
-	{
-		// HLTV event priority, not transmitted
-		event->SetInt( "priority", 1 );	
+	TFHotGameEvent_t healEvent( TF_HOT_EVENT_PLAYER_HEALED );
 
-		// Healed by another player.
-		event->SetInt( "patient", pOther->GetUserID() );
-		event->SetInt( "healer", pOwner->GetUserID() );
-		event->SetInt( "amount", flHealth );
-		gameeventmanager->FireEvent( event );
-	}
+	// HLTV event priority, not transmitted
+	healEvent.SetPriority( 1 );
+
+	// Healed by another player.
+	healEvent.m_nVictim = pOther->GetUserID();
+	healEvent.SetAttacker( pOwner->GetUserID() );
+	healEvent.m_nAmount = (int)flHealth;
+	TFHotGameEvents().Fire( healEvent );
 
-	event = gameeventmanager->CreateEvent( "player_healonhit" );
+	IGameEvent *event = gameeventmanager->CreateEvent( "player_healonhit" );
 	if ( event )
 	{
 		event->SetInt( "amount", flHealth );
@@ -8,6 +8,7 @@
 #else
 #include "beamdraw.h"
 #include <view.h>
+#include "sf/c_goopuddle_renderer.h"
 #endif
 
 ConVar sf_goopuddle_think_tick_time("sf_goopuddle_think_tick_time", "0.1", FCVAR_CHEAT | FCVAR_REPLICATED);
@@ -20,15 +21,17 @@ IMPLEMENT_NETWORKCLASS_ALIASED(TFPropGooPuddle, DT_TFPropGooPuddle)
 BEGIN_NETWORK_TABLE(CTFPropGooPuddle, DT_TFPropGooPuddle)
 #ifdef CLIENT_DLL
 	//RecvPropBool(RECVINFO())
-	RecvPropArray3(RECVINFO_ARRAY(m_vecPuddlePos), RecvPropVector(RECVINFO(m_vecPuddlePos[0]))),
+	RecvPropArray3(RECVINFO_ARRAY(m_nPuddleOffsets), RecvPropInt(RECVINFO(m_nPuddleOffsets[0]))),
+	RecvPropArray3(RECVINFO_ARRAY(m_nPuddleNormals), RecvPropInt(RECVINFO(m_nPuddleNormals[0]))),
 	RecvPropInt(RECVINFO(m_PuddleCount)),
 	RecvPropFloat(RECVINFO(m_flRadius)),
 	RecvPropFloat(RECVINFO(m_flLifetime)),
 	RecvPropInt(RECVINFO(m_nGooType)),
 	RecvPropBool(RECVINFO(m_bCritical)),
 #else
-	SendPropArray3(SENDINFO_ARRAY3(m_vecPuddlePos), SendPropVector(SENDINFO_ARRAY3(m_vecPuddlePos), 12, SPROP_COORD)),
-	SendPropInt(SENDINFO(m_PuddleCount)),
+	SendPropArray3(SENDINFO_ARRAY3(m_nPuddleOffsets), SendPropInt(SENDINFO_ARRAY(m_nPuddleOffsets), PUDDLE_OFFSET_BITS * 3, SPROP_UNSIGNED)),
+	SendPropArray3(SENDINFO_ARRAY3(m_nPuddleNormals), SendPropInt(SENDINFO_ARRAY(m_nPuddleNormals), PUDDLE_NORMAL_BITS, SPROP_UNSIGNED)),
+	SendPropInt(SENDINFO(m_PuddleCount), PUDDLE_COUNT_BITS, SPROP_UNSIGNED),
 	SendPropFloat(SENDINFO(m_flRadius)),
 	SendPropFloat(SENDINFO(m_flLifetime)),
 	SendPropInt(SENDINFO(m_nGooType)),
@@ -41,8 +44,81 @@ PRECACHE_REGISTER(sf_prop_goopuddle);
 
 #define SF_GOOPUDDLE_TESTMODEL "models/weapons/c_models/urinejar.mdl"
 
+COMPILE_TIME_ASSERT(MAX_PUDDLES < (1 << PUDDLE_COUNT_BITS));
+
+//-----------------------------------------------------------------------------
+// Cell encoding, shared so both sides agree on it
+//-----------------------------------------------------------------------------
+#define PUDDLE_OFFSET_MASK ((1 << PUDDLE_OFFSET_BITS) - 1)
+
+// Steps per axis for the normal index.  Odd, so flat ground encodes exactly.
+#define PUDDLE_NORMAL_STEPS 15
+
+static bool PackPuddleOffset(const Vector &offset, int *pPacked)
+{
+	int x = RoundFloatToInt(offset.x);
+	int y = RoundFloatToInt(offset.y);
+	int z = RoundFloatToInt(offset.z);
+
+	if (abs(x) > PUDDLE_OFFSET_MAX || abs(y) > PUDDLE_OFFSET_MAX || abs(z) > PUDDLE_OFFSET_MAX)
+		return false;
+
+	*pPacked = (x & PUDDLE_OFFSET_MASK) | ((y & PUDDLE_OFFSET_MASK) << PUDDLE_OFFSET_BITS) | ((z & PUDDLE_OFFSET_MASK) << (PUDDLE_OFFSET_BITS * 2));
+	return true;
+}
+
+static int UnpackPuddleOffsetAxis(int packed, int axis)
+{
+	int value = (packed >> (PUDDLE_OFFSET_BITS * axis)) & PUDDLE_OFFSET_MASK;
+
+	// Sign extend
+	const int signBit = 1 << (PUDDLE_OFFSET_BITS - 1);
+	return (value ^ signBit) - signBit;
+}
+
+static Vector UnpackPuddleOffset(int packed)
+{
+	return Vector(UnpackPuddleOffsetAxis(packed, 0), UnpackPuddleOffsetAxis(packed, 1), UnpackPuddleOffsetAxis(packed, 2));
+}
+
+// Puddles are grounded with downward traces, so only the upper hemisphere is
+// needed.  The normal is projected onto the octahedron |x| + |y| + z = 1 and
+// the diamond that makes is rotated into a square for the two indices.
+static int PackPuddleNormal(const Vector &normal)
+{
+	Vector n = (normal.z < 0.0f) ? -normal : normal;
+
+	float sum = fabs(n.x) + fabs(n.y) + n.z;
+	if (sum <= 0.0f)
+		return (PUDDLE_NORMAL_STEPS / 2) | ((PUDDLE_NORMAL_STEPS / 2) << 4);
+
+	float px = n.x / sum;
+	float py = n.y / sum;
+
+	int u = RoundFloatToInt(((px + py) * 0.5f + 0.5f) * (PUDDLE_NORMAL_STEPS - 1));
+	int v = RoundFloatToInt(((px - py) * 0.5f + 0.5f) * (PUDDLE_NORMAL_STEPS - 1));
+	u = clamp(u, 0, PUDDLE_NORMAL_STEPS - 1);
+	v = clamp(v, 0, PUDDLE_NORMAL_STEPS - 1);
+
+	return u | (v << 4);
+}
+
+static Vector UnpackPuddleNormal(int packed)
+{
+	float u = ((packed & 0xf) / (float)(PUDDLE_NORMAL_STEPS - 1)) * 2.0f - 1.0f;
+	float v = (((packed >> 4) & 0xf) / (float)(PUDDLE_NORMAL_STEPS - 1)) * 2.0f - 1.0f;
+
+	Vector n;
+	n.x = (u + v) * 0.5f;
+	n.y = (u - v) * 0.5f;
+	n.z = 1.0f - fabs(n.x) - fabs(n.y);
+	VectorNormalize(n);
+	return n;
+}
+
 #ifdef CLIENT_DLL
 extern IMaterialSystem* materials;
+extern ConVar sf_goopuddle_batch;
 #endif
 
 #ifdef GAME_DLL
@@ -221,20 +297,13 @@ void CTFPropGooPuddle::PuddleThink()
 			{
 				float angle = (6.2831 / 6) * (i + 1);
 				Vector angleDir = Vector(cos(angle), sin(angle), 0);
-				Vector nextPos = GroundPuddle((angleDir * PUDDLE_MAX_HALF_WIDTH) + GetAbsOrigin());
+				Vector normal;
+				Vector nextPos = GroundPuddle((angleDir * PUDDLE_MAX_HALF_WIDTH) + GetAbsOrigin(), nullptr, &normal);
 				if (nextPos.IsZero())
 					continue;
-				puddleinfo_t* info = new puddleinfo_t;
-				info->pos = nextPos;
-				info->finishedSpreading = false;
-				info->lifetime.Start(m_flLifetime);
-
-				m_puddles[i] = info;
-
-				m_vecPuddlePos.Set(i, nextPos);
-				m_PuddleCount++;
 
-				RecalculateBounds();
+				if (AddPuddle(nextPos, normal))
+					RecalculateBounds();
 			}
 			SetState(PROPPUDDLESTATE_SPREADING);
 			break;
@@ -310,17 +379,36 @@ bool CTFPropGooPuddle::CreatePuddle(Vector parentPosition, int *traceCount)
 	if (nextPos.DistTo(GetAbsOrigin()) > m_flRadius)
 		return false;
 
-	nextPos = GroundPuddle(nextPos, traceCount);
+	Vector normal;
+	nextPos = GroundPuddle(nextPos, traceCount, &normal);
 	if (nextPos.IsZero())
 		return false;
 
-	puddleinfo_t* info = new puddleinfo_t;
+	return AddPuddle(nextPos, normal);
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Appends a cell and its network encoding.  Fails if the cell is too
+//			far from the prop origin to be encoded.
+//-----------------------------------------------------------------------------
+bool CTFPropGooPuddle::AddPuddle(const Vector &pos, const Vector &normal)
+{
+	if (m_PuddleCount >= MAX_PUDDLES)
+		return false;
+
+	int packedOffset;
+	if (!PackPuddleOffset(pos - GetAbsOrigin(), &packedOffset))
+		return false;
 
-	info->pos = nextPos;
+	puddleinfo_t* info = new puddleinfo_t;
+	info->pos = pos;
+	info->finishedSpreading = false;
 	info->lifetime.Start(m_flLifetime);
-	m_puddles[m_PuddleCount + 1] = info;
 
-	m_vecPuddlePos.Set(m_PuddleCount + 1, nextPos);
+	m_puddles[m_PuddleCount] = info;
+	m_nPuddleOffsets.Set(m_PuddleCount, packedOffset);
+	m_nPuddleNormals.Set(m_PuddleCount, PackPuddleNormal(normal));
+	m_PuddleCount++;
 
 	return true;
 }
@@ -351,7 +439,6 @@ int CTFPropGooPuddle::Spread()
 		if (!CreatePuddle(parentInfo->pos, &traceCount))
 			continue;
 
-		m_PuddleCount++;
 		newPuddles++;
 
 		m_CurPuddleOffset = puddleCount - 1;
@@ -366,7 +453,7 @@ int CTFPropGooPuddle::Spread()
 	}
 	return newPuddles;
 }
-Vector CTFPropGooPuddle::GroundPuddle(Vector pos, int* tracecount)
+Vector CTFPropGooPuddle::GroundPuddle(Vector pos, int* tracecount, Vector *pNormal)
 {
 	trace_t tr;
 	UTIL_TraceLine(pos + Vector(0.0f, 0.0f, 50.0f), pos + Vector(0.0f, 0.0f, -200.0f), MASK_SOLID, this, COLLISION_GROUP_PLAYER_MOVEMENT, &tr);
@@ -378,6 +465,9 @@ Vector CTFPropGooPuddle::GroundPuddle(Vector pos, int* tracecount)
 	if (tr.fraction == 1.0)
 		return Vector(0, 0, 0);
 
+	if (pNormal)
+		*pNormal = tr.plane.normal;
+
 	return tr.endpos + Vector(0.0f, 0.0f, 1.0f);
 }
 
@@ -424,7 +514,9 @@ void CTFPropGooPuddle::OnDataChanged(DataUpdateType_t updateType)
 			}
 			else
 				m_pMaterial.Init(PUDDLE_JUMP_MATERIAL, TEXTURE_GROUP_CLIENT_EFFECTS);
-			
+
+			// The first update can already carry cells
+			InitializeNewPuddleData();
 			break;
 		case DATA_UPDATE_DATATABLE_CHANGED:
 			InitializeNewPuddleData();
@@ -442,27 +534,23 @@ float CTFPropGooPuddle::GetTimeSinceSpawned()
 
 void CTFPropGooPuddle::InitializeNewPuddleData()
 {
-	for (int i = 0; i < m_PuddleCount; i++)
+	// Cells are only appended, so everything past the ones we've already set up is new
+	const Vector &origin = GetNetworkOrigin();
+	for (int i = m_iInitializedPuddles; i < m_PuddleCount; i++)
 	{
 		c_puddleinfo_t* info = &m_puddleArray[i];
 
 		if (info->state == PUDDLESTATE_UNINITIALIZED)
 		{
-			InitializePuddleInfo(info, m_vecPuddlePos[i]);
+			InitializePuddleInfo(info, origin + UnpackPuddleOffset(m_nPuddleOffsets[i]), UnpackPuddleNormal(m_nPuddleNormals[i]));
 		}
 	}
 }
 
-void CTFPropGooPuddle::InitializePuddleInfo(c_puddleinfo_t* info, Vector pos)
+void CTFPropGooPuddle::InitializePuddleInfo(c_puddleinfo_t* info, const Vector &pos, const Vector &normal)
 {
-	trace_t tr;
-	UTIL_TraceLine(pos, pos + Vector(0.0f, 0.0f, -10.0f), MASK_SOLID, this, COLLISION_GROUP_PLAYER_MOVEMENT, &tr);
-
-	if (tr.fraction == 1.0f)
-		return;
-
 	info->pos = pos;
-	info->normal = tr.plane.normal;
+	info->normal = normal;
 	info->size = 0;
 	info->maxSize = RandomFloat(PUDDLE_MIN_SIZE, PUDDLE_MAX_SIZE);
 	info->SetState(PUDDLESTATE_STARTING);
@@ -660,7 +748,29 @@ void CTFPropGooPuddle::GetRenderBoundsWorldspace(Vector& mins, Vector& maxs)
 
 int CTFPropGooPuddle::DrawModel(int flags)
 {
-	CMeshBuilder meshBuilder;
+	// Queue the cells; the view renderer draws every puddle's cells at once.
+	// The TeamColor proxy only looks at the puddle's team, so puddles of one
+	// team can share a batch.
+	if (sf_goopuddle_batch.GetBool())
+	{
+		for (int i = 0; i < m_PuddleCount; i++)
+		{
+			c_puddleinfo_t* info = &m_puddleArray[i];
+			if (info->state != PUDDLESTATE_DEAD && info->state != PUDDLESTATE_UNINITIALIZED)
+			{
+				GooPuddleRenderer()->AddToRenderCache(m_pMaterial, GetClientRenderable(), GetTeamNumber(), info->pos, info->normal, info->size);
+			}
+		}
+
+		// Translucent puddles draw now, in their sorted slot.  The opaque
+		// cells were flushed at the end of the opaque pass.
+		if (flags & STUDIO_TRANSPARENCY)
+		{
+			GooPuddleRenderer()->DrawRenderCache((flags & STUDIO_SHADOWDEPTHTEXTURE) != 0);
+		}
+
+		return BaseClass::DrawModel(flags);
+	}
 
 	CMatRenderContextPtr pRenderContext(materials);
 	pRenderContext->Bind(m_pMaterial, GetClientRenderable());
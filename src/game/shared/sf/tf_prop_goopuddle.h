@@ -21,6 +21,14 @@
 #define PUDDLE_FADE_TIME 1.7f
 #define PUDDLE_DAMAGE_BUILDINGS_INTERVAL 1.0f
 
+// Cells are networked as whole-unit offsets from the prop origin, 10 bits
+// signed per axis packed into one int, plus an 8 bit index for the surface
+// normal.  Cells further out than that are never created.
+#define PUDDLE_OFFSET_BITS 10
+#define PUDDLE_OFFSET_MAX ((1 << (PUDDLE_OFFSET_BITS - 1)) - 1)
+#define PUDDLE_NORMAL_BITS 8
+#define PUDDLE_COUNT_BITS 6
+
 #ifdef GAME_DLL
 class CTFPropGooPuddle : public CBaseAnimating, public IScorer
 #else
@@ -106,8 +114,9 @@ public:
 
 	virtual void		SetState(PropPuddleState state);
 	virtual bool		CreatePuddle(Vector parentPosition, int *traceCount = nullptr);
+	bool				AddPuddle(const Vector &pos, const Vector &normal);
 	virtual int			Spread();
-	virtual Vector		GroundPuddle(Vector pos, int *tracecount = nullptr);
+	virtual Vector		GroundPuddle(Vector pos, int *tracecount = nullptr, Vector *pNormal = nullptr);
 	virtual void		PuddleThink();
 
 #else
@@ -121,7 +130,7 @@ public:
 	float				GetTimeSinceSpawned();
 
 	void				InitializeNewPuddleData();
-	void				InitializePuddleInfo(c_puddleinfo_t* info, Vector pos);
+	void				InitializePuddleInfo(c_puddleinfo_t* info, const Vector &pos, const Vector &normal);
 	virtual void		ClientThink();
 	void				KillPuddle(c_puddleinfo_t* info);
 	//void				UpdatePuddleCount();
@@ -135,8 +144,9 @@ public:
 
 private:
 #ifdef GAME_DLL
-	// Networked
-	CNetworkArray(Vector, m_vecPuddlePos, MAX_PUDDLES);
+	// Networked.  Cells are only ever appended, so each update just carries the new ones.
+	CNetworkArray(int, m_nPuddleOffsets, MAX_PUDDLES);
+	CNetworkArray(int, m_nPuddleNormals, MAX_PUDDLES);
 	CNetworkVar(int, m_PuddleCount);
 	CNetworkVar(float, m_flRadius);
 	CNetworkVar(float, m_flLifetime);
@@ -163,7 +173,8 @@ private:
 #else
 
 	// Networked
-	Vector m_vecPuddlePos[MAX_PUDDLES];
+	int m_nPuddleOffsets[MAX_PUDDLES];
+	int m_nPuddleNormals[MAX_PUDDLES];
 	int m_PuddleCount;
 	float m_flRadius;
 	float m_flLifetime;
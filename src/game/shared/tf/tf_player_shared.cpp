@@ -71,6 +71,7 @@
 #include "util.h"
 #include "tf_team.h"
 #include "tf_gamestats.h"
+#include "tf_hot_game_events.h"
 #include "tf_playerclass.h"
 #include "SpriteTrail.h"
 #include "tf_weapon_builder.h"
@@ -2630,18 +2631,16 @@ void CTFPlayerShared::ConditionGameRulesThink( void )
 											}
 										}
 
-										IGameEvent * event = gameeventmanager->CreateEvent( "player_healed" );
-										if ( event )
-										{
-											// HLTV event priority, not transmitted
-											event->SetInt( "priority", 1 );	
-
-											// Healed by another player.
-											event->SetInt( "patient", m_pOuter->GetUserID() );
-											event->SetInt( "healer", pHealScorer->GetUserID() );
-											event->SetInt( "amount", m_aHealers[i].flHealedLastSecond );
-											gameeventmanager->FireEvent( event );
-										}
+										TFHotGameEvent_t healEvent( TF_HOT_EVENT_PLAYER_HEALED );
+
+										// HLTV event priority, not transmitted
+										healEvent.SetPriority( 1 );
+
+										// Healed by another player.
+										healEvent.m_nVictim = m_pOuter->GetUserID();
+										healEvent.SetAttacker( pHealScorer->GetUserID() );
+										healEvent.m_nAmount = (int)m_aHealers[i].flHealedLastSecond;
+										TFHotGameEvents().Fire( healEvent );
 
 										// Can we figure out which item is doing this healing?
 										if ( pHealScorer )
@@ -26,6 +26,7 @@
 #include "tf_player.h"
 #include "tf_weapon_medigun.h"
 #include "tf_gamestats.h"
+#include "tf_hot_game_events.h"
 
 #include "tf_player.h"
 #include "tf_gamerules.h"
@@ -5095,15 +5096,12 @@ void CTFWeaponBase::ApplyOnHitAttributes( CBaseEntity *pVictimBaseEntity, CTFPla
 				}
 
 				// Show in the medic's UI as primary healing
-				IGameEvent *event = gameeventmanager->CreateEvent( "player_healed" );
-				if ( event )
-				{
-					event->SetInt( "priority", 1 );	// HLTV event priority
-					event->SetInt( "patient", pAttacker->GetUserID() );
-					event->SetInt( "healer", pProvider->GetUserID() );
-					event->SetInt( "amount", iModHealthOnHit );
-					gameeventmanager->FireEvent( event );
-				}
+				TFHotGameEvent_t healEvent( TF_HOT_EVENT_PLAYER_HEALED );
+				healEvent.SetPriority( 1 );	// HLTV event priority
+				healEvent.m_nVictim = pAttacker->GetUserID();
+				healEvent.SetAttacker( pProvider->GetUserID() );
+				healEvent.m_nAmount = iModHealthOnHit;
+				TFHotGameEvents().Fire( healEvent );
 
 				// Give them a little bit of Uber
 				CWeaponMedigun *pMedigun = static_cast<CWeaponMedigun *>( pProvider->Weapon_OwnsThisID( TF_WEAPON_MEDIGUN ) );
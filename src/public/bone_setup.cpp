@@ -1366,6 +1366,496 @@ void WorldSpaceSlerp(
 
 
 
+//-----------------------------------------------------------------------------
+// Bone layer blending, four bones at a time.
+//
+// SlerpBones and BlendBones reduce each layer to a per-bone weight (0 for
+// bones the layer doesn't touch) and hand the arrays to one of the kernels
+// below.  The SIMD kernel transposes four bones into x/y/z/w columns and
+// runs the same math as the scalar mathlib routines on all four lanes,
+// keeping lanes with a zero weight unchanged.  acos/asin/sin stay per lane,
+// and a block with an antipodal slerp goes to the scalar kernel, so the
+// results match the scalar path.
+//-----------------------------------------------------------------------------
+static ConVar anim_simd_blend( "anim_simd_blend", "1", FCVAR_REPLICATED, "Blend animation layers four bones at a time with SSE (0 uses the scalar path)." );
+
+enum BoneBlendOp_t
+{
+	BONE_BLEND_SLERP = 0,		// slerp( q2, q1, 1 - s2 ), lerp positions
+	BONE_BLEND_NLERP,			// normalized lerp( q2, q1, 1 - s2 ), lerp positions
+	BONE_BLEND_DELTA_PRE,		// ( s2 * q2 ) * q1, add s2 * pos2
+	BONE_BLEND_DELTA_POST,		// q1 * ( s2 * q2 ), add s2 * pos2
+
+	BONE_BLEND_OP_COUNT
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: The reference per-bone loop.  pNoAlign is optional; a non-zero
+//			entry means the bone has BONE_FIXED_ALIGNMENT.
+//-----------------------------------------------------------------------------
+static void BlendBoneLayerScalar( BoneBlendOp_t op, int nBoneCount, const float *pS2, const uint32 *pNoAlign,
+	Quaternion *q1, Vector *pos1, const Quaternion *q2, const Vector *pos2 )
+{
+	Quaternion q3;
+	for ( int i = 0; i < nBoneCount; i++ )
+	{
+		float s2 = pS2[i];
+		if ( s2 <= 0.0f )
+			continue;
+
+		bool bNoAlign = pNoAlign && pNoAlign[i];
+
+		switch ( op )
+		{
+		case BONE_BLEND_SLERP:
+		case BONE_BLEND_NLERP:
+			{
+				float s1 = 1.0 - s2;
+
+#ifdef _X360
+				if ( op == BONE_BLEND_SLERP )
+				{
+					fltx4 q1simd = LoadUnalignedSIMD( q1[i].Base() );
+					fltx4 q2simd = LoadAlignedSIMD( q2[i].Base() );
+					fltx4 result = bNoAlign ? QuaternionSlerpNoAlignSIMD( q2simd, q1simd, s1 ) : QuaternionSlerpSIMD( q2simd, q1simd, s1 );
+					StoreUnalignedSIMD( q3.Base(), result );
+				}
+				else
+#endif
+				if ( op == BONE_BLEND_SLERP )
+				{
+					if ( bNoAlign )
+					{
+						QuaternionSlerpNoAlign( q2[i], q1[i], s1, q3 );
+					}
+					else
+					{
+						QuaternionSlerp( q2[i], q1[i], s1, q3 );
+					}
+				}
+				else
+				{
+					if ( bNoAlign )
+					{
+						QuaternionBlendNoAlign( q2[i], q1[i], s1, q3 );
+					}
+					else
+					{
+						QuaternionBlend( q2[i], q1[i], s1, q3 );
+					}
+				}
+
+				q1[i][0] = q3[0];
+				q1[i][1] = q3[1];
+				q1[i][2] = q3[2];
+				q1[i][3] = q3[3];
+
+				pos1[i][0] = pos1[i][0] * s1 + pos2[i][0] * s2;
+				pos1[i][1] = pos1[i][1] * s1 + pos2[i][1] * s2;
+				pos1[i][2] = pos1[i][2] * s1 + pos2[i][2] * s2;
+			}
+			break;
+
+		case BONE_BLEND_DELTA_PRE:
+		case BONE_BLEND_DELTA_POST:
+			{
+#ifndef _X360
+				if ( op == BONE_BLEND_DELTA_POST )
+				{
+					QuaternionMA( q1[i], s2, q2[i], q1[i] );
+				}
+				else
+				{
+					QuaternionSM( s2, q2[i], q1[i], q1[i] );
+				}
+#else
+				fltx4 q1simd = LoadUnalignedSIMD( q1[i].Base() );
+				fltx4 q2simd = LoadAlignedSIMD( q2[i].Base() );
+				fltx4 result = ( op == BONE_BLEND_DELTA_POST ) ? QuaternionMASIMD( q1simd, s2, q2simd ) : QuaternionSMSIMD( s2, q2simd, q1simd );
+				StoreUnalignedSIMD( q1[i].Base(), result );
+#endif
+
+				// FIXME: are these correct?
+				pos1[i][0] = pos1[i][0] + pos2[i][0] * s2;
+				pos1[i][1] = pos1[i][1] + pos2[i][1] * s2;
+				pos1[i][2] = pos1[i][2] + pos2[i][2] * s2;
+			}
+			break;
+
+		default:
+			Assert( 0 );
+			break;
+		}
+	}
+}
+
+#ifndef _X360
+
+//-----------------------------------------------------------------------------
+// Four quaternions stored as x x x x y y y y z z z z w w w w
+//-----------------------------------------------------------------------------
+struct FourBoneQuaternions_t
+{
+	fltx4 x, y, z, w;
+
+	FORCEINLINE void LoadAndSwizzle( const Quaternion *pQ )
+	{
+		x = LoadUnalignedSIMD( pQ[0].Base() );
+		y = LoadUnalignedSIMD( pQ[1].Base() );
+		z = LoadUnalignedSIMD( pQ[2].Base() );
+		w = LoadUnalignedSIMD( pQ[3].Base() );
+		TransposeSIMD( x, y, z, w );
+	}
+
+	FORCEINLINE void TransposeAndStore( Quaternion *pQ ) const
+	{
+		fltx4 a = x, b = y, c = z, d = w;
+		TransposeSIMD( a, b, c, d );
+		StoreUnalignedSIMD( pQ[0].Base(), a );
+		StoreUnalignedSIMD( pQ[1].Base(), b );
+		StoreUnalignedSIMD( pQ[2].Base(), c );
+		StoreUnalignedSIMD( pQ[3].Base(), d );
+	}
+
+	// Lanes set in mask come from a, the rest from b
+	FORCEINLINE void Select( const fltx4 &mask, const FourBoneQuaternions_t &a, const FourBoneQuaternions_t &b )
+	{
+		x = MaskedAssign( mask, a.x, b.x );
+		y = MaskedAssign( mask, a.y, b.y );
+		z = MaskedAssign( mask, a.z, b.z );
+		w = MaskedAssign( mask, a.w, b.w );
+	}
+};
+
+// The sums below are written in the same order as the scalar mathlib code
+FORCEINLINE fltx4 QuaternionDot4( const FourBoneQuaternions_t &p, const FourBoneQuaternions_t &q )
+{
+	return AddSIMD( AddSIMD( AddSIMD( MulSIMD( p.x, q.x ), MulSIMD( p.y, q.y ) ), MulSIMD( p.z, q.z ) ), MulSIMD( p.w, q.w ) );
+}
+
+// QuaternionAlign, skipped for lanes set in noAlign
+FORCEINLINE void QuaternionAlign4( const FourBoneQuaternions_t &p, const FourBoneQuaternions_t &q, const fltx4 &noAlign, FourBoneQuaternions_t &qt )
+{
+	fltx4 dx = SubSIMD( p.x, q.x ), dy = SubSIMD( p.y, q.y ), dz = SubSIMD( p.z, q.z ), dw = SubSIMD( p.w, q.w );
+	fltx4 sx = AddSIMD( p.x, q.x ), sy = AddSIMD( p.y, q.y ), sz = AddSIMD( p.z, q.z ), sw = AddSIMD( p.w, q.w );
+	fltx4 a = AddSIMD( AddSIMD( AddSIMD( MulSIMD( dx, dx ), MulSIMD( dy, dy ) ), MulSIMD( dz, dz ) ), MulSIMD( dw, dw ) );
+	fltx4 b = AddSIMD( AddSIMD( AddSIMD( MulSIMD( sx, sx ), MulSIMD( sy, sy ) ), MulSIMD( sz, sz ) ), MulSIMD( sw, sw ) );
+	fltx4 flip = AndNotSIMD( noAlign, CmpGtSIMD( a, b ) );
+
+	qt.x = MaskedAssign( flip, NegSIMD( q.x ), q.x );
+	qt.y = MaskedAssign( flip, NegSIMD( q.y ), q.y );
+	qt.z = MaskedAssign( flip, NegSIMD( q.z ), q.z );
+	qt.w = MaskedAssign( flip, NegSIMD( q.w ), q.w );
+}
+
+// QuaternionNormalize
+FORCEINLINE void QuaternionNormalize4( FourBoneQuaternions_t &q )
+{
+	fltx4 radius = QuaternionDot4( q, q );
+	fltx4 zero = CmpEqSIMD( radius, Four_Zeros );
+	fltx4 iradius = DivSIMD( Four_Ones, SqrtSIMD( radius ) );
+	q.x = MaskedAssign( zero, q.x, MulSIMD( q.x, iradius ) );
+	q.y = MaskedAssign( zero, q.y, MulSIMD( q.y, iradius ) );
+	q.z = MaskedAssign( zero, q.z, MulSIMD( q.z, iradius ) );
+	q.w = MaskedAssign( zero, q.w, MulSIMD( q.w, iradius ) );
+}
+
+// sclp * p + sclq * q
+FORCEINLINE void QuaternionLerp4( const FourBoneQuaternions_t &p, const FourBoneQuaternions_t &q, const fltx4 &sclp, const fltx4 &sclq, FourBoneQuaternions_t &qt )
+{
+	qt.x = AddSIMD( MulSIMD( sclp, p.x ), MulSIMD( sclq, q.x ) );
+	qt.y = AddSIMD( MulSIMD( sclp, p.y ), MulSIMD( sclq, q.y ) );
+	qt.z = AddSIMD( MulSIMD( sclp, p.z ), MulSIMD( sclq, q.z ) );
+	qt.w = AddSIMD( MulSIMD( sclp, p.w ), MulSIMD( sclq, q.w ) );
+}
+
+// QuaternionSlerpNoAlign for the lanes set in active.  Returns false if an
+// active lane is antipodal, which the caller has to do with the scalar code.
+FORCEINLINE bool QuaternionSlerpNoAlign4( const FourBoneQuaternions_t &p, const FourBoneQuaternions_t &q, const fltx4 &t, const fltx4 &active, FourBoneQuaternions_t &qt )
+{
+	fltx4 threshold = ReplicateX4( 0.000001f );
+
+	fltx4 cosom = QuaternionDot4( p, q );
+	fltx4 antipodal = AndSIMD( active, CmpLeSIMD( AddSIMD( Four_Ones, cosom ), threshold ) );
+	if ( !IsAllZeros( antipodal ) )
+		return false;
+
+	fltx4 sclq = t;
+	fltx4 sclp = SubSIMD( Four_Ones, t );
+
+	fltx4 slerpLanes = AndSIMD( active, CmpGtSIMD( SubSIMD( Four_Ones, cosom ), threshold ) );
+	if ( !IsAllZeros( slerpLanes ) )
+	{
+		for ( int k = 0; k < 4; k++ )
+		{
+			if ( !SubInt( slerpLanes, k ) )
+				continue;
+
+			float omega = acos( SubFloat( cosom, k ) );
+			float sinom = sin( omega );
+			SubFloat( sclp, k ) = sin( ( 1.0f - SubFloat( t, k ) ) * omega ) / sinom;
+			SubFloat( sclq, k ) = sin( SubFloat( t, k ) * omega ) / sinom;
+		}
+	}
+
+	QuaternionLerp4( p, q, sclp, sclq, qt );
+	return true;
+}
+
+// QuaternionScale for the lanes set in active
+FORCEINLINE void QuaternionScale4( const FourBoneQuaternions_t &p, const fltx4 &t, const fltx4 &active, FourBoneQuaternions_t &q )
+{
+	fltx4 sinom = SqrtSIMD( AddSIMD( AddSIMD( MulSIMD( p.x, p.x ), MulSIMD( p.y, p.y ) ), MulSIMD( p.z, p.z ) ) );
+	sinom = MinSIMD( sinom, Four_Ones );
+
+	fltx4 sinsom = Four_Zeros;
+	for ( int k = 0; k < 4; k++ )
+	{
+		if ( SubInt( active, k ) )
+		{
+			SubFloat( sinsom, k ) = sin( asin( SubFloat( sinom, k ) ) * SubFloat( t, k ) );
+		}
+	}
+
+	fltx4 scale = DivSIMD( sinsom, AddSIMD( sinom, Four_Epsilons ) );
+	q.x = MulSIMD( p.x, scale );
+	q.y = MulSIMD( p.y, scale );
+	q.z = MulSIMD( p.z, scale );
+
+	// rescale rotation, keeping its sign
+	fltx4 r = SqrtSIMD( MaxSIMD( SubSIMD( Four_Ones, MulSIMD( sinsom, sinsom ) ), Four_Zeros ) );
+	q.w = MaskedAssign( CmpLtSIMD( p.w, Four_Zeros ), NegSIMD( r ), r );
+}
+
+// QuaternionMult, including its alignment of q to p
+FORCEINLINE void QuaternionMult4( const FourBoneQuaternions_t &p, const FourBoneQuaternions_t &q, FourBoneQuaternions_t &qt )
+{
+	FourBoneQuaternions_t q2;
+	QuaternionAlign4( p, q, Four_Zeros, q2 );
+
+	qt.x = AddSIMD( SubSIMD( AddSIMD( MulSIMD( p.x, q2.w ), MulSIMD( p.y, q2.z ) ), MulSIMD( p.z, q2.y ) ), MulSIMD( p.w, q2.x ) );
+	qt.y = AddSIMD( AddSIMD( AddSIMD( MulSIMD( NegSIMD( p.x ), q2.z ), MulSIMD( p.y, q2.w ) ), MulSIMD( p.z, q2.x ) ), MulSIMD( p.w, q2.y ) );
+	qt.z = AddSIMD( AddSIMD( SubSIMD( MulSIMD( p.x, q2.y ), MulSIMD( p.y, q2.x ) ), MulSIMD( p.z, q2.w ) ), MulSIMD( p.w, q2.z ) );
+	qt.w = AddSIMD( SubSIMD( SubSIMD( MulSIMD( NegSIMD( p.x ), q2.x ), MulSIMD( p.y, q2.y ) ), MulSIMD( p.z, q2.z ) ), MulSIMD( p.w, q2.w ) );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Same results as BlendBoneLayerScalar, four bones per iteration
+//-----------------------------------------------------------------------------
+static void BlendBoneLayerSIMD( BoneBlendOp_t op, int nBoneCount, const float *pS2, const uint32 *pNoAlign,
+	Quaternion *q1, Vector *pos1, const Quaternion *q2, const Vector *pos2 )
+{
+	const bool bLerpPositions = ( op == BONE_BLEND_SLERP || op == BONE_BLEND_NLERP );
+
+	int i = 0;
+	for ( ; i + 4 <= nBoneCount; i += 4 )
+	{
+		fltx4 s2 = LoadUnalignedSIMD( pS2 + i );
+		fltx4 active = CmpGtSIMD( s2, Four_Zeros );
+		if ( IsAllZeros( active ) )
+			continue;
+
+		fltx4 noAlign = pNoAlign ? LoadUnalignedSIMD( pNoAlign + i ) : Four_Zeros;
+		fltx4 s1 = SubSIMD( Four_Ones, s2 );
+
+		FourBoneQuaternions_t a, b, result;
+		a.LoadAndSwizzle( q1 + i );
+		b.LoadAndSwizzle( q2 + i );
+
+		switch ( op )
+		{
+		case BONE_BLEND_SLERP:
+			{
+				FourBoneQuaternions_t aligned;
+				QuaternionAlign4( b, a, noAlign, aligned );
+				if ( !QuaternionSlerpNoAlign4( b, aligned, s1, active, result ) )
+				{
+					BlendBoneLayerScalar( op, 4, pS2 + i, pNoAlign ? pNoAlign + i : NULL, q1 + i, pos1 + i, q2 + i, pos2 + i );
+					continue;
+				}
+			}
+			break;
+
+		case BONE_BLEND_NLERP:
+			{
+				FourBoneQuaternions_t aligned;
+				QuaternionAlign4( b, a, noAlign, aligned );
+				QuaternionLerp4( b, aligned, SubSIMD( Four_Ones, s1 ), s1, result );
+				QuaternionNormalize4( result );
+			}
+			break;
+
+		case BONE_BLEND_DELTA_PRE:
+			{
+				FourBoneQuaternions_t scaled;
+				QuaternionScale4( b, s2, active, scaled );
+				QuaternionMult4( scaled, a, result );
+				QuaternionNormalize4( result );
+			}
+			break;
+
+		case BONE_BLEND_DELTA_POST:
+			{
+				FourBoneQuaternions_t scaled;
+				QuaternionScale4( b, s2, active, scaled );
+				QuaternionMult4( a, scaled, result );
+				QuaternionNormalize4( result );
+			}
+			break;
+
+		default:
+			Assert( 0 );
+			return;
+		}
+
+		result.Select( active, result, a );
+		result.TransposeAndStore( q1 + i );
+
+		// LoadAndSwizzle reads a float past the last vector, so the block at
+		// the very end of the arrays does its positions one at a time
+		if ( i + 4 < nBoneCount )
+		{
+			FourVectors p1, p2;
+			p1.LoadAndSwizzle( pos1[i], pos1[i+1], pos1[i+2], pos1[i+3] );
+			p2.LoadAndSwizzle( pos2[i], pos2[i+1], pos2[i+2], pos2[i+3] );
+
+			fltx4 scale1 = bLerpPositions ? s1 : Four_Ones;
+			fltx4 x = MaskedAssign( active, AddSIMD( MulSIMD( p1.x, scale1 ), MulSIMD( p2.x, s2 ) ), p1.x );
+			fltx4 y = MaskedAssign( active, AddSIMD( MulSIMD( p1.y, scale1 ), MulSIMD( p2.y, s2 ) ), p1.y );
+			fltx4 z = MaskedAssign( active, AddSIMD( MulSIMD( p1.z, scale1 ), MulSIMD( p2.z, s2 ) ), p1.z );
+			fltx4 w = Four_Zeros;
+			TransposeSIMD( x, y, z, w );
+			StoreUnaligned3SIMD( pos1[i].Base(), x );
+			StoreUnaligned3SIMD( pos1[i+1].Base(), y );
+			StoreUnaligned3SIMD( pos1[i+2].Base(), z );
+			StoreUnaligned3SIMD( pos1[i+3].Base(), w );
+		}
+		else
+		{
+			for ( int k = i; k < i + 4; k++ )
+			{
+				float flS2 = pS2[k];
+				if ( flS2 <= 0.0f )
+					continue;
+
+				float flS1 = bLerpPositions ? ( float )( 1.0 - flS2 ) : 1.0f;
+				pos1[k][0] = pos1[k][0] * flS1 + pos2[k][0] * flS2;
+				pos1[k][1] = pos1[k][1] * flS1 + pos2[k][1] * flS2;
+				pos1[k][2] = pos1[k][2] * flS1 + pos2[k][2] * flS2;
+			}
+		}
+	}
+
+	if ( i < nBoneCount )
+	{
+		BlendBoneLayerScalar( op, nBoneCount - i, pS2 + i, pNoAlign ? pNoAlign + i : NULL, q1 + i, pos1 + i, q2 + i, pos2 + i );
+	}
+}
+
+#endif // !_X360
+
+//-----------------------------------------------------------------------------
+// Purpose: Blend one layer into q1/pos1 using the per-bone weights in pS2
+//-----------------------------------------------------------------------------
+static void BlendBoneLayer( BoneBlendOp_t op, int nBoneCount, const float *pS2, const uint32 *pNoAlign,
+	Quaternion *q1, Vector *pos1, const Quaternion *q2, const Vector *pos2 )
+{
+#ifndef _X360
+	static const bool s_bHasSSE2 = GetCPUInformation()->m_bSSE2;
+	if ( s_bHasSSE2 && anim_simd_blend.GetBool() )
+	{
+		BlendBoneLayerSIMD( op, nBoneCount, pS2, pNoAlign, q1, pos1, q2, pos2 );
+		return;
+	}
+#endif
+
+	BlendBoneLayerScalar( op, nBoneCount, pS2, pNoAlign, q1, pos1, q2, pos2 );
+}
+
+
+#ifndef _X360
+//-----------------------------------------------------------------------------
+// Purpose: Times the scalar and SIMD kernels on a made up skeleton, and
+//			reports how far apart their results are
+//-----------------------------------------------------------------------------
+static void AnimBlendBenchmark( const CCommand &args )
+{
+	static const char *s_pOpNames[ BONE_BLEND_OP_COUNT ] = { "slerp", "nlerp", "delta", "delta post" };
+
+	const int nIterations = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 1000;
+	const int nBoneCount = MAXSTUDIOBONES;
+
+	Quaternion baseQ[ MAXSTUDIOBONES ], layerQ[ MAXSTUDIOBONES ], scalarQ[ MAXSTUDIOBONES ], simdQ[ MAXSTUDIOBONES ];
+	Vector basePos[ MAXSTUDIOBONES ], layerPos[ MAXSTUDIOBONES ], scalarPos[ MAXSTUDIOBONES ], simdPos[ MAXSTUDIOBONES ];
+	float flS2[ MAXSTUDIOBONES ];
+	uint32 nNoAlign[ MAXSTUDIOBONES ];
+
+	CUniformRandomStream random;
+	random.SetSeed( 1 );
+	for ( int i = 0; i < nBoneCount; i++ )
+	{
+		AngleQuaternion( QAngle( random.RandomFloat( -180, 180 ), random.RandomFloat( -180, 180 ), random.RandomFloat( -180, 180 ) ), baseQ[i] );
+		AngleQuaternion( QAngle( random.RandomFloat( -180, 180 ), random.RandomFloat( -180, 180 ), random.RandomFloat( -180, 180 ) ), layerQ[i] );
+		basePos[i].Init( random.RandomFloat( -32, 32 ), random.RandomFloat( -32, 32 ), random.RandomFloat( -32, 32 ) );
+		layerPos[i].Init( random.RandomFloat( -32, 32 ), random.RandomFloat( -32, 32 ), random.RandomFloat( -32, 32 ) );
+
+		// Leave some bones out, like a gesture that only drives part of the body
+		flS2[i] = ( random.RandomInt( 0, 7 ) == 0 ) ? 0.0f : random.RandomFloat( 0.05f, 1.0f );
+		nNoAlign[i] = ( random.RandomInt( 0, 15 ) == 0 ) ? 0xFFFFFFFF : 0;
+	}
+
+	Msg( "%d bones, %d iterations per layer type (SSE2 %s)\n", nBoneCount, nIterations, GetCPUInformation()->m_bSSE2 ? "yes" : "no" );
+
+	const double flToNsPerBone = 1000.0 / ( (double)nIterations * nBoneCount );
+	for ( int op = 0; op < BONE_BLEND_OP_COUNT; op++ )
+	{
+		double flScalarUS = 0.0, flSIMDUS = 0.0;
+		for ( int n = 0; n < nIterations; n++ )
+		{
+			CFastTimer timer;
+
+			V_memcpy( scalarQ, baseQ, sizeof( baseQ ) );
+			V_memcpy( scalarPos, basePos, sizeof( basePos ) );
+			timer.Start();
+			BlendBoneLayerScalar( (BoneBlendOp_t)op, nBoneCount, flS2, nNoAlign, scalarQ, scalarPos, layerQ, layerPos );
+			timer.End();
+			flScalarUS += timer.GetDuration().GetMicrosecondsF();
+
+			V_memcpy( simdQ, baseQ, sizeof( baseQ ) );
+			V_memcpy( simdPos, basePos, sizeof( basePos ) );
+			timer.Start();
+			BlendBoneLayerSIMD( (BoneBlendOp_t)op, nBoneCount, flS2, nNoAlign, simdQ, simdPos, layerQ, layerPos );
+			timer.End();
+			flSIMDUS += timer.GetDuration().GetMicrosecondsF();
+		}
+
+		float flMaxDiff = 0.0f;
+		for ( int i = 0; i < nBoneCount; i++ )
+		{
+			for ( int k = 0; k < 4; k++ )
+			{
+				flMaxDiff = MAX( flMaxDiff, fabs( scalarQ[i][k] - simdQ[i][k] ) );
+			}
+			for ( int k = 0; k < 3; k++ )
+			{
+				flMaxDiff = MAX( flMaxDiff, fabs( scalarPos[i][k] - simdPos[i][k] ) );
+			}
+		}
+
+		Msg( "  %-10s scalar %7.2f ns/bone   simd %7.2f ns/bone   %5.2fx   max diff %g\n", s_pOpNames[op],
+			flScalarUS * flToNsPerBone, flSIMDUS * flToNsPerBone, flSIMDUS > 0.0 ? flScalarUS / flSIMDUS : 0.0, flMaxDiff );
+	}
+}
+
+#ifdef CLIENT_DLL
+static ConCommand cl_anim_blend_benchmark( "cl_anim_blend_benchmark", AnimBlendBenchmark, "Time scalar vs. SIMD animation layer blending in ns per bone per layer. Optional iteration count.", FCVAR_CHEAT );
+#else
+static ConCommand anim_blend_benchmark( "anim_blend_benchmark", AnimBlendBenchmark, "Time scalar vs. SIMD animation layer blending in ns per bone per layer. Optional iteration count.", FCVAR_CHEAT );
+#endif
+
+#endif // !_X360
+
+
 //-----------------------------------------------------------------------------
 // Purpose: blend together q1,pos1 with q2,pos2.  Return result in q1,pos1.  
 //			0 returns q1, pos1.  1 returns q2, pos2
@@ -1405,8 +1895,11 @@ void SlerpBones(
 	// Build weightlist for all bones
 	int nBoneCount = pStudioHdr->numbones();
 	float *pS2 = (float*)stackalloc( nBoneCount * sizeof(float) );
+	uint32 *pNoAlign = (uint32*)stackalloc( nBoneCount * sizeof(uint32) );
 	for (i = 0; i < nBoneCount; i++)
 	{
+		pNoAlign[i] = ( pStudioHdr->boneFlags(i) & BONE_FIXED_ALIGNMENT ) ? 0xFFFFFFFF : 0;
+
 		// skip unused bones
 		if (!(pStudioHdr->boneFlags(i) & boneMask))
 		{
@@ -1431,94 +1924,13 @@ void SlerpBones(
 		}
 	}
 
-	float s1, s2;
+	BoneBlendOp_t op = BONE_BLEND_SLERP;
 	if ( seqdesc.flags & STUDIO_DELTA )
 	{
-		for ( i = 0; i < nBoneCount; i++ )
-		{
-			s2 = pS2[i];
-			if ( s2 <= 0.0f )
-				continue;
-
-			if ( seqdesc.flags & STUDIO_POST )
-			{
-#ifndef _X360
-				QuaternionMA( q1[i], s2, q2[i], q1[i] );
-#else
-				fltx4 q1simd = LoadUnalignedSIMD( q1[i].Base() );
-				fltx4 q2simd = LoadAlignedSIMD( q2[i] );
-				fltx4 result = QuaternionMASIMD( q1simd, s2, q2simd );
-				StoreUnalignedSIMD( q1[i].Base(), result );
-#endif
-				// FIXME: are these correct?
-				pos1[i][0] = pos1[i][0] + pos2[i][0] * s2;
-				pos1[i][1] = pos1[i][1] + pos2[i][1] * s2;
-				pos1[i][2] = pos1[i][2] + pos2[i][2] * s2;
-			}
-			else
-			{
-#ifndef _X360
-				QuaternionSM( s2, q2[i], q1[i], q1[i] );
-#else
-				fltx4 q1simd = LoadUnalignedSIMD( q1[i].Base() );
-				fltx4 q2simd = LoadAlignedSIMD( q2[i] );
-				fltx4 result = QuaternionSMSIMD( s2, q2simd, q1simd );
-				StoreUnalignedSIMD( q1[i].Base(), result );
-#endif
-
-				// FIXME: are these correct?
-				pos1[i][0] = pos1[i][0] + pos2[i][0] * s2;
-				pos1[i][1] = pos1[i][1] + pos2[i][1] * s2;
-				pos1[i][2] = pos1[i][2] + pos2[i][2] * s2;
-			}
-		}
-		return;
+		op = ( seqdesc.flags & STUDIO_POST ) ? BONE_BLEND_DELTA_POST : BONE_BLEND_DELTA_PRE;
 	}
 
-	QuaternionAligned q3;
-	for (i = 0; i < nBoneCount; i++)
-	{
-		s2 = pS2[i];
-		if ( s2 <= 0.0f )
-			continue;
-
-		s1 = 1.0 - s2;
-
-#ifdef _X360
-		fltx4  q1simd, q2simd, result;
-		q1simd = LoadUnalignedSIMD( q1[i].Base() );
-		q2simd = LoadAlignedSIMD( q2[i] );
-#endif
-		if ( pStudioHdr->boneFlags(i) & BONE_FIXED_ALIGNMENT )
-		{
-#ifndef _X360
-			QuaternionSlerpNoAlign( q2[i], q1[i], s1, q3 );
-#else
-			result = QuaternionSlerpNoAlignSIMD( q2simd, q1simd, s1 );
-#endif
-		}
-		else
-		{
-#ifndef _X360
-			QuaternionSlerp( q2[i], q1[i], s1, q3 );
-#else
-			result = QuaternionSlerpSIMD( q2simd, q1simd, s1 );
-#endif
-		}
-
-#ifndef _X360
-		q1[i][0] = q3[0];
-		q1[i][1] = q3[1];
-		q1[i][2] = q3[2];
-		q1[i][3] = q3[3];
-#else
-		StoreUnalignedSIMD( q1[i].Base(), result );
-#endif
-
-		pos1[i][0] = pos1[i][0] * s1 + pos2[i][0] * s2;
-		pos1[i][1] = pos1[i][1] * s1 + pos2[i][1] * s2;
-		pos1[i][2] = pos1[i][2] * s1 + pos2[i][2] * s2;
-	}
+	BlendBoneLayer( op, nBoneCount, pS2, pNoAlign, q1, pos1, q2, pos2 );
 }
 
 
@@ -1540,7 +1952,6 @@ void BlendBones(
 	int boneMask )
 {
 	int			i, j;
-	Quaternion		q3;
 
 	virtualmodel_t *pVModel = pStudioHdr->GetVirtualModel();
 	const virtualgroup_t *pSeqGroup = NULL;
@@ -1583,11 +1994,14 @@ void BlendBones(
 		return;
 	}
 
-	float s2 = s;
-	float s1 = 1.0 - s2;
-
-	for (i = 0; i < pStudioHdr->numbones(); i++)
+	int nBoneCount = pStudioHdr->numbones();
+	float *pS2 = (float*)stackalloc( nBoneCount * sizeof(float) );
+	uint32 *pNoAlign = (uint32*)stackalloc( nBoneCount * sizeof(uint32) );
+	for (i = 0; i < nBoneCount; i++)
 	{
+		pS2[i] = 0.0f;
+		pNoAlign[i] = ( pStudioHdr->boneFlags(i) & BONE_FIXED_ALIGNMENT ) ? 0xFFFFFFFF : 0;
+
 		// skip unused bones
 		if (!(pStudioHdr->boneFlags(i) & boneMask))
 		{
@@ -1605,23 +2019,11 @@ void BlendBones(
 
 		if (j >= 0 && seqdesc.weight( j ) > 0.0)
 		{
-			if (pStudioHdr->boneFlags(i) & BONE_FIXED_ALIGNMENT)
-			{
-				QuaternionBlendNoAlign( q2[i], q1[i], s1, q3 );
-			}
-			else
-			{
-				QuaternionBlend( q2[i], q1[i], s1, q3 );
-			}
-			q1[i][0] = q3[0];
-			q1[i][1] = q3[1];
-			q1[i][2] = q3[2];
-			q1[i][3] = q3[3];
-			pos1[i][0] = pos1[i][0] * s1 + pos2[i][0] * s2;
-			pos1[i][1] = pos1[i][1] * s1 + pos2[i][1] * s2;
-			pos1[i][2] = pos1[i][2] * s1 + pos2[i][2] * s2;
+			pS2[i] = s;
 		}
 	}
+
+	BlendBoneLayer( BONE_BLEND_NLERP, nBoneCount, pS2, pNoAlign, q1, pos1, q2, pos2 );
 }
 
 
@@ -4493,6 +4895,30 @@ void CBoneSetup::CalcAutoplaySequences(
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: model to world transformation, including the model scale
+//-----------------------------------------------------------------------------
+static void Studio_BuildModelToWorld( const QAngle& angles, const Vector& origin, float flScale, matrix3x4_t &rotationmatrix )
+{
+	AngleMatrix( angles, origin, rotationmatrix );
+
+	// Account for a change in scale
+	if ( flScale < 1.0f-FLT_EPSILON || flScale > 1.0f+FLT_EPSILON )
+	{
+		Vector vecOffset;
+		MatrixGetColumn( rotationmatrix, 3, vecOffset );
+		vecOffset -= origin;
+		vecOffset *= flScale;
+		vecOffset += origin;
+		MatrixSetColumn( vecOffset, 3, rotationmatrix );
+
+		// Scale it uniformly
+		VectorScale( rotationmatrix[0], flScale, rotationmatrix[0] );
+		VectorScale( rotationmatrix[1], flScale, rotationmatrix[1] );
+		VectorScale( rotationmatrix[2], flScale, rotationmatrix[2] );
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Purpose:
 //-----------------------------------------------------------------------------
@@ -4539,23 +4965,7 @@ void Studio_BuildMatrices(
 
 	matrix3x4_t bonematrix;
 	matrix3x4_t rotationmatrix; // model to world transformation
-	AngleMatrix( angles, origin, rotationmatrix );
-
-	// Account for a change in scale
-	if ( flScale < 1.0f-FLT_EPSILON || flScale > 1.0f+FLT_EPSILON )
-	{
-		Vector vecOffset;
-		MatrixGetColumn( rotationmatrix, 3, vecOffset );
-		vecOffset -= origin;
-		vecOffset *= flScale;
-		vecOffset += origin;
-		MatrixSetColumn( vecOffset, 3, rotationmatrix );
-
-		// Scale it uniformly
-		VectorScale( rotationmatrix[0], flScale, rotationmatrix[0] );
-		VectorScale( rotationmatrix[1], flScale, rotationmatrix[1] );
-		VectorScale( rotationmatrix[2], flScale, rotationmatrix[2] );
-	}
+	Studio_BuildModelToWorld( angles, origin, flScale, rotationmatrix );
 
 	for (j = chainlength - 1; j >= 0; j--)
 	{
@@ -4577,6 +4987,47 @@ void Studio_BuildMatrices(
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Studio_BuildMatrices for a list of bones.  The list has to be in
+//			ascending order and include the parents of every bone in it, and
+//			only the listed bones are written.
+//-----------------------------------------------------------------------------
+void Studio_BuildMatricesForBoneList(
+	const CStudioHdr *pStudioHdr,
+	const QAngle& angles, 
+	const Vector& origin, 
+	const Vector pos[],
+	const Quaternion q[],
+	const short *pBones,
+	int nBoneCount,
+	float flScale,
+	matrix3x4_t bonetoworld[MAXSTUDIOBONES]
+	)
+{
+	matrix3x4_t bonematrix;
+	matrix3x4_t rotationmatrix; // model to world transformation
+	Studio_BuildModelToWorld( angles, origin, flScale, rotationmatrix );
+
+	for ( int j = 0; j < nBoneCount; j++ )
+	{
+		int i = pBones[j];
+		int iParent = pStudioHdr->boneParent( i );
+		Assert( iParent < i );
+
+		QuaternionMatrix( q[i], pos[i], bonematrix );
+
+		if ( iParent == -1 )
+		{
+			ConcatTransforms( rotationmatrix, bonematrix, bonetoworld[i] );
+		}
+		else
+		{
+			ConcatTransforms( bonetoworld[iParent], bonematrix, bonetoworld[i] );
+		}
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: look at single column vector of another bones local transformation 
 //			and generate a procedural transformation based on how that column 
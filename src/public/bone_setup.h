@@ -334,6 +334,18 @@ void Studio_BuildMatrices(
 	int boneMask
 	);
 
+void Studio_BuildMatricesForBoneList(
+	const CStudioHdr *pStudioHdr,
+	const QAngle& angles, 
+	const Vector& origin, 
+	const Vector pos[],
+	const Quaternion q[],
+	const short *pBones,
+	int nBoneCount,
+	float flScale,
+	matrix3x4_t bonetoworld[MAXSTUDIOBONES]
+	);
+
 
 // Get a bone->bone relative transform
 void Studio_CalcBoneToBoneTransform( const CStudioHdr *pStudioHdr, int inputBoneIndex, int outputBoneIndex, matrix3x4_t &matrixOut );
@@ -41,6 +41,14 @@ public:
 
 };
 
+/// Eight rays for the AVX packet path. Like FourRays, all eight must have the same direction
+/// signs. Kept as plain floats so that including this header doesn't require AVX.
+struct EightRays
+{
+	ALIGN32 float origin[3][8] ALIGN32_POST;
+	ALIGN32 float direction[3][8] ALIGN32_POST;
+};
+
 /// The format a triangle is stored in for intersections. size of this structure is important.
 /// This structure can be in one of two forms. Before the ray tracing environment is set up, the
 /// ProjectedEdgeEquations hold the coordinates of the 3 vertices, for facilitating bounding box
@@ -192,6 +200,52 @@ protected:
 
 };
 
+#define BVHNODE_STATE_LEAF 3								// else the KDNODE_STATE_xSPLIT axis the
+															// children were split along
+#define BVH_MAX_DEPTH 64									// the builder never goes deeper, so
+															// this is also enough traversal stack
+
+struct CacheOptimizedBVHNode
+{
+	// 32 bytes, so that a pair of siblings fits in one cache line. As in the kd-tree, the right
+	// child is always stored right after the left child. The node array is 64 byte aligned and
+	// every left child is at an even index, so the pair never straddles a line. The node type is
+	// in the lower 2 bits of m_nTypeAndCount. Leaves keep their triangle count in the remaining bits, and their
+	// triangles are a contiguous run of TriangleIndexList.
+
+	float m_flMins[3];
+	int32 m_nChildOrFirstTri;								// left child, or first TriangleIndexList
+															// entry of a leaf
+	float m_flMaxs[3];
+	int32 m_nTypeAndCount;
+
+	inline int NodeType(void) const
+	{
+		return m_nTypeAndCount & 3;
+	}
+
+	inline int LeftChild(void) const
+	{
+		assert(NodeType()!=BVHNODE_STATE_LEAF);
+		return m_nChildOrFirstTri;
+	}
+
+	inline int32 TriangleIndexStart(void) const
+	{
+		assert(NodeType()==BVHNODE_STATE_LEAF);
+		return m_nChildOrFirstTri;
+	}
+
+	inline int NumberOfTrianglesInLeaf(void) const
+	{
+		assert(NodeType()==BVHNODE_STATE_LEAF);
+		return m_nTypeAndCount>>2;
+	}
+};
+
+// root is 0 and 1 is padding, so that siblings start on a cache line
+typedef CUtlVector< CacheOptimizedBVHNode, CUtlMemoryAligned< CacheOptimizedBVHNode, 64 > > CacheOptimizedBVH_t;
+
 
 struct RayTracingSingleResult
 {
@@ -208,6 +262,13 @@ struct RayTracingResult
 	fltx4 HitDistance;										// distance to intersection
 };
 
+struct EightRayResult
+{
+	ALIGN32 float surface_normal[3][8] ALIGN32_POST;		// surface normal at intersection
+	ALIGN32 int32 HitIds[8] ALIGN32_POST;					// -1=no hit. otherwise, triangle index
+	ALIGN32 float HitDistance[8] ALIGN32_POST;				// distance to intersection
+};
+
 
 class RayTraceLight
 {
@@ -220,6 +281,10 @@ public:
 #define RTE_FLAGS_FAST_TREE_GENERATION 1
 #define RTE_FLAGS_DONT_STORE_TRIANGLE_COLORS 2				// saves memory if not needed
 #define RTE_FLAGS_DONT_STORE_TRIANGLE_MATERIALS 4
+#define RTE_FLAGS_NO_WIDE_PACKETS 8							// trace streams 4 rays at a time even
+															// if the cpu has AVX
+#define RTE_FLAGS_USE_BVH 16								// SetupAccelerationStructure builds a
+															// bvh instead of the kd-tree
 
 enum RayTraceLightingMode_t {
 	DIRECT_LIGHTING,										// just dot product lighting
@@ -228,18 +293,28 @@ enum RayTraceLightingMode_t {
 };
 
 
+#define RAYSTREAM_MAX_PENDING 1024
+
+struct RayStreamEntry_t
+{
+	Vector m_vecStart;
+	Vector m_vecDelta;
+	uint32 m_nSortKey;										// direction sign mask in the top bits,
+															// then origin and direction cells
+	RayTracingSingleResult *m_pOutput;
+};
+
 class RayStream
 {
 	friend class RayTracingEnvironment;
 
-	RayTracingSingleResult *PendingStreamOutputs[8][4];
-	int n_in_stream[8];
-	FourRays PendingRays[8];
+	RayStreamEntry_t m_PendingRays[RAYSTREAM_MAX_PENDING];
+	int m_nPending;
 
 public:
 	RayStream(void)
 	{
-		memset(n_in_stream,0,sizeof(n_in_stream));
+		m_nPending = 0;
 	}
 };
 
@@ -257,11 +332,15 @@ class RayTracingEnvironment
 {
 public:
 	uint32 Flags;											// RTE_FLAGS_xxx above
+	int BuildThreads;										// threads BuildBVH may use. 0 for one
+															// per cpu
 	Vector m_MinBound;
 	Vector m_MaxBound;
 
 	FourVectors BackgroundColor;							//< color where no intersection
 	CUtlVector<CacheOptimizedKDNode> OptimizedKDTree;		//< the packed kdtree. root is 0
+	CacheOptimizedBVH_t OptimizedBVH;						//< the packed bvh if RTE_FLAGS_USE_BVH
+															//< was set instead. root is 0
 	CUtlBlockVector<CacheOptimizedTriangle> OptimizedTriangleList; //< the packed triangles
 	CUtlVector<int32> TriangleIndexList;					//< the list of triangle indices.
 	CUtlVector<LightDesc_t> LightList;						//< the list of lights
@@ -273,6 +352,7 @@ public:
 	{
 		BackgroundColor.DuplicateVector(Vector(1,0,0));		// red
 		Flags=0;
+		BuildThreads=0;
 	}
 
 
@@ -297,6 +377,10 @@ public:
 	// SetupAccelerationStructure to prepare for tracing
 	void SetupAccelerationStructure(void);
 
+	// builds OptimizedBVH with a binned surface area heuristic, using BuildThreads threads for
+	// the subtrees
+	void BuildBVH(void);
+
 
 	// lowest level intersection routine - fire 4 rays through the scene. all 4 rays must pass the
 	// Check() function, and t extents must be initialized. skipid can be set to exclude a
@@ -310,6 +394,21 @@ public:
 					RayTracingResult *rslt_out,
 					int32 skip_id=-1, ITransparentTriangleCallback *pCallback = NULL);
 
+	// same as the low level Trace4Rays, for 8 rays at once using AVX. Only call this if
+	// HasWidePackets() is true. TMin and TMax point at 8 floats, 32 byte aligned. Transparent
+	// triangles are treated as opaque, as they are in Trace4Rays without a callback.
+	void Trace8Rays(const EightRays &rays, const float *TMin, const float *TMax,
+					int DirectionSignMask, EightRayResult *rslt_out, int32 skip_id=-1);
+
+	// bvh traversal for the low level Trace4Rays, once the rays are clipped to the scene bounds
+	void Trace4RaysBVH(const FourRays &rays, FourVectors const &OneOverRayDir, fltx4 TMin,
+					   fltx4 TMax, int DirectionSignMask, RayTracingResult *rslt_out,
+					   int32 skip_id, ITransparentTriangleCallback *pCallback);
+
+	// true if the cpu can run Trace8Rays, RTE_FLAGS_NO_WIDE_PACKETS isn't set and the kd-tree
+	// is in use
+	bool HasWidePackets(void) const;
+
 	// compute virtual light sources to model inter-reflection
 	void ComputeVirtualLightSources(void);
 
@@ -330,12 +429,13 @@ public:
 					 
 	/// raytracing stream - lets you trace an array of rays by feeding them to this function.
 	/// results will not be returned until FinishStream is called. This function handles sorting
-	/// the rays by direction, tracing them 4 at a time, and de-interleaving the results.
+	/// the rays by direction and origin, tracing them 8 (with AVX) or 4 at a time, and
+	/// de-interleaving the results.
 
 	void AddToRayStream(RayStream &s,
 						Vector const &start,Vector const &end,RayTracingSingleResult *rslt_out);
 
-	inline void FlushStreamEntry(RayStream &s,int msk);
+	void FlushRayStream(RayStream &s);
 
 	/// call this when you are done. handles all cleanup. After this is called, all rslt ptrs
 	/// previously passed to AddToRaySteam will have been filled in.
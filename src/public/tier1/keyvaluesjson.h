@@ -16,11 +16,21 @@
 class CUtlBuffer;
 
 /// JSON parser.  Use this class when you need to customize the parsing.
+///
+/// Parsing happens in two stages.  The first stage scans the raw text 16 bytes
+/// at a time (SSE2 when available) and builds an index of token start positions,
+/// skipping whitespace, comments and string bodies without looking at each byte
+/// individually.  The second stage walks that index and builds the KeyValues tree.
+/// The index is built in fixed-size windows as the parser consumes it, so the
+/// memory it needs does not grow with the size of the document.
+///
+/// Pass bUseStructuralIndex=false to tokenize byte by byte instead.  Both modes
+/// produce identical results, including error messages and line numbers.
 class KeyValuesJSONParser
 {
 public:
-	KeyValuesJSONParser( const CUtlBuffer &buf );
-	KeyValuesJSONParser( const char *pszText, int cbSize = -1 );
+	KeyValuesJSONParser( const CUtlBuffer &buf, bool bUseStructuralIndex = true );
+	KeyValuesJSONParser( const char *pszText, int cbSize = -1, bool bUseStructuralIndex = true );
 	~KeyValuesJSONParser();
 
 	/// Parse the whole string.  If there's a problem, returns NULL and sets m_nLine,m_szErrMsg with more info. 
@@ -37,10 +47,11 @@ private:
 	bool ParseObject( KeyValues *pObject );
 	bool ParseArray( KeyValues *pArray );
 	bool ParseValue( KeyValues *pValue );
-	void Init( const char *pszText, int cbSize );
+	void Init( const char *pszText, int cbSize, bool bUseStructuralIndex );
 
 	const char *m_cur;
 	const char *m_end;
+	const char *m_begin;
 
 	enum
 	{
@@ -61,6 +72,40 @@ private:
 	void ParseNumberToken();
 	void ParseStringToken();
 	const char *GetTokenDebugText();
+
+	//
+	// Stage 1: structural index
+	//
+
+	/// Position of a token start, and the line it is on
+	struct IndexEntry_t
+	{
+		uint32 m_nOffset;
+		int m_nLine;
+	};
+
+	/// Scanner state, carried across index windows
+	enum
+	{
+		kScan_Value,		// Between tokens
+		kScan_String,		// Inside a string delimited by m_cScanStringDelim
+		kScan_Comment,		// Inside a // comment
+	};
+
+	bool m_bUseStructuralIndex;
+	bool m_bIndexFinished;
+	int m_iIndexEntry;
+	CUtlVector<IndexEntry_t> m_vecIndex;
+
+	uint32 m_nScanPos;			// Offset of the next 16-byte block to classify
+	uint32 m_nScanSkipTo;		// Bits below this offset are ignored (escaped characters, paired newlines)
+	uint32 m_nScanBoundaryCarry;// Whether the last byte of the previous block ended a token
+	int m_nScanLine;
+	int m_eScanState;
+	char m_cScanStringDelim;
+
+	void FillStructuralIndex();
+	bool SkipToIndexedToken();
 };
 
 #ifdef _DEBUG
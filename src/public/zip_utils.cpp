@@ -339,6 +339,7 @@ public:
 
 	// Add buffer to zip as a file with given name
 	void			AddBufferToZip( const char *relativename, void *data, int length, bool bTextMode, IZip::eCompressionType compressionType );
+	void			AddPreparedBufferToZip( const char *relativename, const void *data, int length, int uncompressedLength, CRC32_t crc, IZip::eCompressionType compressionType );
 
 	// Check if a file already exists in the zip.
 	bool			FileExistsInZip( const char *relativename );
@@ -347,8 +348,9 @@ public:
 	bool			ReadFileFromZip( const char *relativename, bool bTextMode, CUtlBuffer &buf );
 	bool			ReadFileFromZip( HANDLE hZipFile, const char *relativename, bool bTextMode, CUtlBuffer &buf );
 
-	// Initialize the zip file from a buffer
-	void			ParseFromBuffer( void *buffer, int bufferlength );
+	// Initialize the zip file from a buffer.  Without bCopyData the entries point
+	// into the buffer, which must then outlive them.
+	void			ParseFromBuffer( const void *buffer, int bufferlength, bool bCopyData = true );
 	HANDLE			ParseFromDisk( const char *pFilename );
 
 	// Estimate the size of the zip file (including header, padding, etc.)
@@ -427,6 +429,9 @@ private:
 		// Raw data, could be null and data may be in disk write cache
 		void			*m_pData;
 
+		// m_pData points into a buffer given to ParseFromBuffer and isn't ours to free
+		bool			m_bExternalData;
+
 		// Offset in Zip ( set and valid during final write )
 		unsigned int	m_ZipOffset;
 		// CRC of blob
@@ -459,6 +464,7 @@ CZipFile::CZipEntry::CZipEntry( void )
 	m_nCompressedSize = 0;
 	m_nUncompressedSize = 0;
 	m_pData = NULL;
+	m_bExternalData = false;
 	m_ZipOffset = 0;
 	m_ZipCRC = 0;
 	m_DiskCacheOffset = 0;
@@ -477,7 +483,12 @@ CZipFile::CZipEntry::CZipEntry( const CZipFile::CZipEntry& src )
 	m_nUncompressedSize = src.m_nUncompressedSize;
 	m_eCompressionType = src.m_eCompressionType;
 
-	if ( src.m_nCompressedSize > 0 && src.m_pData )
+	m_bExternalData = src.m_bExternalData;
+	if ( src.m_bExternalData )
+	{
+		m_pData = src.m_pData;
+	}
+	else if ( src.m_nCompressedSize > 0 && src.m_pData )
 	{
 		m_pData = malloc( src.m_nCompressedSize );
 		memcpy( m_pData, src.m_pData, src.m_nCompressedSize );
@@ -498,7 +509,7 @@ CZipFile::CZipEntry::CZipEntry( const CZipFile::CZipEntry& src )
 //-----------------------------------------------------------------------------
 CZipFile::CZipEntry::~CZipEntry( void )
 {
-	if ( m_pData )
+	if ( m_pData && !m_bExternalData )
 	{
 		free( m_pData );
 	}
@@ -619,21 +630,24 @@ void CZipFile::ActivateByteSwapping( bool bActivate )
 // Input  : *buffer - 
 //			bufferlength - 
 //-----------------------------------------------------------------------------
-void CZipFile::ParseFromBuffer( void *buffer, int bufferlength )
+void CZipFile::ParseFromBuffer( const void *buffer, int bufferlength, bool bCopyData )
 {
 	// Throw away old data
 	Reset();
 
-	// Initialize a buffer
-	CUtlBuffer buf( 0, bufferlength +1  );					// +1 for null termination
+	// Read straight out of the caller's buffer
+	CUtlBuffer buf( buffer, bufferlength, CUtlBuffer::READ_ONLY );
 
 	// need to swap bytes, so set the buffer opposite the machine's endian
 	buf.ActivateByteSwapping( m_Swap.IsSwappingBytes() );
 
-	buf.Put( buffer, bufferlength );
+	// the disk cache expects to own every entry's data
+	if ( m_bUseDiskCacheForWrites )
+	{
+		bCopyData = true;
+	}
 
-	buf.SeekGet( CUtlBuffer::SEEK_TAIL, 0 );
-	unsigned int fileLen = buf.TellGet();
+	unsigned int fileLen = bufferlength;
 
 	// Start from beginning
 	buf.SeekGet( CUtlBuffer::SEEK_HEAD, 0 );
@@ -742,7 +756,12 @@ void CZipFile::ParseFromBuffer( void *buffer, int bufferlength )
 		e.m_eCompressionType = newfiles[i].compressionType;
 
 		// Make sure length is reasonable
-		if ( e.m_nCompressedSize > 0 )
+		if ( e.m_nCompressedSize > 0 && !bCopyData )
+		{
+			e.m_pData = (byte *)buffer + newfiles[i].filepos;
+			e.m_bExternalData = true;
+		}
+		else if ( e.m_nCompressedSize > 0 )
 		{
 			e.m_pData = malloc( e.m_nCompressedSize );
 
@@ -985,23 +1004,15 @@ static void CopyTextData( char *pDst, const char *pSrc, int dstSize, int srcSize
 }
 
 //-----------------------------------------------------------------------------
-// Purpose: Adds a new lump, or overwrites existing one
-// Input  : *relativename - 
-//			*data - 
-//			length - 
+// Purpose: Converts and compresses a buffer for a zip entry. Only touches its
+//			arguments, so it can run on several threads at once.
 //-----------------------------------------------------------------------------
-void CZipFile::AddBufferToZip( const char *relativename, void *data, int length, bool bTextMode, IZip::eCompressionType compressionType )
+bool IZip::PrepareBufferForZip( const void *data, int length, bool bTextMode, IZip::eCompressionType compressionType,
+								CUtlBuffer &outBuf, int &uncompressedLength, CRC32_t &crc )
 {
-	// Lower case only
-	char name[512];
-	Q_strcpy( name, relativename );
-	Q_strlower( name );
-
 	int outLength = length;
-	int uncompressedLength = length;
-	void *outData = data;
+	const void *outData = data;
 	CUtlBuffer textTransform;
-	CUtlBuffer compressionTransform;
 
 	if ( bTextMode )
 	{
@@ -1011,14 +1022,13 @@ void CZipFile::AddBufferToZip( const char *relativename, void *data, int length,
 
 		outData = (void *)textTransform.Base();
 		outLength = textLen;
-		uncompressedLength = textLen;
 	}
+	uncompressedLength = outLength;
 
 	// uncompressed data final at this point (CRC is before compression)
-	CRC32_t zipCRC;
-	CRC32_Init( &zipCRC );
-	CRC32_ProcessBuffer( &zipCRC, outData, outLength );
-	CRC32_Final( &zipCRC );
+	CRC32_Init( &crc );
+	CRC32_ProcessBuffer( &crc, outData, outLength );
+	CRC32_Final( &crc );
 
 #ifdef ZIP_SUPPORT_LZMA_ENCODE
 	if ( compressionType == IZip::eCompressionType_LZMA )
@@ -1028,7 +1038,7 @@ void CZipFile::AddBufferToZip( const char *relativename, void *data, int length,
 		if ( !pCompressedOutput || compressedSize < sizeof( lzma_header_t ) )
 		{
 			Warning( "ZipFile: LZMA compression failed\n" );
-			return;
+			return false;
 		}
 
 		// Fixup LZMA header for ZIP payload usage
@@ -1040,35 +1050,63 @@ void CZipFile::AddBufferToZip( const char *relativename, void *data, int length,
 		//  LZMA Properties Data variable, defined by "LZMA Properties Size"
 		unsigned int nZIPHeader = 2 + 2 + sizeof( lzma_header_t().properties );
 		unsigned int finalCompressedSize = compressedSize - sizeof( lzma_header_t ) + nZIPHeader;
-		compressionTransform.EnsureCapacity( finalCompressedSize );
+		outBuf.EnsureCapacity( finalCompressedSize );
 
 		// LZMA version
-		compressionTransform.PutUnsignedChar( LZMA_SDK_VERSION_MAJOR );
-		compressionTransform.PutUnsignedChar( LZMA_SDK_VERSION_MINOR );
+		outBuf.PutUnsignedChar( LZMA_SDK_VERSION_MAJOR );
+		outBuf.PutUnsignedChar( LZMA_SDK_VERSION_MINOR );
 		// properties size
 		uint16 nSwappedPropertiesSize = LittleWord( sizeof( lzma_header_t().properties ) );
-		compressionTransform.Put( &nSwappedPropertiesSize, sizeof( nSwappedPropertiesSize ) );
+		outBuf.Put( &nSwappedPropertiesSize, sizeof( nSwappedPropertiesSize ) );
 		// properties
-		compressionTransform.Put( &(((lzma_header_t *)pCompressedOutput)->properties), sizeof( lzma_header_t().properties ) );
+		outBuf.Put( &(((lzma_header_t *)pCompressedOutput)->properties), sizeof( lzma_header_t().properties ) );
 		// payload
-		compressionTransform.Put( pCompressedOutput + sizeof( lzma_header_t ), compressedSize - sizeof( lzma_header_t ) );
+		outBuf.Put( pCompressedOutput + sizeof( lzma_header_t ), compressedSize - sizeof( lzma_header_t ) );
 
 		// Free original
 		free( pCompressedOutput );
-		pCompressedOutput = NULL;
-
-		outData = (void *)compressionTransform.Base();
-		outLength = finalCompressedSize;
-		// (Not updating uncompressedLength)
+		return true;
 	}
 	else
 #endif
 	/* else from ifdef */ if ( compressionType != IZip::eCompressionType_None )
 	{
 		Error( "Calling AddBufferToZip with unknown compression type\n" );
-		return;
+		return false;
 	}
 
+	outBuf.Put( outData, outLength );
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds a new lump, or overwrites existing one
+// Input  : *relativename - 
+//			*data - 
+//			length - 
+//-----------------------------------------------------------------------------
+void CZipFile::AddBufferToZip( const char *relativename, void *data, int length, bool bTextMode, IZip::eCompressionType compressionType )
+{
+	CUtlBuffer prepared;
+	int uncompressedLength;
+	CRC32_t zipCRC;
+	if ( !IZip::PrepareBufferForZip( data, length, bTextMode, compressionType, prepared, uncompressedLength, zipCRC ) )
+		return;
+
+	AddPreparedBufferToZip( relativename, prepared.Base(), prepared.TellPut(), uncompressedLength, zipCRC, compressionType );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds a new lump from a buffer PrepareBufferForZip produced, or
+//			overwrites existing one
+//-----------------------------------------------------------------------------
+void CZipFile::AddPreparedBufferToZip( const char *relativename, const void *outData, int outLength, int uncompressedLength, CRC32_t zipCRC, IZip::eCompressionType compressionType )
+{
+	// Lower case only
+	char name[512];
+	Q_strcpy( name, relativename );
+	Q_strlower( name );
+
 	// See if entry is in list already
 	CZipEntry e;
 	e.m_Name = name;
@@ -1078,10 +1116,11 @@ void CZipFile::AddBufferToZip( const char *relativename, void *data, int length,
 	if ( index != m_Files.InvalidIndex() )
 	{
 		CZipEntry *update = &m_Files[ index ];
-		if ( update->m_pData )
+		if ( update->m_pData && !update->m_bExternalData )
 		{
 			free( update->m_pData );
 		}
+		update->m_bExternalData = false;
 
 		update->m_eCompressionType = compressionType;
 		update->m_pData = malloc( outLength );
@@ -1715,6 +1754,8 @@ public:
 	// Add buffer to zip as a file with given name - uses current alignment size, default 0 (no alignment)
 	virtual void			AddBufferToZip( const char *relativename, void *data, int length,
 											bool bTextMode, eCompressionType compressionType ) OVERRIDE;
+	virtual void			AddPreparedBufferToZip( const char *relativename, const void *data, int length,
+													int uncompressedLength, CRC32_t crc, eCompressionType compressionType ) OVERRIDE;
 
 	// Writes out zip file to a buffer - uses current alignment size
 	// (set by file's previous alignment, or a call to ForceAlignment)
@@ -1728,6 +1769,7 @@ public:
 	// Reads a zip file from a buffer into memory - sets current alignment size to
 	// the file's alignment size, unless overridden by a ForceAlignment call)
 	virtual void			ParseFromBuffer( void *buffer, int bufferlength ) OVERRIDE;
+	virtual void			ParseFromBufferNoCopy( const void *buffer, int bufferlength ) OVERRIDE;
 	virtual HANDLE			ParseFromDisk( const char *pFilename ) OVERRIDE;
 
 	// Forces a specific alignment size for all subsequent file operations, overriding files' previous alignment size.
@@ -1831,6 +1873,11 @@ void CZip::AddBufferToZip( const char *relativename, void *data, int length, boo
 	m_ZipFile.AddBufferToZip( relativename, data, length, bTextMode, compressionType );
 }
 
+void CZip::AddPreparedBufferToZip( const char *relativename, const void *data, int length, int uncompressedLength, CRC32_t crc, eCompressionType compressionType )
+{
+	m_ZipFile.AddPreparedBufferToZip( relativename, data, length, uncompressedLength, crc, compressionType );
+}
+
 void CZip::SaveToBuffer( CUtlBuffer& outbuf )
 {
 	m_ZipFile.SaveToBuffer( outbuf );
@@ -1852,6 +1899,12 @@ void CZip::ParseFromBuffer( void *buffer, int bufferlength )
 	m_ZipFile.ParseFromBuffer( buffer, bufferlength );
 }
 
+void CZip::ParseFromBufferNoCopy( const void *buffer, int bufferlength )
+{
+	m_ZipFile.Reset();
+	m_ZipFile.ParseFromBuffer( buffer, bufferlength, false );
+}
+
 HANDLE CZip::ParseFromDisk( const char *pFilename )
 {
 	m_ZipFile.Reset();
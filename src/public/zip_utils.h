@@ -11,6 +11,7 @@
 #endif
 
 #include "utlsymbol.h"
+#include "checksum_crc.h"
 
 class CUtlBuffer;
 #include "tier0/dbg.h"
@@ -52,6 +53,9 @@ public:
 	// Add buffer to zip as a file with given name - uses current alignment size, default 0 (no alignment)
 	virtual void			AddBufferToZip		( const char *relativename, void *data, int length, bool bTextMode, eCompressionType compressionType = eCompressionType_None ) = 0;
 
+	// Add a buffer that PrepareBufferForZip has already converted and compressed - uses current alignment size
+	virtual void			AddPreparedBufferToZip	( const char *relativename, const void *data, int length, int uncompressedLength, CRC32_t crc, eCompressionType compressionType ) = 0;
+
 	// Writes out zip file to a buffer - uses current alignment size
 	// (set by file's previous alignment, or a call to ForceAlignment)
 	virtual void			SaveToBuffer		( CUtlBuffer& outbuf ) = 0;
@@ -65,6 +69,10 @@ public:
 	// the file's alignment size, unless overridden by a ForceAlignment call)
 	virtual void			ParseFromBuffer		( void *buffer, int bufferlength ) = 0;
 
+	// Same, but only the directory is parsed; entries point into the buffer instead of
+	// copying it.  The buffer must stay valid until the zip is Reset() or released.
+	virtual void			ParseFromBufferNoCopy	( const void *buffer, int bufferlength ) = 0;
+
 	// Mounts a zip file from the disk
 	// Only ReadFileFromZip() is supported because the zip file could be >2GB
 	virtual HANDLE			ParseFromDisk		( const char *pFilename ) = 0;
@@ -79,6 +87,11 @@ public:
 	virtual void			SetBigEndian( bool bigEndian ) = 0;
 	virtual void			ActivateByteSwapping( bool bActivate ) = 0;
 
+	// Does the text conversion, CRC and compression that AddBufferToZip does, without touching a zip, so
+	// several threads can prepare files at once. Returns false if the compression failed.
+	static bool PrepareBufferForZip( const void *data, int length, bool bTextMode, eCompressionType compressionType,
+									 CUtlBuffer &outBuf, int &uncompressedLength, CRC32_t &crc );
+
 	// Create/Release additional instances
 	// Disk Caching is necessary for large zips
 	static IZip *CreateZip( const char *pDiskCacheWritePath = NULL, bool bSortByName = false );
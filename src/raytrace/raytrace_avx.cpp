@@ -0,0 +1,243 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Eight wide AVX version of the kd-tree packet tracer.
+//
+//			This is the only file that uses AVX.  Its functions are compiled
+//			for AVX one at a time, so the rest of the library still runs on
+//			any SSE cpu.  Callers check HasWidePackets() before using them.
+//
+//			Trace8Rays follows Trace4Rays step for step, so both give the
+//			same hits for the same rays.
+//
+//=============================================================================//
+
+#include "raytrace.h"
+#include <immintrin.h>
+
+#if defined( __GNUC__ )
+#define AVX_FUNCTION __attribute__(( target( "avx" ) ))
+#else
+#define AVX_FUNCTION
+#endif
+
+// These match raytrace.cpp
+#define MAILBOX_HASH_SIZE 256
+#define MAX_TREE_DEPTH 21
+#define MAX_NODE_STACK_LEN (40*MAX_TREE_DEPTH)
+
+struct NodeToVisit8
+{
+	CacheOptimizedKDNode const *node;
+	__m256 TMin;
+	__m256 TMax;
+};
+
+bool RayTracingEnvironment::HasWidePackets( void ) const
+{
+	static bool s_bCPUHasAVX = GetCPUInformation()->m_bAVX;
+	return s_bCPUHasAVX && !( Flags & RTE_FLAGS_NO_WIDE_PACKETS ) && !OptimizedBVH.Count();
+}
+
+AVX_FUNCTION static FORCEINLINE bool IsAnyNegative8( __m256 a )
+{
+	return _mm256_movemask_ps( a ) != 0;
+}
+
+// mask ? a : b
+AVX_FUNCTION static FORCEINLINE __m256 MaskedAssign8( __m256 mask, __m256 a, __m256 b )
+{
+	return _mm256_blendv_ps( b, a, mask );
+}
+
+// Same as ReciprocalSaturateSIMD: zeros become epsilons, then estimate plus one newton step
+AVX_FUNCTION static FORCEINLINE __m256 ReciprocalSaturate8( __m256 a )
+{
+	__m256 zero_mask = _mm256_cmp_ps( a, _mm256_setzero_ps(), _CMP_EQ_OQ );
+	__m256 a_safe = _mm256_or_ps( a, _mm256_and_ps( _mm256_set1_ps( SubFloat( Four_Epsilons, 0 ) ), zero_mask ) );
+	__m256 ret = _mm256_rcp_ps( a_safe );
+	return _mm256_sub_ps( _mm256_add_ps( ret, ret ), _mm256_mul_ps( a_safe, _mm256_mul_ps( ret, ret ) ) );
+}
+
+AVX_FUNCTION void RayTracingEnvironment::Trace8Rays( const EightRays &rays, const float *pTMin, const float *pTMax,
+													 int DirectionSignMask, EightRayResult *rslt_out, int32 skip_id )
+{
+	const __m256 Eight_Epsilons = _mm256_set1_ps( 1.0e-10f );
+	const __m256 Eight_NegativeEpsilons = _mm256_set1_ps( -1.0e-10f );
+	const __m256 Eight_Ones = _mm256_set1_ps( 1.0f );
+
+	__m256 origin[3], direction[3], OneOverRayDir[3];
+	for ( int c = 0; c < 3; c++ )
+	{
+		origin[c] = _mm256_load_ps( rays.origin[c] );
+		direction[c] = _mm256_load_ps( rays.direction[c] );
+		OneOverRayDir[c] = ReciprocalSaturate8( direction[c] );
+	}
+
+	__m256 HitIds = _mm256_castsi256_ps( _mm256_set1_epi32( -1 ) );
+	__m256 HitDistance = _mm256_set1_ps( 1.0e23f );
+	__m256 NormalX = _mm256_setzero_ps();
+	__m256 NormalY = _mm256_setzero_ps();
+	__m256 NormalZ = _mm256_setzero_ps();
+
+	// now, clip rays against bounding box
+	__m256 TMin = _mm256_load_ps( pTMin );
+	__m256 TMax = _mm256_load_ps( pTMax );
+	for ( int c = 0; c < 3; c++ )
+	{
+		__m256 isect_min_t = _mm256_mul_ps( _mm256_sub_ps( _mm256_set1_ps( m_MinBound[c] ), origin[c] ), OneOverRayDir[c] );
+		__m256 isect_max_t = _mm256_mul_ps( _mm256_sub_ps( _mm256_set1_ps( m_MaxBound[c] ), origin[c] ), OneOverRayDir[c] );
+		TMin = _mm256_max_ps( TMin, _mm256_min_ps( isect_min_t, isect_max_t ) );
+		TMax = _mm256_min_ps( TMax, _mm256_max_ps( isect_min_t, isect_max_t ) );
+	}
+	__m256 active = _mm256_cmp_ps( TMin, TMax, _CMP_LE_OS );	// mask of which rays are active
+
+	if ( IsAnyNegative8( active ) )
+	{
+		int32 mailboxids[MAILBOX_HASH_SIZE];				// used to avoid redundant triangle tests
+		memset( mailboxids, 0xff, sizeof( mailboxids ) );
+
+		int front_idx[3], back_idx[3];						// based on ray direction, whether to
+															// visit left or right node first
+		for ( int c = 0; c < 3; c++ )
+		{
+			back_idx[c] = ( DirectionSignMask & ( 1 << c ) ) ? 0 : 1;
+			front_idx[c] = 1 - back_idx[c];
+		}
+
+		NodeToVisit8 NodeQueue[MAX_NODE_STACK_LEN];
+		CacheOptimizedKDNode const *CurNode = &( OptimizedKDTree[0] );
+		NodeToVisit8 *stack_ptr = &NodeQueue[MAX_NODE_STACK_LEN];
+		for (;;)
+		{
+			while ( CurNode->NodeType() != KDNODE_STATE_LEAF )		// traverse until next leaf
+			{
+				int split_plane_number = CurNode->NodeType();
+				CacheOptimizedKDNode const *FrontChild = &( OptimizedKDTree[CurNode->LeftChild()] );
+
+				__m256 dist_to_sep_plane =					// dist=(split-org)/dir
+					_mm256_mul_ps( _mm256_sub_ps( _mm256_set1_ps( CurNode->SplittingPlaneValue ), origin[split_plane_number] ),
+								   OneOverRayDir[split_plane_number] );
+				active = _mm256_cmp_ps( TMin, TMax, _CMP_LE_OS );
+
+				__m256 hits_front = _mm256_and_ps( active, _mm256_cmp_ps( dist_to_sep_plane, TMin, _CMP_GE_OS ) );
+				if ( !IsAnyNegative8( hits_front ) )
+				{
+					// missed the front. only traverse back
+					CurNode = FrontChild + back_idx[split_plane_number];
+					TMin = _mm256_max_ps( TMin, dist_to_sep_plane );
+				}
+				else
+				{
+					__m256 hits_back = _mm256_and_ps( active, _mm256_cmp_ps( dist_to_sep_plane, TMax, _CMP_LE_OS ) );
+					if ( !IsAnyNegative8( hits_back ) )
+					{
+						// missed the back - only need to traverse front node
+						CurNode = FrontChild + front_idx[split_plane_number];
+						TMax = _mm256_min_ps( TMax, dist_to_sep_plane );
+					}
+					else
+					{
+						// at least some rays hit both nodes.
+						// must push far, traverse near
+						assert( stack_ptr > NodeQueue );
+						--stack_ptr;
+						stack_ptr->node = FrontChild + back_idx[split_plane_number];
+						stack_ptr->TMin = _mm256_max_ps( TMin, dist_to_sep_plane );
+						stack_ptr->TMax = TMax;
+						CurNode = FrontChild + front_idx[split_plane_number];
+						TMax = _mm256_min_ps( TMax, dist_to_sep_plane );
+					}
+				}
+			}
+
+			// hit a leaf! must do intersection check
+			int ntris = CurNode->NumberOfTrianglesInLeaf();
+			if ( ntris )
+			{
+				int32 const *tlist = &( TriangleIndexList[CurNode->TriangleIndexStart()] );
+				do
+				{
+					int tnum = *( tlist++ );
+					// check mailbox
+					int mbox_slot = tnum & ( MAILBOX_HASH_SIZE - 1 );
+					TriIntersectData_t const *tri = &( OptimizedTriangleList[tnum].m_Data.m_IntersectData );
+					if ( ( mailboxids[mbox_slot] == tnum ) || ( tri->m_nTriangleID == skip_id ) )
+						continue;
+
+					mailboxids[mbox_slot] = tnum;
+
+					// compute plane intersection
+					__m256 Nx = _mm256_set1_ps( tri->m_flNx );
+					__m256 Ny = _mm256_set1_ps( tri->m_flNy );
+					__m256 Nz = _mm256_set1_ps( tri->m_flNz );
+
+					__m256 DDotN = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( direction[0], Nx ), _mm256_mul_ps( direction[1], Ny ) ),
+												  _mm256_mul_ps( direction[2], Nz ) );
+					// mask off zero or near zero (ray parallel to surface)
+					__m256 did_hit = _mm256_or_ps( _mm256_cmp_ps( DDotN, Eight_Epsilons, _CMP_GT_OS ),
+												   _mm256_cmp_ps( DDotN, Eight_NegativeEpsilons, _CMP_LT_OS ) );
+
+					__m256 ODotN = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( origin[0], Nx ), _mm256_mul_ps( origin[1], Ny ) ),
+												  _mm256_mul_ps( origin[2], Nz ) );
+					__m256 isect_t = _mm256_div_ps( _mm256_sub_ps( _mm256_set1_ps( tri->m_flD ), ODotN ), DDotN );
+
+					// now, we have the distance to the plane. lets update our mask
+					did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( isect_t, Eight_Epsilons, _CMP_GT_OS ) );
+					did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( isect_t, HitDistance, _CMP_LT_OS ) );
+					if ( !IsAnyNegative8( did_hit ) )
+						continue;
+
+					// now, check 3 edges
+					int c0 = tri->m_nCoordSelect0;
+					int c1 = tri->m_nCoordSelect1;
+					__m256 hitc1 = _mm256_add_ps( origin[c0], _mm256_mul_ps( isect_t, direction[c0] ) );
+					__m256 hitc2 = _mm256_add_ps( origin[c1], _mm256_mul_ps( isect_t, direction[c1] ) );
+
+					// do barycentric coordinate check
+					__m256 B0 = _mm256_mul_ps( _mm256_set1_ps( tri->m_ProjectedEdgeEquations[0] ), hitc1 );
+					B0 = _mm256_add_ps( B0, _mm256_mul_ps( _mm256_set1_ps( tri->m_ProjectedEdgeEquations[1] ), hitc2 ) );
+					B0 = _mm256_add_ps( B0, _mm256_set1_ps( tri->m_ProjectedEdgeEquations[2] ) );
+					did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( B0, Eight_Epsilons, _CMP_GE_OS ) );
+
+					__m256 B1 = _mm256_mul_ps( _mm256_set1_ps( tri->m_ProjectedEdgeEquations[3] ), hitc1 );
+					B1 = _mm256_add_ps( B1, _mm256_mul_ps( _mm256_set1_ps( tri->m_ProjectedEdgeEquations[4] ), hitc2 ) );
+					B1 = _mm256_add_ps( B1, _mm256_set1_ps( tri->m_ProjectedEdgeEquations[5] ) );
+					did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( B1, Eight_Epsilons, _CMP_GE_OS ) );
+
+					__m256 B2 = _mm256_add_ps( B1, B0 );
+					did_hit = _mm256_and_ps( did_hit, _mm256_cmp_ps( B2, Eight_Ones, _CMP_LE_OS ) );
+
+					if ( !IsAnyNegative8( did_hit ) )
+						continue;
+
+					// now, set the hit_id and closest_hit fields for any enabled rays
+					HitIds = MaskedAssign8( did_hit, _mm256_castsi256_ps( _mm256_set1_epi32( tnum ) ), HitIds );
+					HitDistance = MaskedAssign8( did_hit, isect_t, HitDistance );
+					NormalX = MaskedAssign8( did_hit, Nx, NormalX );
+					NormalY = MaskedAssign8( did_hit, Ny, NormalY );
+					NormalZ = MaskedAssign8( did_hit, Nz, NormalZ );
+				} while ( --ntris );
+
+				// now, check if all rays have terminated
+				__m256 raydone = _mm256_cmp_ps( TMax, HitDistance, _CMP_LE_OS );
+				if ( !IsAnyNegative8( raydone ) )
+					break;
+			}
+
+			if ( stack_ptr == &NodeQueue[MAX_NODE_STACK_LEN] )
+				break;
+
+			// pop stack!
+			CurNode = stack_ptr->node;
+			TMin = stack_ptr->TMin;
+			TMax = stack_ptr->TMax;
+			stack_ptr++;
+		}
+	}
+
+	_mm256_store_ps( (float *)rslt_out->HitIds, HitIds );
+	_mm256_store_ps( rslt_out->HitDistance, HitDistance );
+	_mm256_store_ps( rslt_out->surface_normal[0], NormalX );
+	_mm256_store_ps( rslt_out->surface_normal[1], NormalY );
+	_mm256_store_ps( rslt_out->surface_normal[2], NormalZ );
+}
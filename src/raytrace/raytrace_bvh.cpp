@@ -0,0 +1,415 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Bounding volume hierarchy builder, used instead of the kd-tree
+//			when RTE_FLAGS_USE_BVH is set.
+//
+//			Each node is split at the cheapest of BVH_NUM_BINS triangle
+//			centroid bins on each axis, costed with the same surface area
+//			heuristic as the kd-tree.  Every triangle ends up in exactly one
+//			leaf, so the triangle list partitions in place and no two
+//			subtrees share anything.  The top of the tree is built on the
+//			calling thread until the pieces are small enough to hand out to
+//			the build threads, and the subtrees they build are then spliced
+//			in, in the same order every time.  Nodes are always added in
+//			sibling pairs after the root and a padding node, so each pair
+//			starts at an even index and shares a cache line.
+//
+//=============================================================================//
+
+#include "raytrace.h"
+#include "tier0/threadtools.h"
+
+#define BVH_NUM_BINS 16
+#define BVH_MAX_LEAF_TRIS 8									// always split nodes bigger than this
+#define BVH_MIN_PARALLEL_TRIS 4096							// smaller scenes are built on one thread
+#define BVH_SUBTREES_PER_THREAD 8							// so that a few big subtrees don't
+															// leave the other threads idle
+#define BVH_MAX_THREADS 32
+
+// same estimates as the kd-tree builder
+#define COST_OF_TRAVERSAL 75
+#define COST_OF_INTERSECTION 167
+
+struct BVHBox_t
+{
+	Vector m_vecMins;
+	Vector m_vecMaxs;
+
+	void Clear( void )
+	{
+		m_vecMins.Init( 1.0e23, 1.0e23, 1.0e23 );
+		m_vecMaxs.Init( -1.0e23, -1.0e23, -1.0e23 );
+	}
+
+	void Add( const Vector &vecPoint )
+	{
+		VectorMin( m_vecMins, vecPoint, m_vecMins );
+		VectorMax( m_vecMaxs, vecPoint, m_vecMaxs );
+	}
+
+	void Add( const BVHBox_t &box )
+	{
+		VectorMin( m_vecMins, box.m_vecMins, m_vecMins );
+		VectorMax( m_vecMaxs, box.m_vecMaxs, m_vecMaxs );
+	}
+
+	float SurfaceArea( void ) const
+	{
+		Vector vecSize = m_vecMaxs - m_vecMins;
+		return 2.0f * ( vecSize.x * vecSize.y + vecSize.x * vecSize.z + vecSize.y * vecSize.z );
+	}
+};
+
+struct BVHSplit_t
+{
+	int m_nAxis;
+	int m_nBin;												// last bin on the left, or -1 to just
+															// split the list in half
+	float m_flBinMin;
+	float m_flBinScale;
+
+	FORCEINLINE int Bin( const Vector &vecCentroid ) const
+	{
+		int nBin = (int)( ( vecCentroid[m_nAxis] - m_flBinMin ) * m_flBinScale );
+		return clamp( nBin, 0, BVH_NUM_BINS - 1 );
+	}
+};
+
+// A piece of the tree that one thread builds on its own
+struct BVHSubtree_t
+{
+	int m_nNode;											// OptimizedBVH node its root replaces
+	int m_nFirst;
+	int m_nCount;
+	int m_nDepth;
+	CacheOptimizedBVH_t m_Nodes;							// root first, then sibling pairs
+};
+
+class CBVHBuilder
+{
+public:
+	CBVHBuilder( RayTracingEnvironment *pEnv ) : m_pEnv( pEnv ) {}
+	~CBVHBuilder()
+	{
+		m_Subtrees.PurgeAndDeleteElements();
+	}
+
+	void Build( void );
+
+private:
+	void BuildNode( CacheOptimizedBVH_t &nodes, int nNode, int nFirst, int nCount,
+					int nDepth, bool bDefer );
+	bool FindSplit( int nFirst, int nCount, const BVHBox_t &bounds, const BVHBox_t &centroidBounds,
+					BVHSplit_t &split ) const;
+	int Partition( int nFirst, int nCount, const BVHSplit_t &split );
+
+	void BuildSubtrees( void );
+	void SpliceSubtree( const BVHSubtree_t &subtree );
+	int GetThreadCount( void ) const;
+	static uintp SubtreeThread( void *pParam );
+
+	RayTracingEnvironment *m_pEnv;
+	int32 *m_pTris;											// TriangleIndexList, partitioned as we go
+	CUtlVector<BVHBox_t> m_TriBounds;
+	CUtlVector<Vector> m_TriCentroids;
+
+	int m_nSubtreeSize;										// nodes this small are left to the threads
+	CUtlVector<BVHSubtree_t *> m_Subtrees;					// in the order they were found
+	CUtlVector<BVHSubtree_t *> m_BuildOrder;				// largest first
+	CInterlockedInt m_nNextSubtree;
+};
+
+
+void CBVHBuilder::Build( void )
+{
+	int nTris = m_pEnv->OptimizedTriangleList.Count();
+
+	m_TriBounds.SetCount( nTris );
+	m_TriCentroids.SetCount( nTris );
+	m_pEnv->TriangleIndexList.SetCount( nTris );
+	m_pTris = m_pEnv->TriangleIndexList.Base();
+	for ( int i = 0; i < nTris; i++ )
+	{
+		CacheOptimizedTriangle const &tri = m_pEnv->OptimizedTriangleList[i];
+		m_TriBounds[i].Clear();
+		for ( int v = 0; v < 3; v++ )
+		{
+			m_TriBounds[i].Add( tri.Vertex( v ) );
+		}
+		m_TriCentroids[i] = 0.5f * ( m_TriBounds[i].m_vecMins + m_TriBounds[i].m_vecMaxs );
+		m_pTris[i] = i;
+	}
+
+	int nThreads = GetThreadCount();
+	bool bParallel = ( nThreads > 1 ) && ( nTris >= BVH_MIN_PARALLEL_TRIS );
+	m_nSubtreeSize = MAX( BVH_MIN_PARALLEL_TRIS / 4, nTris / ( nThreads * BVH_SUBTREES_PER_THREAD ) );
+
+	// the root, and a padding node that's never visited
+	CacheOptimizedBVH_t &nodes = m_pEnv->OptimizedBVH;
+	nodes.RemoveAll();
+	nodes.AddMultipleToTail( 2 );
+	V_memset( &nodes[1], 0, sizeof( nodes[1] ) );
+	nodes[1].m_nTypeAndCount = BVHNODE_STATE_LEAF;
+	BuildNode( nodes, 0, 0, nTris, 0, bParallel );
+
+	m_pEnv->m_MinBound.Init( nodes[0].m_flMins[0], nodes[0].m_flMins[1], nodes[0].m_flMins[2] );
+	m_pEnv->m_MaxBound.Init( nodes[0].m_flMaxs[0], nodes[0].m_flMaxs[1], nodes[0].m_flMaxs[2] );
+
+	if ( m_Subtrees.Count() )
+	{
+		BuildSubtrees();
+		for ( int i = 0; i < m_Subtrees.Count(); i++ )
+		{
+			SpliceSubtree( *m_Subtrees[i] );
+		}
+	}
+}
+
+
+void CBVHBuilder::BuildNode( CacheOptimizedBVH_t &nodes, int nNode, int nFirst, int nCount,
+							 int nDepth, bool bDefer )
+{
+	BVHBox_t bounds, centroidBounds;
+	bounds.Clear();
+	centroidBounds.Clear();
+	for ( int i = nFirst; i < nFirst + nCount; i++ )
+	{
+		bounds.Add( m_TriBounds[m_pTris[i]] );
+		centroidBounds.Add( m_TriCentroids[m_pTris[i]] );
+	}
+
+	for ( int c = 0; c < 3; c++ )
+	{
+		nodes[nNode].m_flMins[c] = bounds.m_vecMins[c];
+		nodes[nNode].m_flMaxs[c] = bounds.m_vecMaxs[c];
+	}
+
+	if ( bDefer && nCount <= m_nSubtreeSize )
+	{
+		BVHSubtree_t *pSubtree = new BVHSubtree_t;
+		pSubtree->m_nNode = nNode;
+		pSubtree->m_nFirst = nFirst;
+		pSubtree->m_nCount = nCount;
+		pSubtree->m_nDepth = nDepth;
+		m_Subtrees.AddToTail( pSubtree );
+		return;
+	}
+
+	BVHSplit_t split;
+	if ( ( nDepth >= BVH_MAX_DEPTH - 1 ) || !FindSplit( nFirst, nCount, bounds, centroidBounds, split ) )
+	{
+		nodes[nNode].m_nChildOrFirstTri = nFirst;
+		nodes[nNode].m_nTypeAndCount = BVHNODE_STATE_LEAF + ( nCount << 2 );
+		return;
+	}
+
+	int nLeft = Partition( nFirst, nCount, split );
+	int nLeftChild = nodes.AddMultipleToTail( 2 );
+	nodes[nNode].m_nChildOrFirstTri = nLeftChild;
+	nodes[nNode].m_nTypeAndCount = split.m_nAxis;
+
+	BuildNode( nodes, nLeftChild, nFirst, nLeft, nDepth + 1, bDefer );
+	BuildNode( nodes, nLeftChild + 1, nFirst + nLeft, nCount - nLeft, nDepth + 1, bDefer );
+}
+
+
+//-----------------------------------------------------------------------------
+// Returns false if the node should be a leaf. Otherwise split has the axis
+// and bin to split at, which always leaves triangles on both sides.
+//-----------------------------------------------------------------------------
+bool CBVHBuilder::FindSplit( int nFirst, int nCount, const BVHBox_t &bounds, const BVHBox_t &centroidBounds,
+							 BVHSplit_t &split ) const
+{
+	if ( nCount < 2 )
+		return false;
+
+	float flArea = bounds.SurfaceArea();
+	float flInvArea = ( flArea > 0.0f ) ? 1.0f / flArea : 0.0f;
+	float flBestCost = 1.0e30f;
+	split.m_nAxis = -1;
+
+	for ( int nAxis = 0; nAxis < 3; nAxis++ )
+	{
+		float flExtent = centroidBounds.m_vecMaxs[nAxis] - centroidBounds.m_vecMins[nAxis];
+		if ( flExtent <= 0.0f )
+			continue;
+
+		BVHSplit_t trial;
+		trial.m_nAxis = nAxis;
+		trial.m_flBinMin = centroidBounds.m_vecMins[nAxis];
+		trial.m_flBinScale = BVH_NUM_BINS / flExtent;
+
+		BVHBox_t binBounds[BVH_NUM_BINS];
+		int nBinCount[BVH_NUM_BINS];
+		for ( int b = 0; b < BVH_NUM_BINS; b++ )
+		{
+			binBounds[b].Clear();
+			nBinCount[b] = 0;
+		}
+		for ( int i = nFirst; i < nFirst + nCount; i++ )
+		{
+			int nTri = m_pTris[i];
+			int nBin = trial.Bin( m_TriCentroids[nTri] );
+			binBounds[nBin].Add( m_TriBounds[nTri] );
+			nBinCount[nBin]++;
+		}
+
+		// sweep from the right to get the cost of everything past each split...
+		float flRightArea[BVH_NUM_BINS - 1];
+		int nRightCount[BVH_NUM_BINS - 1];
+		BVHBox_t sweep;
+		sweep.Clear();
+		int nSwept = 0;
+		for ( int b = BVH_NUM_BINS - 1; b > 0; b-- )
+		{
+			sweep.Add( binBounds[b] );
+			nSwept += nBinCount[b];
+			flRightArea[b - 1] = nSwept ? sweep.SurfaceArea() : 0.0f;
+			nRightCount[b - 1] = nSwept;
+		}
+
+		// ...then from the left to cost each split
+		sweep.Clear();
+		nSwept = 0;
+		for ( int b = 0; b < BVH_NUM_BINS - 1; b++ )
+		{
+			sweep.Add( binBounds[b] );
+			nSwept += nBinCount[b];
+			if ( !nSwept || !nRightCount[b] )
+				continue;
+
+			float flCost = COST_OF_TRAVERSAL + COST_OF_INTERSECTION *
+				( sweep.SurfaceArea() * nSwept + flRightArea[b] * nRightCount[b] ) * flInvArea;
+			if ( flCost < flBestCost )
+			{
+				flBestCost = flCost;
+				split = trial;
+				split.m_nBin = b;
+			}
+		}
+	}
+
+	if ( split.m_nAxis < 0 )
+	{
+		// all the centroids are in the same place. only split if the leaf would be too big.
+		if ( nCount <= BVH_MAX_LEAF_TRIS )
+			return false;
+		split.m_nAxis = 0;
+		split.m_nBin = -1;
+		return true;
+	}
+
+	return ( nCount > BVH_MAX_LEAF_TRIS ) || ( flBestCost < COST_OF_INTERSECTION * nCount );
+}
+
+
+// returns how many triangles went left
+int CBVHBuilder::Partition( int nFirst, int nCount, const BVHSplit_t &split )
+{
+	if ( split.m_nBin < 0 )
+		return nCount / 2;
+
+	int32 *pTris = m_pTris + nFirst;
+	int nLeft = 0;
+	int nRight = nCount;
+	while ( nLeft < nRight )
+	{
+		if ( split.Bin( m_TriCentroids[pTris[nLeft]] ) <= split.m_nBin )
+		{
+			nLeft++;
+		}
+		else
+		{
+			V_swap( pTris[nLeft], pTris[--nRight] );
+		}
+	}
+	return nLeft;
+}
+
+
+uintp CBVHBuilder::SubtreeThread( void *pParam )
+{
+	CBVHBuilder *pBuilder = (CBVHBuilder *)pParam;
+	for ( ;; )
+	{
+		int nSubtree = ++pBuilder->m_nNextSubtree - 1;
+		if ( nSubtree >= pBuilder->m_BuildOrder.Count() )
+			break;
+
+		BVHSubtree_t *pSubtree = pBuilder->m_BuildOrder[nSubtree];
+		pSubtree->m_Nodes.AddToTail();
+		pBuilder->BuildNode( pSubtree->m_Nodes, 0, pSubtree->m_nFirst, pSubtree->m_nCount, pSubtree->m_nDepth, false );
+	}
+	return 0;
+}
+
+
+static bool SubtreeLessFunc( BVHSubtree_t * const &pLeft, BVHSubtree_t * const &pRight )
+{
+	return pLeft->m_nCount > pRight->m_nCount;
+}
+
+void CBVHBuilder::BuildSubtrees( void )
+{
+	m_BuildOrder.CopyArray( m_Subtrees.Base(), m_Subtrees.Count() );
+	m_BuildOrder.SortPredicate( SubtreeLessFunc );
+	m_nNextSubtree = 0;
+
+	int nThreads = MIN( GetThreadCount(), m_BuildOrder.Count() );
+	ThreadHandle_t hThreads[BVH_MAX_THREADS];
+	for ( int i = 1; i < nThreads; i++ )
+	{
+		hThreads[i] = CreateSimpleThread( SubtreeThread, this );
+	}
+
+	// this thread does its share too
+	SubtreeThread( this );
+
+	for ( int i = 1; i < nThreads; i++ )
+	{
+		ThreadJoin( hThreads[i] );
+		ReleaseThreadHandle( hThreads[i] );
+	}
+}
+
+
+// moves a finished subtree into its place in OptimizedBVH
+void CBVHBuilder::SpliceSubtree( const BVHSubtree_t &subtree )
+{
+	CacheOptimizedBVH_t &nodes = m_pEnv->OptimizedBVH;
+
+	// local node i > 0 goes to nBase + i - 1. Leaves point at TriangleIndexList, which the
+	// subtrees shared, so only interior nodes need their child moved. Both arrays hold the
+	// root and then whole pairs, so nBase is even and the pairs stay on even indices.
+	Assert( !( nodes.Count() & 1 ) );
+	int nBase = nodes.Count();
+	nodes.AddMultipleToTail( subtree.m_Nodes.Count() - 1 );
+	for ( int i = 0; i < subtree.m_Nodes.Count(); i++ )
+	{
+		CacheOptimizedBVHNode node = subtree.m_Nodes[i];
+		if ( node.NodeType() != BVHNODE_STATE_LEAF )
+		{
+			node.m_nChildOrFirstTri += nBase - 1;
+		}
+		nodes[i ? nBase + i - 1 : subtree.m_nNode] = node;
+	}
+}
+
+
+int CBVHBuilder::GetThreadCount( void ) const
+{
+	int nThreads = m_pEnv->BuildThreads;
+	if ( nThreads <= 0 )
+	{
+		nThreads = GetCPUInformation()->m_nLogicalProcessors;
+	}
+	return clamp( nThreads, 1, BVH_MAX_THREADS );
+}
+
+
+void RayTracingEnvironment::BuildBVH( void )
+{
+	OptimizedKDTree.Purge();
+	CBVHBuilder builder( this );
+	builder.Build();
+}
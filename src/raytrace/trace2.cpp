@@ -302,75 +302,153 @@ static unsigned int GetSignMask(Vector const &v)
 	return ret;
 }
 
+#define RAYSTREAM_SIGNMASK_SHIFT 24
 
-inline void RayTracingEnvironment::FlushStreamEntry(RayStream &s,int msk)
+// spreads the low 4 bits of x out to every third bit, for morton ordering
+static uint32 SpreadBits4(uint32 x)
+{
+	uint32 ret=0;
+	for(int b=0;b<4;b++)
+		ret|=((x>>b)&1)<<(3*b);
+	return ret;
+}
+
+static uint32 MortonCell4(float x, float y, float z)
+{
+	int ix=clamp((int) (x*16.0f),0,15);
+	int iy=clamp((int) (y*16.0f),0,15);
+	int iz=clamp((int) (z*16.0f),0,15);
+	return SpreadBits4(ix)|(SpreadBits4(iy)<<1)|(SpreadBits4(iz)<<2);
+}
+
+static int CompareRayStreamEntries(const void *a, const void *b)
+{
+	uint32 ka=((const RayStreamEntry_t *) a)->m_nSortKey;
+	uint32 kb=((const RayStreamEntry_t *) b)->m_nSortKey;
+	return (ka<kb)?-1:((ka>kb)?1:0);
+}
+
+// fills in 4 rays from the stream, repeating the last one if there are fewer, and normalizes
+// them the way the stream always has.
+static void LoadStreamRays(FourRays &rays, fltx4 &tmax, RayStreamEntry_t const *pRays, int nRays)
 {
-	assert(msk>=0);
-	assert(msk<8);
-	fltx4 tmax=s.PendingRays[msk].direction.length();
-	fltx4 scl=ReciprocalSaturateSIMD(tmax);
-	s.PendingRays[msk].direction*=scl;					// normalize
-	RayTracingResult tmpresult;
-	Trace4Rays(s.PendingRays[msk],Four_Zeros,tmax,msk,&tmpresult);
-	// now, write out results
 	for(int r=0;r<4;r++)
 	{
-		RayTracingSingleResult *out=s.PendingStreamOutputs[msk][r];
-		out->ray_length=SubFloat( tmax, r );
-		out->surface_normal.x=tmpresult.surface_normal.X(r);
-		out->surface_normal.y=tmpresult.surface_normal.Y(r);
-		out->surface_normal.z=tmpresult.surface_normal.Z(r);
-		out->HitID=tmpresult.HitIds[r];
-		out->HitDistance=SubFloat( tmpresult.HitDistance, r );
+		RayStreamEntry_t const &ray=pRays[min(r,nRays-1)];
+		rays.origin.X(r)=ray.m_vecStart.x;
+		rays.origin.Y(r)=ray.m_vecStart.y;
+		rays.origin.Z(r)=ray.m_vecStart.z;
+		rays.direction.X(r)=ray.m_vecDelta.x;
+		rays.direction.Y(r)=ray.m_vecDelta.y;
+		rays.direction.Z(r)=ray.m_vecDelta.z;
 	}
-	s.n_in_stream[msk]=0;
+	tmax=rays.direction.length();
+	fltx4 scl=ReciprocalSaturateSIMD(tmax);
+	rays.direction*=scl;								// normalize
 }
 
-void RayTracingEnvironment::AddToRayStream(RayStream &s,
-										   Vector const &start,Vector const &end,
-										   RayTracingSingleResult *rslt_out)
+static void StoreStreamResult(RayStreamEntry_t const &ray, float flRayLength, float nx, float ny, float nz,
+							  int32 nHitID, float flHitDistance)
 {
-	Vector delta=end;
-	delta-=start;
-	int msk=GetSignMask(delta);
-	assert(msk>=0);
-	assert(msk<8);
-	int pos=s.n_in_stream[msk];
-	assert(pos<4);
-	s.PendingRays[msk].origin.X(pos)=start.x;
-	s.PendingRays[msk].origin.Y(pos)=start.y;
-	s.PendingRays[msk].origin.Z(pos)=start.z;
-	s.PendingRays[msk].direction.X(pos)=delta.x;
-	s.PendingRays[msk].direction.Y(pos)=delta.y;
-	s.PendingRays[msk].direction.Z(pos)=delta.z;
-	s.PendingStreamOutputs[msk][pos]=rslt_out;
-	if (pos==3)
-	{
-		FlushStreamEntry(s,msk);
-	}
-	else
-		s.n_in_stream[msk]++;
+	RayTracingSingleResult *out=ray.m_pOutput;
+	out->ray_length=flRayLength;
+	out->surface_normal.x=nx;
+	out->surface_normal.y=ny;
+	out->surface_normal.z=nz;
+	out->HitID=nHitID;
+	out->HitDistance=flHitDistance;
 }
 
-void RayTracingEnvironment::FinishRayStream(RayStream &s)
+void RayTracingEnvironment::FlushRayStream(RayStream &s)
 {
-	for(int msk=0;msk<8;msk++)
+	// sort so that rays with the same direction signs are together, and within those, rays that
+	// start near each other and point the same way. packets built from neighbours then walk
+	// mostly the same nodes.
+	qsort(s.m_PendingRays,s.m_nPending,sizeof(RayStreamEntry_t),CompareRayStreamEntries);
+
+	int nPacketSize=HasWidePackets()?8:4;
+	for(int i=0;i<s.m_nPending;)
 	{
-		int cnt=s.n_in_stream[msk];
-		if (cnt)
+		RayStreamEntry_t *pRays=&s.m_PendingRays[i];
+		int msk=pRays[0].m_nSortKey>>RAYSTREAM_SIGNMASK_SHIFT;
+		int nRays=1;
+		while( (nRays<nPacketSize) && (i+nRays<s.m_nPending) &&
+			   ( (pRays[nRays].m_nSortKey>>RAYSTREAM_SIGNMASK_SHIFT)==(uint32) msk) )
+			nRays++;
+
+		FourRays rays[2];
+		fltx4 tmax[2];
+		LoadStreamRays(rays[0],tmax[0],pRays,nRays);
+		if (nRays>4)
 		{
-			// fill in unfilled entries with dups of first
-			for(int c=cnt;c<4;c++)
+			LoadStreamRays(rays[1],tmax[1],pRays+4,nRays-4);
+
+			EightRays wide;
+			ALIGN32 float flTMin[8] ALIGN32_POST;
+			ALIGN32 float flTMax[8] ALIGN32_POST;
+			for(int h=0;h<2;h++)
 			{
-				s.PendingRays[msk].origin.X(c) = s.PendingRays[msk].origin.X(0);
-				s.PendingRays[msk].origin.Y(c) = s.PendingRays[msk].origin.Y(0);
-				s.PendingRays[msk].origin.Z(c) = s.PendingRays[msk].origin.Z(0);
-				s.PendingRays[msk].direction.X(c) = s.PendingRays[msk].direction.X(0);
-				s.PendingRays[msk].direction.Y(c) = s.PendingRays[msk].direction.Y(0);
-				s.PendingRays[msk].direction.Z(c) = s.PendingRays[msk].direction.Z(0);
-				s.PendingStreamOutputs[msk][c]=s.PendingStreamOutputs[msk][0];
+				for(int c=0;c<3;c++)
+				{
+					StoreAlignedSIMD(wide.origin[c]+4*h,rays[h].origin[c]);
+					StoreAlignedSIMD(wide.direction[c]+4*h,rays[h].direction[c]);
+				}
+				StoreAlignedSIMD(flTMin+4*h,Four_Zeros);
+				StoreAlignedSIMD(flTMax+4*h,tmax[h]);
 			}
-			FlushStreamEntry(s,msk);
+
+			EightRayResult result;
+			Trace8Rays(wide,flTMin,flTMax,msk,&result);
+			for(int r=0;r<nRays;r++)
+				StoreStreamResult(pRays[r],flTMax[r],result.surface_normal[0][r],
+								  result.surface_normal[1][r],result.surface_normal[2][r],
+								  result.HitIds[r],result.HitDistance[r]);
+		}
+		else
+		{
+			RayTracingResult result;
+			Trace4Rays(rays[0],Four_Zeros,tmax[0],msk,&result);
+			for(int r=0;r<nRays;r++)
+				StoreStreamResult(pRays[r],SubFloat(tmax[0],r),result.surface_normal.X(r),
+								  result.surface_normal.Y(r),result.surface_normal.Z(r),
+								  result.HitIds[r],SubFloat(result.HitDistance,r));
 		}
+		i+=nRays;
 	}
+	s.m_nPending=0;
+}
+
+void RayTracingEnvironment::AddToRayStream(RayStream &s,
+										   Vector const &start,Vector const &end,
+										   RayTracingSingleResult *rslt_out)
+{
+	if (s.m_nPending==RAYSTREAM_MAX_PENDING)
+		FlushRayStream(s);
+
+	RayStreamEntry_t &ray=s.m_PendingRays[s.m_nPending++];
+	ray.m_vecStart=start;
+	ray.m_vecDelta=end;
+	ray.m_vecDelta-=start;
+	ray.m_pOutput=rslt_out;
+
+	// sort key: direction signs, then a coarse cell of the world bounds the ray starts in, then
+	// a coarse cell of its direction
+	Vector extent=m_MaxBound-m_MinBound;
+	float ox=(extent.x>0)?(start.x-m_MinBound.x)/extent.x:0;
+	float oy=(extent.y>0)?(start.y-m_MinBound.y)/extent.y:0;
+	float oz=(extent.z>0)?(start.z-m_MinBound.z)/extent.z:0;
+	Vector absdir(fabs(ray.m_vecDelta.x),fabs(ray.m_vecDelta.y),fabs(ray.m_vecDelta.z));
+	float len=absdir.Length();
+	if (len>0)
+		absdir*=1.0f/len;
+	int msk=GetSignMask(ray.m_vecDelta);
+	assert(msk>=0);
+	assert(msk<8);
+	ray.m_nSortKey=(msk<<RAYSTREAM_SIGNMASK_SHIFT)|(MortonCell4(ox,oy,oz)<<12)|
+		MortonCell4(absdir.x,absdir.y,absdir.z);
+}
+
+void RayTracingEnvironment::FinishRayStream(RayStream &s)
+{
+	FlushRayStream(s);
 }
@@ -9,25 +9,156 @@
 #include "tier1/strtools.h"
 #include <stdint.h> // INT32_MIN defn
 
-KeyValuesJSONParser::KeyValuesJSONParser( const CUtlBuffer &buf )
+#if defined( _M_IX86 ) || defined( _M_X64 ) || defined( __i386__ ) || defined( __x86_64__ )
+	#define KVJSON_SSE2
+	#include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+	#include <intrin.h>
+	#pragma intrinsic(_BitScanForward)
+#endif
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+//-----------------------------------------------------------------------------
+// Character classification for the structural index.  Each classifier takes
+// 16 bytes of input and returns one bitmask per class, bit N for byte N.
+//-----------------------------------------------------------------------------
+
+// How many bytes of input are indexed per window.  The index for a window is
+// thrown away once the parser has consumed it.
+static const uint32 k_nIndexWindowBytes = 64*1024;
+
+struct JSONBlockMasks_t
+{
+	uint32 m_nWhitespace;	// ' ' '\t'
+	uint32 m_nNewline;		// '\n' '\r'
+	uint32 m_nStructural;	// { } [ ] : ,
+	uint32 m_nQuote;		// " '
+	uint32 m_nBackslash;
+	uint32 m_nSlash;
+};
+
+static void ClassifyBlockScalar( const char *p, JSONBlockMasks_t &masks )
 {
-	Init( (const char *)buf.Base(), buf.TellPut() );
+	memset( &masks, 0, sizeof(masks) );
+	for ( int i = 0 ; i < 16 ; ++i )
+	{
+		uint32 bit = 1u << i;
+		switch ( p[i] )
+		{
+			case ' ': case '\t': masks.m_nWhitespace |= bit; break;
+			case '\n': case '\r': masks.m_nNewline |= bit; break;
+			case '{': case '}': case '[': case ']': case ':': case ',': masks.m_nStructural |= bit; break;
+			case '\"': case '\'': masks.m_nQuote |= bit; break;
+			case '\\': masks.m_nBackslash |= bit; break;
+			case '/': masks.m_nSlash |= bit; break;
+		}
+	}
 }
 
-KeyValuesJSONParser::KeyValuesJSONParser( const char *pszText, int cbSize )
+#ifdef KVJSON_SSE2
+static void ClassifyBlockSSE2( const char *p, JSONBlockMasks_t &masks )
 {
-	Init( pszText, cbSize >= 0 ? cbSize : V_strlen(pszText) );
+	__m128i v = _mm_loadu_si128( (const __m128i *)p );
+	#define EQ( ch ) _mm_cmpeq_epi8( v, _mm_set1_epi8( ch ) )
+	masks.m_nWhitespace = _mm_movemask_epi8( _mm_or_si128( EQ( ' ' ), EQ( '\t' ) ) );
+	masks.m_nNewline = _mm_movemask_epi8( _mm_or_si128( EQ( '\n' ), EQ( '\r' ) ) );
+	masks.m_nStructural = _mm_movemask_epi8(
+		_mm_or_si128(
+			_mm_or_si128( _mm_or_si128( EQ( '{' ), EQ( '}' ) ), _mm_or_si128( EQ( '[' ), EQ( ']' ) ) ),
+			_mm_or_si128( EQ( ':' ), EQ( ',' ) ) ) );
+	masks.m_nQuote = _mm_movemask_epi8( _mm_or_si128( EQ( '\"' ), EQ( '\'' ) ) );
+	masks.m_nBackslash = _mm_movemask_epi8( EQ( '\\' ) );
+	masks.m_nSlash = _mm_movemask_epi8( EQ( '/' ) );
+	#undef EQ
+}
+
+// Returns a bitmask of the bytes in the 16 at p that can end a plain run of string characters
+static inline uint32 StringSpecialMaskSSE2( const char *p, char cDelim )
+{
+	__m128i v = _mm_loadu_si128( (const __m128i *)p );
+	__m128i special = _mm_or_si128(
+		_mm_or_si128( _mm_cmpeq_epi8( v, _mm_set1_epi8( cDelim ) ), _mm_cmpeq_epi8( v, _mm_set1_epi8( '\\' ) ) ),
+		_mm_or_si128( _mm_cmpeq_epi8( v, _mm_set1_epi8( '\n' ) ), _mm_cmpeq_epi8( v, _mm_set1_epi8( '\r' ) ) ) );
+	return _mm_movemask_epi8( special );
+}
+#endif
+
+typedef void (*JSONClassifyBlockFn_t)( const char *p, JSONBlockMasks_t &masks );
+
+static JSONClassifyBlockFn_t GetClassifyBlockFn()
+{
+	static JSONClassifyBlockFn_t s_pfn = NULL;
+	if ( !s_pfn )
+	{
+		s_pfn = ClassifyBlockScalar;
+		#ifdef KVJSON_SSE2
+			if ( GetCPUInformation()->m_bSSE2 )
+				s_pfn = ClassifyBlockSSE2;
+		#endif
+	}
+	return s_pfn;
+}
+
+static inline int FirstSetBit( uint32 nMask )
+{
+	Assert( nMask != 0 );
+#ifdef _WIN32
+	unsigned long nBit;
+	_BitScanForward( &nBit, nMask );
+	return (int)nBit;
+#else
+	return __builtin_ctz( nMask );
+#endif
+}
+
+// Can a token end immediately before this character, with the next token
+// (if any) found by the structural index?
+static inline bool IsIndexedTokenBoundary( char c )
+{
+	switch ( c )
+	{
+		case ' ': case '\t': case '\n': case '\r':
+		case '{': case '}': case '[': case ']': case ':': case ',':
+		case '\"': case '\'': case '/':
+			return true;
+	}
+	return false;
+}
+
+KeyValuesJSONParser::KeyValuesJSONParser( const CUtlBuffer &buf, bool bUseStructuralIndex )
+{
+	Init( (const char *)buf.Base(), buf.TellPut(), bUseStructuralIndex );
+}
+
+KeyValuesJSONParser::KeyValuesJSONParser( const char *pszText, int cbSize, bool bUseStructuralIndex )
+{
+	Init( pszText, cbSize >= 0 ? cbSize : V_strlen(pszText), bUseStructuralIndex );
 }
 
 KeyValuesJSONParser::~KeyValuesJSONParser() {}
 
-void KeyValuesJSONParser::Init( const char *pszText, int cbSize )
+void KeyValuesJSONParser::Init( const char *pszText, int cbSize, bool bUseStructuralIndex )
 {
 	m_szErrMsg[0] = '\0';
 	m_nLine = 1;
+	m_begin = pszText;
 	m_cur = pszText;
 	m_end = pszText+cbSize;
 
+	m_bUseStructuralIndex = bUseStructuralIndex;
+	m_bIndexFinished = false;
+	m_iIndexEntry = 0;
+	m_nScanPos = 0;
+	m_nScanSkipTo = 0;
+	m_nScanBoundaryCarry = 1; // Start of input counts as a token boundary
+	m_nScanLine = 1;
+	m_eScanState = kScan_Value;
+	m_cScanStringDelim = '\0';
+
 	m_eToken = kToken_Null;
 	NextToken();
 }
@@ -111,6 +242,10 @@ bool KeyValuesJSONParser::ParseObject( KeyValues *pObject )
 		pObject->AddSubkeyUsingKnownLastChild( pChildValue, pLastChild );
 		pLastChild = pChildValue;
 
+		// Lexical error immediately following the value?
+		if ( m_eToken == kToken_Err )
+			return false;
+
 		// Eat the comma, if there is one.  If no comma,
 		// then the other thing that could come next
 		// is the closing brace to close the object
@@ -180,6 +315,10 @@ bool KeyValuesJSONParser::ParseArray( KeyValues *pArray )
 			return false;
 		}
 
+		// Lexical error immediately following the value?
+		if ( m_eToken == kToken_Err )
+			return false;
+
 		// Eat the comma, if there is one.  If no comma,
 		// then the other thing that could come next
 		// is the closing brace to close the object
@@ -287,6 +426,11 @@ void KeyValuesJSONParser::NextToken()
 	// Clear token
 	m_vecTokenChars.SetCount(0);
 
+	// Jump straight to the next token using the structural index.  If we can't,
+	// the scalar loop below handles it (and produces the appropriate error)
+	if ( m_bUseStructuralIndex )
+		SkipToIndexedToken();
+
 	// Scan until we hit the end of input
 	while ( m_cur < m_end )
 	{
@@ -376,7 +520,7 @@ void KeyValuesJSONParser::NextToken()
 
 			case '/':
 				// C++-style comment?
-				if ( m_cur < m_end && m_cur[1] == '/' )
+				if ( m_cur + 1 < m_end && m_cur[1] == '/' )
 				{
 					m_cur += 2;
 					while ( m_cur < m_end && *m_cur != '\n' && *m_cur != '\r' )
@@ -542,6 +686,24 @@ void KeyValuesJSONParser::ParseStringToken()
 
 	while ( m_cur < m_end )
 	{
+#ifdef KVJSON_SSE2
+		// Copy runs of ordinary characters 16 at a time
+		while ( m_cur + 16 <= m_end )
+		{
+			uint32 nSpecial = StringSpecialMaskSSE2( m_cur, cDelim );
+			int nRun = nSpecial ? FirstSetBit( nSpecial ) : 16;
+			if ( nRun > 0 )
+			{
+				m_vecTokenChars.AddMultipleToTail( nRun, m_cur );
+				m_cur += nRun;
+			}
+			if ( nSpecial )
+				break;
+		}
+		if ( m_cur >= m_end )
+			break;
+#endif
+
 		char c = *(m_cur++);
 		if ( c == '\r' || c == '\n' )
 		{
@@ -569,6 +731,7 @@ void KeyValuesJSONParser::ParseStringToken()
 			continue;
 
 		// Check table of allowed escape characters
+		c = *(m_cur++);
 		switch (c)
 		{
 			case '\\':
@@ -600,9 +763,9 @@ void KeyValuesJSONParser::ParseStringToken()
 					char chHex = *(m_cur++);
 					if ( chHex >= '0' && chHex <= '9' )
 						nCodePoint += chHex - '0';
-					else if ( chHex >= 'a' && chHex <= 'a' )
+					else if ( chHex >= 'a' && chHex <= 'f' )
 						nCodePoint += chHex + 0x0a - 'a';
-					else if ( chHex >= 'A' && chHex <= 'A' )
+					else if ( chHex >= 'A' && chHex <= 'F' )
 						nCodePoint += chHex + 0x0a - 'A';
 					else
 						Assert( false ); // inconceivable, due to above
@@ -660,3 +823,243 @@ const char *KeyValuesJSONParser::GetTokenDebugText()
 	return "<parse error>";
 }
 
+
+void KeyValuesJSONParser::FillStructuralIndex()
+{
+	m_vecIndex.SetCount( 0 );
+	m_iIndexEntry = 0;
+
+	JSONClassifyBlockFn_t pfnClassify = GetClassifyBlockFn();
+	const uint32 nSize = (uint32)( m_end - m_begin );
+
+	// Keep scanning windows until we find at least one token, or hit the end
+	while ( m_vecIndex.Count() == 0 && m_nScanPos < nSize )
+	{
+		uint32 nWindowEnd = MIN( nSize, m_nScanPos + k_nIndexWindowBytes );
+		for ( ; m_nScanPos < nWindowEnd ; m_nScanPos += 16 )
+		{
+			// Classify the block.  The final partial block is padded with whitespace
+			JSONBlockMasks_t masks;
+			if ( m_nScanPos + 16 <= nSize )
+			{
+				pfnClassify( m_begin + m_nScanPos, masks );
+			}
+			else
+			{
+				char tail[16];
+				memset( tail, ' ', sizeof(tail) );
+				memcpy( tail, m_begin + m_nScanPos, nSize - m_nScanPos );
+				pfnClassify( tail, masks );
+			}
+
+			// A token starts at any non-whitespace character that follows a character
+			// that can end a token.  Structural characters, quotes and slashes always
+			// start a token (or a comment).
+			uint32 nBoundary = masks.m_nWhitespace | masks.m_nNewline | masks.m_nStructural | masks.m_nQuote;
+			uint32 nStarts = ~( masks.m_nWhitespace | masks.m_nNewline ) & ( ( nBoundary << 1 ) | m_nScanBoundaryCarry ) & 0xffff;
+			m_nScanBoundaryCarry = ( nBoundary >> 15 ) & 1;
+			uint32 nTokenMask = nStarts | masks.m_nStructural | masks.m_nQuote | masks.m_nSlash;
+			uint32 nInteresting = nTokenMask | masks.m_nNewline | masks.m_nBackslash;
+
+			// Visit only the interesting characters
+			while ( nInteresting )
+			{
+				int iBit = FirstSetBit( nInteresting );
+				nInteresting &= nInteresting - 1;
+				uint32 nPos = m_nScanPos + iBit;
+				if ( nPos < m_nScanSkipTo || nPos >= nSize )
+					continue;
+				uint32 nBit = 1u << iBit;
+				char c = m_begin[ nPos ];
+
+				if ( masks.m_nNewline & nBit )
+				{
+					// Newlines end strings (with an error, reported by ParseStringToken)
+					// and comments.  \r\n or \n\r count as a single line break.
+					++m_nScanLine;
+					if ( nPos + 1 < nSize && m_begin[ nPos + 1 ] == ( '\n' + '\r' - c ) )
+						m_nScanSkipTo = nPos + 2;
+					m_eScanState = kScan_Value;
+					continue;
+				}
+
+				switch ( m_eScanState )
+				{
+					case kScan_Value:
+						if ( !( nTokenMask & nBit ) )
+							break;
+						if ( c == '/' && nPos + 1 < nSize && m_begin[ nPos + 1 ] == '/' )
+						{
+							m_eScanState = kScan_Comment;
+							break;
+						}
+						{
+							IndexEntry_t &entry = m_vecIndex[ m_vecIndex.AddToTail() ];
+							entry.m_nOffset = nPos;
+							entry.m_nLine = m_nScanLine;
+						}
+						if ( masks.m_nQuote & nBit )
+						{
+							m_eScanState = kScan_String;
+							m_cScanStringDelim = c;
+						}
+						break;
+
+					case kScan_String:
+						if ( c == m_cScanStringDelim )
+							m_eScanState = kScan_Value;
+						else if ( c == '\\' )
+							m_nScanSkipTo = nPos + 2; // Skip the escaped character
+						break;
+
+					case kScan_Comment:
+						break;
+				}
+			}
+		}
+	}
+
+	// Terminate the index at the end of input, so that the line
+	// number is correct when we report EOF
+	if ( m_nScanPos >= nSize && !m_bIndexFinished )
+	{
+		IndexEntry_t &entry = m_vecIndex[ m_vecIndex.AddToTail() ];
+		entry.m_nOffset = nSize;
+		entry.m_nLine = m_nScanLine;
+		m_bIndexFinished = true;
+	}
+}
+
+bool KeyValuesJSONParser::SkipToIndexedToken()
+{
+	// If the previous token ended on a character the index doesn't know
+	// about (e.g. "truex"), let the scalar tokenizer deal with it.
+	if ( m_cur < m_end && !IsIndexedTokenBoundary( *m_cur ) )
+		return false;
+
+	const uint32 nCurOffset = (uint32)( m_cur - m_begin );
+	for (;;)
+	{
+		while ( m_iIndexEntry < m_vecIndex.Count() )
+		{
+			const IndexEntry_t &entry = m_vecIndex[ m_iIndexEntry ];
+
+			// Skip entries we've already passed.  This can happen if we dropped
+			// into the scalar tokenizer for a token.
+			if ( entry.m_nOffset < nCurOffset )
+			{
+				++m_iIndexEntry;
+				continue;
+			}
+
+			m_cur = m_begin + entry.m_nOffset;
+			m_nLine = entry.m_nLine;
+			++m_iIndexEntry;
+			return true;
+		}
+
+		if ( m_bIndexFinished )
+			return false;
+		FillStructuralIndex();
+	}
+}
+
+#ifdef _DEBUG
+
+static bool KeyValuesJSONTreesMatch( KeyValues *a, KeyValues *b )
+{
+	if ( a == NULL || b == NULL )
+		return a == b;
+	if ( V_strcmp( a->GetName(), b->GetName() ) != 0 || a->GetDataType() != b->GetDataType() )
+		return false;
+	switch ( a->GetDataType() )
+	{
+		case KeyValues::TYPE_STRING: if ( V_strcmp( a->GetString(), b->GetString() ) != 0 ) return false; break;
+		case KeyValues::TYPE_INT: if ( a->GetInt() != b->GetInt() ) return false; break;
+		case KeyValues::TYPE_UINT64: if ( a->GetUint64() != b->GetUint64() ) return false; break;
+		case KeyValues::TYPE_FLOAT: if ( a->GetFloat() != b->GetFloat() ) return false; break;
+		default: break;
+	}
+	KeyValues *pChildA = a->GetFirstSubKey();
+	KeyValues *pChildB = b->GetFirstSubKey();
+	while ( pChildA || pChildB )
+	{
+		if ( !KeyValuesJSONTreesMatch( pChildA, pChildB ) )
+			return false;
+		pChildA = pChildA ? pChildA->GetNextKey() : NULL;
+		pChildB = pChildB ? pChildB->GetNextKey() : NULL;
+	}
+	return true;
+}
+
+// Parse the text with and without the structural index, and make sure
+// we get the same tree, or the same error on the same line
+static void CheckKeyValuesJSONParsersAgree( const char *pszText, int cbSize )
+{
+	KeyValuesJSONParser parserScalar( pszText, cbSize, false );
+	KeyValuesJSONParser parserIndexed( pszText, cbSize, true );
+	KeyValues *pScalar = parserScalar.ParseFile();
+	KeyValues *pIndexed = parserIndexed.ParseFile();
+
+	AssertMsg1( KeyValuesJSONTreesMatch( pScalar, pIndexed ), "JSON parsers disagree on '%s'", pszText );
+	if ( !pScalar )
+	{
+		AssertMsg1( parserScalar.m_nLine == parserIndexed.m_nLine, "JSON parsers report different error lines for '%s'", pszText );
+		AssertMsg1( V_strcmp( parserScalar.m_szErrMsg, parserIndexed.m_szErrMsg ) == 0, "JSON parsers report different errors for '%s'", pszText );
+	}
+
+	if ( pScalar )
+		pScalar->deleteThis();
+	if ( pIndexed )
+		pIndexed->deleteThis();
+}
+
+void TestKeyValuesJSONParser()
+{
+	static const char *s_corpus[] =
+	{
+		"",
+		"   \n\t  ",
+		"{}",
+		"{ \"a\": 1, \"b\": -2, \"c\": 4294967296, \"d\": 1.5e3, \"e\": .25 }",
+		"{\r\n\t\"a\" : true,\r\n\t\"b\" : false,\r\n\t\"c\" : null\r\n}\r\n",
+		"{ 'single' : 'quotes', \"mixed 'inner'\" : \"x\" }",
+		"{ \"esc\" : \"tab\\there \\\"quoted\\\" \\\\ \\/ \\u00e9\\u20AC\" }",
+		"{ \"q\\\"\" : \"\\\"\", \"b\" : \"\\\\\\\\\", 'c' : '\\'' }",
+		"{ \"arr\" : [ 1, 2, [ 3, { \"x\" : [] } ], ], }",
+		"// leading comment\n{ \"a\" : 1 // trailing comment \"with quotes\"\n }",
+		"{ \"a\" : 1 }\n\n// comment at end without newline",
+		"{ \"long string that crosses the sixteen byte block boundary several times over\" : \"0123456789abcdef0123456789abcdef\" }",
+		"{ \"a\" : truex }",
+		"{ \"a\" : nul }",
+		"{ \"a\" : true1 }",
+		"{ \"a\" : 12abc }",
+		"{ \"a\" : 1-2 }",
+		"{ \"a\" : \"b\"c }",
+		"{ \"a\" : 1 / 2 }",
+		"{ \"a\" : \"unterminated\n }",
+		"{ \"a\" : \"bad \\q escape\" }",
+		"{ \"a\" : -. }",
+		"{ \"a\" : 1e }",
+		"{ \"a\" 1 }",
+		"{ \"a\" : 1 \"b\" : 2 }",
+		"[ 1, 2 ]",
+		"{ \"a\" : [ 1 : 2 ] }",
+		"{\n\n\"a\" : {\n\n\"b\" : [\n\n",
+		"{ \"a\" : 1 } { \"b\" : 2 }",
+		"\n\r\n\r\r\n{ \"a\" : @ }",
+	};
+
+	for ( int i = 0 ; i < (int)ARRAYSIZE( s_corpus ) ; ++i )
+		CheckKeyValuesJSONParsersAgree( s_corpus[i], -1 );
+
+	// A document large enough to span several index windows
+	CUtlBuffer buf( 0, 0, CUtlBuffer::TEXT_BUFFER );
+	buf.PutString( "{\n" );
+	for ( int i = 0 ; i < 20000 ; ++i )
+		buf.Printf( "\t\"key%d\" : { \"damage\" : %d, \"ratio\" : %d.%d, \"name\" : \"weapon \\\"%d\\\"\", \"crit\" : %s },\n", i, i * 7, i, i % 10, i, ( i & 1 ) ? "true" : "false" );
+	buf.PutString( "}\n" );
+	CheckKeyValuesJSONParsersAgree( (const char *)buf.Base(), buf.TellPut() );
+}
+
+#endif
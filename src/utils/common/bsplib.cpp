@@ -28,6 +28,25 @@
 #include "vtf/vtf.h"
 #include "lzma/lzma.h"
 #include "tier1/lzmaDecoder.h"
+#include "tier1/snappy.h"
+#include "threads.h"
+
+#if defined( MPI )
+#include "vmpi.h"
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+// K32GetProcessMemoryInfo, so psapi.lib isn't needed
+#define PSAPI_VERSION 2
+#include <psapi.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include "tier0/memdbgon.h"
 
@@ -2175,16 +2194,380 @@ void ValidateHeader( const char *filename, const dheader_t *pHeader )
 	}
 }
 
+//-----------------------------------------------------------------------------
+// CMappedBSPFile
+//-----------------------------------------------------------------------------
+static int GetMappingGranularity()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo( &info );
+	return info.dwAllocationGranularity;
+#else
+	return (int)sysconf( _SC_PAGESIZE );
+#endif
+}
+
+CMappedBSPFile::CMappedBSPFile()
+{
+	memset( &m_Header, 0, sizeof( m_Header ) );
+	memset( m_Views, 0, sizeof( m_Views ) );
+	memset( &m_WholeFile, 0, sizeof( m_WholeFile ) );
+	m_nFileSize = 0;
+	m_nMappedSize = 0;
+	m_bOpen = false;
+	m_hFile = -1;
+	m_hMapping = 0;
+	m_hFileSystemFile = NULL;
+}
+
+CMappedBSPFile::~CMappedBSPFile()
+{
+	Close();
+}
+
+bool CMappedBSPFile::OpenOnDisk( const char *pDiskPath )
+{
+#ifdef _WIN32
+	HANDLE hFile = CreateFile( pDiskPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( hFile != INVALID_HANDLE_VALUE )
+	{
+		// PAGE_WRITECOPY allows both read-only and copy-on-write views
+		HANDLE hMapping = CreateFileMapping( hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL );
+		if ( hMapping )
+		{
+			m_hFile = (intp)hFile;
+			m_hMapping = (intp)hMapping;
+			m_nFileSize = (int)GetFileSize( hFile, NULL );
+		}
+		else
+		{
+			CloseHandle( hFile );
+		}
+	}
+#else
+	int nFile = open( pDiskPath, O_RDONLY );
+	if ( nFile != -1 )
+	{
+		struct stat fileInfo;
+		if ( fstat( nFile, &fileInfo ) == 0 )
+		{
+			m_hFile = nFile;
+			m_nFileSize = (int)fileInfo.st_size;
+		}
+		else
+		{
+			close( nFile );
+		}
+	}
+#endif
+	return ( m_hFile != -1 );
+}
+
+bool CMappedBSPFile::Open( const char *pFilename )
+{
+	Close();
+
+	// Look in each base path in turn, as SafeOpenRead does
+	CUtlVector<CUtlString> paths;
+	int nPathLength;
+	if ( CmdLib_HasBasePath( pFilename, nPathLength ) )
+	{
+		for ( int i = 0; i < CmdLib_GetNumBasePaths(); i++ )
+		{
+			CUtlString &path = paths[paths.AddToTail( CmdLib_GetBasePath( i ) )];
+			path += pFilename + nPathLength;
+		}
+	}
+	else
+	{
+		paths.AddToTail( pFilename );
+	}
+
+	// Mapping needs the file on disk.  VMPI workers have to read through
+	// the master's filesystem, whatever is on their own disk.
+	bool bMap = true;
+#if defined( MPI )
+	if ( g_bUseMPI && !g_bMPIMaster )
+	{
+		bMap = false;
+	}
+#endif
+
+	for ( int i = 0; bMap && i < paths.Count(); i++ )
+	{
+		if ( OpenOnDisk( paths[i] ) )
+			break;
+	}
+
+	if ( m_hFile == -1 )
+	{
+		for ( int i = 0; i < paths.Count() && !m_hFileSystemFile; i++ )
+		{
+			m_hFileSystemFile = g_pFileSystem->Open( paths[i], "rb" );
+		}
+		if ( !m_hFileSystemFile )
+			return false;
+		m_nFileSize = g_pFileSystem->Size( (FileHandle_t)m_hFileSystemFile );
+	}
+
+	m_bOpen = true;
+
+	LumpView_t header;
+	memset( &header, 0, sizeof( header ) );
+	if ( m_nFileSize < (int)sizeof( dheader_t ) || !MapView( header, 0, sizeof( dheader_t ), false ) )
+	{
+		Close();
+		return false;
+	}
+	memcpy( &m_Header, (byte *)header.m_pView + header.m_nOffset, sizeof( dheader_t ) );
+	ReleaseView( header );
+
+	if ( m_Header.ident != IDBSPHEADER || m_Header.version < MINBSPVERSION || m_Header.version > BSPVERSION )
+	{
+		Close();
+		return false;
+	}
+
+	for ( int i = 0; i < HEADER_LUMPS; i++ )
+	{
+		const lump_t &lump = m_Header.lumps[i];
+		if ( lump.filelen < 0 || lump.fileofs < 0 || lump.fileofs > m_nFileSize - lump.filelen )
+		{
+			Warning( "%s: %s runs past the end of the file\n", pFilename, GetLumpName( i ) );
+			Close();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void CMappedBSPFile::Close()
+{
+	for ( int i = 0; i < HEADER_LUMPS; i++ )
+	{
+		ReleaseView( m_Views[i] );
+	}
+	ReleaseView( m_WholeFile );
+	Assert( m_nMappedSize == 0 );
+
+	if ( m_hFile != -1 )
+	{
+#ifdef _WIN32
+		CloseHandle( (HANDLE)m_hMapping );
+		CloseHandle( (HANDLE)m_hFile );
+#else
+		close( (int)m_hFile );
+#endif
+		m_hFile = -1;
+		m_hMapping = 0;
+	}
+
+	if ( m_hFileSystemFile )
+	{
+		g_pFileSystem->Close( (FileHandle_t)m_hFileSystemFile );
+		m_hFileSystemFile = NULL;
+	}
+
+	memset( &m_Header, 0, sizeof( m_Header ) );
+	m_nFileSize = 0;
+	m_bOpen = false;
+}
+
+bool CMappedBSPFile::MapView( LumpView_t &view, int nFileOffset, int nSize, bool bCopyOnWrite )
+{
+	if ( m_hFile == -1 )
+	{
+		// couldn't map it, read it in instead
+		view.m_pView = malloc( nSize );
+		view.m_nViewSize = nSize;
+		view.m_nOffset = 0;
+		view.m_bHeap = true;
+		g_pFileSystem->Seek( (FileHandle_t)m_hFileSystemFile, nFileOffset, FILESYSTEM_SEEK_HEAD );
+		if ( g_pFileSystem->Read( view.m_pView, nSize, (FileHandle_t)m_hFileSystemFile ) != nSize )
+		{
+			free( view.m_pView );
+			memset( &view, 0, sizeof( view ) );
+			return false;
+		}
+	}
+	else
+	{
+		// views have to start on the allocation granularity
+		static int s_nGranularity = GetMappingGranularity();
+		int nViewStart = nFileOffset - ( nFileOffset % s_nGranularity );
+		view.m_nOffset = nFileOffset - nViewStart;
+		view.m_nViewSize = view.m_nOffset + nSize;
+		view.m_bHeap = false;
+#ifdef _WIN32
+		view.m_pView = MapViewOfFile( (HANDLE)m_hMapping, bCopyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, nViewStart, view.m_nViewSize );
+#else
+		view.m_pView = mmap( NULL, view.m_nViewSize, bCopyOnWrite ? ( PROT_READ | PROT_WRITE ) : PROT_READ, MAP_PRIVATE, (int)m_hFile, nViewStart );
+		if ( view.m_pView == MAP_FAILED )
+		{
+			view.m_pView = NULL;
+		}
+#endif
+		if ( !view.m_pView )
+		{
+			memset( &view, 0, sizeof( view ) );
+			return false;
+		}
+	}
+
+	m_nMappedSize += view.m_nViewSize;
+	return true;
+}
+
+void CMappedBSPFile::ReleaseView( LumpView_t &view )
+{
+	if ( !view.m_pView )
+		return;
+
+	if ( view.m_bHeap )
+	{
+		free( view.m_pView );
+	}
+	else
+	{
+#ifdef _WIN32
+		UnmapViewOfFile( view.m_pView );
+#else
+		munmap( view.m_pView, view.m_nViewSize );
+#endif
+	}
+
+	m_nMappedSize -= view.m_nViewSize;
+	memset( &view, 0, sizeof( view ) );
+}
+
+const void *CMappedBSPFile::GetLump( int lump )
+{
+	Assert( m_bOpen );
+	const lump_t &info = m_Header.lumps[lump];
+	if ( !info.filelen )
+		return NULL;
+
+	LumpView_t &view = m_Views[lump];
+	if ( !view.m_pView && !MapView( view, info.fileofs, info.filelen, false ) )
+	{
+		Warning( "Unable to map %s\n", GetLumpName( lump ) );
+		return NULL;
+	}
+
+	return (byte *)view.m_pView + view.m_nOffset;
+}
+
+void CMappedBSPFile::ReleaseLump( int lump )
+{
+	ReleaseView( m_Views[lump] );
+}
+
+bool CMappedBSPFile::ParsePakFile( IZip *pZip )
+{
+	const void *pPakData = GetLump( LUMP_PAKFILE );
+	if ( !pPakData )
+	{
+		pZip->Reset();
+		return false;
+	}
+
+	pZip->ParseFromBufferNoCopy( pPakData, LumpSize( LUMP_PAKFILE ) );
+	return true;
+}
+
+void *CMappedBSPFile::MapWholeFile()
+{
+	Assert( m_bOpen );
+	if ( !m_WholeFile.m_pView && !MapView( m_WholeFile, 0, m_nFileSize, true ) )
+		return NULL;
+
+	return m_WholeFile.m_pView;
+}
+
+
+//-----------------------------------------------------------------------------
+// CBSPLumpIterator
+//-----------------------------------------------------------------------------
+CBSPLumpIterator::CBSPLumpIterator( CMappedBSPFile &bsp ) : m_BSP( bsp )
+{
+	m_nLumps = 0;
+	m_nCurrent = -1;
+	m_pData = NULL;
+	m_bMappedCurrent = false;
+
+	// insertion sort by file offset, so the file is read front to back
+	const dheader_t &header = bsp.Header();
+	for ( int i = 0; i < HEADER_LUMPS; i++ )
+	{
+		if ( !header.lumps[i].filelen )
+			continue;
+
+		int j = m_nLumps++;
+		for ( ; j > 0 && header.lumps[m_Order[j - 1]].fileofs > header.lumps[i].fileofs; j-- )
+		{
+			m_Order[j] = m_Order[j - 1];
+		}
+		m_Order[j] = i;
+	}
+}
+
+CBSPLumpIterator::~CBSPLumpIterator()
+{
+	ReleaseCurrent();
+}
+
+bool CBSPLumpIterator::Next()
+{
+	ReleaseCurrent();
+	while ( ++m_nCurrent < m_nLumps )
+	{
+		m_bMappedCurrent = !m_BSP.IsLumpMapped( Lump() );
+		m_pData = m_BSP.GetLump( Lump() );
+		if ( m_pData )
+			return true;
+	}
+
+	m_nCurrent = m_nLumps;
+	return false;
+}
+
+void CBSPLumpIterator::ReleaseCurrent()
+{
+	if ( m_bMappedCurrent )
+	{
+		m_BSP.ReleaseLump( Lump() );
+	}
+	m_bMappedCurrent = false;
+	m_pData = NULL;
+}
+
+
 //-----------------------------------------------------------------------------
 //	Low level BSP opener for external parsing. Parses headers, but nothing else.
 //	You must close the BSP, via CloseBSPFile().
 //-----------------------------------------------------------------------------
-void OpenBSPFile( const char *filename )
+static CMappedBSPFile s_BSPFile;
+
+void OpenBSPFile( const char *filename, bool bAllowMapping )
 {
 	Lumps_Init();
 
-	// load the file header
-	LoadFile( filename, (void **)&g_pBSPHeader );
+	// Map the file rather than reading it all in, so only the lumps that get
+	// copied out are ever paged in.  It's mapped copy-on-write so the lumps can
+	// still be swapped in place.  Big-endian files don't pass Open() and are
+	// read in whole.
+	g_pBSPHeader = NULL;
+	if ( bAllowMapping && s_BSPFile.Open( filename ) )
+	{
+		g_pBSPHeader = (dheader_t *)s_BSPFile.MapWholeFile();
+	}
+	if ( !g_pBSPHeader )
+	{
+		s_BSPFile.Close();
+		LoadFile( filename, (void **)&g_pBSPHeader );
+	}
 
 	if ( g_bSwapOnLoad )
 	{
@@ -2202,7 +2585,14 @@ void OpenBSPFile( const char *filename )
 //-----------------------------------------------------------------------------
 void CloseBSPFile( void )
 {
-	free( g_pBSPHeader );
+	if ( s_BSPFile.IsOpen() )
+	{
+		s_BSPFile.Close();
+	}
+	else
+	{
+		free( g_pBSPHeader );
+	}
 	g_pBSPHeader = NULL;
 }
 
@@ -2304,21 +2694,20 @@ void LoadBSPFile( const char *filename )
 	}
 	*/
 		
-	// Load PAK file lump into appropriate data structure
-	byte *pakbuffer = NULL;
-	int paksize = CopyVariableLump<byte>( FIELD_CHARACTER, LUMP_PAKFILE, ( void ** )&pakbuffer );
+	// Load PAK file lump into appropriate data structure.  The entries get
+	// copied out of the lump, so there's no need for a copy of the whole lump.
+	int paksize = g_pBSPHeader->lumps[LUMP_PAKFILE].filelen;
+	g_Lumps.bLumpParsed[LUMP_PAKFILE] = true;
 	if ( paksize > 0 )
 	{
 		GetPakFile()->ActivateByteSwapping( IsX360() );
-		GetPakFile()->ParseFromBuffer( pakbuffer, paksize );
+		GetPakFile()->ParseFromBuffer( (byte *)g_pBSPHeader + g_pBSPHeader->lumps[LUMP_PAKFILE].fileofs, paksize );
 	}
 	else
 	{
 		GetPakFile()->Reset();
 	}
 
-	free( pakbuffer );
-
 	g_GameLumps.ParseGameLump( g_pBSPHeader );
 
 	// NOTE: Do NOT call CopyLump after Lumps_Parse() it parses all un-Copied lumps
@@ -2446,46 +2835,38 @@ void LoadBSPFile_FileSystemOnly( const char *filename )
 {
 	Lumps_Init();
 
-	//
-	// load the file header
-	//
-	LoadFile( filename, (void **)&g_pBSPHeader );
-
-	ValidateHeader( filename, g_pBSPHeader );
+	// only the pak lump is read
+	CMappedBSPFile bsp;
+	if ( !bsp.Open( filename ) )
+	{
+		Error( "Unable to open %s as a BSP file", filename );
+	}
 
-	// Load PAK file lump into appropriate data structure
-	byte *pakbuffer = NULL;
-	int paksize = CopyVariableLump<byte>( FIELD_CHARACTER, LUMP_PAKFILE, ( void ** )&pakbuffer, 1 );
-	if ( paksize > 0 )
+	// Load PAK file lump into appropriate data structure.  The entries are
+	// copied out, so the file can be closed afterwards.
+	const void *pPakData = bsp.GetLump( LUMP_PAKFILE );
+	if ( pPakData )
 	{
-		GetPakFile()->ParseFromBuffer( pakbuffer, paksize );
+		GetPakFile()->ParseFromBuffer( (void *)pPakData, bsp.LumpSize( LUMP_PAKFILE ) );
 	}
 	else
 	{
 		GetPakFile()->Reset();
 	}
-
-	free( pakbuffer );
-
-	// everything has been copied out
-	free( g_pBSPHeader );
-	g_pBSPHeader = NULL;
 }
 
 void ExtractZipFileFromBSP( char *pBSPFileName, char *pZipFileName )
 {
 	Lumps_Init();
 
-	//
-	// load the file header
-	//
-	LoadFile( pBSPFileName, (void **)&g_pBSPHeader);
-
-	ValidateHeader( pBSPFileName, g_pBSPHeader );
+	CMappedBSPFile bsp;
+	if ( !bsp.Open( pBSPFileName ) )
+	{
+		Error( "Unable to open %s as a BSP file", pBSPFileName );
+	}
 
-	byte *pakbuffer = NULL;
-	int paksize = CopyVariableLump<byte>( FIELD_CHARACTER, LUMP_PAKFILE, ( void ** )&pakbuffer );
-	if ( paksize > 0 )
+	const void *pPakData = bsp.GetLump( LUMP_PAKFILE );
+	if ( pPakData )
 	{
 		FILE *fp;
 		fp = fopen( pZipFileName, "wb" );
@@ -2495,7 +2876,7 @@ void ExtractZipFileFromBSP( char *pBSPFileName, char *pZipFileName )
 			return;
 		}
 
-		fwrite( pakbuffer, paksize, 1, fp );
+		fwrite( pPakData, bsp.LumpSize( LUMP_PAKFILE ), 1, fp );
 		fclose( fp );
 	}
 	else
@@ -4447,6 +4828,83 @@ int SortLumpsByOffset( const SortedLump_t *pSortedLumpA, const SortedLump_t *pSo
 	return 0;
 }
 
+//-----------------------------------------------------------------------------
+// Loads a lump for repacking, decompressing it if it was compressed
+//-----------------------------------------------------------------------------
+static void LoadLumpForRepack( dheader_t *pInBSPHeader, lump_t *pLump, CUtlBuffer &inputBuffer )
+{
+	if ( pLump->uncompressedSize )
+	{
+		byte *pCompressedLump = ((byte *)pInBSPHeader) + pLump->fileofs;
+		if ( CLZMA::IsCompressed( pCompressedLump ) && pLump->uncompressedSize == CLZMA::GetActualSize( pCompressedLump ) )
+		{
+			inputBuffer.EnsureCapacity( CLZMA::GetActualSize( pCompressedLump ) );
+			unsigned int outSize = CLZMA::Uncompress( pCompressedLump, (unsigned char *)inputBuffer.Base() );
+			inputBuffer.SeekPut( CUtlBuffer::SEEK_CURRENT, outSize );
+			if ( outSize != pLump->uncompressedSize )
+			{
+				Warning( "Decompressed size differs from header, BSP may be corrupt\n" );
+			}
+		}
+		else
+		{
+			Assert( CLZMA::IsCompressed( pCompressedLump ) &&
+			        pLump->uncompressedSize == CLZMA::GetActualSize( pCompressedLump ) );
+			Warning( "Unsupported BSP: Unrecognized compressed lump\n" );
+		}
+	}
+	else
+	{
+		// Just use input
+		inputBuffer.SetExternalBuffer( ((byte *)pInBSPHeader) + pLump->fileofs, pLump->filelen, pLump->filelen );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Lumps and game lumps are compressed on the tool threads, one job each. The
+// results are written out afterwards in the same order as before, so the
+// repacked file doesn't depend on the thread count.
+//-----------------------------------------------------------------------------
+struct CompressJob_t
+{
+	CUtlBuffer	inputBuffer;
+	CUtlBuffer	compressedBuffer;
+	bool		bCompressed;
+};
+
+static CompressJob_t	*s_pCompressJobs;
+static CompressFunc_t	s_pCompressJobFunc;
+
+static void CompressJob_Thread( int iThread, int iJob )
+{
+	CompressJob_t &job = s_pCompressJobs[iJob];
+	job.bCompressed = job.inputBuffer.TellPut() && s_pCompressJobFunc( job.inputBuffer, job.compressedBuffer );
+}
+
+static void RunCompressJobs( CUtlVector< CompressJob_t > &jobs, CompressFunc_t pCompressFunc )
+{
+	for ( int i = 0; i < jobs.Count(); i++ )
+	{
+		jobs[i].bCompressed = false;
+	}
+	if ( !pCompressFunc || !jobs.Count() )
+		return;
+
+	// compression time is about proportional to size
+	CUtlVector< float > costs;
+	costs.SetCount( jobs.Count() );
+	for ( int i = 0; i < jobs.Count(); i++ )
+	{
+		costs[i] = jobs[i].inputBuffer.TellPut() - jobs[i].inputBuffer.TellGet();
+	}
+
+	s_pCompressJobs = jobs.Base();
+	s_pCompressJobFunc = pCompressFunc;
+	RunThreadsOnIndividualByCost( jobs.Count(), false, CompressJob_Thread, costs.Base() );
+	s_pCompressJobs = NULL;
+	s_pCompressJobFunc = NULL;
+}
+
 bool CompressGameLump( dheader_t *pInBSPHeader, dheader_t *pOutBSPHeader, CUtlBuffer &outputBuffer, CompressFunc_t pCompressFunc )
 {
 	CByteswap	byteSwap;
@@ -4479,13 +4937,11 @@ bool CompressGameLump( dheader_t *pInBSPHeader, dheader_t *pOutBSPHeader, CUtlBu
 	dgamelump_t dummyLump = { 0 };
 	outputBuffer.Put( &dummyLump, sizeof( dgamelump_t ) );
 
+	CUtlVector< CompressJob_t > jobs;
+	jobs.SetCount( pInGameLumpHeader->lumpCount );
 	for ( int i = 0; i < pInGameLumpHeader->lumpCount; i++ )
 	{
-		CUtlBuffer inputBuffer;
-		CUtlBuffer compressedBuffer;
-
-		sOutGameLump[i].fileofs = AlignBuffer( outputBuffer, 4 );
-
+		CUtlBuffer &inputBuffer = jobs[i].inputBuffer;
 		if ( pInGameLump[i].filelen )
 		{
 			if ( pInGameLump[i].flags & GAMELUMPFLAG_COMPRESSED )
@@ -4513,9 +4969,20 @@ bool CompressGameLump( dheader_t *pInBSPHeader, dheader_t *pOutBSPHeader, CUtlBu
 				inputBuffer.SetExternalBuffer( ((byte *)pInBSPHeader) + pInGameLump[i].fileofs,
 				                               pInGameLump[i].filelen, pInGameLump[i].filelen );
 			}
+		}
+	}
+	RunCompressJobs( jobs, pCompressFunc );
+
+	for ( int i = 0; i < pInGameLumpHeader->lumpCount; i++ )
+	{
+		CUtlBuffer &inputBuffer = jobs[i].inputBuffer;
+		CUtlBuffer &compressedBuffer = jobs[i].compressedBuffer;
 
-			bool bCompressed = pCompressFunc ? pCompressFunc( inputBuffer, compressedBuffer ) : false;
-			if ( bCompressed )
+		sOutGameLump[i].fileofs = AlignBuffer( outputBuffer, 4 );
+
+		if ( pInGameLump[i].filelen )
+		{
+			if ( jobs[i].bCompressed )
 			{
 				sOutGameLump[i].flags |= GAMELUMPFLAG_COMPRESSED;
 
@@ -4585,6 +5052,102 @@ bool RepackBSPCallback_LZMA( CUtlBuffer &inputBuffer, CUtlBuffer &outputBuffer )
 }
 
 
+//-----------------------------------------------------------------------------
+// Copies every file in one pak into another, compressing them on the tool
+// threads. Files are read, compressed and added a batch at a time so a big pak
+// isn't held in memory twice over, and always added in the old pak's order.
+//-----------------------------------------------------------------------------
+#define PAK_REPACK_BATCH_BYTES	( 64 * 1024 * 1024 )
+
+struct PakRepackJob_t
+{
+	char		relativeName[MAX_PATH];
+	CUtlBuffer	sourceBuf;
+	CUtlBuffer	preparedBuf;
+	int			uncompressedLength;
+	CRC32_t		crc;
+	bool		bPrepared;
+};
+
+static PakRepackJob_t			**s_ppPakRepackJobs;
+static IZip::eCompressionType	s_ePakRepackCompression;
+
+static void PreparePakFile_Thread( int iThread, int iJob )
+{
+	PakRepackJob_t *pJob = s_ppPakRepackJobs[iJob];
+	pJob->bPrepared = IZip::PrepareBufferForZip( pJob->sourceBuf.Base(), pJob->sourceBuf.TellMaxPut(), false,
+		s_ePakRepackCompression, pJob->preparedBuf, pJob->uncompressedLength, pJob->crc );
+}
+
+static void FlushPakRepackJobs( IZip *pNewPakFile, CUtlVector< PakRepackJob_t * > &jobs, IZip::eCompressionType packfileCompression )
+{
+	if ( !jobs.Count() )
+		return;
+
+	CUtlVector< float > costs;
+	costs.SetCount( jobs.Count() );
+	for ( int i = 0; i < jobs.Count(); i++ )
+	{
+		costs[i] = jobs[i]->sourceBuf.TellMaxPut();
+	}
+
+	s_ppPakRepackJobs = jobs.Base();
+	s_ePakRepackCompression = packfileCompression;
+	RunThreadsOnIndividualByCost( jobs.Count(), false, PreparePakFile_Thread, costs.Base() );
+	s_ppPakRepackJobs = NULL;
+
+	for ( int i = 0; i < jobs.Count(); i++ )
+	{
+		PakRepackJob_t *pJob = jobs[i];
+		if ( pJob->bPrepared )
+		{
+			pNewPakFile->AddPreparedBufferToZip( pJob->relativeName, pJob->preparedBuf.Base(), pJob->preparedBuf.TellPut(),
+			                                     pJob->uncompressedLength, pJob->crc, packfileCompression );
+		}
+
+		DevMsg( "Repacking BSP: Created '%s' in lump pak\n", pJob->relativeName );
+	}
+
+	jobs.PurgeAndDeleteElements();
+}
+
+static void RepackPakFile( IZip *pOldPakFile, IZip *pNewPakFile, IZip::eCompressionType packfileCompression )
+{
+	CUtlVector< PakRepackJob_t * > jobs;
+	unsigned int nBatchBytes = 0;
+
+	int id = -1;
+	int fileSize;
+	while ( 1 )
+	{
+		char relativeName[MAX_PATH];
+		id = GetNextFilename( pOldPakFile, id, relativeName, sizeof( relativeName ), fileSize );
+		if ( id == -1 )
+			break;
+
+		PakRepackJob_t *pJob = new PakRepackJob_t;
+		V_strncpy( pJob->relativeName, relativeName, sizeof( pJob->relativeName ) );
+
+		bool bOK = ReadFileFromPak( pOldPakFile, relativeName, false, pJob->sourceBuf );
+		if ( !bOK )
+		{
+			delete pJob;
+			Error( "Failed to load '%s' from lump pak for repacking.\n", relativeName );
+			continue;
+		}
+
+		jobs.AddToTail( pJob );
+		nBatchBytes += pJob->sourceBuf.TellMaxPut();
+		if ( nBatchBytes >= PAK_REPACK_BATCH_BYTES )
+		{
+			FlushPakRepackJobs( pNewPakFile, jobs, packfileCompression );
+			nBatchBytes = 0;
+		}
+	}
+
+	FlushPakRepackJobs( pNewPakFile, jobs, packfileCompression );
+}
+
 bool RepackBSP( CUtlBuffer &inputBuffer, CUtlBuffer &outputBuffer, CompressFunc_t pCompressFunc, IZip::eCompressionType packfileCompression )
 {
 	dheader_t *pInBSPHeader = (dheader_t *)inputBuffer.Base();
@@ -4620,6 +5183,18 @@ bool RepackBSP( CUtlBuffer &inputBuffer, CUtlBuffer &outputBuffer, CompressFunc_
 	}
 	sortedLumps.Sort( SortLumpsByOffset );
 
+	// compress all the plain lumps before writing any of them out
+	CUtlVector< CompressJob_t > lumpJobs;
+	lumpJobs.SetCount( HEADER_LUMPS );
+	for ( int i = 0; i < HEADER_LUMPS; i++ )
+	{
+		if ( pInBSPHeader->lumps[i].filelen && i != LUMP_GAME_LUMP && i != LUMP_PAKFILE )
+		{
+			LoadLumpForRepack( pInBSPHeader, &pInBSPHeader->lumps[i], lumpJobs[i].inputBuffer );
+		}
+	}
+	RunCompressJobs( lumpJobs, pCompressFunc );
+
 	// iterate in sorted order
 	for ( int i = 0; i < HEADER_LUMPS; ++i )
 	{
@@ -4641,34 +5216,6 @@ bool RepackBSP( CUtlBuffer &inputBuffer, CUtlBuffer &outputBuffer, CompressFunc_
 			}
 			unsigned int newOffset = AlignBuffer( outputBuffer, alignment );
 
-			CUtlBuffer inputBuffer;
-			if ( pSortedLump->pLump->uncompressedSize )
-			{
-				byte *pCompressedLump = ((byte *)pInBSPHeader) + pSortedLump->pLump->fileofs;
-				if ( CLZMA::IsCompressed( pCompressedLump ) && pSortedLump->pLump->uncompressedSize == CLZMA::GetActualSize( pCompressedLump ) )
-				{
-					inputBuffer.EnsureCapacity( CLZMA::GetActualSize( pCompressedLump ) );
-					unsigned int outSize = CLZMA::Uncompress( pCompressedLump, (unsigned char *)inputBuffer.Base() );
-					inputBuffer.SeekPut( CUtlBuffer::SEEK_CURRENT, outSize );
-					if ( outSize != pSortedLump->pLump->uncompressedSize )
-					{
-						Warning( "Decompressed size differs from header, BSP may be corrupt\n" );
-					}
-				}
-				else
-				{
-					Assert( CLZMA::IsCompressed( pCompressedLump ) &&
-					        pSortedLump->pLump->uncompressedSize == CLZMA::GetActualSize( pCompressedLump ) );
-					Warning( "Unsupported BSP: Unrecognized compressed lump\n" );
-				}
-			}
-			else
-			{
-				// Just use input
-				inputBuffer.SetExternalBuffer( ((byte *)pInBSPHeader) + pSortedLump->pLump->fileofs,
-				                               pSortedLump->pLump->filelen, pSortedLump->pLump->filelen );
-			}
-
 			if ( lumpNum == LUMP_GAME_LUMP )
 			{
 				// the game lump has to have each of its components individually compressed
@@ -4676,33 +5223,14 @@ bool RepackBSP( CUtlBuffer &inputBuffer, CUtlBuffer &outputBuffer, CompressFunc_
 			}
 			else if ( lumpNum == LUMP_PAKFILE )
 			{
+				CUtlBuffer inputBuffer;
+				LoadLumpForRepack( pInBSPHeader, pSortedLump->pLump, inputBuffer );
+
 				IZip *newPakFile = IZip::CreateZip( NULL );
 				IZip *oldPakFile = IZip::CreateZip( NULL );
 				oldPakFile->ParseFromBuffer( inputBuffer.Base(), inputBuffer.Size() );
 
-				int id = -1;
-				int fileSize;
-				while ( 1 )
-				{
-					char relativeName[MAX_PATH];
-					id = GetNextFilename( oldPakFile, id, relativeName, sizeof( relativeName ), fileSize );
-					if ( id == -1 )
-						break;
-
-					CUtlBuffer sourceBuf;
-					CUtlBuffer targetBuf;
-
-					bool bOK = ReadFileFromPak( oldPakFile, relativeName, false, sourceBuf );
-					if ( !bOK )
-					{
-						Error( "Failed to load '%s' from lump pak for repacking.\n", relativeName );
-						continue;
-					}
-
-					AddBufferToPak( newPakFile, relativeName, sourceBuf.Base(), sourceBuf.TellMaxPut(), false, packfileCompression );
-
-					DevMsg( "Repacking BSP: Created '%s' in lump pak\n", relativeName );
-				}
+				RepackPakFile( oldPakFile, newPakFile, packfileCompression );
 
 				// save new pack to buffer
 				newPakFile->SaveToBuffer( outputBuffer );
@@ -4716,9 +5244,9 @@ bool RepackBSP( CUtlBuffer &inputBuffer, CUtlBuffer &outputBuffer, CompressFunc_
 			}
 			else
 			{
-				CUtlBuffer compressedBuffer;
-				bool bCompressed = pCompressFunc ? pCompressFunc( inputBuffer, compressedBuffer ) : false;
-				if ( bCompressed )
+				CUtlBuffer &inputBuffer = lumpJobs[lumpNum].inputBuffer;
+				CUtlBuffer &compressedBuffer = lumpJobs[lumpNum].compressedBuffer;
+				if ( lumpJobs[lumpNum].bCompressed )
 				{
 					sOutBSPHeader.lumps[lumpNum].uncompressedSize = inputBuffer.TellPut();
 					sOutBSPHeader.lumps[lumpNum].filelen = compressedBuffer.TellPut();
@@ -4753,6 +5281,235 @@ bool RepackBSP( CUtlBuffer &inputBuffer, CUtlBuffer &outputBuffer, CompressFunc_
 	return true;
 }
 
+//-----------------------------------------------------------------------------
+// Compression benchmark. LZMA is the only lump codec the engine decodes on
+// load; Snappy is timed next to it to show what a cheaper codec would save.
+//-----------------------------------------------------------------------------
+struct CodecTimes_t
+{
+	unsigned int	nSize;
+	unsigned int	nLZMASize;
+	double			flLZMACompress;
+	double			flLZMADecompress;
+	unsigned int	nSnappySize;
+	double			flSnappyCompress;
+	double			flSnappyDecompress;
+};
+
+static void BenchmarkCodecs( unsigned char *pData, unsigned int nSize, CodecTimes_t &times )
+{
+	memset( &times, 0, sizeof( times ) );
+	times.nSize = nSize;
+	if ( !nSize )
+		return;
+
+	unsigned char *pDecompressed = (unsigned char *)malloc( nSize );
+
+	double start = Plat_FloatTime();
+	unsigned char *pLZMA = LZMA_Compress( pData, nSize, &times.nLZMASize );
+	times.flLZMACompress = Plat_FloatTime() - start;
+	if ( pLZMA )
+	{
+		start = Plat_FloatTime();
+		CLZMA::Uncompress( pLZMA, pDecompressed );
+		times.flLZMADecompress = Plat_FloatTime() - start;
+		free( pLZMA );
+	}
+
+	char *pSnappy = (char *)malloc( snappy::MaxCompressedLength( nSize ) );
+	size_t nSnappySize;
+	start = Plat_FloatTime();
+	snappy::RawCompress( (const char *)pData, nSize, pSnappy, &nSnappySize );
+	times.flSnappyCompress = Plat_FloatTime() - start;
+	times.nSnappySize = nSnappySize;
+	start = Plat_FloatTime();
+	snappy::RawUncompress( pSnappy, nSnappySize, (char *)pDecompressed );
+	times.flSnappyDecompress = Plat_FloatTime() - start;
+	free( pSnappy );
+
+	free( pDecompressed );
+}
+
+static void AccumulateCodecTimes( CodecTimes_t &total, const CodecTimes_t &times )
+{
+	total.nSize += times.nSize;
+	total.nLZMASize += times.nLZMASize;
+	total.flLZMACompress += times.flLZMACompress;
+	total.flLZMADecompress += times.flLZMADecompress;
+	total.nSnappySize += times.nSnappySize;
+	total.flSnappyCompress += times.flSnappyCompress;
+	total.flSnappyDecompress += times.flSnappyDecompress;
+}
+
+static void PrintCodecTimes( const char *pName, const CodecTimes_t &times )
+{
+	Msg( "%-28s %10u  %10u %8.1f %8.1f  %10u %8.1f %8.1f\n", pName, times.nSize,
+		times.nLZMASize, times.flLZMACompress * 1000.0, times.flLZMADecompress * 1000.0,
+		times.nSnappySize, times.flSnappyCompress * 1000.0, times.flSnappyDecompress * 1000.0 );
+}
+
+//-----------------------------------------------------------------------------
+// Times every lump, and every file in the pak lump, through LZMA and Snappy on
+// one thread, then a full LZMA repack of the bsp on the tool threads.
+//-----------------------------------------------------------------------------
+void BenchmarkBSPCompression( const char *pFilename )
+{
+	CUtlBuffer fileBuffer;
+	if ( !g_pFileSystem->ReadFile( pFilename, NULL, fileBuffer ) )
+	{
+		Warning( "Compression benchmark: can't read %s\n", pFilename );
+		return;
+	}
+
+	dheader_t *pHeader = (dheader_t *)fileBuffer.Base();
+	if ( fileBuffer.TellPut() < (int)sizeof( dheader_t ) || pHeader->ident != IDBSPHEADER )
+	{
+		Warning( "Compression benchmark: %s is not a bsp\n", pFilename );
+		return;
+	}
+
+	Msg( "\nLump compression (bytes, compress ms, decompress ms):\n" );
+	Msg( "%-28s %10s  %10s %8s %8s  %10s %8s %8s\n", "lump", "size", "lzma", "comp", "decomp", "snappy", "comp", "decomp" );
+
+	CodecTimes_t total;
+	memset( &total, 0, sizeof( total ) );
+	for ( int i = 0; i < HEADER_LUMPS; i++ )
+	{
+		lump_t *pLump = &pHeader->lumps[i];
+		if ( !pLump->filelen || i == LUMP_PAKFILE )
+			continue;
+
+		CUtlBuffer lumpBuffer;
+		LoadLumpForRepack( pHeader, pLump, lumpBuffer );
+
+		CodecTimes_t times;
+		BenchmarkCodecs( (unsigned char *)lumpBuffer.Base(), lumpBuffer.TellPut(), times );
+		PrintCodecTimes( GetLumpName( i ), times );
+		AccumulateCodecTimes( total, times );
+	}
+
+	// the pak is compressed one file at a time
+	if ( pHeader->lumps[LUMP_PAKFILE].filelen )
+	{
+		CUtlBuffer pakBuffer;
+		LoadLumpForRepack( pHeader, &pHeader->lumps[LUMP_PAKFILE], pakBuffer );
+		IZip *pPakFile = IZip::CreateZip( NULL );
+		pPakFile->ParseFromBuffer( pakBuffer.Base(), pakBuffer.Size() );
+
+		CodecTimes_t pakTotal;
+		memset( &pakTotal, 0, sizeof( pakTotal ) );
+		int nFiles = 0;
+		int id = -1;
+		int fileSize;
+		while ( 1 )
+		{
+			char relativeName[MAX_PATH];
+			id = GetNextFilename( pPakFile, id, relativeName, sizeof( relativeName ), fileSize );
+			if ( id == -1 )
+				break;
+
+			CUtlBuffer sourceBuf;
+			if ( !ReadFileFromPak( pPakFile, relativeName, false, sourceBuf ) )
+				continue;
+
+			CodecTimes_t times;
+			BenchmarkCodecs( (unsigned char *)sourceBuf.Base(), sourceBuf.TellMaxPut(), times );
+			AccumulateCodecTimes( pakTotal, times );
+			nFiles++;
+		}
+		IZip::ReleaseZip( pPakFile );
+
+		char name[64];
+		V_snprintf( name, sizeof( name ), "%s (%d files)", GetLumpName( LUMP_PAKFILE ), nFiles );
+		PrintCodecTimes( name, pakTotal );
+		AccumulateCodecTimes( total, pakTotal );
+	}
+	PrintCodecTimes( "total", total );
+
+	double start = Plat_FloatTime();
+	CUtlBuffer repackBuffer;
+	RepackBSP( fileBuffer, repackBuffer, RepackBSPCallback_LZMA, IZip::eCompressionType_LZMA );
+	Msg( "LZMA repack on %d threads: %.2f seconds, %d -> %d bytes\n\n",
+		numthreads, Plat_FloatTime() - start, fileBuffer.TellPut(), repackBuffer.TellPut() );
+}
+
+//-----------------------------------------------------------------------------
+// Load benchmark: peak resident memory and time of CMappedBSPFile against
+// LoadBSPFile().  The peak only ever grows, so the mapped reader runs first.
+//-----------------------------------------------------------------------------
+static int64 GetPeakResidentBytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if ( !GetProcessMemoryInfo( GetCurrentProcess(), &counters, sizeof( counters ) ) )
+		return 0;
+	return (int64)counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if ( getrusage( RUSAGE_SELF, &usage ) != 0 )
+		return 0;
+	// kilobytes on linux
+	return (int64)usage.ru_maxrss * 1024;
+#endif
+}
+
+void BenchmarkBSPLoad( const char *pFilename )
+{
+	Msg( "\nLoad benchmark (peak resident growth, ms):\n" );
+
+	int64 nStartPeak = GetPeakResidentBytes();
+	double start = Plat_FloatTime();
+
+	CMappedBSPFile bsp;
+	if ( !bsp.Open( pFilename ) )
+	{
+		Warning( "Load benchmark: can't open %s as a bsp\n", pFilename );
+		return;
+	}
+
+	// pak directory, then every page of every lump
+	IZip *pPakFile = IZip::CreateZip( NULL );
+	bsp.ParsePakFile( pPakFile );
+	int nPakFiles = 0;
+	int id = -1;
+	int fileSize;
+	char relativeName[MAX_PATH];
+	while ( ( id = GetNextFilename( pPakFile, id, relativeName, sizeof( relativeName ), fileSize ) ) != -1 )
+	{
+		nPakFiles++;
+	}
+	pPakFile->Reset();
+	IZip::ReleaseZip( pPakFile );
+	bsp.ReleaseLump( LUMP_PAKFILE );
+
+	int nMaxMapped = 0;
+	unsigned int nChecksum = 0;
+	for ( CBSPLumpIterator it( bsp ); it.Next(); )
+	{
+		const byte *pData = (const byte *)it.Data();
+		for ( int i = 0; i < it.Size(); i += 4096 )
+		{
+			nChecksum += pData[i];
+		}
+		nMaxMapped = MAX( nMaxMapped, bsp.MappedSize() );
+	}
+	bsp.Close();
+
+	double flMappedTime = Plat_FloatTime() - start;
+	int64 nMappedPeak = GetPeakResidentBytes();
+
+	start = Plat_FloatTime();
+	LoadBSPFile( pFilename );
+	double flLoadTime = Plat_FloatTime() - start;
+	int64 nLoadPeak = GetPeakResidentBytes();
+	UnloadBSPFile();
+
+	Msg( "%-28s %10.1f MB %8.1f  (%d pak files, at most %.1f MB mapped, %08x)\n", "mapped lump iterator",
+		( nMappedPeak - nStartPeak ) / ( 1024.0 * 1024.0 ), flMappedTime * 1000.0, nPakFiles, nMaxMapped / ( 1024.0 * 1024.0 ), nChecksum );
+	Msg( "%-28s %10.1f MB %8.1f\n\n", "LoadBSPFile",
+		( nLoadPeak - nMappedPeak ) / ( 1024.0 * 1024.0 ), flLoadTime * 1000.0 );
+}
+
 //-----------------------------------------------------------------------------
 //  For all lumps in a bsp: Loads the lump from file A, swaps it, writes it to file B.
 //  This limits the memory used for the swap process which helps the Xbox 360.
@@ -5086,7 +5843,12 @@ bool SetPakFileLump( const char *pBSPFilename, const char *pNewFilename, void *p
 	g_bSwapOnLoad = bSwap;
 	g_bSwapOnWrite = bSwap;
 
-	OpenBSPFile( pBSPFilename );
+	// Writing over a mapped file fails on Windows and faults on POSIX, so
+	// read it all in when it's rewritten in place
+	char szBSPPath[MAX_PATH], szNewPath[MAX_PATH];
+	V_MakeAbsolutePath( szBSPPath, sizeof( szBSPPath ), pBSPFilename );
+	V_MakeAbsolutePath( szNewPath, sizeof( szNewPath ), pNewFilename );
+	OpenBSPFile( pBSPFilename, V_stricmp( szBSPPath, szNewPath ) != 0 );
 
 	// save a copy of the old header
 	// generating a new bsp is a destructive operation
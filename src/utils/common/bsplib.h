@@ -278,6 +278,102 @@ extern CByteswap	g_Swap;
 void ExtractZipFileFromBSP( char *pBSPFileName, char *pZipFileName );
 
 
+//-----------------------------------------------------------------------------
+// Read-only view of a BSP for tools that only look at part of it.  Unlike
+// LoadBSPFile() nothing is copied up front: each lump is mapped the first time
+// it's asked for and stays mapped until ReleaseLump() or Close().  Files that
+// can't be mapped (inside a pack file, say) fall back to reading each lump
+// through the filesystem on first access.  Lumps are in file byte order, so
+// only native-endian BSPs can be opened.
+//-----------------------------------------------------------------------------
+class CMappedBSPFile
+{
+public:
+	CMappedBSPFile();
+	~CMappedBSPFile();
+
+	bool				Open( const char *pFilename );
+	void				Close();
+	bool				IsOpen() const				{ return m_bOpen; }
+
+	const dheader_t		&Header() const				{ return m_Header; }
+	int					LumpSize( int lump ) const		{ return m_Header.lumps[lump].filelen; }
+	int					LumpVersion( int lump ) const	{ return m_Header.lumps[lump].version; }
+
+	// NULL if the lump is empty
+	const void			*GetLump( int lump );
+	bool				IsLumpMapped( int lump ) const	{ return m_Views[lump].m_pView != NULL; }
+	void				ReleaseLump( int lump );
+
+	// Reads the pakfile directory into pZip.  The entries point into the pak
+	// lump, so Reset() pZip before closing this file.
+	bool				ParsePakFile( IZip *pZip );
+
+	// Maps the whole file copy-on-write, so it can be swapped in place.
+	// This is what OpenBSPFile() reads from.
+	void				*MapWholeFile();
+
+	// Bytes of the file currently mapped or read in
+	int					MappedSize() const			{ return m_nMappedSize; }
+
+private:
+	struct LumpView_t
+	{
+		void	*m_pView;		// start of the mapping, which is aligned down from the lump
+		int		m_nViewSize;
+		int		m_nOffset;		// where the lump starts within the view
+		bool	m_bHeap;		// read through the filesystem rather than mapped
+	};
+
+	bool				OpenOnDisk( const char *pPath );
+	bool				MapView( LumpView_t &view, int nFileOffset, int nSize, bool bCopyOnWrite );
+	void				ReleaseView( LumpView_t &view );
+
+	dheader_t			m_Header;
+	LumpView_t			m_Views[HEADER_LUMPS];
+	LumpView_t			m_WholeFile;
+	int					m_nFileSize;
+	int					m_nMappedSize;
+	bool				m_bOpen;
+
+	intp				m_hFile;				// OS handle, or -1 if not mapped
+	intp				m_hMapping;
+	void				*m_hFileSystemFile;		// FileHandle_t for the fallback
+};
+
+//-----------------------------------------------------------------------------
+// Walks the lumps of a CMappedBSPFile in the order they're stored, mapping
+// each as it's reached and releasing it again on the next step, so only one
+// lump is resident at a time.  Lumps that were already mapped are left alone.
+//
+//		for ( CBSPLumpIterator it( bsp ); it.Next(); )
+//			Validate( it.Lump(), it.Data(), it.Size() );
+//-----------------------------------------------------------------------------
+class CBSPLumpIterator
+{
+public:
+	CBSPLumpIterator( CMappedBSPFile &bsp );
+	~CBSPLumpIterator();
+
+	bool				Next();
+
+	int					Lump() const		{ return m_Order[m_nCurrent]; }
+	int					Version() const		{ return m_BSP.LumpVersion( Lump() ); }
+	int					Size() const		{ return m_BSP.LumpSize( Lump() ); }
+	const void			*Data() const		{ return m_pData; }
+
+private:
+	void				ReleaseCurrent();
+
+	CMappedBSPFile		&m_BSP;
+	int					m_Order[HEADER_LUMPS];
+	int					m_nLumps;
+	int					m_nCurrent;
+	const void			*m_pData;
+	bool				m_bMappedCurrent;
+};
+
+
 //-----------------------------------------------------------------------------
 // String table methods
 //-----------------------------------------------------------------------------
@@ -287,7 +383,9 @@ int					TexDataStringTable_AddOrFindString( const char *pString );
 void	DecompressVis (byte *in, byte *decompressed);
 int		CompressVis (byte *vis, byte *dest);
 
-void	OpenBSPFile( const char *filename );
+// Unless bAllowMapping is false, the file stays mapped until CloseBSPFile(),
+// so it must not be written over before then.
+void	OpenBSPFile( const char *filename, bool bAllowMapping = true );
 void	CloseBSPFile(void);
 void	LoadBSPFile( const char *filename );
 void	LoadBSPFile_FileSystemOnly( const char *filename );
@@ -299,6 +397,8 @@ void	ReleasePakFileLumps(void);
 
 bool	RepackBSPCallback_LZMA( CUtlBuffer &inputBuffer, CUtlBuffer &outputBuffer );
 bool	RepackBSP( CUtlBuffer &inputBuffer, CUtlBuffer &outputBuffer, CompressFunc_t pCompressFunc, IZip::eCompressionType packfileCompression );
+void	BenchmarkBSPCompression( const char *pFilename );
+void	BenchmarkBSPLoad( const char *pFilename );
 bool	SwapBSPFile( const char *filename, const char *swapFilename, bool bSwapOnLoad, VTFConvertFunc_t pVTFConvertFunc, VHVFixupFunc_t pVHVFixupFunc, CompressFunc_t pCompressFunc );
 
 bool	GetPakFileLump( const char *pBSPFilename, void **pPakData, int *pPakSize );
@@ -31,7 +31,9 @@ void pw(winding_t *w)
 		printf ("(%5.1f, %5.1f, %5.1f)\n",w->p[i][0], w->p[i][1],w->p[i][2]);
 }
 
-winding_t *winding_pool[MAX_POINTS_ON_WINDING+4];
+// Freed windings by size. Each thread has its own lists, so allocating and
+// freeing never waits on the other threads once the pools have warmed up.
+winding_t *winding_pool[MAX_TOOL_THREADS+1][MAX_POINTS_ON_WINDING+4];
 
 /*
 =============
@@ -50,18 +52,17 @@ winding_t *AllocWinding (int points)
 		if (c_active_windings > c_peak_windings)
 			c_peak_windings = c_active_windings;
 	}
-	ThreadLock();
-	if (winding_pool[points])
+	winding_t **pPool = &winding_pool[GetThreadIndex()][points];
+	if (*pPool)
 	{
-		w = winding_pool[points];
-		winding_pool[points] = w->next;
+		w = *pPool;
+		*pPool = w->next;
 	}
 	else
 	{
 		w = (winding_t *)malloc(sizeof(*w));
 		w->p = (Vector *)calloc( points, sizeof(Vector) );
 	}
-	ThreadUnlock();
 	w->numpoints = 0; // None are occupied yet even though allocated.
 	w->maxpoints = points;
 	w->next = NULL;
@@ -73,11 +74,11 @@ void FreeWinding (winding_t *w)
 	if (w->numpoints == 0xdeaddead)
 		Error ("FreeWinding: freed a freed winding");
 	
-	ThreadLock();
+	// goes on this thread's list, whichever thread allocated it
+	winding_t **pPool = &winding_pool[GetThreadIndex()][w->maxpoints];
 	w->numpoints = 0xdeaddead; // flag as freed
-	w->next = winding_pool[w->maxpoints];
-	winding_pool[w->maxpoints] = w;
-	ThreadUnlock();
+	w->next = *pPool;
+	*pPool = w;
 }
 
 /*
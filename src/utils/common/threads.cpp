@@ -13,13 +13,24 @@
 
 #define	USED
 
+#ifdef _WIN32
 #include <windows.h>
+#else
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
 #include "cmdlib.h"
 #define NO_THREAD_NAMES
 #include "threads.h"
 #include "pacifier.h"
+#include "tier0/threadtools.h"
+
+#define	MAX_THREADS	MAX_TOOL_THREADS
 
-#define	MAX_THREADS	16
+// Work handed out from a thread's own range at once. The range shrinks as it
+// is used up so the last items stay spread between threads.
+#define MAX_WORK_CHUNK		32
+#define WORK_CHUNK_DIVISOR	8
 
 
 class CRunThreadsData
@@ -33,16 +44,105 @@ public:
 CRunThreadsData g_RunThreadsData[MAX_THREADS];
 
 
-int		dispatch;
+//-----------------------------------------------------------------------------
+// Work stealing dispatch. The (optionally cost sorted) work list is dealt out
+// round robin, so thread t starts with positions t, t + numthreads, ... and
+// every thread begins on its most expensive items. Threads take chunks off
+// the front of their own range; a thread that runs dry takes the back half of
+// the largest range left. Each thread's range sits on its own cache line.
+//-----------------------------------------------------------------------------
+class ALIGN_N( 64 ) CThreadWorkRange
+{
+public:
+	CThreadFastMutex m_Mutex;
+	int m_iSource;				// whose stripe of the work list m_nFront..m_nBack index
+	int m_nFront;
+	int m_nBack;
+
+	// Reserved by the owner, not stealable
+	int m_iSourceChunk;
+	int m_nChunkNext;
+	int m_nChunkEnd;
+
+	// Stats
+	double m_flFinishTime;
+	int m_nSteals;
+} ALIGN_N_POST( 64 );
+
+CThreadWorkRange g_ThreadWork[MAX_THREADS+1];
+CThreadLocalInt<> g_iToolThread;		// thread index + 1, 0 outside RunThreadsOn
+
 int		workcount;
+int		g_nWorkStripes;
+const int *g_pWorkOrder;				// position -> work item, NULL for 0..workcount-1
+CUtlVector<int> g_WorkOrder;
+CInterlockedInt g_nWorkDispatched;
+CThreadFastMutex g_PacifierMutex;
 qboolean		pacifier;
 
 qboolean	threaded;
 bool g_bLowPriorityThreads = false;
 
-HANDLE g_ThreadHandles[MAX_THREADS];
+ThreadHandle_t g_ThreadHandles[MAX_THREADS];
 
 
+static int ThreadWorkItem( int iSource, int nIndex )
+{
+	int nPosition = nIndex * g_nWorkStripes + iSource;
+	return g_pWorkOrder ? g_pWorkOrder[nPosition] : nPosition;
+}
+
+static void ResetThreadWork( int nThreads )
+{
+	g_nWorkStripes = nThreads;
+	for ( int i = 0; i <= MAX_THREADS; i++ )
+	{
+		CThreadWorkRange &range = g_ThreadWork[i];
+		range.m_iSource = i;
+		range.m_nFront = 0;
+		range.m_nBack = ( i < nThreads ) ? ( workcount - i + nThreads - 1 ) / nThreads : 0;
+		range.m_iSourceChunk = i;
+		range.m_nChunkNext = range.m_nChunkEnd = 0;
+		range.m_flFinishTime = 0;
+		range.m_nSteals = 0;
+	}
+	g_nWorkDispatched = 0;
+}
+
+// Moves the back half of the largest range left into pRange, which is empty
+static bool StealThreadWork( CThreadWorkRange *pRange )
+{
+	while ( 1 )
+	{
+		CThreadWorkRange *pVictim = NULL;
+		int nMost = 0;
+		for ( int i = 0; i < g_nWorkStripes; i++ )
+		{
+			int nLeft = g_ThreadWork[i].m_nBack - g_ThreadWork[i].m_nFront;
+			if ( nLeft > nMost )
+			{
+				nMost = nLeft;
+				pVictim = &g_ThreadWork[i];
+			}
+		}
+		if ( !pVictim )
+			return false;
+
+		AUTO_LOCK( pVictim->m_Mutex );
+		int nLeft = pVictim->m_nBack - pVictim->m_nFront;
+		if ( nLeft <= 0 )
+			continue;		// someone beat us to it, look again
+
+		int nTake = ( nLeft + 1 ) / 2;
+		AUTO_LOCK( pRange->m_Mutex );
+		pRange->m_iSource = pVictim->m_iSource;
+		pRange->m_nBack = pVictim->m_nBack;
+		pRange->m_nFront = pVictim->m_nBack - nTake;
+		pVictim->m_nBack -= nTake;
+		pRange->m_nSteals++;
+		return true;
+	}
+}
 
 /*
 =============
@@ -52,26 +152,58 @@ GetThreadWork
 */
 int	GetThreadWork (void)
 {
-	int	r;
+	int iThread = g_iToolThread - 1;
+	Assert( iThread >= 0 && iThread < g_nWorkStripes );
+	CThreadWorkRange *pRange = &g_ThreadWork[iThread];
 
-	ThreadLock ();
-
-	if (dispatch == workcount)
+	if ( pRange->m_nChunkNext == pRange->m_nChunkEnd )
 	{
-		ThreadUnlock ();
-		return -1;
+		while ( 1 )
+		{
+			{
+				AUTO_LOCK( pRange->m_Mutex );
+				int nLeft = pRange->m_nBack - pRange->m_nFront;
+				if ( nLeft > 0 )
+				{
+					// Cost sorted items are expensive enough to hand out one at a time,
+					// which keeps the heavy ones stealable
+					int nChunk = g_pWorkOrder ? 1 : clamp( nLeft / WORK_CHUNK_DIVISOR, 1, MAX_WORK_CHUNK );
+					pRange->m_iSourceChunk = pRange->m_iSource;
+					pRange->m_nChunkNext = pRange->m_nFront;
+					pRange->m_nChunkEnd = pRange->m_nFront + nChunk;
+					pRange->m_nFront += nChunk;
+					break;
+				}
+			}
+
+			if ( !StealThreadWork( pRange ) )
+			{
+				pRange->m_flFinishTime = Plat_FloatTime();
+				return -1;
+			}
+		}
 	}
 
-	UpdatePacifier( (float)dispatch / workcount );
+	int r = ThreadWorkItem( pRange->m_iSourceChunk, pRange->m_nChunkNext++ );
 
-	r = dispatch;
-	dispatch++;
-	ThreadUnlock ();
+	int nDispatched = ++g_nWorkDispatched;
+	if ( pacifier && g_PacifierMutex.TryLock() )
+	{
+		UpdatePacifier( (float)nDispatched / workcount );
+		g_PacifierMutex.Unlock();
+	}
 
 	return r;
 }
 
 
+int GetThreadIndex (void)
+{
+	int iThread = g_iToolThread - 1;
+	return ( iThread >= 0 ) ? iThread : THREADINDEX_MAIN;
+}
+
+
 ThreadWorkerFn workfunction;
 
 void ThreadWorkerFunction( int iThread, void *pUserData )
@@ -98,48 +230,76 @@ void RunThreadsOnIndividual (int workcnt, qboolean showpacifier, ThreadWorkerFn
 }
 
 
+static const float *s_pSortWorkCosts;
+
+static int __cdecl CompareWorkCosts( const void *pA, const void *pB )
+{
+	float flA = s_pSortWorkCosts[*(const int *)pA];
+	float flB = s_pSortWorkCosts[*(const int *)pB];
+	if ( flA != flB )
+		return ( flA > flB ) ? -1 : 1;
+	return *(const int *)pA - *(const int *)pB;
+}
+
+void RunThreadsOnIndividualByCost( int workcnt, qboolean showpacifier, ThreadWorkerFn func, const float *pWorkCosts )
+{
+	if ( !pWorkCosts )
+	{
+		RunThreadsOnIndividual( workcnt, showpacifier, func );
+		return;
+	}
+
+	// Most expensive first so the long items don't all start at the end
+	g_WorkOrder.SetCount( workcnt );
+	for ( int i = 0; i < workcnt; i++ )
+	{
+		g_WorkOrder[i] = i;
+	}
+	s_pSortWorkCosts = pWorkCosts;
+	qsort( g_WorkOrder.Base(), workcnt, sizeof( int ), CompareWorkCosts );
+	s_pSortWorkCosts = NULL;
+
+	g_pWorkOrder = g_WorkOrder.Base();
+	RunThreadsOnIndividual( workcnt, showpacifier, func );
+	g_pWorkOrder = NULL;
+}
+
+
 /*
 ===================================================================
 
-WIN32
+THREADS
 
 ===================================================================
 */
 
 int		numthreads = -1;
-CRITICAL_SECTION		crit;
+CThreadMutex		crit;
 static int enter;
 
 
-class CCritInit
-{
-public:
-	CCritInit()
-	{
-		InitializeCriticalSection (&crit);
-	}
-} g_CritInit;
-
-
-
 void SetLowPriority()
 {
+#ifdef _WIN32
 	SetPriorityClass( GetCurrentProcess(), IDLE_PRIORITY_CLASS );
+#else
+	setpriority( PRIO_PROCESS, 0, 19 );
+#endif
 }
 
 
 void ThreadSetDefault (void)
 {
-	SYSTEM_INFO info;
-
 	if (numthreads == -1)	// not set manually
 	{
-		GetSystemInfo (&info);
-		numthreads = info.dwNumberOfProcessors;
-		if (numthreads < 1 || numthreads > 32)
+		numthreads = GetCPUInformation()->m_nLogicalProcessors;
+		if (numthreads < 1)
 			numthreads = 1;
 	}
 
+	if ( numthreads > MAX_TOOL_THREADS )
+		numthreads = MAX_TOOL_THREADS;
+
 	Msg ("%i threads\n", numthreads);
 }
 
@@ -148,7 +308,7 @@ void ThreadLock (void)
 {
 	if (!threaded)
 		return;
-	EnterCriticalSection (&crit);
+	crit.Lock();
 	if (enter)
 		Error ("Recursive ThreadLock\n");
 	enter = 1;
@@ -161,15 +321,17 @@ void ThreadUnlock (void)
 	if (!enter)
 		Error ("ThreadUnlock without lock\n");
 	enter = 0;
-	LeaveCriticalSection (&crit);
+	crit.Unlock();
 }
 
 
 // This runs in the thread and dispatches a RunThreadsFn call.
-DWORD WINAPI InternalRunThreadsFn( LPVOID pParameter )
+uintp InternalRunThreadsFn( void *pParameter )
 {
 	CRunThreadsData *pData = (CRunThreadsData*)pParameter;
+	g_iToolThread = pData->m_iThread + 1;
 	pData->m_Fn( pData->m_iThread, pData->m_pUserData );
+	g_iToolThread = 0;
 	return 0;
 }
 
@@ -188,23 +350,21 @@ void RunThreads_Start( RunThreadsFn fn, void *pUserData, ERunThreadsPriority ePr
 		g_RunThreadsData[i].m_pUserData = pUserData;
 		g_RunThreadsData[i].m_Fn = fn;
 
-		DWORD dwDummy;
-		g_ThreadHandles[i] = CreateThread(
-		   NULL,	// LPSECURITY_ATTRIBUTES lpsa,
-		   0,		// DWORD cbStack,
-		   InternalRunThreadsFn,	// LPTHREAD_START_ROUTINE lpStartAddr,
-		   &g_RunThreadsData[i],	// LPVOID lpvThreadParm,
-		   0,			// DWORD fdwCreate,
-		   &dwDummy );
+		g_ThreadHandles[i] = CreateSimpleThread( InternalRunThreadsFn, &g_RunThreadsData[i] );
 
 		if ( ePriority == k_eRunThreadsPriority_UseGlobalState )
 		{
 			if( g_bLowPriorityThreads )
-				SetThreadPriority( g_ThreadHandles[i], THREAD_PRIORITY_LOWEST );
+				ThreadSetPriority( g_ThreadHandles[i], TP_PRIORITY_LOWEST );
 		}
 		else if ( ePriority == k_eRunThreadsPriority_Idle )
 		{
-			SetThreadPriority( g_ThreadHandles[i], THREAD_PRIORITY_IDLE );
+			// Same as lowest outside Windows
+#ifdef _WIN32
+			ThreadSetPriority( g_ThreadHandles[i], THREAD_PRIORITY_IDLE );
+#else
+			ThreadSetPriority( g_ThreadHandles[i], TP_PRIORITY_LOWEST );
+#endif
 		}
 	}
 }
@@ -212,13 +372,40 @@ void RunThreads_Start( RunThreadsFn fn, void *pUserData, ERunThreadsPriority ePr
 
 void RunThreads_End()
 {
-	WaitForMultipleObjects( numthreads, g_ThreadHandles, TRUE, INFINITE );
 	for ( int i=0; i < numthreads; i++ )
-		CloseHandle( g_ThreadHandles[i] );
+	{
+		ThreadJoin( g_ThreadHandles[i] );
+		ReleaseThreadHandle( g_ThreadHandles[i] );
+	}
 
 	threaded = false;
 }
-	
+
+
+// How much of the run each thread spent working, i.e. didn't sit waiting for the others
+static void PrintThreadUtilisation( double flStart, double flEnd )
+{
+	double flElapsed = flEnd - flStart;
+	if ( numthreads < 2 || flElapsed <= 0 )
+		return;
+
+	double flTotal = 0;
+	int nSteals = 0;
+	char szThreads[MAX_TOOL_THREADS * 5 + 1];
+	szThreads[0] = 0;
+	for ( int i = 0; i < numthreads; i++ )
+	{
+		const CThreadWorkRange &range = g_ThreadWork[i];
+		double flFinish = ( range.m_flFinishTime > 0 ) ? range.m_flFinishTime : flEnd;
+		double flUsed = clamp( ( flFinish - flStart ) / flElapsed, 0.0, 1.0 );
+		flTotal += flUsed;
+		nSteals += range.m_nSteals;
+		V_snprintf( szThreads + V_strlen( szThreads ), sizeof( szThreads ) - V_strlen( szThreads ), " %d", (int)( flUsed * 100.0 + 0.5 ) );
+	}
+
+	Msg( "    thread utilisation %d%% (%d steals):%s\n", (int)( flTotal * 100.0 / numthreads + 0.5 ), nSteals, szThreads );
+}
+
 
 /*
 =============
@@ -227,20 +414,30 @@ RunThreadsOn
 */
 void RunThreadsOn( int workcnt, qboolean showpacifier, RunThreadsFn fn, void *pUserData )
 {
-	int		start, end;
+	double	start, end;
+
+	if (numthreads == -1)
+		ThreadSetDefault ();
+	if ( numthreads > MAX_TOOL_THREADS )
+		numthreads = MAX_TOOL_THREADS;
 
 	start = Plat_FloatTime();
-	dispatch = 0;
 	workcount = workcnt;
-	StartPacifier("");
 	pacifier = showpacifier;
+	if (pacifier)
+		StartPacifier("");	// not otherwise, it would reset a pacifier the caller is drawing
 
 #ifdef _PROFILE
 	threaded = false;
-	(*func)( 0 );
+	ResetThreadWork( 1 );
+	g_iToolThread = 1;
+	fn( 0, pUserData );
+	g_iToolThread = 0;
 	return;
 #endif
 
+	ResetThreadWork( numthreads );
+
 	
 	RunThreads_Start( fn, pUserData );
 	RunThreads_End();
@@ -250,8 +447,7 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, RunThreadsFn fn, void *pU
 	if (pacifier)
 	{
 		EndPacifier(false);
-		printf (" (%i)\n", end-start);
+		printf (" (%i)\n", (int)(end-start));
+		PrintThreadUtilisation( start, end );
 	}
 }
-
-
@@ -18,7 +18,7 @@
 
 // Arrays that are indexed by thread should always be MAX_TOOL_THREADS+1
 // large so THREADINDEX_MAIN can be used from the main thread.
-#define MAX_TOOL_THREADS	16
+#define MAX_TOOL_THREADS	64
 #define THREADINDEX_MAIN	(MAX_TOOL_THREADS)
 
 
@@ -43,10 +43,20 @@ enum ERunThreadsPriority
 void SetLowPriority();
 
 void ThreadSetDefault (void);
+
+// Returns the next work item for the calling thread, or -1 when everything has
+// been handed out. Only valid from a RunThreadsOn thread.
 int	GetThreadWork (void);
 
+// The calling thread's index inside RunThreadsOn, or THREADINDEX_MAIN outside it
+int GetThreadIndex (void);
+
 void RunThreadsOnIndividual ( int workcnt, qboolean showpacifier, ThreadWorkerFn fn );
 
+// Same, but hands out the most expensive items first. pWorkCosts has workcnt
+// entries in any unit; only their order matters.
+void RunThreadsOnIndividualByCost ( int workcnt, qboolean showpacifier, ThreadWorkerFn fn, const float *pWorkCosts );
+
 void RunThreadsOn ( int workcnt, qboolean showpacifier, RunThreadsFn fn, void *pUserData=NULL );
 
 // This version doesn't track work items - it just runs your function and waits for it to finish.
@@ -60,6 +70,7 @@ void ThreadUnlock (void);
 #ifndef NO_THREAD_NAMES
 #define RunThreadsOn(n,p,f) { if (p) printf("%-20s ", #f ":"); RunThreadsOn(n,p,f); }
 #define RunThreadsOnIndividual(n,p,f) { if (p) printf("%-20s ", #f ":"); RunThreadsOnIndividual(n,p,f); }
+#define RunThreadsOnIndividualByCost(n,p,f,c) { if (p) printf("%-20s ", #f ":"); RunThreadsOnIndividualByCost(n,p,f,c); }
 #endif
 
 #endif // THREADS_H
@@ -9,8 +9,8 @@
 #include "vbsp.h"
 
 
-int		c_nodes;
-int		c_nonvis;
+CInterlockedInt	c_nodes;
+CInterlockedInt	c_nonvis;
 int		c_active_brushes;
 
 // if a brush just barely pokes onto the other side,
@@ -310,21 +310,32 @@ AllocNode
 */
 node_t *AllocNode (void)
 {
-	static int s_NodeCount = 0;
+	static CInterlockedInt s_NodeCount;
 
 	node_t	*node;
 
 	node = (node_t*)malloc(sizeof(*node));
 	memset (node, 0, sizeof(*node));
-	node->id = s_NodeCount;
+	node->id = s_NodeCount++;
 	node->diskId = -1;
 
-	s_NodeCount++;
-
 	return node;
 }
 
 
+// Freed brushes are kept by side count on a list per thread, the same way
+// polylib keeps windings, so the threads building subtrees don't contend for
+// the heap. A header in front of each brush remembers its allocated size.
+#define	MAX_POOLED_BRUSH_SIDES	64
+
+struct brushblock_t
+{
+	brushblock_t	*next;
+	int				maxsides;
+};
+
+static brushblock_t *s_BrushPool[MAX_TOOL_THREADS+1][MAX_POOLED_BRUSH_SIDES];
+
 /*
 ================
 AllocBrush
@@ -332,13 +343,25 @@ AllocBrush
 */
 bspbrush_t *AllocBrush (int numsides)
 {
-	static int s_BrushId = 0;
+	static CInterlockedInt s_BrushId;
 
 	bspbrush_t	*bb;
+	brushblock_t	*block;
 	int			c;
 
 	c = (int)&(((bspbrush_t *)0)->sides[numsides]);
-	bb = (bspbrush_t*)malloc(c);
+	brushblock_t **pPool = (numsides < MAX_POOLED_BRUSH_SIDES) ? &s_BrushPool[GetThreadIndex()][numsides] : NULL;
+	if (pPool && *pPool)
+	{
+		block = *pPool;
+		*pPool = block->next;
+	}
+	else
+	{
+		block = (brushblock_t *)malloc(sizeof(*block) + c);
+		block->maxsides = numsides;
+	}
+	bb = (bspbrush_t *)(block + 1);
 	memset (bb, 0, c);
 	bb->id = s_BrushId++;
 	if (numthreads == 1)
@@ -358,7 +381,19 @@ void FreeBrush (bspbrush_t *brushes)
 	for (i=0 ; i<brushes->numsides ; i++)
 		if (brushes->sides[i].winding)
 			FreeWinding(brushes->sides[i].winding);
-	free (brushes);
+
+	// goes on this thread's list, whichever thread allocated it
+	brushblock_t *block = ((brushblock_t *)brushes) - 1;
+	if (block->maxsides < MAX_POOLED_BRUSH_SIDES)
+	{
+		brushblock_t **pPool = &s_BrushPool[GetThreadIndex()][block->maxsides];
+		block->next = *pPool;
+		*pPool = block;
+	}
+	else
+	{
+		free (block);
+	}
 	if (numthreads == 1)
 		c_active_brushes--;
 }
@@ -849,151 +884,248 @@ Returns NULL if there are no valid planes to split with..
 ================
 */
 
-side_t *SelectSplitSide (bspbrush_t *brushes, node_t *node)
+struct splitcandidate_t
 {
-	int			value, bestvalue;
-	bspbrush_t	*brush, *test;
-	side_t		*side, *bestside;
-	int			i, j, pass, numpasses;
+	side_t		*side;
 	int			pnum;
+	int			pass;		// 0 = visible, 1 = nonvisible
+	int			order;		// position in the brush list
+	qboolean	valid;		// false if the plane would produce a tiny volume
+	int			value;
+};
+
+// Nodes with at least this many candidate/brush tests score their candidates
+// on all threads. Below that the threads cost more than they save.
+#define	PARALLEL_SPLIT_TESTS	100000
+
+// Puts the first use of each plane first, visible sides before nonvisible
+static int CompareSplitCandidatePlanes (const void *a, const void *b)
+{
+	const splitcandidate_t *pA = (const splitcandidate_t *)a;
+	const splitcandidate_t *pB = (const splitcandidate_t *)b;
+	if (pA->pnum != pB->pnum)
+		return pA->pnum - pB->pnum;
+	if (pA->pass != pB->pass)
+		return pA->pass - pB->pass;
+	return pA->order - pB->order;
+}
+
+// Back into the order the brush list was walked in
+static int CompareSplitCandidateOrder (const void *a, const void *b)
+{
+	const splitcandidate_t *pA = (const splitcandidate_t *)a;
+	const splitcandidate_t *pB = (const splitcandidate_t *)b;
+	if (pA->pass != pB->pass)
+		return pA->pass - pB->pass;
+	return pA->order - pB->order;
+}
+
+static void ScoreSplitCandidate (splitcandidate_t *cand, bspbrush_t *brushes, node_t *node)
+{
+	bspbrush_t	*test;
 	int			s;
 	int			front, back, both, facing, splits;
 	int			bsplits;
-	int			bestsplits;
 	int			epsilonbrush;
+	int			value;
 	qboolean	hintsplit = false;
 
-	bestside = NULL;
-	bestvalue = -99999;
-	bestsplits = 0;
+	cand->valid = CheckPlaneAgainstVolume (cand->pnum, node);
+	if (!cand->valid)
+		return;	// would produce a tiny volume
+
+	front = 0;
+	back = 0;
+	both = 0;
+	facing = 0;
+	splits = 0;
+	epsilonbrush = 0;
+
+	for (test = brushes ; test ; test=test->next)
+	{
+		s = TestBrushToPlanenum (test, cand->pnum, &bsplits, &hintsplit, &epsilonbrush);
+
+		splits += bsplits;
+		if (bsplits && (s&PSIDE_FACING) )
+			Error ("PSIDE_FACING with splits");
+
+		if (s & PSIDE_FACING)
+			facing++;
+		if (s & PSIDE_FRONT)
+			front++;
+		if (s & PSIDE_BACK)
+			back++;
+		if (s == PSIDE_BOTH)
+			both++;
+	}
+
+	// give a value estimate for using this plane
+	value =  5*facing - 5*splits - abs(front-back);
+//		value =  -5*splits;
+//		value =  5*facing - 5*splits;
+	if (g_MainMap->mapplanes[cand->pnum].type < 3)
+		value+=5;		// axial is better
+	value -= epsilonbrush*1000;	// avoid!
+
+	// trans should split last
+	if ( cand->side->surf & SURF_TRANS )
+	{
+		value -= 500;
+	}
+
+	// never split a hint side except with another hint
+	if (hintsplit && !(cand->side->surf & SURF_HINT) )
+		value = -9999999;
+
+	// water should split first
+	if (cand->side->contents & (CONTENTS_WATER | CONTENTS_SLIME))
+		value = 9999999;
+
+	cand->value = value;
+}
+
+static splitcandidate_t	*s_pScoreCandidates;
+static bspbrush_t		*s_pScoreBrushes;
+static node_t			*s_pScoreNode;
+
+static void ScoreSplitCandidate_Thread (int iThread, int iCandidate)
+{
+	ScoreSplitCandidate (&s_pScoreCandidates[iCandidate], s_pScoreBrushes, s_pScoreNode);
+}
+
+// non-NULL while the main thread builds the top of a tree on several threads
+struct bspsubtree_t
+{
+	node_t		*node;
+	bspbrush_t	*brushes;
+	int			numbrushes;
+};
+
+static CUtlVector<bspsubtree_t>	*s_pDeferredSubtrees;
+static int s_nDeferBrushes;		// subtrees with fewer brushes than this are left for the threads
+
+side_t *SelectSplitSide (bspbrush_t *brushes, node_t *node)
+{
+	int			value, bestvalue;
+	bspbrush_t	*brush, *test;
+	side_t		*side;
+	splitcandidate_t *bestcand;
+	int			i, pass, numpasses;
+	int			numbrushes;
+	int			bsplits;
+	int			epsilonbrush;
+	qboolean	hintsplit;
+
+	//
+	// Every side that could split, in brush list order. Only the first side
+	// on each plane is scored: the others would score the same.
+	//
+	CUtlVector<splitcandidate_t> candidates;
+	numbrushes = 0;
+	for (brush = brushes ; brush ; brush=brush->next)
+	{
+		numbrushes++;
+		for (i=0 ; i<brush->numsides ; i++)
+		{
+			side = brush->sides + i;
+
+			if (side->bevel)
+				continue;	// never use a bevel as a spliter
+			if (!side->winding)
+				continue;	// nothing visible, so it can't split
+			if (side->texinfo == TEXINFO_NODE)
+				continue;	// allready a node splitter
+			if (side->surf & SURF_SKIP)
+				continue;	// skip surfaces are never chosen
+
+			splitcandidate_t &cand = candidates[candidates.AddToTail()];
+			cand.side = side;
+			cand.pnum = side->planenum & ~1;	// allways use positive facing plane
+			cand.pass = side->visible ? 0 : 1;
+			cand.order = candidates.Count();
+			cand.valid = false;
+			cand.value = 0;
+		}
+	}
+
+	if (!candidates.Count())
+		return NULL;
+
+	qsort (candidates.Base(), candidates.Count(), sizeof(splitcandidate_t), CompareSplitCandidatePlanes);
+	int numunique = 0;
+	for (i=0 ; i<candidates.Count() ; i++)
+	{
+		if (numunique && candidates[numunique-1].pnum == candidates[i].pnum)
+			continue;	// we allready have metrics for this plane
+		candidates[numunique++] = candidates[i];
+	}
+	candidates.SetCountNonDestructively (numunique);
+	qsort (candidates.Base(), candidates.Count(), sizeof(splitcandidate_t), CompareSplitCandidateOrder);
 
 	// the search order goes: visible-structural, nonvisible-structural
 	// If any valid plane is available in a pass, no further
 	// passes will be tried.
+	bestcand = NULL;
+	bestvalue = -99999;
 	numpasses = 2;
+	int first = 0;
 	for (pass = 0 ; pass < numpasses ; pass++)
 	{
-		for (brush = brushes ; brush ; brush=brush->next)
+		int count = 0;
+		while (first + count < candidates.Count() && candidates[first+count].pass == pass)
 		{
-			for (i=0 ; i<brush->numsides ; i++)
+			CheckPlaneAgainstParents (candidates[first+count].pnum, node);
+			count++;
+		}
+
+		if (s_pDeferredSubtrees && numthreads > 1 && count * numbrushes >= PARALLEL_SPLIT_TESTS)
+		{
+			s_pScoreCandidates = candidates.Base() + first;
+			s_pScoreBrushes = brushes;
+			s_pScoreNode = node;
+			RunThreadsOnIndividual (count, false, ScoreSplitCandidate_Thread);
+		}
+		else
+		{
+			for (i=0 ; i<count ; i++)
+				ScoreSplitCandidate (&candidates[first+i], brushes, node);
+		}
+
+		for (i=0 ; i<count ; i++)
+		{
+			splitcandidate_t &cand = candidates[first+i];
+			if (!cand.valid)
+				continue;
+
+			value = cand.value;
+			if (value > bestvalue)
 			{
-				side = brush->sides + i;
-
-				if (side->bevel)
-					continue;	// never use a bevel as a spliter
-				if (!side->winding)
-					continue;	// nothing visible, so it can't split
-				if (side->texinfo == TEXINFO_NODE)
-					continue;	// allready a node splitter
-				if (side->tested)
-					continue;	// we allready have metrics for this plane
-				if (side->surf & SURF_SKIP)
-					continue;	// skip surfaces are never chosen
-				if ( side->visible ^ (pass<1) )
-					continue;	// only check visible faces on first pass
-				
-				pnum = side->planenum;
-				pnum &= ~1;	// allways use positive facing plane
-
-				CheckPlaneAgainstParents (pnum, node);
-
-				if (!CheckPlaneAgainstVolume (pnum, node))
-					continue;	// would produce a tiny volume
-
-				front = 0;
-				back = 0;
-				both = 0;
-				facing = 0;
-				splits = 0;
-				epsilonbrush = 0;
-
-				for (test = brushes ; test ; test=test->next)
-				{
-					s = TestBrushToPlanenum (test, pnum, &bsplits, &hintsplit, &epsilonbrush);
-
-					splits += bsplits;
-					if (bsplits && (s&PSIDE_FACING) )
-						Error ("PSIDE_FACING with splits");
-
-					test->testside = s;
-					// if the brush shares this face, don't bother
-					// testing that facenum as a splitter again
-					if (s & PSIDE_FACING)
-					{
-						facing++;
-						for (j=0 ; j<test->numsides ; j++)
-						{
-							if ( (test->sides[j].planenum&~1) == pnum)
-								test->sides[j].tested = true;
-						}
-					}
-					if (s & PSIDE_FRONT)
-						front++;
-					if (s & PSIDE_BACK)
-						back++;
-					if (s == PSIDE_BOTH)
-						both++;
-				}
-
-				// give a value estimate for using this plane
-				value =  5*facing - 5*splits - abs(front-back);
-//					value =  -5*splits;
-//					value =  5*facing - 5*splits;
-				if (g_MainMap->mapplanes[pnum].type < 3)
-					value+=5;		// axial is better
-				value -= epsilonbrush*1000;	// avoid!
-
-				// trans should split last
-				if ( side->surf & SURF_TRANS )
-				{
-					value -= 500;
-				}
-
-				// never split a hint side except with another hint
-				if (hintsplit && !(side->surf & SURF_HINT) )
-					value = -9999999;
-
-				// water should split first
-				if (side->contents & (CONTENTS_WATER | CONTENTS_SLIME))
-					value = 9999999;
-
-				// save off the side test so we don't need
-				// to recalculate it when we actually seperate
-				// the brushes
-				if (value > bestvalue)
-				{
-					bestvalue = value;
-					bestside = side;
-					bestsplits = splits;
-					for (test = brushes ; test ; test=test->next)
-						test->side = test->testside;
-				}
+				bestvalue = value;
+				bestcand = &cand;
 			}
 		}
+		first += count;
 
 		// if we found a good plane, don't bother trying any
 		// other passes
-		if (bestside)
+		if (bestcand)
 		{
 			if (pass > 0)
-			{
-				if (numthreads == 1)
-					c_nonvis++;
-			}
+				c_nonvis++;
 			break;
 		}
 	}
 
-	//
-	// clear all the tested flags we set
-	//
-	for (brush = brushes ; brush ; brush=brush->next)
-	{
-		for (i=0 ; i<brush->numsides ; i++)
-			brush->sides[i].tested = false;
-	}
+	if (!bestcand)
+		return NULL;
+
+	// save off the side test for the chosen plane so that
+	// we can seperate the brushes with it
+	epsilonbrush = 0;
+	for (test = brushes ; test ; test=test->next)
+		test->side = TestBrushToPlanenum (test, bestcand->pnum, &bsplits, &hintsplit, &epsilonbrush);
 
-	return bestside;
+	return bestcand->side;
 }
 
 
@@ -1338,8 +1470,7 @@ node_t *BuildTree_r (node_t *node, bspbrush_t *brushes)
 	int			i;
 	bspbrush_t	*children[2];
 
-	if (numthreads == 1)
-		c_nodes++;
+	c_nodes++;
 
 	// find the best plane to use as a splitter
 	bestside = SelectSplitSide (brushes, node);
@@ -1374,11 +1505,74 @@ node_t *BuildTree_r (node_t *node, bspbrush_t *brushes)
 	// recursively process children
 	for (i=0 ; i<2 ; i++)
 	{
+		if (s_pDeferredSubtrees)
+		{
+			int numbrushes = CountBrushList (children[i]);
+			if (numbrushes < s_nDeferBrushes)
+			{
+				bspsubtree_t &subtree = s_pDeferredSubtrees->Element (s_pDeferredSubtrees->AddToTail ());
+				subtree.node = node->children[i];
+				subtree.brushes = children[i];
+				subtree.numbrushes = numbrushes;
+				continue;
+			}
+		}
+
 		node->children[i] = BuildTree_r (node->children[i], children[i]);
 	}
 
 	return node;
 }
+
+
+/*
+================
+BuildTree
+
+With more than one thread, the top of the tree is built here with the split
+planes scored on all the threads, and each subtree below it is handed to a
+thread whole, biggest first. Nothing a subtree does depends on the others, so
+the tree comes out the same as a one thread build.
+================
+*/
+#define	MIN_PARALLEL_BSP_BRUSHES	256		// smaller lists are built on one thread
+#define	BSP_SUBTREES_PER_THREAD		8		// so a few big subtrees don't leave threads idle
+
+static bspsubtree_t *s_pBuildSubtrees;
+
+static void BuildSubtree_Thread (int iThread, int iSubtree)
+{
+	bspsubtree_t *subtree = &s_pBuildSubtrees[iSubtree];
+	BuildTree_r (subtree->node, subtree->brushes);
+}
+
+node_t *BuildTree (node_t *node, bspbrush_t *brushes, int numbrushes)
+{
+	if (g_nParallelThreads <= 1 || numbrushes < MIN_PARALLEL_BSP_BRUSHES)
+		return BuildTree_r (node, brushes);
+
+	int oldthreads = numthreads;
+	numthreads = g_nParallelThreads;
+
+	CUtlVector<bspsubtree_t> subtrees;
+	s_pDeferredSubtrees = &subtrees;
+	s_nDeferBrushes = max (MIN_PARALLEL_BSP_BRUSHES / 4, numbrushes / (numthreads * BSP_SUBTREES_PER_THREAD));
+	node = BuildTree_r (node, brushes);
+	s_pDeferredSubtrees = NULL;
+
+	// scoring is about brushes squared
+	CUtlVector<float> costs;
+	costs.SetCount (subtrees.Count());
+	for (int i=0 ; i<subtrees.Count() ; i++)
+		costs[i] = (float)subtrees[i].numbrushes * subtrees[i].numbrushes;
+
+	s_pBuildSubtrees = subtrees.Base();
+	RunThreadsOnIndividualByCost (subtrees.Count(), false, BuildSubtree_Thread, costs.Base());
+	s_pBuildSubtrees = NULL;
+
+	numthreads = oldthreads;
+	return node;
+}
 	  
 
 //===========================================================
@@ -1447,7 +1641,7 @@ tree_t *BrushBSP (bspbrush_t *brushlist, Vector& mins, Vector& maxs)
 
 	tree->headnode = node;
 
-	node = BuildTree_r (node, brushlist);
+	node = BuildTree (node, brushlist, c_brushes);
 	qprintf ("%5i visible nodes\n", c_nodes/2 - c_nonvis);
 	qprintf ("%5i nonvis nodes\n", c_nonvis);
 	qprintf ("%5i leafs\n", (c_nodes+1)/2);
@@ -18,7 +18,6 @@
 #include "gamebspfile.h"
 #include "mathlib/VMatrix.h"
 #include "materialpatch.h"
-#include "pacifier.h"
 #include "vstdlib/random.h"
 #include "builddisp.h"
 #include "disp_vbsp.h"
@@ -28,6 +27,7 @@
 #include "UtlLinkedList.h"
 #include "byteswap.h"
 #include "writebsp.h"
+#include "threads.h"
 
 //-----------------------------------------------------------------------------
 // Information about particular detail object types
@@ -75,6 +75,123 @@ struct DetailObject_t
 static CUtlVector<DetailObject_t>	s_DetailObjectDict;
 
 
+//-----------------------------------------------------------------------------
+// Details are placed on each face in parallel and added to the lump afterwards
+// in face order.
+//
+// vbsp has always seeded the CRT's rand() and vstdlib's random stream with
+// each face's hammer id, placed the face's details with rand(), and scaled
+// sprites with RandomGaussianFloat().  The threaded path reproduces that
+// exactly: each face runs its own copy of the CRT generator, and the Gaussian
+// scales are drawn in the lump pass, in face order, because the Gaussian
+// stream carries its spare value over from one face to the next.  Where we
+// don't know how the CRT's rand() works, the details are placed serially.
+//-----------------------------------------------------------------------------
+#if defined( _WIN32 ) || defined( __GLIBC__ )
+#define DETAIL_RANDOM_THREADED	1
+#else
+#define DETAIL_RANDOM_THREADED	0
+#endif
+
+class CDetailRandom
+{
+public:
+	// With bCRT it's just rand(), which the caller has seeded
+	CDetailRandom( int nSeed, bool bCRT );
+
+	bool IsCRT() const { return m_bCRT; }
+
+	// Same sequence as rand() after srand( nSeed )
+	int Rand();
+
+private:
+	bool		m_bCRT;
+#if defined( _WIN32 )
+	unsigned int m_nHoldRand;
+#elif defined( __GLIBC__ )
+	int32		m_State[31];
+	int			m_nFront;
+	int			m_nRear;
+#endif
+};
+
+CDetailRandom::CDetailRandom( int nSeed, bool bCRT ) : m_bCRT( bCRT )
+{
+#if defined( _WIN32 )
+	m_nHoldRand = (unsigned int)nSeed;
+#elif defined( __GLIBC__ )
+	// glibc's default TYPE_3 additive feedback generator
+	if ( !nSeed )
+	{
+		nSeed = 1;
+	}
+	m_State[0] = nSeed;
+	int32 nWord = nSeed;
+	for ( int i = 1; i < 31; ++i )
+	{
+		int64 nHi = nWord / 127773;
+		int64 nLo = nWord % 127773;
+		nWord = (int32)( 16807 * nLo - 2836 * nHi );
+		if ( nWord < 0 )
+		{
+			nWord += 2147483647;
+		}
+		m_State[i] = nWord;
+	}
+	m_nFront = 3;
+	m_nRear = 0;
+	for ( int i = 0; i < 310; ++i )
+	{
+		Rand();
+	}
+#endif
+}
+
+int CDetailRandom::Rand()
+{
+#if defined( _WIN32 )
+	if ( !m_bCRT )
+	{
+		m_nHoldRand = m_nHoldRand * 214013 + 2531011;
+		return ( m_nHoldRand >> 16 ) & 0x7fff;
+	}
+#elif defined( __GLIBC__ )
+	if ( !m_bCRT )
+	{
+		uint32 nVal = (uint32)m_State[m_nFront] + (uint32)m_State[m_nRear];
+		m_State[m_nFront] = (int32)nVal;
+		if ( ++m_nFront >= 31 )
+		{
+			m_nFront = 0;
+		}
+		if ( ++m_nRear >= 31 )
+		{
+			m_nRear = 0;
+		}
+		return (int)( nVal >> 1 );
+	}
+#endif
+	return rand();
+}
+
+struct DetailPlacement_t
+{
+	DetailModel_t const	*m_pModel;
+	Vector				m_Origin;
+	QAngle				m_Angles;
+	float				m_flScale;
+	float				m_flScaleStdDev;	// if non-zero, m_flScale is drawn in the lump pass
+};
+
+struct DetailFace_t
+{
+	int								m_nFace;
+	int								m_nSeed;
+	DetailObject_t					*m_pDetail;
+	CUtlVector<DetailPlacement_t>	m_Placements;
+};
+
+
 //-----------------------------------------------------------------------------
 // Error checking.. make sure the model is valid + is a static prop
 //-----------------------------------------------------------------------------
@@ -319,7 +436,7 @@ void LoadEmitDetailObjectDictionary( const char* pGameDir )
 //-----------------------------------------------------------------------------
 // Selects a detail group
 //-----------------------------------------------------------------------------
-static int SelectGroup( const DetailObject_t& detail, float alpha )
+static int SelectGroup( const DetailObject_t& detail, float alpha, CDetailRandom& random )
 {
 	// Find the two groups whose alpha we're between...
 	int start, end;
@@ -345,7 +462,7 @@ static int SelectGroup( const DetailObject_t& detail, float alpha )
 	}
 
 	// Pick a number, any number...
-	float r = rand() / (float)VALVE_RAND_MAX;
+	float r = random.Rand() / (float)VALVE_RAND_MAX;
 
 	// When dist == 0, we *always* want start.
 	// When dist == 1, we *always* want end
@@ -357,10 +474,10 @@ static int SelectGroup( const DetailObject_t& detail, float alpha )
 //-----------------------------------------------------------------------------
 // Selects a detail object
 //-----------------------------------------------------------------------------
-static int SelectDetail( DetailObjectGroup_t const& group )
+static int SelectDetail( DetailObjectGroup_t const& group, CDetailRandom& random )
 {
 	// Pick a number, any number...
-	float r = rand() / (float)VALVE_RAND_MAX;
+	float r = random.Rand() / (float)VALVE_RAND_MAX;
 
 	// Look through the list of models + pick the one associated with this number
 	for ( int i = 0; i < group.m_Models.Count(); ++i )
@@ -545,7 +662,8 @@ static void AddDetailSpriteToLump( const Vector &vecOrigin, const QAngle &vecAng
 // (only when not in the debugger?)
 // Printing the values of normal at the bottom of the function fixes it as does
 // disabling global optimizations.
-static void PlaceDetail( DetailModel_t const& model, const Vector& pt, const Vector& normal )
+static void PlaceDetail( DetailModel_t const& model, const Vector& pt, const Vector& normal,
+						 CDetailRandom& random, CUtlVector<DetailPlacement_t>& placements )
 {
 	// But only place it on the surface if it meets the angle constraints...
 	float cosAngle = normal.z;
@@ -560,7 +678,7 @@ static void PlaceDetail( DetailModel_t const& model, const Vector& pt, const Vec
 		float probability = (cosAngle - model.m_MaxCosAngle) / 
 			(model.m_MinCosAngle - model.m_MaxCosAngle);
 
-		float t = rand() / (float)VALVE_RAND_MAX;
+		float t = random.Rand() / (float)VALVE_RAND_MAX;
 		if (t > probability)
 			return;
 	}
@@ -570,7 +688,7 @@ static void PlaceDetail( DetailModel_t const& model, const Vector& pt, const Vec
 	if (model.m_Flags & MODELFLAG_UPRIGHT)
 	{
 		// If it's upright, we just select a random yaw
-		angles.Init( 0, 360.0f * rand() / (float)VALVE_RAND_MAX, 0.0f );
+		angles.Init( 0, 360.0f * random.Rand() / (float)VALVE_RAND_MAX, 0.0f );
 	}
 	else
 	{
@@ -594,7 +712,7 @@ static void PlaceDetail( DetailModel_t const& model, const Vector& pt, const Vec
 		matrix.SetBasisVectors( xaxis, yaxis, zaxis );
 		matrix.SetTranslation( vec3_origin );
 
-		float rotAngle = 360.0f * rand() / (float)VALVE_RAND_MAX;
+		float rotAngle = 360.0f * random.Rand() / (float)VALVE_RAND_MAX;
 		VMatrix rot = SetupMatrixAxisRot( Vector( 0, 0, 1 ), rotAngle );
 		matrix = matrix * rot;
 
@@ -603,25 +721,46 @@ static void PlaceDetail( DetailModel_t const& model, const Vector& pt, const Vec
 
 	// FIXME: We may also want a purely random rotation too
 
+	DetailPlacement_t &placement = placements[placements.AddToTail()];
+	placement.m_pModel = &model;
+	placement.m_Origin = pt;
+	placement.m_Angles = angles;
+	placement.m_flScale = 1.0f;
+	placement.m_flScaleStdDev = 0.0f;
+
+	// Sprites and procedural models made from sprites can be scaled
+	if ( model.m_Type != DETAIL_PROP_TYPE_MODEL && model.m_flRandomScaleStdDev != 0.0f ) 
+	{
+		if ( random.IsCRT() )
+		{
+			placement.m_flScale = fabs( RandomGaussianFloat( 1.0f, model.m_flRandomScaleStdDev ) );
+		}
+		else
+		{
+			placement.m_flScaleStdDev = model.m_flRandomScaleStdDev;
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Adds a placed detail to the lump
+//-----------------------------------------------------------------------------
+static void AddPlacementToLump( DetailPlacement_t const& placement )
+{
+	DetailModel_t const& model = *placement.m_pModel;
+
 	// Insert an element into the object dictionary if it aint there...
 	switch ( model.m_Type )
 	{
 	case DETAIL_PROP_TYPE_MODEL:
-		AddDetailToLump( model.m_ModelName.String(), pt, angles, model.m_Orientation );
+		AddDetailToLump( model.m_ModelName.String(), placement.m_Origin, placement.m_Angles, model.m_Orientation );
 		break;
 
 	// Sprites and procedural models made from sprites
 	case DETAIL_PROP_TYPE_SPRITE:
 	default:
-		{
-			float flScale = 1.0f;
-			if ( model.m_flRandomScaleStdDev != 0.0f ) 
-			{
-				flScale = fabs( RandomGaussianFloat( 1.0f, model.m_flRandomScaleStdDev ) );
-			}
-
-			AddDetailSpriteToLump( pt, angles, model, flScale );
-		}
+		AddDetailSpriteToLump( placement.m_Origin, placement.m_Angles, model, placement.m_flScale );
 		break;
 	}
 }
@@ -630,7 +769,8 @@ static void PlaceDetail( DetailModel_t const& model, const Vector& pt, const Vec
 //-----------------------------------------------------------------------------
 // Places Detail Objects on a face
 //-----------------------------------------------------------------------------
-static void EmitDetailObjectsOnFace( dface_t* pFace, DetailObject_t& detail )
+static void EmitDetailObjectsOnFace( dface_t* pFace, DetailObject_t& detail,
+									 CDetailRandom& random, CUtlVector<DetailPlacement_t>& placements )
 {
 	if (pFace->numedges < 3)
 		return;
@@ -666,8 +806,8 @@ static void EmitDetailObjectsOnFace( dface_t* pFace, DetailObject_t& detail )
 		for (int i = 0; i < numSamples; ++i )
 		{
 			// Create a random sample...
-			float u = rand() / (float)VALVE_RAND_MAX;
-			float v = rand() / (float)VALVE_RAND_MAX;
+			float u = random.Rand() / (float)VALVE_RAND_MAX;
+			float v = random.Rand() / (float)VALVE_RAND_MAX;
 			if (v > 1.0f - u)
 			{
 				u = 1.0f - u;
@@ -679,10 +819,10 @@ static void EmitDetailObjectsOnFace( dface_t* pFace, DetailObject_t& detail )
 			float alpha = 1.0f;
 
 			// Select a group based on the alpha value
-			int group = SelectGroup( detail, alpha );
+			int group = SelectGroup( detail, alpha, random );
 
 			// Now that we've got a group, choose a detail
-			int model = SelectDetail( detail.m_Groups[group] );
+			int model = SelectDetail( detail.m_Groups[group], random );
 			if (model < 0)
 				continue;
 
@@ -692,7 +832,7 @@ static void EmitDetailObjectsOnFace( dface_t* pFace, DetailObject_t& detail )
 			VectorMA( pt, v, e2, pt );
 			VectorDivide( areaVec, -normalLength, normal );
 
-			PlaceDetail( detail.m_Groups[group].m_Models[model], pt, normal );
+			PlaceDetail( detail.m_Groups[group].m_Models[model], pt, normal, random, placements );
 		}
 	}
 }
@@ -735,7 +875,8 @@ static float ComputeDisplacementFaceArea( dface_t* pFace )
 // Places Detail Objects on a face
 //-----------------------------------------------------------------------------
 static void EmitDetailObjectsOnDisplacementFace( dface_t* pFace, 
-						DetailObject_t& detail, CCoreDispInfo& coreDispInfo )
+						DetailObject_t& detail, CCoreDispInfo& coreDispInfo,
+						CDetailRandom& random, CUtlVector<DetailPlacement_t>& placements )
 {
 	assert(pFace->numedges == 4);
 
@@ -752,8 +893,8 @@ static void EmitDetailObjectsOnDisplacementFace( dface_t* pFace,
 	for (int i = 0; i < numSamples; ++i )
 	{
 		// Create a random sample...
-		float u = rand() / (float)VALVE_RAND_MAX;
-		float v = rand() / (float)VALVE_RAND_MAX;
+		float u = random.Rand() / (float)VALVE_RAND_MAX;
+		float v = random.Rand() / (float)VALVE_RAND_MAX;
 
 		// Compute alpha
 		float alpha;
@@ -762,15 +903,15 @@ static void EmitDetailObjectsOnDisplacementFace( dface_t* pFace,
 		alpha /= 255.0f;
 
 		// Select a group based on the alpha value
-		int group = SelectGroup( detail, alpha );
+		int group = SelectGroup( detail, alpha, random );
 
 		// Now that we've got a group, choose a detail
-		int model = SelectDetail( detail.m_Groups[group] );
+		int model = SelectDetail( detail.m_Groups[group], random );
 		if (model < 0)
 			continue;
 
 		// Got a detail! Place it on the surface...
-		PlaceDetail( detail.m_Groups[group].m_Models[model], pt, normal );
+		PlaceDetail( detail.m_Groups[group].m_Models[model], pt, normal, random, placements );
 	}
 }
 
@@ -829,19 +970,177 @@ static void SetLumpData( )
 }
 
 
+//-----------------------------------------------------------------------------
+// Places the details on one face.  bCRT draws from the CRT and vstdlib's
+// global streams, so it has to run on one thread in face order.
+//-----------------------------------------------------------------------------
+static void EmitDetailObjectsOnDetailFace( DetailFace_t &detailFace, bool bCRT )
+{
+	dface_t *pFace = &dfaces[detailFace.m_nFace];
+
+	if ( bCRT )
+	{
+		srand( detailFace.m_nSeed );
+		RandomSeed( detailFace.m_nSeed );
+	}
+	CDetailRandom random( detailFace.m_nSeed, bCRT );
+
+	if (pFace->dispinfo < 0)
+	{
+		EmitDetailObjectsOnFace( pFace, *detailFace.m_pDetail, random, detailFace.m_Placements );
+	}
+	else
+	{
+		// Get a CCoreDispInfo. All we need is the triangles and lightmap texture coordinates.
+		mapdispinfo_t *pMapDisp = &mapdispinfo[pFace->dispinfo];
+		CCoreDispInfo coreDispInfo;
+		DispMapToCoreDispInfo( pMapDisp, &coreDispInfo, NULL, NULL );
+
+		EmitDetailObjectsOnDisplacementFace( pFace, *detailFace.m_pDetail, coreDispInfo, random, detailFace.m_Placements );
+	}
+}
+
+static DetailFace_t *s_pDetailFaces;
+
+static void EmitDetailObjectsOnFace_Thread( int iThread, int iDetailFace )
+{
+	EmitDetailObjectsOnDetailFace( s_pDetailFaces[iDetailFace], false );
+}
+
+//-----------------------------------------------------------------------------
+// Places the details on every face, either the way vbsp always has or
+// across the threads.  Both give the same placements.
+//-----------------------------------------------------------------------------
+static void PlaceDetailsOnFaces( CUtlVector<DetailFace_t> &detailFaces, bool bThreaded )
+{
+	if ( !bThreaded )
+	{
+		for (int i = 0; i < detailFaces.Count(); ++i)
+		{
+			EmitDetailObjectsOnDetailFace( detailFaces[i], true );
+		}
+		return;
+	}
+
+	int nOldThreads = numthreads;
+	numthreads = g_nParallelThreads;
+	s_pDetailFaces = detailFaces.Base();
+	RunThreadsOnIndividual( detailFaces.Count(), false, EmitDetailObjectsOnFace_Thread );
+	s_pDetailFaces = NULL;
+	numthreads = nOldThreads;
+
+	// The Gaussian scales, drawn as RandomGaussianFloat() would have: from a
+	// uniform stream reseeded for each face, through one Gaussian stream
+	CUniformRandomStream uniform;
+	CGaussianRandomStream gaussian( &uniform );
+	for (int i = 0; i < detailFaces.Count(); ++i)
+	{
+		CUtlVector<DetailPlacement_t> &placements = detailFaces[i].m_Placements;
+		bool bSeeded = false;
+		for (int k = 0; k < placements.Count(); ++k)
+		{
+			if ( placements[k].m_flScaleStdDev == 0.0f )
+				continue;
+
+			if ( !bSeeded )
+			{
+				uniform.SetSeed( detailFaces[i].m_nSeed );
+				bSeeded = true;
+			}
+			placements[k].m_flScale = fabs( gaussian.RandomFloat( 1.0f, placements[k].m_flScaleStdDev ) );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Adds the placed details to the lump in face order
+//-----------------------------------------------------------------------------
+static int AddPlacementsToLump( CUtlVector<DetailFace_t> &detailFaces )
+{
+	int nPlaced = 0;
+	for (int i = 0; i < detailFaces.Count(); ++i)
+	{
+		CUtlVector<DetailPlacement_t> &placements = detailFaces[i].m_Placements;
+		for (int k = 0; k < placements.Count(); ++k)
+		{
+			AddPlacementToLump( placements[k] );
+		}
+		nPlaced += placements.Count();
+	}
+	return nPlaced;
+}
+
+//-----------------------------------------------------------------------------
+// -detailpropcheck: the threaded placement has to build the same lump as
+// the serial one.  Padding and unused fields aren't initialized, so the
+// objects are compared field by field.
+//-----------------------------------------------------------------------------
+struct DetailLumps_t
+{
+	CUtlVector<DetailObjectDictLump_t>	m_DictLump;
+	CUtlVector<DetailSpriteDictLump_t>	m_SpriteDictLump;
+	CUtlVector<DetailObjectLump_t>		m_ObjectLump;
+};
+
+static bool DetailObjectLumpsMatch( DetailObjectLump_t const& a, DetailObjectLump_t const& b )
+{
+	if ( memcmp( &a.m_Origin, &b.m_Origin, sizeof( a.m_Origin ) ) || memcmp( &a.m_Angles, &b.m_Angles, sizeof( a.m_Angles ) ) )
+		return false;
+	if ( a.m_DetailModel != b.m_DetailModel || a.m_Leaf != b.m_Leaf || a.m_Orientation != b.m_Orientation || a.m_Type != b.m_Type )
+		return false;
+	if ( a.m_Type == DETAIL_PROP_TYPE_MODEL )
+		return true;
+	return !memcmp( &a.m_flScale, &b.m_flScale, sizeof( a.m_flScale ) ) && a.m_ShapeAngle == b.m_ShapeAngle &&
+		a.m_ShapeSize == b.m_ShapeSize && a.m_SwayAmount == b.m_SwayAmount;
+}
+
+static void CheckDetailLumpsMatch( DetailLumps_t const& serial )
+{
+	bool bMatch = serial.m_DictLump.Count() == s_DetailObjectDictLump.Count() &&
+		serial.m_SpriteDictLump.Count() == s_DetailSpriteDictLump.Count() &&
+		serial.m_ObjectLump.Count() == s_DetailObjectLump.Count();
+	if ( bMatch && serial.m_DictLump.Count() )
+	{
+		bMatch = !memcmp( serial.m_DictLump.Base(), s_DetailObjectDictLump.Base(), serial.m_DictLump.Count() * sizeof(DetailObjectDictLump_t) );
+	}
+	if ( bMatch && serial.m_SpriteDictLump.Count() )
+	{
+		bMatch = !memcmp( serial.m_SpriteDictLump.Base(), s_DetailSpriteDictLump.Base(), serial.m_SpriteDictLump.Count() * sizeof(DetailSpriteDictLump_t) );
+	}
+	for (int i = 0; bMatch && i < serial.m_ObjectLump.Count(); ++i)
+	{
+		if ( !DetailObjectLumpsMatch( serial.m_ObjectLump[i], s_DetailObjectLump[i] ) )
+		{
+			Warning( "Detail prop %d differs between the serial and threaded placement\n", i );
+			bMatch = false;
+		}
+	}
+
+	if ( bMatch )
+	{
+		Msg( "Detail prop check: threaded placement matches serial (%d props)\n", s_DetailObjectLump.Count() );
+	}
+	else
+	{
+		Warning( "Detail prop check: threaded placement does NOT match serial (%d props serial, %d threaded)\n",
+			serial.m_ObjectLump.Count(), s_DetailObjectLump.Count() );
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Places Detail Objects in the level
 //-----------------------------------------------------------------------------
 void EmitDetailModels()
 {
-	StartPacifier("Placing detail props : ");
+	Msg( "Placing detail props : " );
+	double flStart = Plat_FloatTime();
 
-	// Place stuff on each face
+	// Find the faces with detail objects on them. The material system
+	// is only used from here, on the main thread.
+	CUtlVector<DetailFace_t> detailFaces;
 	dface_t* pFace = dfaces;
 	for (int j = 0; j < numfaces; ++j)
 	{
-		UpdatePacifier( (float)j / (float)numfaces );
-
 		// Get at the material associated with this face
 		texinfo_t* pTexInfo = &texinfo[pFace[j].texinfo];
 		dtexdata_t* pTexData = GetTexData( pTexInfo->texdata );
@@ -871,30 +1170,49 @@ void EmitDetailModels()
 			continue;
 		}
 
-		// Emit objects on a particular face
-		DetailObject_t& detail = s_DetailObjectDict[objectType];
+		DetailFace_t &detailFace = detailFaces[detailFaces.AddToTail()];
+		detailFace.m_nFace = j;
+		detailFace.m_pDetail = &s_DetailObjectDict[objectType];
 
-		// Initialize the Random Number generators for detail prop placement based on the hammer Face num.
-		int	detailpropseed = dfaceids[j].hammerfaceid;
+		// Seed the random numbers for detail prop placement based on the hammer face num.
+		detailFace.m_nSeed = dfaceids[j].hammerfaceid;
 #ifdef WARNSEEDNUMBER
-		Warning( "[%d]\n",detailpropseed );
+		Warning( "[%d]\n",detailFace.m_nSeed );
 #endif
-		srand( detailpropseed );
-		RandomSeed( detailpropseed );
+	}
+	double flFound = Plat_FloatTime();
 
-		if (pFace[j].dispinfo < 0)
+	// Place everything the serial way first, to check the threaded lump against
+	DetailLumps_t serialLumps;
+	if ( g_bCheckDetailProps && DETAIL_RANDOM_THREADED )
+	{
+		PlaceDetailsOnFaces( detailFaces, false );
+		AddPlacementsToLump( detailFaces );
+
+		serialLumps.m_DictLump = s_DetailObjectDictLump;
+		serialLumps.m_SpriteDictLump = s_DetailSpriteDictLump;
+		serialLumps.m_ObjectLump = s_DetailObjectLump;
+		s_DetailObjectDictLump.RemoveAll();
+		s_DetailSpriteDictLump.RemoveAll();
+		s_DetailObjectLump.RemoveAll();
+		for (int i = 0; i < detailFaces.Count(); ++i)
 		{
-			EmitDetailObjectsOnFace( &pFace[j], detail );
+			detailFaces[i].m_Placements.RemoveAll();
 		}
-		else
-		{
-			// Get a CCoreDispInfo. All we need is the triangles and lightmap texture coordinates.
-			mapdispinfo_t *pMapDisp = &mapdispinfo[pFace[j].dispinfo];
-			CCoreDispInfo coreDispInfo;
-			DispMapToCoreDispInfo( pMapDisp, &coreDispInfo, NULL, NULL );
+		flFound = Plat_FloatTime();
+	}
 
-			EmitDetailObjectsOnDisplacementFace( &pFace[j], detail, coreDispInfo );
-		}
+	// Emit objects on each face
+	PlaceDetailsOnFaces( detailFaces, DETAIL_RANDOM_THREADED != 0 );
+	double flPlaced = Plat_FloatTime();
+
+	// Add them to the lump in face order
+	int nPlaced = AddPlacementsToLump( detailFaces );
+	double flAdded = Plat_FloatTime();
+
+	if ( g_bCheckDetailProps && DETAIL_RANDOM_THREADED )
+	{
+		CheckDetailLumpsMatch( serialLumps );
 	}
 
 	// Emit specifically specified detail props
@@ -945,7 +1263,9 @@ void EmitDetailModels()
 		}
 	}
 
-	EndPacifier( true );
+	Msg( "%d on %d faces (%.2f)\n", nPlaced, detailFaces.Count(), Plat_FloatTime() - flStart );
+	qprintf( "  materials %.2f, placement %.2f on %d threads, lump %.2f\n",
+		flFound - flStart, flPlaced - flFound, g_nParallelThreads, flAdded - flPlaced );
 }
 
 
@@ -19,6 +19,7 @@
 #include "loadcmdline.h"
 #include "byteswap.h"
 #include "worldvertextransitionfixup.h"
+#include "pacifier.h"
 
 extern float		g_maxLightmapDimension;
 
@@ -63,6 +64,8 @@ float		g_minLuxelScale = 1.0f;
 bool		g_BumpAll = false;
 
 int			g_nDXLevel = 0; // default dxlevel if you don't specify it on the command-line.
+int			g_nParallelThreads = 1;
+bool		g_bCheckDetailProps = false;
 CUtlVector<int> g_SkyAreas;
 char		outbase[32];
 
@@ -257,8 +260,26 @@ void ProcessWorldModel (void)
 	{
 		qprintf ("--------------------------------------------\n");
 
-		RunThreadsOnIndividual ((block_xh-block_xl+1)*(block_yh-block_yl+1),
-			!verbose, ProcessBlock_Thread);
+		// The blocks are built one at a time so that each BrushBSP
+		// can spread its own tree across the threads.
+		int numblocks = (block_xh-block_xl+1)*(block_yh-block_yl+1);
+		double start = Plat_FloatTime();
+		if (!verbose)
+		{
+			printf ("%-20s ", "ProcessBlock_Thread:");
+			StartPacifier ("");
+		}
+		for (int iBlock = 0 ; iBlock < numblocks ; iBlock++)
+		{
+			ProcessBlock_Thread (0, iBlock);
+			if (!verbose)
+				UpdatePacifier ((float)(iBlock+1) / numblocks);
+		}
+		if (!verbose)
+		{
+			EndPacifier (false);
+			printf (" (%i)\n", (int)(Plat_FloatTime() - start));
+		}
 
 		//
 		// build the division tree
@@ -1125,6 +1146,10 @@ int RunVBSP( int argc, char **argv )
 		{
 			g_bNoVirtualMesh = true;
 		}
+		else if ( !Q_stricmp( argv[i], "-detailpropcheck" ) )
+		{
+			g_bCheckDetailProps = true;
+		}
 		else if ( !Q_stricmp( argv[i], "-replacematerials" ) )
 		{
 			g_ReplaceMaterials = true;
@@ -1231,6 +1256,8 @@ int RunVBSP( int argc, char **argv )
 				"  -keepstalezip   : Keep the BSP's zip files intact but regenerate everything\n"
 				"                    else.\n"
 				"  -virtualdispphysics : Use virtual (not precomputed) displacement collision models\n"
+				"  -detailpropcheck : Place detail props serially as well and check that the\n"
+				"                    threaded placement matches.\n"
 				"  -xbox           : Enable mandatory xbox options\n"
 				"  -x360		   : Generate Xbox360 version of vsp\n"
 				"  -nox360		   : Disable generation Xbox360 version of vsp (default)\n"
@@ -1277,7 +1304,8 @@ int RunVBSP( int argc, char **argv )
 	}
 
 	ThreadSetDefault ();
-	numthreads = 1;		// multiple threads aren't helping...
+	g_nParallelThreads = numthreads;
+	numthreads = 1;		// multiple threads aren't helping... except in BrushBSP and detail placement
 
 	// Setup the logfile.
 	char logFile[512];
@@ -365,6 +365,8 @@ extern	bool		g_NodrawTriggers;
 extern	bool		g_DisableWaterLighting;
 extern	bool		g_bAllowDetailCracks;
 extern	bool		g_bNoVirtualMesh;
+extern	int			g_nParallelThreads;	// for the few phases that run on more than one thread
+extern	bool		g_bCheckDetailProps;
 extern	char		outbase[32];
 
 extern	char	source[1024];
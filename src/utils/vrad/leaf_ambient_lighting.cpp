@@ -7,6 +7,7 @@
 #include "vrad.h"
 #include "leaf_ambient_lighting.h"
 #include "bsplib.h"
+#include "gamebspfile.h"
 #include "vraddetailprops.h"
 #include "mathlib/anorms.h"
 #include "pacifier.h"
@@ -16,6 +17,13 @@
 #include "messbuf.h"
 #include "vmpi.h"
 #include "vmpi_distribute_work.h"
+#include "lightcache.h"
+#include "tier1/checksum_crc.h"
+#include "tier1/utlmap.h"
+#include "tier1/utlbuffer.h"
+#include "filesystem.h"
+
+int GetVisCache( int lastoffset, int cluster, byte *pvs );
 
 static TableVector g_BoxDirections[6] = 
 {
@@ -565,14 +573,495 @@ void ComputeAmbientForLeaf( int iThread, int leafID, CUtlVector<ambientsample_t>
 	CompressAmbientSampleList( list );
 }
 
+//-----------------------------------------------------------------------------
+// Per-leaf ambient cache for -incremental.
+//
+// A leaf's samples depend on its own shape, on the lightmaps of the surfaces
+// it can see and on the surface lights that go in the ambient cubes.  Each
+// leaf is keyed by those, summed over the clusters in its PVS, so changing one
+// area only resamples the leaves that can see it.  The static props shadow
+// those lights too, and changing them resamples every leaf.  Cached leaves are
+// found by their bounds rather than their index, so leaves renumbered by an
+// unrelated change can still be reused.
+//-----------------------------------------------------------------------------
+#define LEAFAMBIENTCACHE_ID			(('C'<<24)+('A'<<16)+('L'<<8)+'V')
+#define LEAFAMBIENTCACHE_VERSION	2
+
+// Why a leaf had to be resampled
+enum
+{
+	LEAFAMBIENT_NEW			= 0x1,		// no cached leaf with the same bounds
+	LEAFAMBIENT_SHAPE		= 0x2,		// its boundary planes or brushes changed
+	LEAFAMBIENT_LIGHTS		= 0x4,		// a visible ambient cube light, the sky ambient or the static props changed
+	LEAFAMBIENT_SURFACES	= 0x8,		// the geometry or lightmap of a visible surface changed
+};
+
+struct leafambientkey_t
+{
+	CRC32_t		m_Bounds;
+	CRC32_t		m_Shape;
+	CRC32_t		m_Lights;
+	CRC32_t		m_Surfaces;
+};
+
+struct cachedleafambient_t
+{
+	leafambientkey_t				m_Key;
+	CUtlVector<ambientsample_t>		m_Samples;
+};
+
+static bool								s_bAmbientCacheActive = false;
+static char								s_szAmbientCacheFile[MAX_PATH];
+static CUtlVector<leafambientkey_t>		s_LeafAmbientKeys;		// indexed by leaf
+static CUtlVector<int>					s_LeafAmbientWork;		// leaves that still need sampling
+
+static CRC32_t ComputeFaceAmbientHash( dface_t *f )
+{
+	CRC32_t crc;
+	CRC32_Init( &crc );
+
+	for ( int i = 0; i < f->numedges; ++i )
+	{
+		int e = dsurfedges[f->firstedge + i];
+		int v = ( e >= 0 ) ? dedges[e].v[0] : dedges[-e].v[1];
+		CRC32_ProcessBuffer( &crc, &dvertexes[v].point, sizeof( Vector ) );
+	}
+
+	if ( f->dispinfo != -1 )
+	{
+		const ddispinfo_t &disp = g_dispinfo[f->dispinfo];
+		CRC32_ProcessBuffer( &crc, &disp.startPosition, sizeof( Vector ) );
+		CRC32_ProcessBuffer( &crc, &disp.power, sizeof( disp.power ) );
+		CRC32_ProcessBuffer( &crc, &g_DispVerts[disp.m_iDispVertStart], disp.NumVerts() * sizeof( CDispVert ) );
+	}
+
+	const texinfo_t *pTexInfo = &texinfo[f->texinfo];
+	CRC32_ProcessBuffer( &crc, &pTexInfo->flags, sizeof( pTexInfo->flags ) );
+	CRC32_ProcessBuffer( &crc, &dtexdata[pTexInfo->texdata].reflectivity, sizeof( Vector ) );
+	CRC32_ProcessBuffer( &crc, f->styles, sizeof( f->styles ) );
+
+	// the lightmap, with the per-style averages stored in front of it
+	if ( f->lightofs != -1 && !( pTexInfo->flags & SURF_SKY ) )
+	{
+		int nStyles = 0;
+		while ( nStyles < MAXLIGHTMAPS && f->styles[nStyles] != 255 )
+		{
+			++nStyles;
+		}
+
+		int nLuxels = ( f->m_LightmapTextureSizeInLuxels[0] + 1 ) * ( f->m_LightmapTextureSizeInLuxels[1] + 1 );
+		if ( ( pTexInfo->flags & SURF_BUMPLIGHT ) && !( pTexInfo->flags & SURF_NOLIGHT ) )
+		{
+			nLuxels *= NUM_BUMP_VECTS + 1;
+		}
+
+		int nStart = f->lightofs - nStyles * sizeof( ColorRGBExp32 );
+		int nSize = ( nStyles + nStyles * nLuxels ) * sizeof( ColorRGBExp32 );
+		if ( nStart >= 0 && nStart + nSize <= pdlightdata->Count() )
+		{
+			CRC32_ProcessBuffer( &crc, pdlightdata->Base() + nStart, nSize );
+		}
+	}
+
+	CRC32_Final( &crc );
+	return crc;
+}
+
+static void GetDispBounds( dface_t *f, Vector &mins, Vector &maxs )
+{
+	ClearBounds( mins, maxs );
+	for ( int i = 0; i < f->numedges; ++i )
+	{
+		int e = dsurfedges[f->firstedge + i];
+		int v = ( e >= 0 ) ? dedges[e].v[0] : dedges[-e].v[1];
+		AddPointToBounds( dvertexes[v].point, mins, maxs );
+	}
+
+	const ddispinfo_t &disp = g_dispinfo[f->dispinfo];
+	float flMaxDist = 0.0f;
+	for ( int i = 0; i < disp.NumVerts(); ++i )
+	{
+		const CDispVert &vert = g_DispVerts[disp.m_iDispVertStart + i];
+		flMaxDist = max( flMaxDist, vert.m_vVector.Length() * fabs( vert.m_flDist ) );
+	}
+
+	Vector vExpand( flMaxDist + 1.0f, flMaxDist + 1.0f, flMaxDist + 1.0f );
+	mins -= vExpand;
+	maxs += vExpand;
+}
+
+//-----------------------------------------------------------------------------
+// Sums the surface and ambient light hashes of every cluster.  Sums don't
+// depend on the order faces and clusters are numbered in.
+//-----------------------------------------------------------------------------
+static void ComputeClusterAmbientHashes( CUtlVector<CRC32_t> &surfaces, CUtlVector<CRC32_t> &lights )
+{
+	int nClusters = dvis->numclusters;
+	surfaces.SetCount( nClusters );
+	lights.SetCount( nClusters );
+	for ( int i = 0; i < nClusters; ++i )
+	{
+		surfaces[i] = 0;
+		lights[i] = 0;
+	}
+
+	CUtlVector<CRC32_t> faceHashes;
+	faceHashes.SetCount( numfaces );
+	for ( int i = 0; i < numfaces; ++i )
+	{
+		faceHashes[i] = ComputeFaceAmbientHash( &g_pFaces[i] );
+	}
+
+	for ( int leafID = 0; leafID < numleafs; ++leafID )
+	{
+		int cluster = dleafs[leafID].cluster;
+		if ( cluster < 0 || cluster >= nClusters )
+			continue;
+
+		for ( int i = 0; i < dleafs[leafID].numleaffaces; ++i )
+		{
+			surfaces[cluster] += faceHashes[ dleaffaces[dleafs[leafID].firstleafface + i] ];
+		}
+	}
+
+	// displacements aren't in the leaf face lists
+	for ( int i = 0; i < numfaces; ++i )
+	{
+		if ( g_pFaces[i].dispinfo == -1 )
+			continue;
+
+		Vector mins, maxs;
+		GetDispBounds( &g_pFaces[i], mins, maxs );
+
+		CLeafList leafList;
+		ToolBSPTree()->EnumerateLeavesInBox( mins, maxs, &leafList, 0 );
+		for ( int j = 0; j < leafList.m_list.Count(); ++j )
+		{
+			int cluster = dleafs[ leafList.m_list[j] ].cluster;
+			if ( cluster >= 0 && cluster < nClusters )
+			{
+				surfaces[cluster] += faceHashes[i];
+			}
+		}
+	}
+
+	for ( int i = 0; i < *pNumworldlights; ++i )
+	{
+		dworldlight_t *wl = &dworldlights[i];
+		if ( !( wl->flags & DWL_FLAGS_INAMBIENTCUBE ) )
+			continue;
+
+		int cluster = ClusterFromPoint( wl->origin );
+		if ( cluster < 0 || cluster >= nClusters )
+			continue;
+
+		CRC32_t crc;
+		CRC32_Init( &crc );
+		CRC32_ProcessBuffer( &crc, wl, sizeof( dworldlight_t ) );
+		CRC32_Final( &crc );
+		lights[cluster] += crc;
+	}
+}
+
+static void ComputeLeafShapeKeys( int leafID, leafambientkey_t &key )
+{
+	dleaf_t *pLeaf = &dleafs[leafID];
+
+	CRC32_Init( &key.m_Bounds );
+	CRC32_ProcessBuffer( &key.m_Bounds, pLeaf->mins, sizeof( pLeaf->mins ) );
+	CRC32_ProcessBuffer( &key.m_Bounds, pLeaf->maxs, sizeof( pLeaf->maxs ) );
+	CRC32_ProcessBuffer( &key.m_Bounds, &pLeaf->contents, sizeof( pLeaf->contents ) );
+	CRC32_Final( &key.m_Bounds );
+
+	// sample positions are clipped to the boundary planes and rejected inside brushes
+	CRC32_Init( &key.m_Shape );
+
+	CUtlVector<dplane_t> leafPlanes;
+	GetLeafBoundaryPlanes( leafPlanes, leafID );
+	for ( int i = 0; i < leafPlanes.Count(); ++i )
+	{
+		CRC32_ProcessBuffer( &key.m_Shape, &leafPlanes[i].normal, sizeof( Vector ) );
+		CRC32_ProcessBuffer( &key.m_Shape, &leafPlanes[i].dist, sizeof( float ) );
+	}
+
+	for ( int i = 0; i < pLeaf->numleafbrushes; ++i )
+	{
+		const dbrush_t *pBrush = &dbrushes[ dleafbrushes[pLeaf->firstleafbrush + i] ];
+		CRC32_ProcessBuffer( &key.m_Shape, &pBrush->contents, sizeof( pBrush->contents ) );
+		for ( int j = 0; j < pBrush->numsides; ++j )
+		{
+			const dplane_t *pPlane = &dplanes[ dbrushsides[pBrush->firstside + j].planenum ];
+			CRC32_ProcessBuffer( &key.m_Shape, &pPlane->normal, sizeof( Vector ) );
+			CRC32_ProcessBuffer( &key.m_Shape, &pPlane->dist, sizeof( float ) );
+		}
+	}
+
+	CRC32_Final( &key.m_Shape );
+}
+
+static void ComputeLeafAmbientKeys()
+{
+	CUtlVector<CRC32_t> clusterSurfaces, clusterLights;
+	ComputeClusterAmbientHashes( clusterSurfaces, clusterLights );
+
+	// every leaf that hits the sky picks up the sky ambient
+	CRC32_t skyHash;
+	CRC32_Init( &skyHash );
+	for ( directlight_t *dl = activelights; dl != NULL; dl = dl->next )
+	{
+		if ( dl->light.type == emit_skyambient )
+		{
+			CRC32_ProcessBuffer( &skyHash, &dl->light.intensity, sizeof( Vector ) );
+		}
+	}
+	CRC32_Final( &skyHash );
+
+	// Static props shadow the surface lights through g_RtEnv, but we don't know
+	// which clusters a prop is in, so any change to them resamples every leaf
+	CRC32_t propHash;
+	CRC32_Init( &propHash );
+	GameLumpHandle_t hStaticProps = g_GameLumps.GetGameLumpHandle( GAMELUMP_STATIC_PROPS );
+	if ( hStaticProps != g_GameLumps.InvalidGameLump() )
+	{
+		CRC32_ProcessBuffer( &propHash, g_GameLumps.GetGameLump( hStaticProps ), g_GameLumps.GameLumpSize( hStaticProps ) );
+	}
+	CRC32_ProcessBuffer( &propHash, &g_bStaticPropPolys, sizeof( g_bStaticPropPolys ) );
+	CRC32_Final( &propHash );
+
+	// sum what each cluster can see
+	int nClusters = dvis->numclusters;
+	CUtlVector<CRC32_t> visibleSurfaces, visibleLights;
+	visibleSurfaces.SetCount( nClusters );
+	visibleLights.SetCount( nClusters );
+
+	byte *pvs = (byte *)stackalloc( ( nClusters + 7 ) / 8 );
+	for ( int cluster = 0; cluster < nClusters; ++cluster )
+	{
+		GetVisCache( -1, cluster, pvs );
+
+		CRC32_t surfaces = 0, lights = skyHash;
+		for ( int i = 0; i < nClusters; ++i )
+		{
+			if ( PVSCheck( pvs, i ) )
+			{
+				surfaces += clusterSurfaces[i];
+				lights += clusterLights[i];
+			}
+		}
+		visibleSurfaces[cluster] = surfaces;
+		visibleLights[cluster] = lights;
+	}
+
+	s_LeafAmbientKeys.SetCount( numleafs );
+	for ( int leafID = 0; leafID < numleafs; ++leafID )
+	{
+		leafambientkey_t &key = s_LeafAmbientKeys[leafID];
+		ComputeLeafShapeKeys( leafID, key );
+
+		int cluster = dleafs[leafID].cluster;
+		bool bHasCluster = ( cluster >= 0 && cluster < nClusters );
+		key.m_Lights = ( bHasCluster ? visibleLights[cluster] : 0 ) + propHash;
+		key.m_Surfaces = bHasCluster ? visibleSurfaces[cluster] : 0;
+	}
+}
+
+static bool LoadLeafAmbientCache( CUtlVector<cachedleafambient_t> &entries )
+{
+	CUtlBuffer buf;
+	if ( !g_pFileSystem->ReadFile( s_szAmbientCacheFile, NULL, buf ) )
+	{
+		Msg( "No leaf ambient cache in %s, sampling every leaf.\n", s_szAmbientCacheFile );
+		return false;
+	}
+
+	if ( buf.GetInt() != LEAFAMBIENTCACHE_ID || buf.GetInt() != LEAFAMBIENTCACHE_VERSION )
+	{
+		Warning( "Leaf ambient cache %s is not a version %d cache, sampling every leaf.\n", s_szAmbientCacheFile, LEAFAMBIENTCACHE_VERSION );
+		return false;
+	}
+
+	if ( buf.GetInt() != (int)g_bFastAmbient )
+	{
+		Msg( "-fastambient changed since %s was written, sampling every leaf.\n", s_szAmbientCacheFile );
+		return false;
+	}
+
+	bool bCorrupt = false;
+	int nEntries = buf.GetInt();
+	for ( int i = 0; i < nEntries && buf.IsValid(); ++i )
+	{
+		cachedleafambient_t &entry = entries[ entries.AddToTail() ];
+		buf.Get( &entry.m_Key, sizeof( entry.m_Key ) );
+
+		int nSamples = buf.GetInt();
+		if ( nSamples < 0 || nSamples > buf.GetBytesRemaining() / (int)sizeof( ambientsample_t ) )
+		{
+			bCorrupt = true;
+			break;
+		}
+		entry.m_Samples.SetCount( nSamples );
+		buf.Get( entry.m_Samples.Base(), nSamples * sizeof( ambientsample_t ) );
+	}
+
+	if ( bCorrupt || !buf.IsValid() || entries.Count() != nEntries )
+	{
+		Warning( "Leaf ambient cache %s is damaged, sampling every leaf.\n", s_szAmbientCacheFile );
+		entries.Purge();
+		return false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Restores every leaf whose keys match the cache and queues the rest.  Says
+// why each leaf was resampled so mappers can tell what a change touched.
+//-----------------------------------------------------------------------------
+static void LeafAmbientCache_Restore( const char *pBSPFilename )
+{
+	s_bAmbientCacheActive = false;
+	s_LeafAmbientWork.RemoveAll();
+
+	bool bUseCache = g_bIncrementalLighting && !g_pIncremental;
+#ifdef MPI
+	bUseCache = bUseCache && !g_bUseMPI;
+#endif
+
+	if ( !bUseCache )
+	{
+		for ( int leafID = 0; leafID < numleafs; leafID++ )
+		{
+			s_LeafAmbientWork.AddToTail( leafID );
+		}
+		return;
+	}
+
+	V_StripExtension( pBSPFilename, s_szAmbientCacheFile, sizeof( s_szAmbientCacheFile ) );
+	if ( g_bHDR )
+	{
+		V_strncat( s_szAmbientCacheFile, "_hdr", sizeof( s_szAmbientCacheFile ) );
+	}
+	V_strncat( s_szAmbientCacheFile, ".ambientcache", sizeof( s_szAmbientCacheFile ) );
+	s_bAmbientCacheActive = true;
+
+	ComputeLeafAmbientKeys();
+
+	CUtlVector<cachedleafambient_t> entries;
+	LoadLeafAmbientCache( entries );
+
+	CUtlMap<CRC32_t, int> entryByBounds( DefLessFunc( CRC32_t ) );
+	for ( int i = 0; i < entries.Count(); ++i )
+	{
+		if ( entryByBounds.Find( entries[i].m_Key.m_Bounds ) == entryByBounds.InvalidIndex() )
+		{
+			entryByBounds.Insert( entries[i].m_Key.m_Bounds, i );
+		}
+	}
+
+	int nReused = 0;
+	int nResampled = 0;
+	int nReasons[4] = { 0, 0, 0, 0 };
+	for ( int leafID = 0; leafID < numleafs; leafID++ )
+	{
+		// solid leaves don't get samples, so there's nothing to save
+		if ( dleafs[leafID].contents & CONTENTS_SOLID )
+		{
+			s_LeafAmbientWork.AddToTail( leafID );
+			continue;
+		}
+
+		const leafambientkey_t &key = s_LeafAmbientKeys[leafID];
+		int reasons = 0;
+
+		unsigned short iEntry = entryByBounds.Find( key.m_Bounds );
+		if ( iEntry == entryByBounds.InvalidIndex() )
+		{
+			reasons |= LEAFAMBIENT_NEW;
+		}
+		else
+		{
+			const cachedleafambient_t &entry = entries[ entryByBounds[iEntry] ];
+			if ( entry.m_Key.m_Shape != key.m_Shape )
+				reasons |= LEAFAMBIENT_SHAPE;
+			if ( entry.m_Key.m_Lights != key.m_Lights )
+				reasons |= LEAFAMBIENT_LIGHTS;
+			if ( entry.m_Key.m_Surfaces != key.m_Surfaces )
+				reasons |= LEAFAMBIENT_SURFACES;
+
+			if ( !reasons )
+			{
+				g_LeafAmbientSamples[leafID].CopyArray( entry.m_Samples.Base(), entry.m_Samples.Count() );
+				++nReused;
+				continue;
+			}
+		}
+
+		s_LeafAmbientWork.AddToTail( leafID );
+		++nResampled;
+		for ( int i = 0; i < 4; ++i )
+		{
+			if ( reasons & ( 1 << i ) )
+				++nReasons[i];
+		}
+
+		qprintf( "  resampling leaf %d (%d %d %d):%s%s%s%s\n", leafID,
+			( dleafs[leafID].mins[0] + dleafs[leafID].maxs[0] ) / 2,
+			( dleafs[leafID].mins[1] + dleafs[leafID].maxs[1] ) / 2,
+			( dleafs[leafID].mins[2] + dleafs[leafID].maxs[2] ) / 2,
+			( reasons & LEAFAMBIENT_NEW ) ? " new or resized" : "",
+			( reasons & LEAFAMBIENT_SHAPE ) ? " shape changed" : "",
+			( reasons & LEAFAMBIENT_LIGHTS ) ? " visible lights changed" : "",
+			( reasons & LEAFAMBIENT_SURFACES ) ? " visible surfaces changed" : "" );
+	}
+
+	Msg( "Leaf ambient cache: reused %d leaves, resampling %d (%d new or resized, %d reshaped, %d saw a light change, %d saw a surface change)\n",
+		nReused, nResampled, nReasons[0], nReasons[1], nReasons[2], nReasons[3] );
+}
+
+static void LeafAmbientCache_Save()
+{
+	if ( !s_bAmbientCacheActive )
+		return;
+
+	CUtlBuffer buf;
+	buf.PutInt( LEAFAMBIENTCACHE_ID );
+	buf.PutInt( LEAFAMBIENTCACHE_VERSION );
+	buf.PutInt( (int)g_bFastAmbient );
+
+	int nEntries = 0;
+	for ( int leafID = 0; leafID < numleafs; leafID++ )
+	{
+		if ( !( dleafs[leafID].contents & CONTENTS_SOLID ) )
+			++nEntries;
+	}
+
+	buf.PutInt( nEntries );
+	for ( int leafID = 0; leafID < numleafs; leafID++ )
+	{
+		if ( dleafs[leafID].contents & CONTENTS_SOLID )
+			continue;
+
+		const CUtlVector<ambientsample_t> &list = g_LeafAmbientSamples[leafID];
+		buf.Put( &s_LeafAmbientKeys[leafID], sizeof( leafambientkey_t ) );
+		buf.PutInt( list.Count() );
+		buf.Put( list.Base(), list.Count() * sizeof( ambientsample_t ) );
+	}
+
+	if ( !g_pFileSystem->WriteFile( s_szAmbientCacheFile, NULL, buf ) )
+	{
+		Warning( "Unable to write leaf ambient cache %s\n", s_szAmbientCacheFile );
+	}
+}
+
 static void ThreadComputeLeafAmbient( int iThread, void *pUserData )
 {
 	CUtlVector<ambientsample_t> list;
 	while (1)
 	{
-		int leafID = GetThreadWork ();
-		if (leafID == -1)
+		int work = GetThreadWork ();
+		if (work == -1)
 			break;
+		int leafID = s_LeafAmbientWork[work];
 		list.RemoveAll();
 		ComputeAmbientForLeaf(iThread, leafID, list);
 		// copy to the output array
@@ -643,6 +1132,9 @@ void ComputePerLeafAmbientLighting()
 
 	g_LeafAmbientSamples.SetCount(numleafs);
 
+	// with -incremental, only leaves that can see a change get resampled
+	LeafAmbientCache_Restore( source );
+
 #ifdef MPI
 	if ( g_bUseMPI )
 	{
@@ -653,9 +1145,11 @@ void ComputePerLeafAmbientLighting()
 	else
 #endif
 	{
-		RunThreadsOn(numleafs, true, ThreadComputeLeafAmbient);
+		RunThreadsOn(s_LeafAmbientWork.Count(), true, ThreadComputeLeafAmbient);
 	}
 
+	LeafAmbientCache_Save();
+
 	// now write out the data
 	Msg("Writing leaf ambient...");
 	g_pLeafAmbientIndex->RemoveAll();
@@ -0,0 +1,481 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Per-map cache of direct and bounced lighting for -incremental.
+//
+//=============================================================================//
+
+#include "vrad.h"
+#include "lightmap.h"
+#include "lightcache.h"
+#include "bsplib.h"
+#include "gamebspfile.h"
+#include "tier1/checksum_crc.h"
+#include "tier1/utlbuffer.h"
+#include "tier0/threadtools.h"
+#include "filesystem.h"
+#ifdef MPI
+#include "vmpi.h"
+#endif
+
+#define LIGHTCACHE_ID		(('C'<<24)+('R'<<16)+('L'<<8)+'V')
+#define LIGHTCACHE_VERSION	1
+
+extern float luxeldensity;
+extern float minchop;
+extern float reflectivityScale;
+
+bool g_bIncrementalLighting = false;
+
+struct CachedFace_t
+{
+	CachedFace_t() : m_Key( 0 ), m_nSamples( 0 ), m_nNormals( 0 ), m_bValid( false ), m_bUsed( false ) {}
+
+	CRC32_t		m_Key;				// the face's sample count and the lights it can see
+	int			m_nSamples;
+	int			m_nNormals;
+	byte		m_Styles[MAXLIGHTMAPS];
+	bool		m_bValid;			// holds lighting for m_Key
+	bool		m_bUsed;			// lit or restored by this compile, so worth saving
+
+	CUtlVector<LightingValue_t>	m_Light;	// [style][normal][sample]
+	CUtlVector<Vector>			m_Normals;	// smoothed sample normals
+};
+
+static bool							s_bActive = false;
+static char							s_szCacheFile[MAX_PATH];
+static CRC32_t						s_GlobalCRC;
+static CUtlVector<CRC32_t>			s_LightHashes;		// indexed by directlight_t::index
+static CUtlVector<CachedFace_t>		s_Faces;
+
+// Patch emission and bounced light from the cached compile, and the same for this one
+static CUtlVector<Vector>			s_OldEmit;
+static CUtlVector<bumplights_t>		s_OldBounce;
+static CUtlVector<Vector>			s_NewEmit;
+static CUtlVector<bumplights_t>		s_NewBounce;
+static bool							s_bBouncedDelta = false;
+
+static CInterlockedInt				s_nFacesReused;
+static CInterlockedInt				s_nFacesRelit;
+
+
+//-----------------------------------------------------------------------------
+// Everything that can change any face's lighting other than the lights
+// themselves.  Shadows reach across the whole map, so any geometry change
+// throws the whole cache away.
+//-----------------------------------------------------------------------------
+static CRC32_t ComputeGlobalCRC()
+{
+	CRC32_t crc;
+	CRC32_Init( &crc );
+
+	CRC32_ProcessBuffer( &crc, dvertexes, numvertexes * sizeof( dvertex_t ) );
+	CRC32_ProcessBuffer( &crc, dplanes, numplanes * sizeof( dplane_t ) );
+	CRC32_ProcessBuffer( &crc, dedges, numedges * sizeof( dedge_t ) );
+	CRC32_ProcessBuffer( &crc, dsurfedges, numsurfedges * sizeof( int ) );
+	CRC32_ProcessBuffer( &crc, dmodels, nummodels * sizeof( dmodel_t ) );
+	CRC32_ProcessBuffer( &crc, dvisdata, visdatasize );
+	CRC32_ProcessBuffer( &crc, texinfo.Base(), texinfo.Count() * sizeof( texinfo_t ) );
+	CRC32_ProcessBuffer( &crc, dtexdata, numtexdata * sizeof( dtexdata_t ) );
+	CRC32_ProcessBuffer( &crc, g_TexDataStringData.Base(), g_TexDataStringData.Count() );
+	CRC32_ProcessBuffer( &crc, g_dispinfo.Base(), g_dispinfo.Count() * sizeof( ddispinfo_t ) );
+	CRC32_ProcessBuffer( &crc, g_DispVerts.Base(), g_DispVerts.Count() * sizeof( CDispVert ) );
+
+	// Only the geometry of the faces; the lighting fields are what we write
+	for ( int i = 0; i < numfaces; ++i )
+	{
+		const dface_t *f = &g_pFaces[i];
+		int geometry[] =
+		{
+			f->planenum, f->side, f->firstedge, f->numedges, f->texinfo, f->dispinfo,
+			f->m_LightmapTextureMinsInLuxels[0], f->m_LightmapTextureMinsInLuxels[1],
+			f->m_LightmapTextureSizeInLuxels[0], f->m_LightmapTextureSizeInLuxels[1],
+		};
+		CRC32_ProcessBuffer( &crc, geometry, sizeof( geometry ) );
+		CRC32_ProcessBuffer( &crc, &face_offset[i], sizeof( Vector ) );
+	}
+
+	GameLumpHandle_t hStaticProps = g_GameLumps.GetGameLumpHandle( GAMELUMP_STATIC_PROPS );
+	if ( hStaticProps != g_GameLumps.InvalidGameLump() )
+	{
+		CRC32_ProcessBuffer( &crc, g_GameLumps.GetGameLump( hStaticProps ), g_GameLumps.GameLumpSize( hStaticProps ) );
+	}
+
+	float settings[] =
+	{
+		(float)do_extra, (float)extrapasses, (float)do_fast, (float)do_centersamples, (float)numbounce,
+		g_flSkySampleScale, g_SunAngularExtent, smoothing_threshold, lightscale, dlight_threshold,
+		(float)g_bTextureShadows, (float)g_bStaticPropPolys, (float)g_bLargeDispSampleRadius, (float)g_bNoSkyRecurse,
+		luxeldensity, maxchop, minchop, dispchop, g_MaxDispPatchRadius, reflectivityScale, indirect_sun,
+	};
+	CRC32_ProcessBuffer( &crc, settings, sizeof( settings ) );
+
+	CRC32_Final( &crc );
+	return crc;
+}
+
+static CRC32_t ComputeLightHash( const directlight_t *dl )
+{
+	CRC32_t crc;
+	CRC32_Init( &crc );
+	CRC32_ProcessBuffer( &crc, &dl->light, sizeof( dl->light ) );
+
+	float params[] =
+	{
+		(float)dl->facenum, (float)dl->texdata,
+		dl->snormal.x, dl->snormal.y, dl->snormal.z,
+		dl->tnormal.x, dl->tnormal.y, dl->tnormal.z,
+		dl->sscale, dl->tscale, dl->soffset, dl->toffset,
+		dl->m_flStartFadeDistance, dl->m_flEndFadeDistance, dl->m_flCapDist,
+	};
+	CRC32_ProcessBuffer( &crc, params, sizeof( params ) );
+
+	CRC32_Final( &crc );
+	return crc;
+}
+
+//-----------------------------------------------------------------------------
+// A face's key covers every light that passes the same PVS test
+// GatherSampleLight uses for any of its samples
+//-----------------------------------------------------------------------------
+static CRC32_t ComputeFaceKey( const facelight_t *fl )
+{
+	CUtlVectorFixedGrowable<int, 32> clusters;
+	for ( int i = 0; i < fl->numsamples; ++i )
+	{
+		int cluster = ClusterFromPoint( fl->sample[i].pos );
+		if ( clusters.Find( cluster ) == clusters.InvalidIndex() )
+		{
+			clusters.AddToTail( cluster );
+		}
+	}
+
+	CRC32_t crc;
+	CRC32_Init( &crc );
+	CRC32_ProcessBuffer( &crc, &fl->numsamples, sizeof( fl->numsamples ) );
+
+	for ( directlight_t *dl = activelights; dl != NULL; dl = dl->next )
+	{
+		for ( int i = 0; i < clusters.Count(); ++i )
+		{
+			if ( PVSCheck( dl->pvs, clusters[i] ) )
+			{
+				CRC32_ProcessBuffer( &crc, &s_LightHashes[dl->index], sizeof( CRC32_t ) );
+				break;
+			}
+		}
+	}
+
+	CRC32_Final( &crc );
+	return crc;
+}
+
+static bool LoadCache()
+{
+	CUtlBuffer buf;
+	if ( !g_pFileSystem->ReadFile( s_szCacheFile, NULL, buf ) )
+	{
+		Msg( "No light cache in %s, lighting every face.\n", s_szCacheFile );
+		return false;
+	}
+
+	if ( buf.GetInt() != LIGHTCACHE_ID || buf.GetInt() != LIGHTCACHE_VERSION )
+	{
+		Warning( "Light cache %s is not a version %d cache, lighting every face.\n", s_szCacheFile, LIGHTCACHE_VERSION );
+		return false;
+	}
+
+	if ( (CRC32_t)buf.GetUnsignedInt() != s_GlobalCRC || buf.GetInt() != numfaces )
+	{
+		Msg( "Geometry or settings changed since %s was written, lighting every face.\n", s_szCacheFile );
+		return false;
+	}
+
+	bool bCorrupt = false;
+	int nEntries = buf.GetInt();
+	for ( int i = 0; i < nEntries && buf.IsValid(); ++i )
+	{
+		int facenum = buf.GetInt();
+		if ( facenum < 0 || facenum >= numfaces )
+		{
+			bCorrupt = true;
+			break;
+		}
+
+		CachedFace_t &face = s_Faces[facenum];
+		face.m_Key = (CRC32_t)buf.GetUnsignedInt();
+		face.m_nSamples = buf.GetInt();
+		face.m_nNormals = buf.GetInt();
+		buf.Get( face.m_Styles, sizeof( face.m_Styles ) );
+
+		int nLight = buf.GetInt();
+		if ( face.m_nSamples < 0 || nLight < 0 || nLight > buf.GetBytesRemaining() / (int)sizeof( LightingValue_t ) )
+		{
+			bCorrupt = true;
+			break;
+		}
+		face.m_Light.SetCount( nLight );
+		buf.Get( face.m_Light.Base(), nLight * sizeof( LightingValue_t ) );
+
+		if ( face.m_nSamples > buf.GetBytesRemaining() / (int)sizeof( Vector ) )
+		{
+			bCorrupt = true;
+			break;
+		}
+		face.m_Normals.SetCount( face.m_nSamples );
+		buf.Get( face.m_Normals.Base(), face.m_nSamples * sizeof( Vector ) );
+
+		int nStyles = 0;
+		for ( int j = 0; j < MAXLIGHTMAPS; ++j )
+		{
+			if ( face.m_Styles[j] != 255 )
+				++nStyles;
+		}
+		face.m_bValid = buf.IsValid() && nLight == nStyles * face.m_nNormals * face.m_nSamples;
+	}
+
+	int nPatches = bCorrupt ? 0 : buf.GetInt();
+	if ( !bCorrupt && buf.IsValid() && nPatches == g_Patches.Count() &&
+		buf.GetBytesRemaining() >= nPatches * (int)( sizeof( Vector ) + sizeof( bumplights_t ) ) )
+	{
+		s_OldEmit.SetCount( nPatches );
+		buf.Get( s_OldEmit.Base(), nPatches * sizeof( Vector ) );
+		s_OldBounce.SetCount( nPatches );
+		buf.Get( s_OldBounce.Base(), nPatches * sizeof( bumplights_t ) );
+	}
+
+	if ( bCorrupt || !buf.IsValid() )
+	{
+		Warning( "Light cache %s is damaged, lighting every face.\n", s_szCacheFile );
+		for ( int i = 0; i < s_Faces.Count(); ++i )
+		{
+			s_Faces[i].m_bValid = false;
+		}
+		s_OldEmit.Purge();
+		s_OldBounce.Purge();
+		return false;
+	}
+
+	return true;
+}
+
+void LightCache_Init( const char *pBSPFilename )
+{
+	s_bActive = false;
+	if ( !g_bIncrementalLighting )
+		return;
+
+	// Hammer's incremental lighting has its own bookkeeping
+	if ( g_pIncremental )
+		return;
+
+#ifdef MPI
+	if ( g_bUseMPI )
+	{
+		Warning( "-incremental doesn't work with -mpi yet, lighting every face.\n" );
+		return;
+	}
+#endif
+
+	V_StripExtension( pBSPFilename, s_szCacheFile, sizeof( s_szCacheFile ) );
+	if ( g_bHDR )
+	{
+		V_strncat( s_szCacheFile, "_hdr", sizeof( s_szCacheFile ) );
+	}
+	V_strncat( s_szCacheFile, ".vradcache", sizeof( s_szCacheFile ) );
+
+	s_GlobalCRC = ComputeGlobalCRC();
+
+	s_LightHashes.SetCount( numdlights );
+	for ( directlight_t *dl = activelights; dl != NULL; dl = dl->next )
+	{
+		s_LightHashes[dl->index] = ComputeLightHash( dl );
+	}
+
+	s_Faces.SetCount( numfaces );
+	s_bActive = true;
+
+	LoadCache();
+}
+
+bool LightCache_RestoreFace( int facenum, facelight_t *fl )
+{
+	if ( !s_bActive )
+		return false;
+
+	CachedFace_t &face = s_Faces[facenum];
+	CRC32_t key = ComputeFaceKey( fl );
+	face.m_bUsed = true;
+
+	if ( !face.m_bValid || face.m_Key != key || face.m_nSamples != fl->numsamples )
+	{
+		face.m_Key = key;
+		face.m_bValid = false;
+		++s_nFacesRelit;
+		return false;
+	}
+
+	dface_t *f = &g_pFaces[facenum];
+	const LightingValue_t *pLight = face.m_Light.Base();
+	for ( int i = 0; i < MAXLIGHTMAPS; ++i )
+	{
+		f->styles[i] = face.m_Styles[i];
+		if ( f->styles[i] == 255 )
+			continue;
+
+		for ( int n = 0; n < face.m_nNormals; ++n )
+		{
+			fl->light[i][n] = ( LightingValue_t* )malloc( fl->numsamples * sizeof( LightingValue_t ) );
+			memcpy( fl->light[i][n], pLight, fl->numsamples * sizeof( LightingValue_t ) );
+			pLight += fl->numsamples;
+		}
+	}
+
+	for ( int i = 0; i < fl->numsamples; ++i )
+	{
+		fl->sample[i].normal = face.m_Normals[i];
+	}
+
+	++s_nFacesReused;
+	return true;
+}
+
+void LightCache_StoreFace( int facenum, facelight_t *fl )
+{
+	if ( !s_bActive )
+		return;
+
+	CachedFace_t &face = s_Faces[facenum];
+	dface_t *f = &g_pFaces[facenum];
+
+	face.m_nSamples = fl->numsamples;
+	face.m_nNormals = 0;
+	while ( face.m_nNormals < NUM_BUMP_VECTS + 1 && fl->light[0][face.m_nNormals] )
+	{
+		++face.m_nNormals;
+	}
+
+	face.m_Light.RemoveAll();
+	for ( int i = 0; i < MAXLIGHTMAPS; ++i )
+	{
+		face.m_Styles[i] = f->styles[i];
+		if ( f->styles[i] == 255 )
+			continue;
+
+		for ( int n = 0; n < face.m_nNormals; ++n )
+		{
+			face.m_Light.AddMultipleToTail( fl->numsamples, fl->light[i][n] );
+		}
+	}
+
+	face.m_Normals.SetCount( fl->numsamples );
+	for ( int i = 0; i < fl->numsamples; ++i )
+	{
+		face.m_Normals[i] = fl->sample[i].normal;
+	}
+
+	face.m_bValid = true;
+}
+
+//-----------------------------------------------------------------------------
+// Gathering is linear in the emitted light, so bouncing (new - old) direct
+// light and adding the old bounced light gives the new bounced light.  When
+// little has changed the difference dies out in a bounce or two.
+//-----------------------------------------------------------------------------
+void LightCache_StartBounce()
+{
+	s_bBouncedDelta = false;
+	if ( !s_bActive )
+		return;
+
+	int nPatches = g_Patches.Count();
+	s_NewEmit.CopyArray( emitlight.Base(), nPatches );
+
+	if ( s_OldEmit.Count() != nPatches )
+		return;
+
+	for ( int i = 0; i < nPatches; ++i )
+	{
+		emitlight[i] -= s_OldEmit[i];
+	}
+	s_bBouncedDelta = true;
+}
+
+void LightCache_FinishBounce()
+{
+	if ( !s_bActive )
+		return;
+
+	int nPatches = g_Patches.Count();
+	if ( s_bBouncedDelta )
+	{
+		for ( int i = 0; i < nPatches; ++i )
+		{
+			for ( int j = 0; j < NUM_BUMP_VECTS + 1; ++j )
+			{
+				g_Patches[i].totallight.light[j] += s_OldBounce[i].light[j];
+			}
+		}
+	}
+
+	s_NewBounce.SetCount( nPatches );
+	for ( int i = 0; i < nPatches; ++i )
+	{
+		s_NewBounce[i] = g_Patches[i].totallight;
+	}
+}
+
+void LightCache_Report()
+{
+	if ( !s_bActive )
+		return;
+
+	Msg( "Light cache: reused %d faces, relit %d, %s\n", (int)s_nFacesReused, (int)s_nFacesRelit,
+		s_bBouncedDelta ? "bounced only the change in direct light" : "bounced all direct light" );
+}
+
+void LightCache_Save()
+{
+	if ( !s_bActive )
+		return;
+
+	CUtlBuffer buf;
+	buf.PutInt( LIGHTCACHE_ID );
+	buf.PutInt( LIGHTCACHE_VERSION );
+	buf.PutUnsignedInt( s_GlobalCRC );
+	buf.PutInt( numfaces );
+
+	int nEntries = 0;
+	for ( int i = 0; i < s_Faces.Count(); ++i )
+	{
+		if ( s_Faces[i].m_bUsed && s_Faces[i].m_bValid )
+			++nEntries;
+	}
+
+	buf.PutInt( nEntries );
+	for ( int i = 0; i < s_Faces.Count(); ++i )
+	{
+		const CachedFace_t &face = s_Faces[i];
+		if ( !face.m_bUsed || !face.m_bValid )
+			continue;
+
+		buf.PutInt( i );
+		buf.PutUnsignedInt( face.m_Key );
+		buf.PutInt( face.m_nSamples );
+		buf.PutInt( face.m_nNormals );
+		buf.Put( face.m_Styles, sizeof( face.m_Styles ) );
+		buf.PutInt( face.m_Light.Count() );
+		buf.Put( face.m_Light.Base(), face.m_Light.Count() * sizeof( LightingValue_t ) );
+		buf.Put( face.m_Normals.Base(), face.m_Normals.Count() * sizeof( Vector ) );
+	}
+
+	// Without bounced light there's nothing to add a difference back to
+	int nPatches = ( s_NewBounce.Count() == s_NewEmit.Count() ) ? s_NewEmit.Count() : 0;
+	buf.PutInt( nPatches );
+	buf.Put( s_NewEmit.Base(), nPatches * sizeof( Vector ) );
+	buf.Put( s_NewBounce.Base(), nPatches * sizeof( bumplights_t ) );
+
+	if ( !g_pFileSystem->WriteFile( s_szCacheFile, NULL, buf ) )
+	{
+		Warning( "Unable to write light cache %s\n", s_szCacheFile );
+	}
+}
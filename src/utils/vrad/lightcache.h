@@ -0,0 +1,41 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Per-map cache of direct and bounced lighting for -incremental.
+//
+//			The cache is only valid for the exact same geometry, materials
+//			and compile settings.  Within that, each face's direct lighting
+//			is keyed by its own inputs plus every light its samples can see,
+//			so moving or retuning a light only relights the faces in its PVS.
+//			Bounced light is updated by bouncing just the change in direct
+//			light and adding it to the previous compile's result.
+//
+//=============================================================================//
+
+#ifndef LIGHTCACHE_H
+#define LIGHTCACHE_H
+#pragma once
+
+struct facelight_t;
+
+extern bool g_bIncrementalLighting;		// -incremental
+
+// Call once the lights and patches exist.  Loads <map>.vradcache (or
+// <map>_hdr.vradcache) if it matches this compile.
+void LightCache_Init( const char *pBSPFilename );
+
+// Call after CalcPoints.  Returns true if the face's direct lighting (styles,
+// light samples and smoothed sample normals) was restored from the cache.
+bool LightCache_RestoreFace( int facenum, facelight_t *fl );
+
+// Records the direct lighting of a face that had to be relit
+void LightCache_StoreFace( int facenum, facelight_t *fl );
+
+// Wrap the bounce loop.  Start turns emitlight into the change since the
+// cached compile, Finish adds the cached bounced light back in.
+void LightCache_StartBounce();
+void LightCache_FinishBounce();
+
+void LightCache_Report();
+void LightCache_Save();
+
+#endif // LIGHTCACHE_H
@@ -9,6 +9,7 @@
 #include "vrad.h"
 #include "lightmap.h"
 #include "radial.h"
+#include "lightcache.h"
 #include "mathlib/bumpvects.h"
 #include "tier1/utlvector.h"
 #include "vmpi.h"
@@ -3056,54 +3057,17 @@ static void InitSampleInfo( lightinfo_t const& l, int iThread, SSE_SampleInfo_t&
 	}
 }
 
-void BuildFacelights (int iThread, int facenum)
+//-----------------------------------------------------------------------------
+// Samples every light at the face's sample points.  Returns false when the
+// editor's incremental lighting only wants the raw direct light.
+//-----------------------------------------------------------------------------
+static bool BuildFaceDirectLighting( int iThread, int facenum, lightinfo_t &l, facelight_t *fl )
 {
-	int	i, j;
-
-	lightinfo_t	l;
-	dface_t *f;
-	facelight_t	*fl;
+	dface_t *f = &g_pFaces[facenum];
 	SSE_SampleInfo_t sampleInfo;
 	directlight_t *dl;
-	Vector spot;
 	Vector v[4], n[4];
 
-	if( g_bInterrupt )
-		return;
-
-	// FIXME: Is there a better way to do this? Like, in RunThreadsOn, for instance?
-	// Don't pay this cost unless we have to; this is super perf-critical code.
-	if (g_pIncremental)
-	{
-		// Both threads will be accessing this so it needs to be protected or else thread A
-		// will load it in and thread B will increment it but its increment will be
-		// overwritten by thread A when thread A writes it back.
-		ThreadLock();
-		++g_iCurFace;
-		ThreadUnlock();
-	}
-
-	// some surfaces don't need lightmaps
-	f = &g_pFaces[facenum];
-	f->lightofs = -1;
-	for (j=0 ; j<MAXLIGHTMAPS ; j++)
-		f->styles[j] = 255;
-
-	// Trivial-reject the whole face?	
-	if( !( g_FacesVisibleToLights[facenum>>3] & (1 << (facenum & 7)) ) )
-		return;
-
-	if ( texinfo[f->texinfo].flags & TEX_SPECIAL)
-		return;		// non-lit texture
-
-	// check for patches for this face.  If none it must be degenerate.  Ignore.
-	if( g_FacePatches.Element( facenum ) == g_FacePatches.InvalidIndex() )
-		return;
-
-	fl = &facelight[facenum];
-
-	InitLightinfo( &l, facenum );
-	CalcPoints( &l, fl, facenum );
 	InitSampleInfo( l, iThread, sampleInfo );
 
 	// Allocate sample positions/normals to SSE
@@ -3157,14 +3121,14 @@ void BuildFacelights (int iThread, int facenum)
 
 		// Don't have to deal with patch lights (only direct lighting is used)
 		// or supersampling
-		return;
+		return false;
 	}
 
 	// get rid of the -extra functionality on displacement surfaces
 	if (do_extra && !sampleInfo.m_IsDispFace)
 	{
 		// For each lightstyle, perform a supersampling pass
-		for ( i = 0; i < MAXLIGHTMAPS; ++i )
+		for ( int i = 0; i < MAXLIGHTMAPS; ++i )
 		{
 			// Stop when we run out of lightstyles
 			if (f->styles[i] == 255)
@@ -3174,6 +3138,63 @@ void BuildFacelights (int iThread, int facenum)
 		}
 	}
 
+	return true;
+}
+
+void BuildFacelights (int iThread, int facenum)
+{
+	int	j;
+
+	lightinfo_t	l;
+	dface_t *f;
+	facelight_t	*fl;
+
+	if( g_bInterrupt )
+		return;
+
+	// FIXME: Is there a better way to do this? Like, in RunThreadsOn, for instance?
+	// Don't pay this cost unless we have to; this is super perf-critical code.
+	if (g_pIncremental)
+	{
+		// Both threads will be accessing this so it needs to be protected or else thread A
+		// will load it in and thread B will increment it but its increment will be
+		// overwritten by thread A when thread A writes it back.
+		ThreadLock();
+		++g_iCurFace;
+		ThreadUnlock();
+	}
+
+	// some surfaces don't need lightmaps
+	f = &g_pFaces[facenum];
+	f->lightofs = -1;
+	for (j=0 ; j<MAXLIGHTMAPS ; j++)
+		f->styles[j] = 255;
+
+	// Trivial-reject the whole face?	
+	if( !( g_FacesVisibleToLights[facenum>>3] & (1 << (facenum & 7)) ) )
+		return;
+
+	if ( texinfo[f->texinfo].flags & TEX_SPECIAL)
+		return;		// non-lit texture
+
+	// check for patches for this face.  If none it must be degenerate.  Ignore.
+	if( g_FacePatches.Element( facenum ) == g_FacePatches.InvalidIndex() )
+		return;
+
+	fl = &facelight[facenum];
+
+	InitLightinfo( &l, facenum );
+	CalcPoints( &l, fl, facenum );
+
+	// -incremental: faces whose lights haven't changed keep last compile's direct light
+	if ( !LightCache_RestoreFace( facenum, fl ) )
+	{
+		if ( !BuildFaceDirectLighting( iThread, facenum, l, fl ) )
+			return;
+
+		LightCache_StoreFace( facenum, fl );
+	}
+
 #ifdef MPI
 	if (!g_bUseMPI) 
 #endif
@@ -13,6 +13,7 @@
 #include "trace.h"
 #include "Cmodel.h"
 #include "mathlib/vmatrix.h"
+#include "vstdlib/random.h"
 
 
 //=============================================================================
@@ -651,3 +652,101 @@ void AddBrushesForRayTrace( void )
 		}
 	}
 }
+
+//-----------------------------------------------------------------------------
+// Purpose: -raytracebench.  Streams a fixed set of random rays through the
+//			finished acceleration structure on one thread, once 4 at a time
+//			and once 8 at a time if the cpu can, and reports the throughput
+//			of each so that traversal changes can be compared between builds.
+//-----------------------------------------------------------------------------
+void RayTraceBenchmark( void )
+{
+	const int nRays = 1 << 20;
+
+	CUniformRandomStream random;
+	random.SetSeed( 0 );
+
+	Vector vecSize = g_RtEnv.m_MaxBound - g_RtEnv.m_MinBound;
+	float flRayLength = 0.5f * vecSize.Length();
+
+	CUtlVector<Vector> starts, ends;
+	starts.SetCount( nRays );
+	ends.SetCount( nRays );
+	for ( int i = 0; i < nRays; i++ )
+	{
+		Vector vecDir;
+		do
+		{
+			vecDir.Init( random.RandomFloat( -1, 1 ), random.RandomFloat( -1, 1 ), random.RandomFloat( -1, 1 ) );
+		} while ( vecDir.LengthSqr() < 0.01f || vecDir.LengthSqr() > 1.0f );
+		VectorNormalize( vecDir );
+
+		starts[i].x = g_RtEnv.m_MinBound.x + random.RandomFloat( 0, 1 ) * vecSize.x;
+		starts[i].y = g_RtEnv.m_MinBound.y + random.RandomFloat( 0, 1 ) * vecSize.y;
+		starts[i].z = g_RtEnv.m_MinBound.z + random.RandomFloat( 0, 1 ) * vecSize.z;
+		ends[i] = starts[i] + flRayLength * vecDir;
+	}
+
+	Msg( "Ray trace benchmark (%s):\n", g_RtEnv.OptimizedBVH.Count() ? "bvh" : "kd-tree" );
+
+	CUtlVector<RayTracingSingleResult> results[2];
+	uint32 nOldFlags = g_RtEnv.Flags;
+	for ( int nPass = 0; nPass < 2; nPass++ )
+	{
+		if ( nPass == 0 )
+		{
+			g_RtEnv.Flags |= RTE_FLAGS_NO_WIDE_PACKETS;
+		}
+		else
+		{
+			g_RtEnv.Flags &= ~RTE_FLAGS_NO_WIDE_PACKETS;
+			if ( !g_RtEnv.HasWidePackets() )
+			{
+				Msg( "8 wide packets: not available with this cpu or acceleration structure\n" );
+				break;
+			}
+		}
+
+		results[nPass].SetCount( nRays );
+		RayStream *pStream = new RayStream;
+
+		double flStart = Plat_FloatTime();
+		for ( int i = 0; i < nRays; i++ )
+		{
+			g_RtEnv.AddToRayStream( *pStream, starts[i], ends[i], &results[nPass][i] );
+		}
+		g_RtEnv.FinishRayStream( *pStream );
+		double flElapsed = Plat_FloatTime() - flStart;
+
+		delete pStream;
+
+		int nHits = 0;
+		for ( int i = 0; i < nRays; i++ )
+		{
+			if ( results[nPass][i].HitID != -1 && results[nPass][i].HitDistance < flRayLength )
+				nHits++;
+		}
+
+		Msg( "%d wide packets: %.2f Mrays/s (%d rays, %d hits, %.2f seconds)\n",
+			nPass ? 8 : 4, nRays / ( 1.0e6 * MAX( flElapsed, 1.0e-6 ) ), nRays, nHits, flElapsed );
+	}
+	g_RtEnv.Flags = nOldFlags;
+
+	// Both paths must agree on everything the ray actually reaches.  Hits past
+	// the end of the ray depend on traversal order and don't count.
+	if ( results[1].Count() )
+	{
+		int nMismatches = 0;
+		for ( int i = 0; i < nRays; i++ )
+		{
+			bool bHit0 = results[0][i].HitID != -1 && results[0][i].HitDistance < flRayLength;
+			bool bHit1 = results[1][i].HitID != -1 && results[1][i].HitDistance < flRayLength;
+			if ( bHit0 != bHit1 || ( bHit0 && results[0][i].HitID != results[1][i].HitID ) )
+				nMismatches++;
+		}
+		if ( nMismatches )
+		{
+			Warning( "Ray trace benchmark: %d rays differ between 4 and 8 wide packets!\n", nMismatches );
+		}
+	}
+}
@@ -16,6 +16,7 @@
 #include "macro_texture.h"
 #include "vmpi_tools_shared.h"
 #include "leaf_ambient_lighting.h"
+#include "lightcache.h"
 #include "tools_minidump.h"
 #include "loadcmdline.h"
 #include "byteswap.h"
@@ -57,6 +58,10 @@ float		g_MaxDispPatchRadius = 1500.0f;			// Maximum radius allowed for displacem
 qboolean	g_bDumpPatches;
 bool	    bDumpNormals = false;
 bool		g_bDumpRtEnv = false;
+bool		g_bRayTraceBenchmark = false;
+bool		g_bUseBVH = false;
+bool		g_bCompressionBenchmark = false;
+bool		g_bLoadBenchmark = false;
 bool		bRed2Black = true;
 bool		g_bFastAmbient = false;
 bool        g_bNoSkyRecurse = false;
@@ -1436,7 +1441,11 @@ void CollectLight( Vector& total )
 				VectorAdd( patch->totallight.light[j], addlight[i].light[j], patch->totallight.light[j] );
 			}
 			VectorCopy( addlight[i].light[0], emitlight[i] );
-			VectorAdd( total, emitlight[i], total );
+
+			// Absolute, since -incremental bounces a signed difference
+			total.x += fabs( emitlight[i].x );
+			total.y += fabs( emitlight[i].y );
+			total.z += fabs( emitlight[i].z );
 		}
 		else
 		{
@@ -1667,6 +1676,8 @@ void BounceLight (void)
 		VectorFill( g_Patches[i].totallight.light[0], 0 );
 	}
 
+	LightCache_StartBounce();
+
 #if 0
 	FileHandle_t dFp = g_pFileSystem->Open( "lightemit.txt", "w" );
 
@@ -1724,6 +1735,8 @@ void BounceLight (void)
 			WriteWorld (name, 0);
 		}
 	}
+
+	LightCache_FinishBounce();
 }
 
 
@@ -2096,6 +2109,9 @@ bool RadWorld_Go()
 #endif
 			
 		Msg("FinalLightFace Done\n"); fflush(stdout);
+
+		LightCache_Report();
+		LightCache_Save();
 	}
 
 	return true;
@@ -2190,6 +2206,11 @@ void VRAD_LoadBSP( char const *pFilename )
 	Q_DefaultExtension(incrementfile, ".r0", sizeof(incrementfile));
 	Q_DefaultExtension(source, ".bsp", sizeof( source ));
 
+	if ( g_bLoadBenchmark )
+	{
+		BenchmarkBSPLoad( source );
+	}
+
 	Msg( "Loading %s\n", source );
 #ifdef MPI
 	VMPI_SetCurrentStage( "LoadBSPFile" );
@@ -2283,12 +2304,18 @@ void VRAD_LoadBSP( char const *pFilename )
 		WriteRTEnv("trace.txt");
 
 	// Build acceleration structure
-	printf ( "Setting up ray-trace acceleration structure... ");
+	printf ( "Setting up ray-trace acceleration structure (%s)... ", g_bUseBVH ? "bvh" : "kd-tree" );
 	float start = Plat_FloatTime();
+	if ( g_bUseBVH )
+		g_RtEnv.Flags |= RTE_FLAGS_USE_BVH;
+	g_RtEnv.BuildThreads = numthreads;
 	g_RtEnv.SetupAccelerationStructure();
 	float end = Plat_FloatTime();
 	printf ( "Done (%.2f seconds)\n", end-start );
 
+	if ( g_bRayTraceBenchmark )
+		RayTraceBenchmark();
+
 #if 0  // To test only k-d build
 	exit(0);
 #endif
@@ -2304,6 +2331,8 @@ void VRAD_LoadBSP( char const *pFilename )
 			return;
 		}
 	}
+
+	LightCache_Init( source );
 }
 
 
@@ -2342,6 +2371,11 @@ void VRAD_Finish()
 #endif
 	WriteBSPFile(source);
 
+	if ( g_bCompressionBenchmark )
+	{
+		BenchmarkBSPCompression( source );
+	}
+
 	if ( g_bDumpPatches )
 	{
 		for ( int iStyle = 0; iStyle < 4; ++iStyle )
@@ -2432,6 +2466,22 @@ int ParseCommandLine( int argc, char **argv, bool *onlydetail )
 		{
 			g_bDumpRtEnv = true;
 		}
+		else if ( !Q_stricmp( argv[i], "-raytracebench" ) )
+		{
+			g_bRayTraceBenchmark = true;
+		}
+		else if ( !Q_stricmp( argv[i], "-bvh" ) )
+		{
+			g_bUseBVH = true;
+		}
+		else if ( !Q_stricmp( argv[i], "-compressbench" ) )
+		{
+			g_bCompressionBenchmark = true;
+		}
+		else if ( !Q_stricmp( argv[i], "-loadbench" ) )
+		{
+			g_bLoadBenchmark = true;
+		}
 		else if ( !Q_stricmp( argv[i], "-LargeDispSampleRadius" ) )
 		{
 			g_bLargeDispSampleRadius = true;
@@ -2458,6 +2508,10 @@ int ParseCommandLine( int argc, char **argv, bool *onlydetail )
 				return -1;
 			}
 		}
+		else if (!Q_stricmp(argv[i],"-incremental"))
+		{
+			g_bIncrementalLighting = true;
+		}
 		else if (!Q_stricmp(argv[i],"-verbose") || !Q_stricmp(argv[i],"-v"))
 		{
 			verbose = true;
@@ -2823,6 +2877,9 @@ void PrintUsage( int argc, char **argv )
 		"  -final          : High quality processing. equivalent to -extrasky 16.\n"
 		"  -extrasky n     : trace N times as many rays for indirect light and sky ambient.\n"
 		"  -low            : Run as an idle-priority process.\n"
+		"  -incremental    : Keep lighting in <map>.vradcache and only relight faces\n"
+		"                    whose lights changed since the last compile. Leaf\n"
+		"                    ambient samples are kept in <map>.ambientcache.\n"
 #ifdef MPI
 		"  -mpi            : Use VMPI to distribute computations.\n"
 #endif
@@ -2836,6 +2893,13 @@ void PrintUsage( int argc, char **argv )
 		"  -dump           : Write debugging .txt files.\n"
 		"  -dumpnormals    : Write normals to debug files.\n"
 		"  -dumptrace      : Write ray-tracing environment to debug files.\n"
+		"  -raytracebench  : Time a fixed set of rays through the ray-tracing environment.\n"
+		"  -bvh            : Trace rays through a bounding volume hierarchy instead of a kd-tree.\n"
+		"                    Builds in parallel, which helps maps with many high-poly props.\n"
+		"  -compressbench  : After writing the bsp, time LZMA and Snappy on each lump and\n"
+		"                    pakfile entry, and an LZMA repack of the whole bsp.\n"
+		"  -loadbench      : Before loading the bsp, compare the peak memory and time of\n"
+		"                    the mapped lump reader against a full load.\n"
 		"  -threads        : Control the number of threads vbsp uses (defaults to the #\n"
 		"                    or processors on your machine).\n"
 		"  -lights <file>  : Load a lights file in addition to lights.rad and the\n"
@@ -247,6 +247,7 @@ extern CUtlVector<CPatch>	g_Patches;
 extern CUtlVector<int>		g_FacePatches;		// constains all patches, children first
 extern CUtlVector<int>		faceParents;		// contains only root patches, use next parent to iterate
 extern CUtlVector<int>		clusterChildren;
+extern CUtlVector<Vector>	emitlight;
 
 
 struct sky_camera_t
@@ -394,6 +395,9 @@ void TestLine_DoesHitSky( FourVectors const& start, FourVectors const& stop,
 void ExtractBrushEntityShadowCasters ( void );
 void AddBrushesForRayTrace ( void );
 
+// -raytracebench: times the finished acceleration structure with a fixed set of rays
+void RayTraceBenchmark( void );
+
 void BaseLightForFace( dface_t *f, Vector& light, float *parea, Vector& reflectivity );
 void CreateDirectLights (void);
 void GetPhongNormal( int facenum, Vector const& spot, Vector& phongnormal );
@@ -268,7 +268,8 @@ private:
 #endif
 	
 	// local thread version
-	static void ThreadComputeStaticPropLighting( int iThread, void *pUserData );
+	static void ThreadComputeStaticPropLighting( int iThread, int iStaticProp );
+	float GetLightingCost( int iStaticProp );
 	void ComputeLightingForProp( int iThread, int iStaticProp );
 
 	// Methods associated with unserializing static props
@@ -1147,17 +1148,25 @@ bool PositionInSolid( Vector &position )
 }
 
 //-----------------------------------------------------------------------------
-// Trace from a vertex to each direct light source, accumulating its contribution.
+// Trace from up to four points to each direct light source, accumulating their
+// contributions. The points share one 4-wide ray packet per light, so batching
+// neighbouring samples costs about the same as lighting a single one.
 //-----------------------------------------------------------------------------
-void ComputeDirectLightingAtPoint( Vector &position, Vector &normal, Vector &outColor, int iThread,
-								   int static_prop_id_to_skip=-1, int nLFlags = 0)
+void ComputeDirectLightingAtPoints( const Vector *pPositions, const Vector *pNormals, int nPoints, Vector *pOutColors,
+								    int iThread, int static_prop_id_to_skip=-1, int nLFlags = 0 )
 {
+	Assert( nPoints >= 1 && nPoints <= 4 );
+
 	SSE_sampleLightOutput_t	sampleOutput;
+	int clusters[4];
 
-	outColor.Init();
+	for ( int i = 0; i < nPoints; i++ )
+	{
+		pOutColors[i].Init();
+		clusters[i] = ClusterFromPoint( pPositions[i] );
+	}
 
 	// Iterate over all direct lights and accumulate their contribution
-	int cluster = ClusterFromPoint( position );
 	for ( directlight_t *dl = activelights; dl != NULL; dl = dl->next )
 	{
 		if ( dl->light.style )
@@ -1166,44 +1175,121 @@ void ComputeDirectLightingAtPoint( Vector &position, Vector &normal, Vector &out
 			continue;
 		}
 
-		// is this lights cluster visible?
-		if ( !PVSCheck( dl->pvs, cluster ) )
+		// is this lights cluster visible from any of the points?
+		bool bVisible[4];
+		bool bAnyVisible = false;
+		for ( int i = 0; i < nPoints; i++ )
+		{
+			bVisible[i] = PVSCheck( dl->pvs, clusters[i] ) != 0;
+			bAnyVisible = bAnyVisible || bVisible[i];
+		}
+		if ( !bAnyVisible )
 			continue;
 
-		// push the vertex towards the light to avoid surface acne
-		Vector adjusted_pos = position;
 		float flEpsilon = 0.0;
 
-		if  (dl->light.type != emit_skyambient)
+		// unused lanes repeat the last point so the packet stays coherent
+		FourVectors adjusted_pos4;
+		FourVectors normal4;
+		for ( int i = 0; i < 4; i++ )
 		{
-			// push towards the light
-			Vector fudge;
-			if ( dl->light.type == emit_skylight )
-				fudge = -( dl->light.normal);
-			else
+			const Vector &position = pPositions[ MIN( i, nPoints - 1 ) ];
+			const Vector &normal = pNormals[ MIN( i, nPoints - 1 ) ];
+
+			// push the vertex towards the light to avoid surface acne
+			Vector adjusted_pos = position;
+
+			if  (dl->light.type != emit_skyambient)
 			{
-				fudge = dl->light.origin-position;
-				VectorNormalize( fudge );
+				// push towards the light
+				Vector fudge;
+				if ( dl->light.type == emit_skylight )
+					fudge = -( dl->light.normal);
+				else
+				{
+					fudge = dl->light.origin-position;
+					VectorNormalize( fudge );
+				}
+				fudge *= 4.0;
+				adjusted_pos += fudge;
+			}
+			else 
+			{
+				// push out along normal
+				adjusted_pos += 4.0 * normal;
 			}
-			fudge *= 4.0;
-			adjusted_pos += fudge;
-		}
-		else 
-		{
-			// push out along normal
-			adjusted_pos += 4.0 * normal;
-//			flEpsilon = 1.0;
-		}
 
-		FourVectors adjusted_pos4;
-		FourVectors normal4;
-		adjusted_pos4.DuplicateVector( adjusted_pos );
-		normal4.DuplicateVector( normal );
+			adjusted_pos4.X( i ) = adjusted_pos.x;
+			adjusted_pos4.Y( i ) = adjusted_pos.y;
+			adjusted_pos4.Z( i ) = adjusted_pos.z;
+			normal4.X( i ) = normal.x;
+			normal4.Y( i ) = normal.y;
+			normal4.Z( i ) = normal.z;
+		}
 
 		GatherSampleLightSSE( sampleOutput, dl, -1, adjusted_pos4, &normal4, 1, iThread, nLFlags | GATHERLFLAGS_FORCE_FAST,
 		                      static_prop_id_to_skip, flEpsilon );
 		
-		VectorMA( outColor, sampleOutput.m_flFalloff.m128_f32[0] * sampleOutput.m_flDot[0].m128_f32[0], dl->light.intensity, outColor );
+		for ( int i = 0; i < nPoints; i++ )
+		{
+			if ( bVisible[i] )
+			{
+				VectorMA( pOutColors[i], SubFloat( sampleOutput.m_flFalloff, i ) * SubFloat( sampleOutput.m_flDot[0], i ), dl->light.intensity, pOutColors[i] );
+			}
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Trace from a vertex to each direct light source, accumulating its contribution.
+//-----------------------------------------------------------------------------
+void ComputeDirectLightingAtPoint( Vector &position, Vector &normal, Vector &outColor, int iThread,
+								   int static_prop_id_to_skip=-1, int nLFlags = 0)
+{
+	ComputeDirectLightingAtPoints( &position, &normal, 1, &outColor, iThread, static_prop_id_to_skip, nLFlags );
+}
+
+//-----------------------------------------------------------------------------
+// Lights a model's vertexes that are outside solid, four at a time.
+//-----------------------------------------------------------------------------
+static void ComputeVertexLighting( CUtlVector<colorVertex_t> &colorVerts, const CUtlVector<int> &vertexes, CUtlVector<Vector> &normals,
+								   int iThread, int skip_prop, int nFlags )
+{
+	for ( int i = 0; i < vertexes.Count(); i += 4 )
+	{
+		int nPoints = MIN( 4, vertexes.Count() - i );
+
+		Vector positions[4];
+		Vector directColors[4];
+		for ( int j = 0; j < nPoints; j++ )
+		{
+			positions[j] = colorVerts[ vertexes[i + j] ].m_Position;
+		}
+
+		ComputeDirectLightingAtPoints( positions, &normals[i], nPoints, directColors, iThread, skip_prop, nFlags );
+
+		for ( int j = 0; j < nPoints; j++ )
+		{
+			Vector &directColor = directColors[j];
+			Vector indirectColor(0,0,0);
+
+			if (g_bShowStaticPropNormals)
+			{
+				directColor = normals[i + j];
+				directColor += Vector(1.0,1.0,1.0);
+				directColor *= 50.0;
+			}
+			else
+			{
+				if (numbounce >= 1)
+					ComputeIndirectLightingAtPoint( 
+						positions[j], normals[i + j], 
+						indirectColor, iThread, true,
+						( nFlags & GATHERLFLAGS_IGNORE_NORMALS ) != 0 );
+			}
+
+			VectorAdd( directColor, indirectColor, colorVerts[ vertexes[i + j] ].m_Color );
+		}
 	}
 }
 
@@ -1311,6 +1397,8 @@ void CVradStaticPropMgr::ApplyLightingToStaticProp( int iStaticProp, CStaticProp
 void CVradStaticPropMgr::ComputeLighting( CStaticProp &prop, int iThread, int prop_index, CComputeStaticPropLightingResults *pResults )
 {
 	CUtlVector<badVertex_t>		badVerts;
+	CUtlVector<int>				goodVerts;
+	CUtlVector<Vector>			goodNormals;
 
 	StaticPropDict_t &dict = m_StaticPropDict[prop.m_ModelIdx];
 	studiohdr_t	*pStudioHdr = dict.m_pStudioHdr;
@@ -1397,39 +1485,20 @@ void CVradStaticPropMgr::ComputeLighting( CStaticProp &prop, int iThread, int pr
 					}
 					else
 					{
-						Vector direct_pos=samplePosition;
-							
-						
-
-						Vector directColor(0,0,0);
-						ComputeDirectLightingAtPoint( direct_pos,
-														sampleNormal, directColor, iThread,
-														skip_prop, nFlags );
-						Vector indirectColor(0,0,0);
-
-						if (g_bShowStaticPropNormals)
-						{
-							directColor= sampleNormal;
-							directColor += Vector(1.0,1.0,1.0);
-							directColor *= 50.0;
-						}
-						else
-						{
-							if (numbounce >= 1)
-								ComputeIndirectLightingAtPoint( 
-									samplePosition, sampleNormal, 
-									indirectColor, iThread, true,
-									( prop.m_Flags & STATIC_PROP_IGNORE_NORMALS) != 0 );
-						}
-						
+						// lit below, once the whole model has been gathered
 						colorVerts[numVertexes].m_bValid = true;
 						colorVerts[numVertexes].m_Position = samplePosition;
-						VectorAdd( directColor, indirectColor, colorVerts[numVertexes].m_Color );
+						goodVerts.AddToTail( numVertexes );
+						goodNormals.AddToTail( sampleNormal );
 					}
 					
 					numVertexes++;
 				}
 			}
+
+			ComputeVertexLighting( colorVerts, goodVerts, goodNormals, iThread, skip_prop, nFlags );
+			goodVerts.RemoveAll();
+			goodNormals.RemoveAll();
 			
 			// color in the bad vertexes
 			// when entire model has no lighting origin and no valid neighbors
@@ -1756,16 +1825,38 @@ void CVradStaticPropMgr::ComputeLightingForProp( int iThread, int iStaticProp )
 	ApplyLightingToStaticProp( iStaticProp, m_StaticProps[iStaticProp], &results );
 }
 
-void CVradStaticPropMgr::ThreadComputeStaticPropLighting( int iThread, void *pUserData )
+void CVradStaticPropMgr::ThreadComputeStaticPropLighting( int iThread, int iStaticProp )
+{
+	g_StaticPropMgr.ComputeLightingForProp( iThread, iStaticProp );
+}
+
+//-----------------------------------------------------------------------------
+// Roughly how many samples a prop will light: its vertexes, plus its lightmap
+// texels when it has one. Used to hand the big props out first.
+//-----------------------------------------------------------------------------
+float CVradStaticPropMgr::GetLightingCost( int iStaticProp )
 {
-	while (1)
+	CStaticProp &prop = m_StaticProps[iStaticProp];
+	studiohdr_t	*pStudioHdr = m_StaticPropDict[prop.m_ModelIdx].m_pStudioHdr;
+	if ( !pStudioHdr )
+		return 0.0f;
+
+	float flCost = 0.0f;
+	for ( int bodyID = 0; bodyID < pStudioHdr->numbodyparts; ++bodyID )
 	{
-		int j = GetThreadWork ();
-		if (j == -1)
-			break;
-		CComputeStaticPropLightingResults results;
-		g_StaticPropMgr.ComputeLightingForProp( iThread, j );
+		mstudiobodyparts_t *pBodyPart = pStudioHdr->pBodypart( bodyID );
+		for ( int modelID = 0; modelID < pBodyPart->nummodels; ++modelID )
+		{
+			flCost += pBodyPart->pModel( modelID )->numvertices;
+		}
+	}
+
+	if ( ( prop.m_Flags & STATIC_PROP_NO_PER_TEXEL_LIGHTING ) == 0 )
+	{
+		flCost += (float)prop.m_LightmapImageWidth * prop.m_LightmapImageHeight;
 	}
+
+	return flCost;
 }
 
 //-----------------------------------------------------------------------------
@@ -1783,6 +1874,7 @@ void CVradStaticPropMgr::ComputeLighting( int iThread )
 	}
 
 	StartPacifier( "Computing static prop lighting : " );
+	double flStartTime = Plat_FloatTime();
 
 	// ensure any traces against us are ignored because we have no inherit lighting contribution
 	m_bIgnoreStaticPropTrace = true;
@@ -1801,16 +1893,30 @@ void CVradStaticPropMgr::ComputeLighting( int iThread )
 	else
 #endif
 	{
-		RunThreadsOn(count, true, ThreadComputeStaticPropLighting);
+		// one huge prop picked up last would leave every other thread idle,
+		// so hand them out largest first
+		CUtlVector<float> costs;
+		costs.SetCount( count );
+		for ( int i = 0; i < count; i++ )
+		{
+			costs[i] = GetLightingCost( i );
+		}
+
+		RunThreadsOnIndividualByCost(count, true, ThreadComputeStaticPropLighting, costs.Base());
 	}
 
 	// restore default
 	m_bIgnoreStaticPropTrace = false;
 
+	double flLightTime = Plat_FloatTime();
+
 	// save data to bsp
 	SerializeLighting();
 
 	EndPacifier( true );
+
+	double flEndTime = Plat_FloatTime();
+	qprintf( "%d static props: lighting %.2fs, serialize %.2fs\n", count, flLightTime - flStartTime, flEndTime - flLightTime );
 }
 
 //-----------------------------------------------------------------------------
@@ -2406,6 +2512,7 @@ static void GenerateLightmapSamplesForMesh( const matrix3x4_t& _matPos, const ma
 	// on the other side.
 	// First attempt: Just pretend the triangle was larger and cast a ray from this new world pos 
 	// as above.
+	CUtlVector<int> texelsToLight;
 	int linearPos = 0;
 	for ( int j = 0; j < _lightmapResY; ++j )
 	{
@@ -2431,20 +2538,35 @@ static void GenerateLightmapSamplesForMesh( const matrix3x4_t& _matPos, const ma
 
 			if (shouldProcess)
 			{
-				Vector directColor(0, 0, 0),
-					   indirectColor(0, 0, 0);
+				texelsToLight.AddToTail( linearPos );
+			}
+
+			++linearPos;
+		}
+	}
 
+	// light the texels four at a time so each shadow trace fills a whole ray packet
+	for ( int i = 0; i < texelsToLight.Count(); i += 4 )
+	{
+		int nPoints = MIN( 4, texelsToLight.Count() - i );
 
-				ComputeDirectLightingAtPoint( colorTexels[linearPos].m_WorldPosition, colorTexels[linearPos].m_WorldNormal, directColor, _iThread, _skipProp, _flags);
+		Vector positions[4], normals[4], directColors[4];
+		for ( int j = 0; j < nPoints; j++ )
+		{
+			positions[j] = colorTexels[ texelsToLight[i + j] ].m_WorldPosition;
+			normals[j] = colorTexels[ texelsToLight[i + j] ].m_WorldNormal;
+		}
 
-				if (numbounce >= 1) {
-					ComputeIndirectLightingAtPoint( colorTexels[linearPos].m_WorldPosition, colorTexels[linearPos].m_WorldNormal, indirectColor, _iThread, true, (_flags & GATHERLFLAGS_IGNORE_NORMALS) != 0 );
-				}
+		ComputeDirectLightingAtPoints( positions, normals, nPoints, directColors, _iThread, _skipProp, _flags );
 
-				VectorAdd(directColor, indirectColor, colorTexels[linearPos].m_Color);
+		for ( int j = 0; j < nPoints; j++ )
+		{
+			Vector indirectColor(0, 0, 0);
+			if (numbounce >= 1) {
+				ComputeIndirectLightingAtPoint( positions[j], normals[j], indirectColor, _iThread, true, (_flags & GATHERLFLAGS_IGNORE_NORMALS) != 0 );
 			}
 
-			++linearPos;
+			VectorAdd(directColors[j], indirectColor, colorTexels[ texelsToLight[i + j] ].m_Color);
 		}
 	}
 }
@@ -7,6 +7,7 @@
 //=============================================================================//
 #include "vis.h"
 #include "vmpi.h"
+#include "mathlib/ssemath.h"
 
 int g_TraceClusterStart = -1;
 int g_TraceClusterStop = -1;
@@ -469,6 +470,22 @@ void WritePortalTrace( const char *source )
 	Warning("Wrote %s!!!\n", filename);
 }
 
+//-----------------------------------------------------------------------------
+// might = prev & test, 128 bits at a time. Returns true if might has any bits
+// that aren't in vis yet. portalbytes is a multiple of 16.
+//-----------------------------------------------------------------------------
+static inline bool AndMightSee( byte *might, const byte *prev, const byte *test, const byte *vis )
+{
+	fltx4 more = Four_Zeros;
+	for ( int j = 0; j < portalbytes; j += sizeof( fltx4 ) )
+	{
+		fltx4 bits = AndSIMD( LoadUnalignedSIMD( prev + j ), LoadUnalignedSIMD( test + j ) );
+		StoreUnalignedSIMD( (float *)( might + j ), bits );
+		more = OrSIMD( more, AndNotSIMD( LoadUnalignedSIMD( vis + j ), bits ) );
+	}
+	return !IsAllZeros( more );
+}
+
 /*
 ==================
 RecursiveLeafFlow
@@ -483,8 +500,9 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 	portal_t	*p;
 	plane_t		backplane;
 	leaf_t 		*leaf;
-	int			i, j;
-	long		*test, *might, *vis, more;
+	int			i;
+	byte		*test, *vis;
+	bool		more;
 	int			pnum;
 
 #ifdef MPI
@@ -510,8 +528,7 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 	stack.leaf = leaf;
 	stack.portal = NULL;
 
-	might = (long *)stack.mightsee;
-	vis = (long *)thread->base->portalvis;
+	vis = thread->base->portalvis;
 	
 	// check all portals for flowing into other leafs	
 	for (i=0 ; i<leaf->portals.Count() ; i++)
@@ -525,22 +542,18 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 			continue;	// can't possibly see it
 		}
 
-		// if the portal can't see anything we haven't allready seen, skip it
+		// if the portal can't see anything we haven't allready seen, skip it.
+		// Portals that have finished flowing give a much tighter bound.
 		if (p->status == stat_done)
 		{
-			test = (long *)p->portalvis;
+			test = p->portalvis;
 		}
 		else
 		{
-			test = (long *)p->portalflood;
+			test = p->portalflood;
 		}
 
-		more = 0;
-		for (j=0 ; j<portallongs ; j++)
-		{
-			might[j] = ((long *)prevstack->mightsee)[j] & test[j];
-			more |= (might[j] & ~vis[j]);
-		}
+		more = AndMightSee( stack.mightsee, prevstack->mightsee, test, vis );
 		
 		if ( !more && CheckBit( thread->base->portalvis, pnum ) )
 		{	// can't see anything new
@@ -634,7 +647,9 @@ void PortalFlow (int iThread, int portalnum)
 	int				i;
 	portal_t		*p;
 	int				c_might, c_can;
+	double			start;
 
+	start = Plat_FloatTime();
 	p = sorted_portals[portalnum];
 	p->status = stat_working;
 				
@@ -654,6 +669,9 @@ void PortalFlow (int iThread, int portalnum)
 
 	p->status = stat_done;
 
+	p->flowtime = Plat_FloatTime() - start;
+	p->numchains = data.c_chains;
+
 	c_can = CountBits (p->portalvis, g_numportals*2);
 
 	qprintf ("portal:%4i  mightsee:%4i  cansee:%4i (%i chains)\n", 
@@ -661,6 +679,67 @@ void PortalFlow (int iThread, int portalnum)
 }
 
 
+static int FlowTimeCompare( const void *a, const void *b )
+{
+	float ta = (*(portal_t **)a)->flowtime;
+	float tb = (*(portal_t **)b)->flowtime;
+	if ( ta == tb )
+		return 0;
+	return ( ta > tb ) ? -1 : 1;
+}
+
+/*
+===============
+WritePortalFlowLog
+
+Writes how long every portal took to flow, slowest first, so map authors
+can find the portals worth fixing.
+===============
+*/
+void WritePortalFlowLog( const char *source )
+{
+	char	filename[1024];
+	FILE	*logfile;
+	int		i;
+	double	total = 0;
+
+	CUtlVector<portal_t *> sorted;
+	sorted.SetCount( g_numportals*2 );
+	for ( i = 0; i < g_numportals*2; i++ )
+	{
+		sorted[i] = &portals[i];
+		total += portals[i].flowtime;
+	}
+
+	if ( total <= 0 )
+		return;		// fastvis, or the flow ran on VMPI workers
+
+	qsort( sorted.Base(), sorted.Count(), sizeof( portal_t * ), FlowTimeCompare );
+
+	sprintf (filename, "%s.vislog", source);
+	logfile = fopen (filename, "w");
+	if (!logfile)
+	{
+		Warning ("Couldn't open %s\n", filename);
+		return;
+	}
+
+	fprintf (logfile, "// %d portals, %.2f seconds of flow in total\n", g_numportals*2, total);
+	fprintf (logfile, "// portal  to leaf   mightsee    cansee    chains   seconds  center\n");
+	for ( i = 0; i < sorted.Count(); i++ )
+	{
+		portal_t *p = sorted[i];
+		Vector center;
+		WindingCenter (p->winding, center);
+		fprintf (logfile, "%8i %9i %10i %9i %9i %9.3f  %.0f %.0f %.0f\n",
+			(int)(p - portals), p->leaf, CountBits (p->portalflood, g_numportals*2), CountBits (p->portalvis, g_numportals*2),
+			p->numchains, p->flowtime, center.x, center.y, center.z);
+	}
+	fclose (logfile);
+	Msg ("Wrote %s\n", filename);
+}
+
+
 /*
 ===============================================================================
 
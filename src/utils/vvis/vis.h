@@ -56,6 +56,9 @@ struct portal_t
 	byte		*portalvis;		// [portals], final
 
 	int			nummightsee;	// bit count on portalflood for sort
+
+	float		flowtime;		// seconds spent in PortalFlow, for the flow log
+	int			numchains;
 };
 
 struct leaf_t
@@ -114,6 +117,7 @@ void BasePortalVis (int iThread, int portalnum);
 void BetterPortalVis (int portalnum);
 void PortalFlow (int iThread, int portalnum);
 void WritePortalTrace( const char *source );
+void WritePortalFlowLog( const char *source );
 
 extern	portal_t	*sorted_portals[MAX_MAP_PORTALS*2];
 extern int g_TraceClusterStart, g_TraceClusterStop;
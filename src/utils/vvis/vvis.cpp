@@ -309,9 +309,22 @@ void CalcPortalVis (void)
 	}
 	else 
 #endif
+	if ( nosort )
 	{
 		RunThreadsOnIndividual (g_numportals*2, true, PortalFlow);
 	}
+	else
+	{
+		// The portals that might see the most take by far the longest to flow, so start
+		// them first instead of leaving them for the end when most threads are idle
+		CUtlVector<float> costs;
+		costs.SetCount( g_numportals*2 );
+		for (i=0 ; i<g_numportals*2 ; i++)
+		{
+			costs[i] = sorted_portals[i]->nummightsee;
+		}
+		RunThreadsOnIndividualByCost (g_numportals*2, true, PortalFlow, costs.Base());
+	}
 }
 
 
@@ -478,7 +491,8 @@ void LoadPortals (char *name)
 	leafbytes = ((portalclusters+63)&~63)>>3;
 	leaflongs = leafbytes/sizeof(long);
 	
-	portalbytes = ((g_numportals*2+63)&~63)>>3;
+	// portal bit vectors are padded to 128 bits for the SIMD flow
+	portalbytes = ((g_numportals*2+127)&~127)>>3;
 	portallongs = portalbytes/sizeof(long);
 
 // each file portal is split into two memory portals
@@ -1179,6 +1193,7 @@ int RunVVis( int argc, char **argv )
 	if ( g_TraceClusterStart < 0 )
 	{
 		CalcVis ();
+		WritePortalFlowLog (source);
 		CalcPAS ();
 
 		// We need a mapping from cluster to leaves, since the PVS